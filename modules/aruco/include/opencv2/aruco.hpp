@@ -224,6 +224,56 @@ CV_EXPORTS_W void detectMarkers(InputArray image, const Ptr<Dictionary> &diction
 
 
 
+/**
+ * @brief Marker detector for video streams
+ *
+ * Keeps the markers detected in the previous frame and, instead of running the candidate
+ * detection (adaptive thresholding and contour search) over the whole image, only searches the
+ * regions around them, dilated by roiMarginRate times the marker size. The whole frame is searched
+ * again every fullScanInterval frames, when no marker was found in the previous frame, or when
+ * some of the tracked markers are lost. Markers entering the image are therefore detected with a
+ * delay of up to fullScanInterval frames.
+ *
+ * Identification and corner refinement are the same as in detectMarkers(), which is equivalent
+ * to a fullScanInterval of 1.
+ * @sa detectMarkers
+ */
+class CV_EXPORTS_W ArucoVideoDetector {
+
+    public:
+    /**
+     * @brief Create an ArucoVideoDetector
+     *
+     * @param dictionary indicates the type of markers that will be searched
+     * @param parameters marker detection parameters
+     * @param fullScanInterval number of frames between two searches over the whole image
+     * @param roiMarginRate margin added around the last position of each marker, relative to the
+     * marker size in pixels. It should cover the motion of the markers between two frames.
+     */
+    CV_WRAP static Ptr<ArucoVideoDetector> create(const Ptr<Dictionary> &dictionary,
+                                                  const Ptr<DetectorParameters> &parameters = DetectorParameters::create(),
+                                                  int fullScanInterval = 10, float roiMarginRate = 0.5f);
+
+    /**
+     * @brief Detect the markers in the next frame of the stream
+     *
+     * Parameters are the same as in detectMarkers(). rejectedImgPoints only contains the rejected
+     * candidates of the searched regions.
+     */
+    CV_WRAP virtual void detect(InputArray image, OutputArrayOfArrays corners, OutputArray ids,
+                                OutputArrayOfArrays rejectedImgPoints = noArray(),
+                                InputArray cameraMatrix = noArray(), InputArray distCoeff = noArray()) = 0;
+
+    /**
+     * @brief Forget the tracked markers, the next frame is searched completely
+     */
+    CV_WRAP virtual void reset() = 0;
+
+    virtual ~ArucoVideoDetector() {}
+};
+
+
+
 /**
  * @brief Pose estimation for single markers
  *
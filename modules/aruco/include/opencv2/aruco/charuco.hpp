@@ -190,6 +190,56 @@ CV_EXPORTS_W bool estimatePoseCharucoBoard(InputArray charucoCorners, InputArray
 
 
 
+/**
+ * @brief Marker detections of one image, input of estimatePoseCharucoBoards
+ */
+struct CV_EXPORTS CharucoFrame {
+    /// image where the markers were detected, used for the subpixel refinement of the corners
+    Mat image;
+    /// detected marker corners and identifiers, as returned by detectMarkers
+    std::vector< std::vector< Point2f > > markerCorners;
+    std::vector< int > markerIds;
+    /// optional camera parameters of the image. The poses are only estimated if provided.
+    Mat cameraMatrix;
+    Mat distCoeffs;
+};
+
+/**
+ * @brief Result of estimatePoseCharucoBoards for one board in one image
+ */
+struct CV_EXPORTS CharucoBoardPose {
+    int boardIdx;  ///< index of the board in the boards vector
+    int frameIdx;  ///< index of the image in the frames vector
+    std::vector< Point2f > charucoCorners; ///< interpolated chessboard corners
+    std::vector< int > charucoIds;         ///< identifiers of the interpolated corners
+    Vec3d rvec, tvec;  ///< board pose, only meaningful if valid is true
+    bool valid;        ///< whether the pose could be estimated
+    double timeMs;     ///< time spent on this board and image, in milliseconds
+};
+
+/**
+ * @brief Interpolate the corners and estimate the pose of several ChArUco boards in several images
+ *
+ * @param boards layouts of the ChArUco boards. Their markers must come from the dictionary used to
+ * detect the markers of the frames, and two boards cannot share a marker identifier.
+ * @param frames marker detections of each image
+ * @param poses one result per board and image, ordered by image and then by board
+ * (poses[frameIdx * boards.size() + boardIdx])
+ * @param minMarkers number of adjacent markers that must be detected to return a charuco corner
+ *
+ * Equivalent to calling interpolateCornersCharuco and estimatePoseCharucoBoard for each board in
+ * each image, with the markers of the image filtered to the ones of the board. The per board
+ * lookup tables and the grey version of each image are computed once, and all the board and image
+ * pairs are processed in parallel.
+ * @sa interpolateCornersCharuco, estimatePoseCharucoBoard
+ */
+CV_EXPORTS void estimatePoseCharucoBoards(const std::vector< Ptr<CharucoBoard> > &boards,
+                                          const std::vector< CharucoFrame > &frames,
+                                          std::vector< CharucoBoardPose > &poses, int minMarkers = 2);
+
+
+
+
 /**
  * @brief Draws a set of Charuco corners
  * @param image input/output image. It must have 1 or 3 channels. The number of channels is not
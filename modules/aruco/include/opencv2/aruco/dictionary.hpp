@@ -47,6 +47,7 @@ namespace aruco {
 //! @addtogroup aruco
 //! @{
 
+struct DictionaryIndex;
 
 /**
  * @brief Dictionary/Set of markers. It contains the inner codification
@@ -104,6 +105,24 @@ class CV_EXPORTS_W Dictionary {
      */
     bool identify(const Mat &onlyBits, int &idx, int &rotation, double maxCorrectionRate) const;
 
+    /**
+     * @brief Precompute a hash index over the marker codewords to speed up identify()
+     *
+     * @param maxCorrectionRate largest correction rate the index has to serve (same meaning as
+     * in identify()). Calls to identify() with a higher rate fall back to the linear search.
+     *
+     * Each codeword, in its four rotations, is split into maxCorrectionBits*maxCorrectionRate+1
+     * disjoint bit substrings which are hashed separately (multi-index hashing). Any candidate
+     * within the correction distance of a codeword matches it exactly in at least one substring,
+     * so identify() only has to check the codewords sharing a substring with the candidate.
+     * Results are identical to the linear search. The index refers to the current bytesList
+     * buffer: it is ignored if bytesList is reassigned and must be rebuilt if its content is
+     * modified in place. A bytesList over external data is copied first, so that the index
+     * can keep its buffer allocated. Useful for large dictionaries such as DICT_APRILTAG_36h10 or
+     * custom dictionaries with thousands of markers.
+     */
+    CV_WRAP void buildIndex(double maxCorrectionRate = 1.);
+
     /**
       * @brief Returns the distance of the input bits to the specific id. If allRotations is true,
       * the four posible bits rotation are considered
@@ -127,6 +146,9 @@ class CV_EXPORTS_W Dictionary {
       * @brief Transform list of bytes to matrix of bits
       */
     CV_WRAP static Mat getBitsFromByteList(const Mat &byteList, int markerSize);
+
+    private:
+    Ptr<DictionaryIndex> index; // optional codeword index, see buildIndex()
 };
 
 
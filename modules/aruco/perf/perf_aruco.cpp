@@ -0,0 +1,61 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html.
+#include "perf_precomp.hpp"
+
+namespace opencv_test { namespace {
+
+/**
+ * @brief Image with a grid of markers, slightly warped so that every candidate goes through the
+ * perspective removal
+ */
+static Mat createMarkerGrid(const Ptr<Dictionary> &dictionary, int markersX, int markersY,
+                            int markerSidePixels) {
+    int cellSide = markerSidePixels * 3 / 2;
+    Mat grid(markersY * cellSide, markersX * cellSide, CV_8UC1, Scalar::all(255));
+    for(int y = 0; y < markersY; y++) {
+        for(int x = 0; x < markersX; x++) {
+            Mat marker;
+            drawMarker(dictionary, (y * markersX + x) % dictionary->bytesList.rows, markerSidePixels, marker);
+            marker.copyTo(grid(Rect(x * cellSide + markerSidePixels / 4, y * cellSide + markerSidePixels / 4,
+                                    markerSidePixels, markerSidePixels)));
+        }
+    }
+
+    Point2f src[] = { Point2f(0, 0), Point2f((float)grid.cols, 0), Point2f((float)grid.cols, (float)grid.rows),
+                      Point2f(0, (float)grid.rows) };
+    Point2f dst[] = { Point2f(0.02f * grid.cols, 0), Point2f(0.97f * grid.cols, 0.03f * grid.rows),
+                      Point2f((float)grid.cols, (float)grid.rows), Point2f(0, 0.98f * grid.rows) };
+    Mat img;
+    warpPerspective(grid, img, getPerspectiveTransform(src, dst), grid.size(), INTER_LINEAR,
+                    BORDER_CONSTANT, Scalar::all(255));
+    return img;
+}
+
+typedef TestBaseWithParam<tuple<int, int> > ArucoDetectPerfTest;
+
+PERF_TEST_P(ArucoDetectPerfTest, detectMarkers,
+            Combine(Values(CORNER_REFINE_NONE, CORNER_REFINE_SUBPIX, CORNER_REFINE_APRILTAG), Values(64, 256)))
+{
+    int cornerRefinementMethod = get<0>(GetParam());
+    int nMarkers = get<1>(GetParam());
+
+    Ptr<Dictionary> dictionary = getPredefinedDictionary(DICT_6X6_250);
+    int markersX = nMarkers == 64 ? 8 : 16;
+    Mat img = createMarkerGrid(dictionary, markersX, nMarkers / markersX, 60);
+
+    Ptr<DetectorParameters> params = DetectorParameters::create();
+    params->cornerRefinementMethod = cornerRefinementMethod;
+
+    vector< vector< Point2f > > corners;
+    vector< int > ids;
+    TEST_CYCLE()
+    {
+        detectMarkers(img, dictionary, corners, ids, params);
+    }
+
+    EXPECT_EQ(nMarkers, (int)ids.size());
+    SANITY_CHECK_NOTHING();
+}
+
+}} // namespace
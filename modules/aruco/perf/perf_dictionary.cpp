@@ -0,0 +1,60 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html.
+#include "perf_precomp.hpp"
+
+namespace opencv_test { namespace {
+
+CV_ENUM(DictionaryNames, DICT_4X4_1000, DICT_5X5_250, DICT_6X6_1000, DICT_7X7_1000,
+        DICT_APRILTAG_36h10, DICT_APRILTAG_36h11);
+typedef tuple<DictionaryNames, bool> IdentifyParams;
+
+typedef TestBaseWithParam<IdentifyParams> DictionaryIdentifyPerfTest;
+
+PERF_TEST_P(DictionaryIdentifyPerfTest, identify, Combine(DictionaryNames::all(), Bool()))
+{
+    const int nCandidates = 500;
+    const double correctionRate = 0.6;
+    RNG rng(0);
+
+    Ptr<Dictionary> dictionary = getPredefinedDictionary(get<0>(GetParam()));
+    bool useIndex = get<1>(GetParam());
+    if(useIndex)
+        dictionary->buildIndex(correctionRate);
+
+    // half of the candidates are noisy markers, the other half random bit patterns
+    int markerSize = dictionary->markerSize;
+    int maxErrors = int(dictionary->maxCorrectionBits * correctionRate);
+    vector<Mat> candidates(nCandidates);
+    for(int i = 0; i < nCandidates; i++) {
+        if(i % 2 == 0) {
+            int id = rng.uniform(0, dictionary->bytesList.rows);
+            candidates[i] = Dictionary::getBitsFromByteList(dictionary->bytesList.row(id), markerSize);
+            int nErrors = maxErrors > 0 ? rng.uniform(0, maxErrors + 1) : 0;
+            for(int e = 0; e < nErrors; e++) {
+                uchar &bit = candidates[i].at<uchar>(rng.uniform(0, markerSize), rng.uniform(0, markerSize));
+                bit = 1 - bit;
+            }
+        }
+        else {
+            candidates[i].create(markerSize, markerSize, CV_8UC1);
+            rng.fill(candidates[i], RNG::UNIFORM, 0, 2);
+        }
+    }
+
+    int nFound = 0;
+    TEST_CYCLE()
+    {
+        nFound = 0;
+        for(int i = 0; i < nCandidates; i++) {
+            int idx, rotation;
+            if(dictionary->identify(candidates[i], idx, rotation, correctionRate))
+                nFound++;
+        }
+    }
+
+    EXPECT_GE(nFound, nCandidates / 2);
+    SANITY_CHECK_NOTHING();
+}
+
+}} // namespace
@@ -1028,63 +1028,13 @@ int fit_quad(const Ptr<DetectorParameters> &_params, const Mat im, zarray_t *clu
     return res;
 }
 
-/**
- *
- * @param nCidx0
- * @param nCidx1
- * @param nClusters
- * @param nW
- * @param nH
- * @param nquads
- * @param td
- * @param im
- */
-static void do_quad(int nCidx0, int nCidx1, zarray_t &nClusters, int nW, int nH, zarray_t *nquads, const Ptr<DetectorParameters> &td, const Mat im){
-
-    CV_Assert(nquads != NULL);
-
-    //struct quad_task *task = (struct quad_task*) p;
-
-    //zarray_t *clusters = nClusters;
-    zarray_t *quads = nquads;
-    int w = nW, h = nH;
-
-    for (int cidx = nCidx0; cidx < nCidx1; cidx++) {
-
-        zarray_t *cluster;
-        _zarray_get(&nClusters, cidx, &cluster);
-
-        if (_zarray_size(cluster) < td->aprilTagMinClusterPixels)
-            continue;
-
-        // a cluster should contain only boundary points around the
-        // tag. it cannot be bigger than the whole screen. (Reject
-        // large connected blobs that will be prohibitively slow to
-        // fit quads to.) A typical point along an edge is added three
-        // times (because it has 3 neighbors). The maximum perimeter
-        // is 2w+2h.
-        if (_zarray_size(cluster) > 3*(2*w+2*h)) {
-            continue;
-        }
-
-        struct sQuad quad;
-        memset(&quad, 0, sizeof(struct sQuad));
-
-        if (fit_quad(td, im, cluster, &quad)) {
-            //pthread_mutex_lock(&td.mutex);
-            _zarray_add(quads, &quad);
-            //pthread_mutex_unlock(&td.mutex);
-        }
-    }
-}
-
 /**
  *
  * @param mIm
  * @param parameters
  * @param mThresh
  */
-void threshold(const Mat mIm, const Ptr<DetectorParameters> &parameters, Mat& mThresh){
+void threshold(const Mat mIm, const Ptr<DetectorParameters> &parameters, Mat& mThresh, AprilTagBuffers &buffers){
     int w = mIm.cols, h = mIm.rows;
     int s = (unsigned) mIm.step;
     CV_Assert(w < 32768);
@@ -1122,8 +1072,10 @@ void threshold(const Mat mIm, const Ptr<DetectorParameters> &parameters, Mat& mT
     int tw = w / tilesz;
     int th = h / tilesz;
 
-    uint8_t *im_max = (uint8_t*)calloc(tw*th, sizeof(uint8_t));
-    uint8_t *im_min = (uint8_t*)calloc(tw*th, sizeof(uint8_t));
+    buffers.tileMax.resize(tw*th);
+    buffers.tileMin.resize(tw*th);
+    uint8_t *im_max = buffers.tileMax.data();
+    uint8_t *im_min = buffers.tileMin.data();
 
 
     // first, collect min/max statistics for each tile
@@ -1150,8 +1102,10 @@ void threshold(const Mat mIm, const Ptr<DetectorParameters> &parameters, Mat& mT
     // second, apply 3x3 max/min convolution to "blur" these values
     // over larger areas. This reduces artifacts due to abrupt changes
     // in the threshold value.
-    uint8_t *im_max_tmp = (uint8_t*)calloc(tw*th, sizeof(uint8_t));
-    uint8_t *im_min_tmp = (uint8_t*)calloc(tw*th, sizeof(uint8_t));
+    buffers.tileMaxTmp.resize(tw*th);
+    buffers.tileMinTmp.resize(tw*th);
+    uint8_t *im_max_tmp = buffers.tileMaxTmp.data();
+    uint8_t *im_min_tmp = buffers.tileMinTmp.data();
 
     for (int ty = 0; ty < th; ty++) {
         for (int tx = 0; tx < tw; tx++) {
@@ -1177,8 +1131,6 @@ void threshold(const Mat mIm, const Ptr<DetectorParameters> &parameters, Mat& mT
             im_min_tmp[ty*tw + tx] = min;
         }
     }
-    free(im_max);
-    free(im_min);
     im_max = im_max_tmp;
     im_min = im_min_tmp;
 
@@ -1258,8 +1210,6 @@ void threshold(const Mat mIm, const Ptr<DetectorParameters> &parameters, Mat& mT
             }
         }
     }
-    free(im_min);
-    free(im_max);
 
     // this is a dilate/erode deglitching scheme that does not improve
     // anything as far as I can tell.
@@ -1306,22 +1256,34 @@ static void _darken(const Mat &im){
 }
 #endif
 
+/**
+ * Root of a union-find node, without path compression so that it can be queried concurrently
+ */
+static inline uint32_t _get_root(const struct ufrec *data, uint32_t id){
+    while (data[id].parent != id)
+        id = data[id].parent;
+    return id;
+}
+
 /**
  *
  * @param parameters
  * @param mImg
  * @param contours
+ * @param buffers
  * @return
  */
-zarray_t *apriltag_quad_thresh(const Ptr<DetectorParameters> &parameters, const Mat & mImg, std::vector< std::vector< Point > > &contours){
+zarray_t *apriltag_quad_thresh(const Ptr<DetectorParameters> &parameters, const Mat & mImg, std::vector< std::vector< Point > > &contours,
+                               AprilTagBuffers &buffers){
 
     ////////////////////////////////////////////////////////
     // step 1. threshold the image, creating the edge image.
 
     int w = mImg.cols, h = mImg.rows;
 
-    Mat thold(h, w, mImg.type());
-    threshold(mImg, parameters, thold);
+    buffers.thold.create(h, w, mImg.type());
+    Mat &thold = buffers.thold;
+    threshold(mImg, parameters, thold, buffers);
 
     int ts = thold.cols;
 
@@ -1332,94 +1294,45 @@ zarray_t *apriltag_quad_thresh(const Ptr<DetectorParameters> &parameters, const
     ////////////////////////////////////////////////////////
     // step 2. find connected components.
 
-    unionfind_t *uf = unionfind_create(w * h);
-
-    // TODO PARALLELIZE
-    for (int y = 0; y < h - 1; y++) {
-        do_unionfind_line(uf, thold, w, ts, y);
-    }
-
-    // XXX sizing??
-    int nclustermap = 2*w*h - 1;
-
-    struct uint64_zarray_entry **clustermap = (struct uint64_zarray_entry**)calloc(nclustermap, sizeof(struct uint64_zarray_entry*));
-
-    for (int y = 1; y < h-1; y++) {
-        for (int x = 1; x < w-1; x++) {
-
-            uint8_t v0 = thold.data[y*ts + x];
-            if (v0 == 127)
-                continue;
-
-            // XXX don't query this until we know we need it?
-            uint64_t rep0 = unionfind_get_representative(uf, y*w + x);
-
-            // whenever we find two adjacent pixels such that one is
-            // white and the other black, we add the point half-way
-            // between them to a cluster associated with the unique
-            // ids of the white and black regions.
-            //
-            // We additionally compute the gradient direction (i.e., which
-            // direction was the white pixel?) Note: if (v1-v0) == 255, then
-            // (dx,dy) points towards the white pixel. if (v1-v0) == -255, then
-            // (dx,dy) points towards the black pixel. p.gx and p.gy will thus
-            // be -255, 0, or 255.
-            //
-            // Note that any given pixel might be added to multiple
-            // different clusters. But in the common case, a given
-            // pixel will be added multiple times to the same cluster,
-            // which increases the size of the cluster and thus the
-            // computational costs.
-            //
-            // A possible optimization would be to combine entries
-            // within the same cluster.
-
-#define DO_CONN(dx, dy)                                                 \
-        if (1) {                                                    \
-            uint8_t v1 = thold.data[y*ts + dy*ts + x + dx];         \
-            \
-            if (v0 + v1 == 255) {                                   \
-                uint64_t rep1 = unionfind_get_representative(uf, y*w + dy*w + x + dx); \
-                uint64_t clusterid;                                 \
-                if (rep0 < rep1)                                    \
-                clusterid = (rep1 << 32) + rep0;                \
-                else                                                \
-                clusterid = (rep0 << 32) + rep1;                \
-                \
-                /* XXX lousy hash function */                       \
-        uint32_t clustermap_bucket = u64hash_2(clusterid) % nclustermap; \
-        struct uint64_zarray_entry *entry = clustermap[clustermap_bucket]; \
-        while (entry && entry->id != clusterid)     {       \
-            entry = entry->next;                            \
-        }                                                   \
-        \
-        if (!entry) {                                       \
-            entry = (struct uint64_zarray_entry*)calloc(1, sizeof(struct uint64_zarray_entry)); \
-            entry->id = clusterid;                          \
-            entry->cluster = _zarray_create(sizeof(struct pt)); \
-            entry->next = clustermap[clustermap_bucket];    \
-            clustermap[clustermap_bucket] = entry;          \
-        }                                                   \
-        \
-        struct pt p;                                        \
-        p.x = saturate_cast<uint16_t>(2*x + dx);            \
-        p.y = saturate_cast<uint16_t>(2*y + dy);            \
-        p.gx = saturate_cast<uint16_t>(dx*((int) v1-v0));   \
-        p.gy = saturate_cast<uint16_t>(dy*((int) v1-v0));   \
-        _zarray_add(entry->cluster, &p);                    \
-        }                                                   \
+    // the rows are split in tiles, each tile only connects the pixels of its own rows so the
+    // tiles can be processed concurrently. The rows between tiles are connected afterwards.
+    int ntiles = std::max(1, std::min(h / 16, 4 * getNumThreads()));
+    std::vector<int> tileStart(ntiles + 1);
+    for (int t = 0; t <= ntiles; t++)
+        tileStart[t] = t * h / ntiles;
+
+    buffers.ufData.resize((size_t)w * h + 1);
+    unionfind_t uf_;
+    uf_.maxid = w * h;
+    uf_.data = buffers.ufData.data();
+    unionfind_t *uf = &uf_;
+    uf->data[w * h].parent = w * h;
+    uf->data[w * h].size = 1;
+
+    parallel_for_(Range(0, ntiles), [&](const Range &range){
+        for (int t = range.start; t < range.end; t++) {
+            for (uint32_t i = tileStart[t] * w; i < (uint32_t)(tileStart[t + 1] * w); i++) {
+                uf->data[i].size = 1;
+                uf->data[i].parent = i;
+            }
+            int y1 = std::min(tileStart[t + 1], h) - 1;
+            for (int y = tileStart[t]; y < y1; y++) {
+                do_unionfind_line(uf, thold, w, ts, y);
+            }
+        }
+    });
+    for (int t = 1; t < ntiles; t++) {
+        if (tileStart[t] > 0)
+            do_unionfind_line(uf, thold, w, ts, tileStart[t] - 1);
     }
 
-    // do 4 connectivity. NB: Arguments must be [-1, 1] or we'll overflow .gx, .gy
-    DO_CONN(1, 0);
-    DO_CONN(0, 1);
-
-    // do 8 connectivity
-    DO_CONN(-1, 1);
-    DO_CONN(1, 1);
-}
-}
-#undef DO_CONN
+    // flatten the forest once, the gradient clustering then only reads the labels
+    buffers.labels.resize((size_t)w * h);
+    uint32_t *labels = buffers.labels.data();
+    parallel_for_(Range(0, h), [&](const Range &range){
+        for (uint32_t i = range.start * w; i < (uint32_t)(range.end * w); i++)
+            labels[i] = _get_root(uf->data, i);
+    });
 
 #ifdef APRIL_DEBUG
 Mat out = Mat::zeros(h, w, CV_8UC3);
@@ -1428,9 +1341,9 @@ uint32_t *colors = (uint32_t*) calloc(w*h, sizeof(*colors));
 
 for (int y = 0; y < h; y++) {
     for (int x = 0; x < w; x++) {
-        uint32_t v = unionfind_get_representative(uf, y*w+x);
+        uint32_t v = labels[y*w+x];
 
-        if (unionfind_get_set_size(uf, v) < parameters->aprilTagMinClusterPixels)
+        if (uf->data[v].size < (uint32_t)parameters->aprilTagMinClusterPixels)
             continue;
 
         uint32_t color = colors[v];
@@ -1456,21 +1369,108 @@ out = Mat::zeros(h, w, CV_8UC3);
 #endif
 
     ////////////////////////////////////////////////////////
-    // step 3. process each connected component.
-    zarray_t *clusters = _zarray_create(sizeof(zarray_t*)); //, uint64_zarray_hash_size(clustermap));
-    CV_Assert(clusters != NULL);
-
-    for (int i = 0; i < nclustermap; i++) {
-        for (struct uint64_zarray_entry *entry = clustermap[i]; entry; entry = entry->next) {
-            // XXX reject clusters here?
-            _zarray_add(clusters, &entry->cluster);
+    // step 3. gather the boundary points of each pair of connected components
+
+    buffers.tilePoints.resize(ntiles);
+    parallel_for_(Range(0, ntiles), [&](const Range &range){
+        for (int t = range.start; t < range.end; t++) {
+            std::vector<struct cluster_pt> &points = buffers.tilePoints[t];
+            points.clear();
+
+            int y0 = std::max(tileStart[t], 1), y1 = std::min(tileStart[t + 1], h - 1);
+            for (int y = y0; y < y1; y++) {
+                for (int x = 1; x < w-1; x++) {
+
+                    uint8_t v0 = thold.data[y*ts + x];
+                    if (v0 == 127)
+                        continue;
+
+                    uint64_t rep0 = labels[y*w + x];
+
+                    // whenever we find two adjacent pixels such that one is
+                    // white and the other black, we add the point half-way
+                    // between them to a cluster associated with the unique
+                    // ids of the white and black regions.
+                    //
+                    // We additionally compute the gradient direction (i.e., which
+                    // direction was the white pixel?) Note: if (v1-v0) == 255, then
+                    // (dx,dy) points towards the white pixel. if (v1-v0) == -255, then
+                    // (dx,dy) points towards the black pixel. p.gx and p.gy will thus
+                    // be -255, 0, or 255.
+                    //
+                    // Note that any given pixel might be added to multiple
+                    // different clusters. But in the common case, a given
+                    // pixel will be added multiple times to the same cluster,
+                    // which increases the size of the cluster and thus the
+                    // computational costs.
+
+#define DO_CONN(dx, dy)                                                 \
+                    if (1) {                                            \
+                        uint8_t v1 = thold.data[y*ts + dy*ts + x + dx]; \
+                        if (v0 + v1 == 255) {                           \
+                            uint64_t rep1 = labels[y*w + dy*w + x + dx]; \
+                            struct cluster_pt cp;                       \
+                            cp.id = rep0 < rep1 ? (rep1 << 32) + rep0 : (rep0 << 32) + rep1; \
+                            cp.p.x = saturate_cast<uint16_t>(2*x + dx); \
+                            cp.p.y = saturate_cast<uint16_t>(2*y + dy); \
+                            cp.p.gx = saturate_cast<uint16_t>(dx*((int) v1-v0)); \
+                            cp.p.gy = saturate_cast<uint16_t>(dy*((int) v1-v0)); \
+                            cp.p.theta = 0;                             \
+                            points.push_back(cp);                       \
+                        }                                               \
+                    }
+
+                    // do 4 connectivity. NB: Arguments must be [-1, 1] or we'll overflow .gx, .gy
+                    DO_CONN(1, 0);
+                    DO_CONN(0, 1);
+
+                    // do 8 connectivity
+                    DO_CONN(-1, 1);
+                    DO_CONN(1, 1);
+#undef DO_CONN
+                }
+            }
+        }
+    });
+
+    // group the points by cluster, keeping the scan order inside each cluster. Clusters are
+    // numbered in order of appearance so the result does not depend on the number of tiles.
+    buffers.clusterIndex.clear();
+    buffers.clusterStart.clear();
+    buffers.pointCluster.clear();
+    for (int t = 0; t < ntiles; t++) {
+        const std::vector<struct cluster_pt> &points = buffers.tilePoints[t];
+        for (size_t i = 0; i < points.size(); i++) {
+            std::pair<std::unordered_map<uint64_t, int>::iterator, bool> it =
+                    buffers.clusterIndex.insert(std::make_pair(points[i].id, (int)buffers.clusterStart.size()));
+            if (it.second)
+                buffers.clusterStart.push_back(0);
+            buffers.clusterStart[it.first->second]++;
+            buffers.pointCluster.push_back(it.first->second);
         }
     }
 
+    int nclusters = (int)buffers.clusterStart.size();
+    int npoints = (int)buffers.pointCluster.size();
+    buffers.clusterPoints.resize(npoints);
+    buffers.clusters.resize(nclusters);
+    for (int c = 0, start = 0; c < nclusters; c++) {
+        zarray_t &cluster = buffers.clusters[c];
+        cluster.el_sz = sizeof(struct pt);
+        cluster.size = cluster.alloc = buffers.clusterStart[c];
+        cluster.data = (char*)(buffers.clusterPoints.data() + start);
+        buffers.clusterStart[c] = start;
+        start += cluster.size;
+    }
+    for (int t = 0, k = 0; t < ntiles; t++) {
+        const std::vector<struct cluster_pt> &points = buffers.tilePoints[t];
+        for (size_t i = 0; i < points.size(); i++, k++)
+            buffers.clusterPoints[buffers.clusterStart[buffers.pointCluster[k]]++] = points[i].p;
+    }
+
 #ifdef APRIL_DEBUG
-for (int i = 0; i < _zarray_size(clusters); i++) {
-    zarray_t *cluster;
-    _zarray_get(clusters, i, &cluster);
+for (int i = 0; i < nclusters; i++) {
+    zarray_t *cluster = &buffers.clusters[i];
 
     uint32_t r, g, b;
 
@@ -1495,9 +1495,8 @@ imwrite("2.4 debug_clusters.pnm", out);
 out = Mat::zeros(h, w, CV_8UC3);
 #endif
 
-    for (int i = 0; i < _zarray_size(clusters); i++) {
-        zarray_t *cluster;
-        _zarray_get(clusters, i, &cluster);
+    for (int i = 0; i < nclusters; i++) {
+        zarray_t *cluster = &buffers.clusters[i];
 
         std::vector< Point > cnt;
         for (int j = 0; j < _zarray_size(cluster); j++) {
@@ -1510,26 +1509,40 @@ out = Mat::zeros(h, w, CV_8UC3);
         contours.push_back(cnt);
     }
 
-    for (int i = 0; i < nclustermap; i++) {
-        struct uint64_zarray_entry *entry = clustermap[i];
-        while (entry) {
-            struct uint64_zarray_entry *tmp = entry->next;
-            free(entry);
-            entry = tmp;
-        }
-    }
-    free(clustermap);
+    ////////////////////////////////////////////////////////
+    // step 4. fit a quad to each cluster, in parallel. Each cluster has its own output slot
+    // so the quads keep the cluster order.
+    buffers.quads.resize(nclusters);
+    buffers.quadValid.assign(nclusters, 0);
 
-    zarray_t *quads = _zarray_create(sizeof(struct sQuad));
+    parallel_for_(Range(0, nclusters), [&](const Range &range){
+        for (int cidx = range.start; cidx < range.end; cidx++) {
+            zarray_t *cluster = &buffers.clusters[cidx];
 
-    //int chunksize = 1 + sz / (APRILTAG_TASKS_PER_THREAD_TARGET * numberOfThreads);
-    int chunksize = h / (10 * getNumThreads());
-    int sz = _zarray_size(clusters);
+            if (_zarray_size(cluster) < parameters->aprilTagMinClusterPixels)
+                continue;
+
+            // a cluster should contain only boundary points around the
+            // tag. it cannot be bigger than the whole screen. (Reject
+            // large connected blobs that will be prohibitively slow to
+            // fit quads to.) A typical point along an edge is added three
+            // times (because it has 3 neighbors). The maximum perimeter
+            // is 2w+2h.
+            if (_zarray_size(cluster) > 3*(2*w+2*h))
+                continue;
 
-    // TODO PARALLELIZE
-    for (int i = 0; i < sz; i += chunksize) {
-        int min = sz < (i+chunksize)? sz: (i+chunksize);
-        do_quad(i, min, *clusters, w, h, quads, parameters, mImg);
+            struct sQuad &quad = buffers.quads[cidx];
+            memset(&quad, 0, sizeof(struct sQuad));
+
+            if (fit_quad(parameters, mImg, cluster, &quad))
+                buffers.quadValid[cidx] = 1;
+        }
+    });
+
+    zarray_t *quads = _zarray_create(sizeof(struct sQuad));
+    for (int cidx = 0; cidx < nclusters; cidx++) {
+        if (buffers.quadValid[cidx])
+            _zarray_add(quads, &buffers.quads[cidx]);
     }
 
 #ifdef APRIL_DEBUG
@@ -1556,14 +1569,6 @@ for (int i = 0; i < _zarray_size(quads); i++) {
 imwrite("2.5 debug_lines.pnm", out);
 #endif
 
-    unionfind_destroy(uf);
-
-    for (int i = 0; i < _zarray_size(clusters); i++) {
-        zarray_t *cluster;
-        _zarray_get(clusters, i, &cluster);
-        _zarray_destroy(cluster);
-    }
-    _zarray_destroy(clusters);
     return quads;
 }
 
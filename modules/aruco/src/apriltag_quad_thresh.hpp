@@ -23,21 +23,11 @@
 #include "unionfind.hpp"
 #include "zmaxheap.hpp"
 #include "zarray.hpp"
+#include <unordered_map>
 
 namespace cv {
 namespace aruco {
 
-static inline uint32_t u64hash_2(uint64_t x) {
-    return uint32_t((2654435761UL * x) >> 32);
-}
-
-struct uint64_zarray_entry{
-    uint64_t id;
-    zarray_t *cluster;
-
-    struct uint64_zarray_entry *next;
-};
-
 struct pt{
     // Note: these represent 2*actual value.
     uint16_t x, y;
@@ -45,6 +35,39 @@ struct pt{
     int16_t gx, gy;
 };
 
+struct cluster_pt{
+    // ids of the two connected components the point lies between
+    uint64_t id;
+    struct pt p;
+};
+
+/**
+ * Working memory of apriltag_quad_thresh. A detector can keep it between calls so that the
+ * buffers are only reallocated when the image size grows.
+ */
+struct AprilTagBuffers{
+    Mat thold; // thresholded image
+
+    // min/max statistics of the threshold tiles
+    std::vector<uint8_t> tileMax, tileMin, tileMaxTmp, tileMinTmp;
+
+    // connected components: union-find nodes and resulting representative of every pixel
+    std::vector<struct ufrec> ufData;
+    std::vector<uint32_t> labels;
+
+    // boundary points, first per row tile in scan order, then grouped by cluster
+    std::vector< std::vector<struct cluster_pt> > tilePoints;
+    std::unordered_map<uint64_t, int> clusterIndex;
+    std::vector<int> pointCluster;
+    std::vector<int> clusterStart;
+    std::vector<struct pt> clusterPoints;
+    std::vector<zarray_t> clusters; // views on clusterPoints, must not be destroyed
+
+    // fitted quad of each cluster
+    std::vector<struct sQuad> quads;
+    std::vector<uint8_t> quadValid;
+};
+
 struct remove_vertex{
     int i;           // which vertex to remove?
     int left, right; // left vertex, right vertex
@@ -109,17 +132,20 @@ int fit_quad(const Ptr<DetectorParameters> &_params, const Mat im, zarray_t *clu
  * @param mIm
  * @param parameters
  * @param mThresh
+ * @param buffers
  */
-void threshold(const Mat mIm, const Ptr<DetectorParameters> &parameters, Mat& mThresh);
+void threshold(const Mat mIm, const Ptr<DetectorParameters> &parameters, Mat& mThresh, AprilTagBuffers &buffers);
 
 /**
  *
  * @param parameters
  * @param mImg
  * @param contours
+ * @param buffers working memory, reused between calls
  * @return
  */
-zarray_t *apriltag_quad_thresh(const Ptr<DetectorParameters> &parameters, const Mat & mImg, std::vector< std::vector< Point > > &contours);
+zarray_t *apriltag_quad_thresh(const Ptr<DetectorParameters> &parameters, const Mat & mImg, std::vector< std::vector< Point > > &contours,
+                               AprilTagBuffers &buffers);
 
 }}
 #endif
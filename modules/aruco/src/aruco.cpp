@@ -40,6 +40,8 @@ the use of this software, even if advised of the possibility of such damage.
 #include "opencv2/aruco.hpp"
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
+#include "opencv2/core/hal/intrin.hpp"
+#include <algorithm>
 
 #include "apriltag_quad_thresh.hpp"
 #include "zarray.hpp"
@@ -420,6 +422,97 @@ static void _detectCandidates(InputArray _image, vector< vector< vector< Point2f
 }
 
 
+/**
+  * @brief Sample the region of the image under the inverse homography M into a square patch of
+  * patchSize pixels. Same nearest neighbour rounding and constant (zero) border as
+  * warpPerspective(..., INTER_NEAREST), without the intermediate image.
+  */
+static void _samplePerspective(const Mat &image, const Matx33d &M, int patchSize, uchar *patch) {
+
+    for(int y = 0; y < patchSize; y++) {
+        uchar *dst = patch + y * patchSize;
+        double X0 = M(0, 1) * y + M(0, 2);
+        double Y0 = M(1, 1) * y + M(1, 2);
+        double W0 = M(2, 1) * y + M(2, 2);
+        int x = 0;
+
+#if CV_SIMD128_64F
+        const v_float64x2 v_M0 = v_setall_f64(M(0, 0)), v_M3 = v_setall_f64(M(1, 0)),
+                          v_M6 = v_setall_f64(M(2, 0));
+        const v_float64x2 v_X0 = v_setall_f64(X0), v_Y0 = v_setall_f64(Y0), v_W0 = v_setall_f64(W0);
+        const v_float64x2 v_zero = v_setzero_f64(), v_one = v_setall_f64(1.), v_two = v_setall_f64(2.);
+        const v_float64x2 v_intmin = v_setall_f64((double)INT_MIN), v_intmax = v_setall_f64((double)INT_MAX);
+        v_float64x2 v_x = v_float64x2(0., 1.);
+        int CV_DECL_ALIGNED(16) xi[4];
+        int CV_DECL_ALIGNED(16) yi[4];
+        for(; x <= patchSize - 4; x += 4) {
+            v_float64x2 v_W = v_muladd(v_M6, v_x, v_W0);
+            v_W = v_select(v_W != v_zero, v_one / v_W, v_zero);
+            v_float64x2 v_fX0 = v_max(v_intmin, v_min(v_intmax, v_muladd(v_M0, v_x, v_X0) * v_W));
+            v_float64x2 v_fY0 = v_max(v_intmin, v_min(v_intmax, v_muladd(v_M3, v_x, v_Y0) * v_W));
+            v_x += v_two;
+
+            v_W = v_muladd(v_M6, v_x, v_W0);
+            v_W = v_select(v_W != v_zero, v_one / v_W, v_zero);
+            v_float64x2 v_fX1 = v_max(v_intmin, v_min(v_intmax, v_muladd(v_M0, v_x, v_X0) * v_W));
+            v_float64x2 v_fY1 = v_max(v_intmin, v_min(v_intmax, v_muladd(v_M3, v_x, v_Y0) * v_W));
+            v_x += v_two;
+
+            v_store_aligned(xi, v_round(v_fX0, v_fX1));
+            v_store_aligned(yi, v_round(v_fY0, v_fY1));
+            for(int k = 0; k < 4; k++) {
+                bool inside = (unsigned)xi[k] < (unsigned)image.cols && (unsigned)yi[k] < (unsigned)image.rows;
+                dst[x + k] = inside ? image.ptr< uchar >(yi[k])[xi[k]] : 0;
+            }
+        }
+#endif
+
+        for(; x < patchSize; x++) {
+            double W = W0 + M(2, 0) * x;
+            W = W ? 1. / W : 0;
+            double fX = max((double)INT_MIN, min((double)INT_MAX, (X0 + M(0, 0) * x) * W));
+            double fY = max((double)INT_MIN, min((double)INT_MAX, (Y0 + M(1, 0) * x) * W));
+            int X = saturate_cast< int >(fX);
+            int Y = saturate_cast< int >(fY);
+            bool inside = (unsigned)X < (unsigned)image.cols && (unsigned)Y < (unsigned)image.rows;
+            dst[x] = inside ? image.ptr< uchar >(Y)[X] : 0;
+        }
+    }
+}
+
+
+/**
+  * @brief Otsu threshold of a 256 bins histogram, same as threshold(..., THRESH_OTSU)
+  */
+static int _getOtsuThreshold(const int *hist, int total) {
+
+    double mu = 0, scale = 1. / total;
+    for(int i = 0; i < 256; i++)
+        mu += i * (double)hist[i];
+    mu *= scale;
+
+    double mu1 = 0, q1 = 0;
+    double maxSigma = 0;
+    int maxVal = 0;
+    for(int i = 0; i < 256; i++) {
+        double p_i = hist[i] * scale;
+        mu1 *= q1;
+        q1 += p_i;
+        double q2 = 1. - q1;
+        if(min(q1, q2) < FLT_EPSILON || max(q1, q2) > 1. - FLT_EPSILON)
+            continue;
+        mu1 = (mu1 + i * p_i) / q1;
+        double mu2 = (mu - q1 * mu1) / q2;
+        double sigma = q1 * q2 * (mu1 - mu2) * (mu1 - mu2);
+        if(sigma > maxSigma) {
+            maxSigma = sigma;
+            maxVal = i;
+        }
+    }
+    return maxVal;
+}
+
+
 /**
   * @brief Given an input image and candidate corners, extract the bits of the candidate, including
   * the border bits
@@ -433,11 +526,12 @@ static Mat _extractBits(InputArray _image, InputArray _corners, int markerSize,
     CV_Assert(markerBorderBits > 0 && cellSize > 0 && cellMarginRate >= 0 && cellMarginRate <= 1);
     CV_Assert(minStdDevOtsu >= 0);
 
+    Mat image = _image.getMat();
+
     // number of bits in the marker
     int markerSizeWithBorders = markerSize + 2 * markerBorderBits;
     int cellMarginPixels = int(cellMarginRate * cellSize);
 
-    Mat resultImg; // marker image after removing perspective
     int resultImgSize = markerSizeWithBorders * cellSize;
     Mat resultImgCorners(4, 1, CV_32FC2);
     resultImgCorners.ptr< Point2f >(0)[0] = Point2f(0, 0);
@@ -446,24 +540,42 @@ static Mat _extractBits(InputArray _image, InputArray _corners, int markerSize,
         Point2f((float)resultImgSize - 1, (float)resultImgSize - 1);
     resultImgCorners.ptr< Point2f >(0)[3] = Point2f(0, (float)resultImgSize - 1);
 
-    // remove perspective
-    Mat transformation = getPerspectiveTransform(_corners, resultImgCorners);
-    warpPerspective(_image, resultImg, transformation, Size(resultImgSize, resultImgSize),
-                    INTER_NEAREST);
+    // remove perspective, sampling the image directly instead of warping it (the patch is small
+    // enough to live on the stack for the usual marker and cell sizes)
+    Matx33d transformation = getPerspectiveTransform(_corners, resultImgCorners);
+    Matx33d inverseTransformation = transformation.inv();
+    AutoBuffer< uchar, 4096 > resultImgBuf(resultImgSize * resultImgSize);
+    uchar *resultImg = resultImgBuf.data();
+    _samplePerspective(image, inverseTransformation, resultImgSize, resultImg);
 
     // output image containing the bits
     Mat bits(markerSizeWithBorders, markerSizeWithBorders, CV_8UC1, Scalar::all(0));
 
+    // histogram of the whole patch for Otsu, mean and standard deviation of the inner region
+    // (some border is removed just to avoid border noise from perspective transformation)
+    int hist[256] = { 0 };
+    double innerSum = 0, innerSqSum = 0;
+    int innerStart = cellSize / 2, innerEnd = resultImgSize - cellSize / 2;
+    for(int y = 0; y < resultImgSize; y++) {
+        const uchar *row = resultImg + y * resultImgSize;
+        bool innerRow = y >= innerStart && y < innerEnd;
+        for(int x = 0; x < resultImgSize; x++) {
+            hist[row[x]]++;
+            if(innerRow && x >= innerStart && x < innerEnd) {
+                innerSum += row[x];
+                innerSqSum += (double)row[x] * row[x];
+            }
+        }
+    }
+
     // check if standard deviation is enough to apply Otsu
     // if not enough, it probably means all bits are the same color (black or white)
-    Mat mean, stddev;
-    // Remove some border just to avoid border noise from perspective transformation
-    Mat innerRegion = resultImg.colRange(cellSize / 2, resultImg.cols - cellSize / 2)
-                          .rowRange(cellSize / 2, resultImg.rows - cellSize / 2);
-    meanStdDev(innerRegion, mean, stddev);
-    if(stddev.ptr< double >(0)[0] < minStdDevOtsu) {
+    int innerTotal = (innerEnd - innerStart) * (innerEnd - innerStart);
+    double mean = innerSum / innerTotal;
+    double stddev = std::sqrt(max(innerSqSum / innerTotal - mean * mean, 0.));
+    if(stddev < minStdDevOtsu) {
         // all black or all white, depending on mean value
-        if(mean.ptr< double >(0)[0] > 127)
+        if(mean > 127)
             bits.setTo(1);
         else
             bits.setTo(0);
@@ -471,18 +583,22 @@ static Mat _extractBits(InputArray _image, InputArray _corners, int markerSize,
     }
 
     // now extract code, first threshold using Otsu
-    threshold(resultImg, resultImg, 125, 255, THRESH_BINARY | THRESH_OTSU);
+    int otsuThreshold = _getOtsuThreshold(hist, resultImgSize * resultImgSize);
 
     // for each cell
+    int cellInnerSize = cellSize - 2 * cellMarginPixels;
     for(int y = 0; y < markerSizeWithBorders; y++) {
         for(int x = 0; x < markerSizeWithBorders; x++) {
             int Xstart = x * (cellSize) + cellMarginPixels;
             int Ystart = y * (cellSize) + cellMarginPixels;
-            Mat square = resultImg(Rect(Xstart, Ystart, cellSize - 2 * cellMarginPixels,
-                                        cellSize - 2 * cellMarginPixels));
             // count white pixels on each cell to assign its value
-            size_t nZ = (size_t) countNonZero(square);
-            if(nZ > square.total() / 2) bits.at< unsigned char >(y, x) = 1;
+            int nZ = 0;
+            for(int yy = Ystart; yy < Ystart + cellInnerSize; yy++) {
+                const uchar *row = resultImg + yy * resultImgSize;
+                for(int xx = Xstart; xx < Xstart + cellInnerSize; xx++)
+                    nZ += row[xx] > otsuThreshold;
+            }
+            if(nZ > cellInnerSize * cellInnerSize / 2) bits.at< unsigned char >(y, x) = 1;
         }
     }
 
@@ -860,7 +976,7 @@ static void _darken(const Mat &im){
  * @param contours
  */
 static void _apriltag(Mat im_orig, const Ptr<DetectorParameters> & _params, std::vector< std::vector< Point2f > > &candidates,
-        std::vector< std::vector< Point > > &contours){
+        std::vector< std::vector< Point > > &contours, AprilTagBuffers &buffers){
 
     ///////////////////////////////////////////////////////////
     /// Step 1. Detect quads according to requested image decimation
@@ -921,7 +1037,7 @@ static void _apriltag(Mat im_orig, const Ptr<DetectorParameters> & _params, std:
 
     ///////////////////////////////////////////////////////////
     /// Step 2. do the Threshold :: get the set of candidate quads
-    zarray_t *quads = apriltag_quad_thresh(_params, quad_im, contours);
+    zarray_t *quads = apriltag_quad_thresh(_params, quad_im, contours, buffers);
 
     CV_Assert(quads != NULL);
 
@@ -978,35 +1094,20 @@ static void _apriltag(Mat im_orig, const Ptr<DetectorParameters> & _params, std:
 
 
 /**
+  * @brief Identify the detected candidates and refine the corners of the accepted markers
+  * (steps 2 and 3 of detectMarkers)
   */
-void detectMarkers(InputArray _image, const Ptr<Dictionary> &_dictionary, OutputArrayOfArrays _corners,
-                   OutputArray _ids, const Ptr<DetectorParameters> &_params,
-                   OutputArrayOfArrays _rejectedImgPoints, InputArrayOfArrays camMatrix, InputArrayOfArrays distCoeff) {
-
-    CV_Assert(!_image.empty());
+static void _identifyAndRefineCandidates(const Mat &grey, vector< vector< vector< Point2f > > > &candidatesSet,
+                                         vector< vector< vector< Point > > > &contoursSet,
+                                         const Ptr<Dictionary> &_dictionary, OutputArrayOfArrays _corners,
+                                         OutputArray _ids, const Ptr<DetectorParameters> &_params,
+                                         OutputArrayOfArrays _rejectedImgPoints, InputArrayOfArrays camMatrix,
+                                         InputArrayOfArrays distCoeff) {
 
-    Mat grey;
-    _convertToGrey(_image.getMat(), grey);
-
-    /// STEP 1: Detect marker candidates
     vector< vector< Point2f > > candidates;
     vector< vector< Point > > contours;
     vector< int > ids;
 
-    vector< vector< vector< Point2f > > > candidatesSet;
-    vector< vector< vector< Point > > > contoursSet;
-    /// STEP 1.a Detect marker candidates :: using AprilTag
-    if(_params->cornerRefinementMethod == CORNER_REFINE_APRILTAG){
-        _apriltag(grey, _params, candidates, contours);
-
-        candidatesSet.push_back(candidates);
-        contoursSet.push_back(contours);
-    }
-
-    /// STEP 1.b Detect marker candidates :: traditional way
-    else
-        _detectCandidates(grey, candidatesSet, contoursSet, _params);
-
     /// STEP 2: Check candidate codification (identify markers)
     _identifyCandidates(grey, candidatesSet, contoursSet, _dictionary, candidates, contours, ids, _params,
                         _rejectedImgPoints);
@@ -1055,6 +1156,251 @@ void detectMarkers(InputArray _image, const Ptr<Dictionary> &_dictionary, Output
     }
 }
 
+
+/**
+  * @brief detectMarkers using the given AprilTag working memory
+  */
+static void _detectMarkers(InputArray _image, const Ptr<Dictionary> &_dictionary, OutputArrayOfArrays _corners,
+                           OutputArray _ids, const Ptr<DetectorParameters> &_params,
+                           OutputArrayOfArrays _rejectedImgPoints, InputArrayOfArrays camMatrix,
+                           InputArrayOfArrays distCoeff, AprilTagBuffers &aprilTagBuffers) {
+
+    CV_Assert(!_image.empty());
+
+    Mat grey;
+    _convertToGrey(_image.getMat(), grey);
+
+    /// STEP 1: Detect marker candidates
+    vector< vector< vector< Point2f > > > candidatesSet;
+    vector< vector< vector< Point > > > contoursSet;
+    /// STEP 1.a Detect marker candidates :: using AprilTag
+    if(_params->cornerRefinementMethod == CORNER_REFINE_APRILTAG){
+        vector< vector< Point2f > > candidates;
+        vector< vector< Point > > contours;
+        _apriltag(grey, _params, candidates, contours, aprilTagBuffers);
+
+        candidatesSet.push_back(candidates);
+        contoursSet.push_back(contours);
+    }
+
+    /// STEP 1.b Detect marker candidates :: traditional way
+    else
+        _detectCandidates(grey, candidatesSet, contoursSet, _params);
+
+    /// STEP 2 and 3: identify the candidates and refine the corners
+    _identifyAndRefineCandidates(grey, candidatesSet, contoursSet, _dictionary, _corners, _ids, _params,
+                                 _rejectedImgPoints, camMatrix, distCoeff);
+}
+
+
+/**
+  */
+void detectMarkers(InputArray _image, const Ptr<Dictionary> &_dictionary, OutputArrayOfArrays _corners,
+                   OutputArray _ids, const Ptr<DetectorParameters> &_params,
+                   OutputArrayOfArrays _rejectedImgPoints, InputArrayOfArrays camMatrix, InputArrayOfArrays distCoeff) {
+
+    AprilTagBuffers aprilTagBuffers;
+    _detectMarkers(_image, _dictionary, _corners, _ids, _params, _rejectedImgPoints, camMatrix, distCoeff,
+                   aprilTagBuffers);
+}
+
+
+/**
+  * @brief ArucoVideoDetector implementation, see ArucoVideoDetector
+  */
+class ArucoVideoDetectorImpl : public ArucoVideoDetector {
+    public:
+    ArucoVideoDetectorImpl(const Ptr<Dictionary> &_dictionary, const Ptr<DetectorParameters> &_params,
+                           int _fullScanInterval, float _roiMarginRate)
+        : dictionary(_dictionary), params(_params), fullScanInterval(_fullScanInterval),
+          roiMarginRate(_roiMarginRate), framesSinceFullScan(0) {
+
+        CV_Assert(!dictionary.empty() && !params.empty());
+        CV_Assert(fullScanInterval > 0 && roiMarginRate >= 0);
+    }
+
+    void detect(InputArray _image, OutputArrayOfArrays _corners, OutputArray _ids,
+                OutputArrayOfArrays _rejectedImgPoints, InputArray camMatrix, InputArray distCoeff) CV_OVERRIDE;
+
+    void reset() CV_OVERRIDE {
+        trackedCorners.clear();
+        trackedIds.clear();
+        framesSinceFullScan = 0;
+    }
+
+    private:
+    void getSearchRegions(Size imageSize, vector< Rect > &rois) const;
+    void detectCandidatesInRegions(const Mat &grey, const vector< Rect > &rois,
+                                   vector< vector< vector< Point2f > > > &candidatesSet,
+                                   vector< vector< vector< Point > > > &contoursSet);
+
+    Ptr<Dictionary> dictionary;
+    Ptr<DetectorParameters> params;
+    int fullScanInterval;
+    float roiMarginRate;
+
+    int framesSinceFullScan;
+    vector< vector< Point2f > > trackedCorners; // markers detected in the last frame
+    vector< int > trackedIds; // their ids, sorted
+    AprilTagBuffers aprilTagBuffers; // reused by the full frame searches
+    vector< AprilTagBuffers > roiBuffers; // one per search region, reused by the tracking frames
+};
+
+
+/**
+  * @brief Bounding boxes of the last detected markers dilated by roiMarginRate, with the
+  * overlapping ones merged so that no image region is searched twice
+  */
+void ArucoVideoDetectorImpl::getSearchRegions(Size imageSize, vector< Rect > &rois) const {
+
+    Rect imageRect(Point(0, 0), imageSize);
+    rois.clear();
+    for(size_t i = 0; i < trackedCorners.size(); i++) {
+        Rect box = boundingRect(trackedCorners[i]);
+        int margin = cvCeil(roiMarginRate * max(box.width, box.height));
+        box.x -= margin;
+        box.y -= margin;
+        box.width += 2 * margin;
+        box.height += 2 * margin;
+        box &= imageRect;
+        if(box.area() > 0) rois.push_back(box);
+    }
+
+    // merge intersecting regions until none overlap
+    bool merged = true;
+    while(merged) {
+        merged = false;
+        for(size_t i = 0; i < rois.size() && !merged; i++) {
+            for(size_t j = i + 1; j < rois.size(); j++) {
+                if((rois[i] & rois[j]).area() > 0) {
+                    rois[i] |= rois[j];
+                    rois.erase(rois.begin() + j);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+
+/**
+  * @brief Run the candidate detection (step 1 of detectMarkers) only inside the search regions
+  */
+void ArucoVideoDetectorImpl::detectCandidatesInRegions(const Mat &grey, const vector< Rect > &rois,
+                                                       vector< vector< vector< Point2f > > > &candidatesSet,
+                                                       vector< vector< vector< Point > > > &contoursSet) {
+
+    vector< vector< vector< Point2f > > > roiCandidates(rois.size());
+    if(params->cornerRefinementMethod == CORNER_REFINE_APRILTAG && roiBuffers.size() < rois.size())
+        roiBuffers.resize(rois.size());
+    vector< vector< vector< Point > > > roiContours(rois.size());
+
+    parallel_for_(Range(0, (int)rois.size()), [&](const Range &range) {
+        for(int r = range.start; r < range.end; r++) {
+            Mat roiGrey = grey(rois[r]);
+
+            // perimeter rates are relative to the image size, keep them relative to the full frame
+            Ptr<DetectorParameters> roiParams = makePtr<DetectorParameters>(*params);
+            double scale = double(max(grey.cols, grey.rows)) / max(roiGrey.cols, roiGrey.rows);
+            roiParams->minMarkerPerimeterRate *= scale;
+            roiParams->maxMarkerPerimeterRate *= scale;
+
+            if(params->cornerRefinementMethod == CORNER_REFINE_APRILTAG)
+                _apriltag(roiGrey, roiParams, roiCandidates[r], roiContours[r], roiBuffers[r]);
+            else
+                _detectInitialCandidates(roiGrey, roiCandidates[r], roiContours[r], roiParams);
+
+            // back to full frame coordinates
+            Point offset = rois[r].tl();
+            for(size_t i = 0; i < roiCandidates[r].size(); i++) {
+                for(size_t c = 0; c < roiCandidates[r][i].size(); c++)
+                    roiCandidates[r][i][c] += Point2f(offset);
+                for(size_t c = 0; c < roiContours[r][i].size(); c++)
+                    roiContours[r][i][c] += offset;
+            }
+        }
+    });
+
+    vector< vector< Point2f > > candidates;
+    vector< vector< Point > > contours;
+    for(size_t r = 0; r < rois.size(); r++) {
+        candidates.insert(candidates.end(), roiCandidates[r].begin(), roiCandidates[r].end());
+        contours.insert(contours.end(), roiContours[r].begin(), roiContours[r].end());
+    }
+
+    if(params->cornerRefinementMethod == CORNER_REFINE_APRILTAG) {
+        candidatesSet.push_back(candidates);
+        contoursSet.push_back(contours);
+    }
+    else {
+        _reorderCandidatesCorners(candidates);
+        _filterTooCloseCandidates(candidates, candidatesSet, contours, contoursSet,
+                                  params->minMarkerDistanceRate, params->detectInvertedMarker);
+    }
+}
+
+
+/**
+  */
+void ArucoVideoDetectorImpl::detect(InputArray _image, OutputArrayOfArrays _corners, OutputArray _ids,
+                                    OutputArrayOfArrays _rejectedImgPoints, InputArray camMatrix,
+                                    InputArray distCoeff) {
+
+    CV_Assert(!_image.empty());
+
+    Mat grey;
+    _convertToGrey(_image.getMat(), grey);
+
+    vector< vector< Point2f > > corners;
+    vector< int > ids;
+
+    bool fullScan = trackedCorners.empty() || framesSinceFullScan + 1 >= fullScanInterval;
+    if(!fullScan) {
+        vector< Rect > rois;
+        getSearchRegions(grey.size(), rois);
+
+        vector< vector< vector< Point2f > > > candidatesSet;
+        vector< vector< vector< Point > > > contoursSet;
+        detectCandidatesInRegions(grey, rois, candidatesSet, contoursSet);
+        _identifyAndRefineCandidates(grey, candidatesSet, contoursSet, dictionary, corners, ids, params,
+                                     _rejectedImgPoints, camMatrix, distCoeff);
+
+        // tracking lost for some of the markers, search the whole frame again. Comparing the
+        // counts is not enough, a new marker may show up in the region of a lost one
+        vector< int > sortedIds(ids);
+        std::sort(sortedIds.begin(), sortedIds.end());
+        if(!std::includes(sortedIds.begin(), sortedIds.end(), trackedIds.begin(), trackedIds.end()))
+            fullScan = true;
+        else framesSinceFullScan++;
+    }
+
+    if(fullScan) {
+        corners.clear();
+        ids.clear();
+        _detectMarkers(grey, dictionary, corners, ids, params, _rejectedImgPoints, camMatrix, distCoeff,
+                       aprilTagBuffers);
+        framesSinceFullScan = 0;
+    }
+
+    trackedCorners = corners;
+    trackedIds = ids;
+    std::sort(trackedIds.begin(), trackedIds.end());
+
+    _copyVector2Output(corners, _corners);
+    Mat(ids).copyTo(_ids);
+}
+
+
+/**
+  */
+Ptr<ArucoVideoDetector> ArucoVideoDetector::create(const Ptr<Dictionary> &dictionary,
+                                                   const Ptr<DetectorParameters> &parameters,
+                                                   int fullScanInterval, float roiMarginRate) {
+    return makePtr<ArucoVideoDetectorImpl>(dictionary, parameters, fullScanInterval, roiMarginRate);
+}
+
+
 /**
   */
 void estimatePoseSingleMarkers(InputArrayOfArrays _corners, float markerLength,
@@ -304,7 +304,7 @@ static int _selectAndRefineChessboardCorners(InputArray _allCorners, InputArray
     if(_image.type() == CV_8UC3)
         cvtColor(_image, grey, COLOR_BGR2GRAY);
     else
-        _image.copyTo(grey);
+        grey = _image.getMat();
 
     const Ptr<DetectorParameters> params = DetectorParameters::create(); // use default params for corner refinement
 
@@ -649,6 +649,88 @@ bool estimatePoseCharucoBoard(InputArray _charucoCorners, InputArray _charucoIds
 
 
 
+/**
+  */
+void estimatePoseCharucoBoards(const vector< Ptr<CharucoBoard> > &boards, const vector< CharucoFrame > &frames,
+                               vector< CharucoBoardPose > &poses, int minMarkers) {
+
+    int nBoards = (int)boards.size();
+    int nFrames = (int)frames.size();
+
+    // marker id -> board, computed once for all the images
+    vector< int > markerBoard;
+    for(int b = 0; b < nBoards; b++) {
+        CV_Assert(!boards[b].empty());
+        for(size_t m = 0; m < boards[b]->ids.size(); m++) {
+            int id = boards[b]->ids[m];
+            CV_Assert(id >= 0);
+            if(id >= (int)markerBoard.size()) markerBoard.resize(id + 1, -1);
+            CV_Assert(markerBoard[id] == -1 || markerBoard[id] == b);
+            markerBoard[id] = b;
+        }
+    }
+
+    for(int f = 0; f < nFrames; f++) {
+        CV_Assert(frames[f].image.type() == CV_8UC1 || frames[f].image.type() == CV_8UC3);
+        CV_Assert(frames[f].markerCorners.size() == frames[f].markerIds.size());
+    }
+
+    // grey images, shared by all the boards of each image
+    vector< Mat > greyImages(nFrames);
+    parallel_for_(Range(0, nFrames), [&](const Range& range) {
+        for(int f = range.start; f < range.end; f++) {
+            const Mat &image = frames[f].image;
+            if(image.type() == CV_8UC3)
+                cvtColor(image, greyImages[f], COLOR_BGR2GRAY);
+            else
+                greyImages[f] = image;
+        }
+    });
+
+    poses.resize((size_t)nFrames * nBoards);
+    parallel_for_(Range(0, nFrames * nBoards), [&](const Range& range) {
+        for(int i = range.start; i < range.end; i++) {
+            int f = i / nBoards, b = i % nBoards;
+            const CharucoFrame &frame = frames[f];
+            CharucoBoardPose &pose = poses[i];
+            int64 startTicks = getTickCount();
+
+            pose.boardIdx = b;
+            pose.frameIdx = f;
+            pose.charucoCorners.clear();
+            pose.charucoIds.clear();
+            pose.rvec = Vec3d();
+            pose.tvec = Vec3d();
+            pose.valid = false;
+
+            // markers of this board
+            vector< vector< Point2f > > markerCorners;
+            vector< int > markerIds;
+            for(size_t m = 0; m < frame.markerIds.size(); m++) {
+                int id = frame.markerIds[m];
+                if(id >= 0 && id < (int)markerBoard.size() && markerBoard[id] == b) {
+                    markerCorners.push_back(frame.markerCorners[m]);
+                    markerIds.push_back(id);
+                }
+            }
+
+            if(!markerIds.empty()) {
+                interpolateCornersCharuco(markerCorners, markerIds, greyImages[f], boards[b],
+                                          pose.charucoCorners, pose.charucoIds, frame.cameraMatrix,
+                                          frame.distCoeffs, minMarkers);
+                if(!frame.cameraMatrix.empty())
+                    pose.valid = estimatePoseCharucoBoard(pose.charucoCorners, pose.charucoIds, boards[b],
+                                                          frame.cameraMatrix, frame.distCoeffs,
+                                                          pose.rvec, pose.tvec);
+            }
+
+            pose.timeMs = (getTickCount() - startTicks) * 1000. / getTickFrequency();
+        }
+    });
+}
+
+
+
 /**
   */
 double calibrateCameraCharuco(InputArrayOfArrays _charucoCorners, InputArrayOfArrays _charucoIds,
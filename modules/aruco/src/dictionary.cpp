@@ -43,6 +43,7 @@ the use of this software, even if advised of the possibility of such damage.
 #include "predefined_dictionaries.hpp"
 #include "predefined_dictionaries_apriltag.hpp"
 #include "opencv2/core/hal/hal.hpp"
+#include <unordered_map>
 
 namespace cv {
 namespace aruco {
@@ -92,6 +93,103 @@ Ptr<Dictionary> Dictionary::get(int dict) {
 }
 
 
+/**
+  * @brief Multi-index hash over the codewords of a dictionary, see Dictionary::buildIndex()
+  */
+struct DictionaryIndex {
+    // bytesList the index was built from. Holding it keeps its buffer allocated, so another
+    // byte list cannot be allocated at the same address while the index exists
+    Mat bytesList;
+    int maxCorrection;       // largest number of corrected bits the index can serve
+    vector< int > chunkStart; // first bit of each substring, plus the total number of bits
+    vector< unordered_map< uint64, vector< int > > > tables; // substring -> marker ids
+
+    bool isValid(const Mat &_bytesList) const {
+        return _bytesList.u == bytesList.u && _bytesList.data == bytesList.data &&
+               _bytesList.rows == bytesList.rows && _bytesList.cols == bytesList.cols;
+    }
+};
+
+
+/**
+  * @brief Extract bits [start, end) of a codeword as an integer key
+  */
+static inline uint64 _getSubstring(const uchar *bytes, int start, int end) {
+    uint64 key = 0;
+    for(int i = start; i < end; i++)
+        key = (key << 1) | ((bytes[i >> 3] >> (7 - (i & 7))) & 1);
+    return key;
+}
+
+
+/**
+  * @brief Distance between the candidate and the best of the four rotations of marker m
+  */
+static inline int _getMarkerDistance(const Mat &bytesList, const Mat &candidateBytes, int m,
+                                     int &rotation) {
+    int currentMinDistance = INT_MAX;
+    rotation = -1;
+    for(unsigned int r = 0; r < 4; r++) {
+        int currentHamming = cv::hal::normHamming(
+                bytesList.ptr(m)+r*candidateBytes.cols,
+                candidateBytes.ptr(),
+                candidateBytes.cols);
+
+        if(currentHamming < currentMinDistance) {
+            currentMinDistance = currentHamming;
+            rotation = r;
+        }
+    }
+    return currentMinDistance;
+}
+
+
+/**
+ */
+void Dictionary::buildIndex(double maxCorrectionRate) {
+
+    CV_Assert(bytesList.rows > 0 && bytesList.type() == CV_8UC4);
+    CV_Assert(maxCorrectionRate >= 0.);
+
+    // a byte list over external data cannot be kept allocated by the index, take a copy
+    if(!bytesList.u) bytesList = bytesList.clone();
+
+    Ptr<DictionaryIndex> newIndex = makePtr<DictionaryIndex>();
+    newIndex->bytesList = bytesList;
+    newIndex->maxCorrection = int(double(maxCorrectionBits) * maxCorrectionRate);
+
+    // the hamming distance runs over all the bits of the byte list, padding included, so the
+    // substrings have to cover all of them for the result to be exact
+    int nbits = 8 * bytesList.cols;
+    int nchunks = min(newIndex->maxCorrection + 1, nbits);
+    int chunkLength = (nbits + nchunks - 1) / nchunks;
+    if(chunkLength > 64) {
+        // keys would not fit, keep the linear search
+        index.release();
+        return;
+    }
+    for(int c = 0; c < nchunks; c++)
+        newIndex->chunkStart.push_back(c * nbits / nchunks);
+    newIndex->chunkStart.push_back(nbits);
+
+    newIndex->tables.resize(nchunks);
+    for(int m = 0; m < bytesList.rows; m++) {
+        for(int r = 0; r < 4; r++) {
+            const uchar *codeword = bytesList.ptr(m) + r * bytesList.cols;
+            for(int c = 0; c < nchunks; c++) {
+                uint64 key = _getSubstring(codeword, newIndex->chunkStart[c],
+                                           newIndex->chunkStart[c + 1]);
+                vector< int > &ids = newIndex->tables[c][key];
+                // rotations of the same marker can share a substring
+                if(ids.empty() || ids.back() != m) ids.push_back(m);
+            }
+        }
+    }
+
+    index = newIndex;
+}
+
+
 /**
  */
 bool Dictionary::identify(const Mat &onlyBits, int &idx, int &rotation,
@@ -106,21 +204,37 @@ bool Dictionary::identify(const Mat &onlyBits, int &idx, int &rotation,
 
     idx = -1; // by default, not found
 
-    // search closest marker in dict
-    for(int m = 0; m < bytesList.rows; m++) {
-        int currentMinDistance = markerSize * markerSize + 1;
-        int currentRotation = -1;
-        for(unsigned int r = 0; r < 4; r++) {
-            int currentHamming = cv::hal::normHamming(
-                    bytesList.ptr(m)+r*candidateBytes.cols,
-                    candidateBytes.ptr(),
-                    candidateBytes.cols);
-
-            if(currentHamming < currentMinDistance) {
-                currentMinDistance = currentHamming;
-                currentRotation = r;
+    if(index && index->isValid(bytesList) && maxCorrectionRecalculed <= index->maxCorrection) {
+        // only check the markers sharing at least one substring with the candidate, in
+        // increasing id order so the first match is the same as in the linear search
+        vector< int > markers;
+        int nchunks = (int)index->tables.size();
+        for(int c = 0; c < nchunks; c++) {
+            uint64 key = _getSubstring(candidateBytes.ptr(), index->chunkStart[c],
+                                       index->chunkStart[c + 1]);
+            unordered_map< uint64, vector< int > >::const_iterator it = index->tables[c].find(key);
+            if(it != index->tables[c].end())
+                markers.insert(markers.end(), it->second.begin(), it->second.end());
+        }
+        std::sort(markers.begin(), markers.end());
+        markers.erase(std::unique(markers.begin(), markers.end()), markers.end());
+
+        for(size_t i = 0; i < markers.size(); i++) {
+            int currentRotation;
+            if(_getMarkerDistance(bytesList, candidateBytes, markers[i], currentRotation) <=
+               maxCorrectionRecalculed) {
+                idx = markers[i];
+                rotation = currentRotation;
+                break;
             }
         }
+        return idx != -1;
+    }
+
+    // search closest marker in dict
+    for(int m = 0; m < bytesList.rows; m++) {
+        int currentRotation;
+        int currentMinDistance = _getMarkerDistance(bytesList, candidateBytes, m, currentRotation);
 
         // if maxCorrection is fulfilled, return this one
         if(currentMinDistance <= maxCorrectionRecalculed) {
@@ -554,4 +554,176 @@ TEST(CV_ArucoBitCorrection, algorithmic) {
     test.safe_run();
 }
 
+/**
+ * @brief Bits of a candidate as read before the direct sampling: perspective removed by
+ * warpPerspective, Otsu threshold of the patch and majority vote in each cell
+ */
+static bool identifyWithWarpPerspective(const Mat &grey, const vector< Point2f > &corners,
+                                        const Ptr<aruco::Dictionary> &dictionary,
+                                        const Ptr<aruco::DetectorParameters> &params, int &id, int &rotation) {
+
+    int markerSize = dictionary->markerSize, borderBits = params->markerBorderBits;
+    int markerSizeWithBorders = markerSize + 2 * borderBits;
+    int cellSize = params->perspectiveRemovePixelPerCell;
+    int cellMarginPixels = int(params->perspectiveRemoveIgnoredMarginPerCell * cellSize);
+
+    int resultImgSize = markerSizeWithBorders * cellSize;
+    vector< Point2f > resultImgCorners;
+    resultImgCorners.push_back(Point2f(0, 0));
+    resultImgCorners.push_back(Point2f((float)resultImgSize - 1, 0));
+    resultImgCorners.push_back(Point2f((float)resultImgSize - 1, (float)resultImgSize - 1));
+    resultImgCorners.push_back(Point2f(0, (float)resultImgSize - 1));
+
+    Mat resultImg;
+    warpPerspective(grey, resultImg, getPerspectiveTransform(corners, resultImgCorners),
+                    Size(resultImgSize, resultImgSize), INTER_NEAREST);
+
+    Mat bits(markerSizeWithBorders, markerSizeWithBorders, CV_8UC1, Scalar::all(0));
+    Mat mean, stddev;
+    meanStdDev(resultImg.colRange(cellSize / 2, resultImg.cols - cellSize / 2)
+                   .rowRange(cellSize / 2, resultImg.rows - cellSize / 2), mean, stddev);
+    if(stddev.ptr< double >(0)[0] < params->minOtsuStdDev) {
+        bits.setTo(mean.ptr< double >(0)[0] > 127 ? 1 : 0);
+    }
+    else {
+        threshold(resultImg, resultImg, 125, 255, THRESH_BINARY | THRESH_OTSU);
+        for(int y = 0; y < markerSizeWithBorders; y++) {
+            for(int x = 0; x < markerSizeWithBorders; x++) {
+                Mat square = resultImg(Rect(x * cellSize + cellMarginPixels, y * cellSize + cellMarginPixels,
+                                            cellSize - 2 * cellMarginPixels, cellSize - 2 * cellMarginPixels));
+                if((size_t)countNonZero(square) > square.total() / 2) bits.at< uchar >(y, x) = 1;
+            }
+        }
+    }
+
+    int borderErrors = 0;
+    for(int y = 0; y < markerSizeWithBorders; y++) {
+        for(int x = 0; x < markerSizeWithBorders; x++) {
+            bool border = x < borderBits || y < borderBits || x >= markerSizeWithBorders - borderBits ||
+                          y >= markerSizeWithBorders - borderBits;
+            if(border && bits.at< uchar >(y, x) != 0) borderErrors++;
+        }
+    }
+    if(borderErrors > int(markerSize * markerSize * params->maxErroneousBitsInBorderRate))
+        return false;
+
+    Mat onlyBits = bits(Rect(borderBits, borderBits, markerSize, markerSize));
+    return dictionary->identify(onlyBits, id, rotation, params->errorCorrectionRate);
+}
+
+/**
+ * @brief The candidates sampled directly from the image are accepted or rejected, and identified,
+ * as they were with warpPerspective
+ */
+TEST(CV_ArucoDetectionPerspective, same_bits_as_warpPerspective) {
+    Mat cameraMatrix = Mat::eye(3, 3, CV_64FC1);
+    Size imgSize(500, 500);
+    cameraMatrix.at< double >(0, 0) = cameraMatrix.at< double >(1, 1) = 650;
+    cameraMatrix.at< double >(0, 2) = imgSize.width / 2;
+    cameraMatrix.at< double >(1, 2) = imgSize.height / 2;
+    Ptr<aruco::Dictionary> dictionary = aruco::getPredefinedDictionary(aruco::DICT_6X6_250);
+
+    int iter = 0, nAccepted = 0;
+    for(double distance = 0.1; distance < 0.7; distance += 0.2) {
+        for(int pitch = 0; pitch < 360; pitch += 45) {
+            for(int yaw = 60; yaw <= 120; yaw += 20) {
+                int markerBorder = iter % 2 + 1;
+                int currentId = iter++ % 250;
+                SCOPED_TRACE(cv::format("distance %.1f, pitch %d, yaw %d", distance, pitch, yaw));
+
+                Ptr<aruco::DetectorParameters> params = aruco::DetectorParameters::create();
+                params->minDistanceToBorder = 1;
+                params->markerBorderBits = markerBorder;
+
+                vector< Point2f > groundTruthCorners;
+                Mat img = projectMarker(dictionary, currentId, cameraMatrix, deg2rad(yaw), deg2rad(pitch),
+                                        distance, imgSize, markerBorder, groundTruthCorners);
+
+                vector< vector< Point2f > > corners, rejected;
+                vector< int > ids;
+                aruco::detectMarkers(img, dictionary, corners, ids, params, rejected);
+
+                for(size_t i = 0; i < corners.size(); i++) {
+                    int id = -1, rotation = -1;
+                    EXPECT_TRUE(identifyWithWarpPerspective(img, corners[i], dictionary, params, id, rotation));
+                    EXPECT_EQ(ids[i], id);
+                    // the corners of the accepted markers are already rotated
+                    EXPECT_EQ(0, rotation);
+                }
+                for(size_t i = 0; i < rejected.size(); i++) {
+                    int id = -1, rotation = -1;
+                    EXPECT_FALSE(identifyWithWarpPerspective(img, rejected[i], dictionary, params, id, rotation));
+                }
+                nAccepted += (int)corners.size();
+            }
+        }
+    }
+    EXPECT_GT(nAccepted, 0);
+}
+
+TEST(CV_ArucoVideoDetector, tracks_moving_markers) {
+    Ptr<aruco::Dictionary> dictionary = aruco::getPredefinedDictionary(aruco::DICT_6X6_250);
+    Ptr<aruco::ArucoVideoDetector> videoDetector = aruco::ArucoVideoDetector::create(dictionary);
+
+    const int markerSidePixels = 80;
+    const int nMarkers = 3;
+
+    // markers shift a few pixels per frame, as in a video stream
+    for(int frame = 0; frame < 25; frame++) {
+        Mat img(480, 640, CV_8UC1, Scalar::all(255));
+        for(int m = 0; m < nMarkers; m++) {
+            Mat marker;
+            aruco::drawMarker(dictionary, m, markerSidePixels, marker);
+            Point tl(40 + 180 * m + 4 * frame, 60 + 100 * m + 3 * frame);
+            marker.copyTo(img(Rect(tl, Size(markerSidePixels, markerSidePixels))));
+        }
+
+        vector< vector< Point2f > > corners, expectedCorners;
+        vector< int > ids, expectedIds;
+        videoDetector->detect(img, corners, ids);
+        aruco::detectMarkers(img, dictionary, expectedCorners, expectedIds);
+
+        ASSERT_EQ(expectedIds.size(), ids.size()) << "frame " << frame;
+        for(size_t i = 0; i < expectedIds.size(); i++) {
+            size_t k = std::find(ids.begin(), ids.end(), expectedIds[i]) - ids.begin();
+            ASSERT_LT(k, ids.size()) << "frame " << frame;
+            for(int c = 0; c < 4; c++)
+                EXPECT_LE(cv::norm(expectedCorners[i][c] - corners[k][c]), 0.001) << "frame " << frame;
+        }
+    }
+}
+
+TEST(CV_ArucoVideoDetector, rescans_when_a_marker_is_replaced) {
+    Ptr<aruco::Dictionary> dictionary = aruco::getPredefinedDictionary(aruco::DICT_6X6_250);
+    Ptr<aruco::ArucoVideoDetector> videoDetector = aruco::ArucoVideoDetector::create(dictionary,
+        aruco::DetectorParameters::create(), 100);
+
+    const int markerSidePixels = 80;
+    const Point places[] = { Point(40, 60), Point(260, 60), Point(480, 340) };
+
+    // marker 1 moves far away and marker 2 takes its place, the number of markers in the
+    // tracked regions stays the same
+    const int frameIds[2][3] = { { 0, 1, -1 }, { 0, 2, 1 } };
+    for(int frame = 0; frame < 2; frame++) {
+        Mat img(480, 640, CV_8UC1, Scalar::all(255));
+        for(int p = 0; p < 3; p++) {
+            if(frameIds[frame][p] < 0) continue;
+            Mat marker;
+            aruco::drawMarker(dictionary, frameIds[frame][p], markerSidePixels, marker);
+            marker.copyTo(img(Rect(places[p], Size(markerSidePixels, markerSidePixels))));
+        }
+
+        vector< vector< Point2f > > corners;
+        vector< int > ids;
+        videoDetector->detect(img, corners, ids);
+        std::sort(ids.begin(), ids.end());
+
+        vector< int > expectedIds;
+        for(int p = 0; p < 3; p++)
+            if(frameIds[frame][p] >= 0) expectedIds.push_back(frameIds[frame][p]);
+        std::sort(expectedIds.begin(), expectedIds.end());
+        EXPECT_EQ(expectedIds, ids) << "frame " << frame;
+    }
+}
+
 }} // namespace
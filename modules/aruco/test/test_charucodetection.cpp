@@ -599,6 +599,75 @@ TEST(CV_CharucoBoardCreation, accuracy) {
     test.safe_run();
 }
 
+TEST(Charuco, estimatePoseCharucoBoards_matches_single_board)
+{
+    Mat cameraMatrix = Mat::eye(3, 3, CV_64FC1);
+    Size imgSize(500, 500);
+    cameraMatrix.at< double >(0, 0) = cameraMatrix.at< double >(1, 1) = 650;
+    cameraMatrix.at< double >(0, 2) = imgSize.width / 2;
+    cameraMatrix.at< double >(1, 2) = imgSize.height / 2;
+    Mat distCoeffs(5, 1, CV_64FC1, Scalar::all(0));
+
+    // two boards with disjoint marker ids
+    Ptr<aruco::Dictionary> dictionary = aruco::getPredefinedDictionary(aruco::DICT_6X6_250);
+    vector< Ptr<aruco::CharucoBoard> > boards;
+    boards.push_back(aruco::CharucoBoard::create(4, 4, 0.03f, 0.015f, dictionary));
+    boards.push_back(aruco::CharucoBoard::create(4, 4, 0.03f, 0.015f, dictionary));
+    for(size_t m = 0; m < boards[1]->ids.size(); m++)
+        boards[1]->ids[m] += 100;
+
+    // one image per board, each image only shows its board
+    vector< aruco::CharucoFrame > frames;
+    for(int b = 0; b < 2; b++) {
+        Mat rvec, tvec;
+        aruco::CharucoFrame frame;
+        frame.image = projectCharucoBoard(boards[b], cameraMatrix, deg2rad(30 + 20 * b), deg2rad(60),
+                                          0.3, imgSize, 1, rvec, tvec);
+        aruco::detectMarkers(frame.image, dictionary, frame.markerCorners, frame.markerIds);
+        ASSERT_FALSE(frame.markerIds.empty());
+        frame.cameraMatrix = cameraMatrix;
+        frame.distCoeffs = distCoeffs;
+        frames.push_back(frame);
+    }
+
+    vector< aruco::CharucoBoardPose > poses;
+    aruco::estimatePoseCharucoBoards(boards, frames, poses);
+    ASSERT_EQ(frames.size() * boards.size(), poses.size());
+
+    for(size_t f = 0; f < frames.size(); f++) {
+        for(size_t b = 0; b < boards.size(); b++) {
+            const aruco::CharucoBoardPose &pose = poses[f * boards.size() + b];
+            EXPECT_EQ((int)f, pose.frameIdx);
+            EXPECT_EQ((int)b, pose.boardIdx);
+            EXPECT_GE(pose.timeMs, 0.);
+
+            if(f != b) {
+                // the board is not in the image
+                EXPECT_TRUE(pose.charucoIds.empty());
+                EXPECT_FALSE(pose.valid);
+                continue;
+            }
+
+            vector< Point2f > charucoCorners;
+            vector< int > charucoIds;
+            aruco::interpolateCornersCharuco(frames[f].markerCorners, frames[f].markerIds, frames[f].image,
+                                             boards[b], charucoCorners, charucoIds, cameraMatrix, distCoeffs);
+            Vec3d rvec, tvec;
+            bool valid = aruco::estimatePoseCharucoBoard(charucoCorners, charucoIds, boards[b], cameraMatrix,
+                                                         distCoeffs, rvec, tvec);
+
+            ASSERT_EQ(charucoIds, pose.charucoIds);
+            for(size_t i = 0; i < charucoCorners.size(); i++)
+                EXPECT_LE(cv::norm(charucoCorners[i] - pose.charucoCorners[i]), 1e-5);
+            ASSERT_EQ(valid, pose.valid);
+            if(valid) {
+                EXPECT_LE(cv::norm(rvec - pose.rvec), 1e-6);
+                EXPECT_LE(cv::norm(tvec - pose.tvec), 1e-6);
+            }
+        }
+    }
+}
+
 TEST(Charuco, testCharucoCornersCollinear_true)
 {
     int squaresX = 13;
@@ -24,4 +24,71 @@ TEST(CV_ArucoDrawMarker, regression_1226)
     });
 }
 
+TEST(CV_ArucoDictionary, identify_with_index)
+{
+    const double correctionRate = 0.6;
+    RNG rng(0);
+
+    const int dictionaries[] = { cv::aruco::DICT_4X4_250, cv::aruco::DICT_5X5_1000,
+                                 cv::aruco::DICT_6X6_250, cv::aruco::DICT_ARUCO_ORIGINAL,
+                                 cv::aruco::DICT_APRILTAG_36h11 };
+    for(size_t d = 0; d < sizeof(dictionaries) / sizeof(dictionaries[0]); d++) {
+        cv::Ptr<cv::aruco::Dictionary> linear = cv::aruco::getPredefinedDictionary(dictionaries[d]);
+        cv::Ptr<cv::aruco::Dictionary> indexed = cv::aruco::getPredefinedDictionary(dictionaries[d]);
+        indexed->buildIndex(correctionRate);
+
+        int markerSize = linear->markerSize;
+        for(int i = 0; i < 1000; i++) {
+            cv::Mat bits;
+            if(i % 2 == 0) {
+                int id = rng.uniform(0, linear->bytesList.rows);
+                bits = cv::aruco::Dictionary::getBitsFromByteList(linear->bytesList.row(id), markerSize);
+                int nErrors = rng.uniform(0, linear->maxCorrectionBits + 2);
+                for(int e = 0; e < nErrors; e++) {
+                    uchar &bit = bits.at<uchar>(rng.uniform(0, markerSize), rng.uniform(0, markerSize));
+                    bit = 1 - bit;
+                }
+            }
+            else {
+                bits.create(markerSize, markerSize, CV_8UC1);
+                rng.fill(bits, RNG::UNIFORM, 0, 2);
+            }
+
+            int idxLinear, rotationLinear, idxIndexed, rotationIndexed;
+            bool foundLinear = linear->identify(bits, idxLinear, rotationLinear, correctionRate);
+            bool foundIndexed = indexed->identify(bits, idxIndexed, rotationIndexed, correctionRate);
+            ASSERT_EQ(foundLinear, foundIndexed);
+            ASSERT_EQ(idxLinear, idxIndexed);
+            if(foundLinear)
+                ASSERT_EQ(rotationLinear, rotationIndexed);
+        }
+    }
+}
+
+// the index must not be used for another byte list, even one allocated at the address of the
+// byte list it was built from
+TEST(CV_ArucoDictionary, identify_after_bytesList_reassigned)
+{
+    cv::Ptr<cv::aruco::Dictionary> indexed = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
+    cv::Ptr<cv::aruco::Dictionary> linear = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
+
+    // same size, but in the reverse order
+    cv::Mat reversed(linear->bytesList.size(), linear->bytesList.type());
+    for(int i = 0; i < reversed.rows; i++)
+        linear->bytesList.row(reversed.rows - 1 - i).copyTo(reversed.row(i));
+    linear->bytesList = reversed;
+
+    indexed->buildIndex(0.6);
+    indexed->bytesList.release();
+    indexed->bytesList = reversed.clone();
+
+    for(int id = 0; id < reversed.rows; id++) {
+        cv::Mat bits = cv::aruco::Dictionary::getBitsFromByteList(reversed.row(id), linear->markerSize);
+        int idx = -1, rotation = -1;
+        ASSERT_TRUE(indexed->identify(bits, idx, rotation, 0.6));
+        ASSERT_EQ(id, idx);
+        ASSERT_EQ(0, rotation);
+    }
+}
+
 }} // namespace
@@ -341,7 +341,8 @@ namespace rgbd
           threshold_(0.01),
           sensor_error_a_(0),
           sensor_error_b_(0),
-          sensor_error_c_(0)
+          sensor_error_c_(0),
+          use_previous_planes_(false)
     {
     }
 
@@ -441,6 +442,20 @@ namespace rgbd
     {
         sensor_error_c_ = val;
     }
+    /** When enabled, the region growing first starts from the tiles that agree best with the
+     * planes found by the previous call, so planes that are still visible keep their order
+     * (and thus their index in the mask) from one frame to the next. Other planes are
+     * searched afterwards as usual.
+     */
+    CV_WRAP bool getUsePreviousPlanes() const
+    {
+        return use_previous_planes_;
+    }
+    CV_WRAP void setUsePreviousPlanes(bool val)
+    {
+        use_previous_planes_ = val;
+        previous_planes_.clear();
+    }
 
   private:
     /** The method to use to compute the planes */
@@ -453,6 +468,10 @@ namespace rgbd
     double threshold_;
     /** coefficient of the sensor error with respect to the. All 0 by default but you want a=0.0075 for a Kinect */
     double sensor_error_a_, sensor_error_b_, sensor_error_c_;
+    /** Whether to seed the search with the planes of the previous frame */
+    bool use_previous_planes_;
+    /** The planes found by the last call */
+    std::vector<Vec4f> previous_planes_;
   };
 
   /** Object that contains a frame data.
@@ -504,6 +523,26 @@ namespace rgbd
     CV_WRAP void
     releasePyramids();
 
+    /** Releases the frame data and cached pyramids but keeps their memory: the next prepareFrameCache() call
+     * on this frame refills the recycled buffers in place instead of allocating new ones.
+     * Together with swapping frame pointers it allows to process a sequence without any per-frame
+     * pyramid allocations; the pyramids of the previous dstFrame are reused as srcFrame ones as is:
+     * @code
+     * std::swap(srcFrame, dstFrame);
+     * dstFrame->recycle();
+     * dstFrame->image = image; dstFrame->depth = depth;
+     * odometry->compute(srcFrame, dstFrame, Rt);
+     * @endcode
+     */
+    CV_WRAP void
+    recycle();
+
+    /** Indices of the recycled pyramids in pyramidBuffers */
+    enum
+    {
+      PYR_IMAGE = 0, PYR_DEPTH, PYR_MASK, PYR_CLOUD, PYR_DIX, PYR_DIY, PYR_TEXMASK, PYR_NORM, PYR_NORMMASK, PYR_COUNT
+    };
+
     CV_PROP std::vector<Mat> pyramidImage;
     CV_PROP std::vector<Mat> pyramidDepth;
     CV_PROP std::vector<Mat> pyramidMask;
@@ -516,6 +555,11 @@ namespace rgbd
 
     CV_PROP std::vector<Mat> pyramidNormals;
     CV_PROP std::vector<Mat> pyramidNormalsMask;
+
+    /** Memory of the pyramids released by recycle(), it's consumed by prepareFrameCache() */
+    std::vector<Mat> pyramidBuffers[PYR_COUNT];
+    /** Memory of the normals released by recycle() */
+    Mat normalsBuffer;
   };
 
   /** Base class for computation of odometry.
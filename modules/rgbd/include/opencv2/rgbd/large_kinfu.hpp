@@ -79,6 +79,15 @@ struct CV_EXPORTS_W Params
     */
     CV_PROP_RW float truncateThreshold;
 
+    /** @brief Pipelined update
+        When enabled, update() only tracks the frame on the calling thread. Integration, raycasting
+        and submap management run on a worker thread and the pose graph is optimized on another one;
+        their results are swapped in when ready, so a frame is tracked against the latest available
+        model prediction. If the worker is still busy, only the most recent frame waits for
+        integration and older pending frames are skipped.
+    */
+    CV_PROP_RW bool pipelined;
+
     /** @brief Volume parameters
     */
     kinfu::VolumeParams volumeParams;
@@ -392,6 +392,23 @@ public:
                    const String& format = "templates_%s.yml.gz");
   CV_WRAP void writeClasses(const String& format = "templates_%s.yml.gz") const;
 
+  /**
+   * \brief Write the templates of all classes into a single binary database file.
+   *
+   * The database is a compact native-endian alternative to the YAML files of writeClasses(),
+   * meant for large template sets that have to be loaded quickly.
+   */
+  CV_WRAP void writeClassesBinary(const String& filename) const;
+
+  /**
+   * \brief Add all classes of a database written by writeClassesBinary().
+   *
+   * Only the class directory is parsed here. The file is memory-mapped where the platform
+   * allows it and the templates of a class are decoded when the class is first used, so
+   * matching a few classes of a large database does not pay for loading all of them.
+   */
+  CV_WRAP void readClassesBinary(const String& filename);
+
 protected:
   std::vector< Ptr<Modality> > modalities;
   int pyramid_levels;
@@ -399,7 +416,25 @@ protected:
 
   typedef std::vector<Template> TemplatePyramid;
   typedef std::map<String, std::vector<TemplatePyramid> > TemplatesMap;
-  TemplatesMap class_templates;
+  /// Classes read by readClassesBinary() have an empty entry here until they are loaded
+  mutable TemplatesMap class_templates;
+
+  /// Binary template database opened by readClassesBinary(), defined in linemod.cpp
+  struct TemplateDatabase;
+
+  struct PendingClass
+  {
+    Ptr<TemplateDatabase> db;
+    size_t offset, size;
+    int num_templates;
+  };
+  /// Classes of a binary database whose templates are not decoded yet
+  mutable std::map<String, PendingClass> pending_classes;
+  /// Guards pending_classes and the class_templates entries being loaded
+  Ptr<Mutex> pending_classes_mutex;
+
+  /// Decodes the templates of class_id if it is still pending, safe to call concurrently
+  void loadPendingClass(const String& class_id) const;
 
   typedef std::vector<Mat> LinearMemories;
   // Indexed as [pyramid level][modality][quantized label]
@@ -410,6 +445,22 @@ protected:
                   float threshold, std::vector<Match>& matches,
                   const String& class_id,
                   const std::vector<TemplatePyramid>& template_pyramids) const;
+
+  /// Matches all templates of the given classes in parallel, the matches are appended in the
+  /// same order as a sequential matchClass() call for each class would produce
+  void matchClasses(const LinearMemoryPyramid& lm_pyramid,
+                    const std::vector<Size>& sizes,
+                    float threshold, std::vector<Match>& matches,
+                    const std::vector<TemplatesMap::const_iterator>& classes) const;
+
+  /// Similarity images reused by a matching thread, see matchTemplate()
+  struct MatchBuffers;
+
+  void matchTemplate(const LinearMemoryPyramid& lm_pyramid,
+                     const std::vector<Size>& sizes,
+                     float threshold, std::vector<Match>& matches,
+                     const String& class_id, int template_id,
+                     const TemplatePyramid& tp, MatchBuffers& buffers) const;
 };
 
 /**
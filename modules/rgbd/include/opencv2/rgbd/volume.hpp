@@ -34,6 +34,21 @@ class CV_EXPORTS_W Volume
                          const Size& frameSize, OutputArray points, OutputArray normals) const = 0;
     virtual void fetchNormals(InputArray points, OutputArray _normals) const                   = 0;
     virtual void fetchPointsNormals(OutputArray points, OutputArray normals) const             = 0;
+    /** @brief Extracts the surface as a triangle mesh using marching cubes
+
+      @param vertices Nx1 array of vertices in the same format as the points of fetchPointsNormals
+      @param triangles Mx1 CV_32SC3 array of vertex indices, vertices shared by adjacent triangles
+      are not duplicated
+
+      Volumes made of volume units remesh only the units integrated since the previous call.
+      The default implementation throws StsNotImplemented.
+    */
+    virtual void fetchMesh(OutputArray vertices, OutputArray triangles) const
+    {
+        CV_UNUSED(vertices);
+        CV_UNUSED(triangles);
+        CV_Error(Error::StsNotImplemented, "This volume does not support mesh extraction");
+    }
     virtual void reset()                                                                       = 0;
 
    public:
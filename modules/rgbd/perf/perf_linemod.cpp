@@ -0,0 +1,57 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html
+
+#include "perf_precomp.hpp"
+#include <opencv2/imgproc.hpp>
+
+namespace opencv_test { namespace {
+
+/** Draws a rotated textured rectangle, used both as a template view and as a scene object */
+static void drawObject(Mat& img, Mat& mask, Point2f center, float angle, float scale)
+{
+    RotatedRect rect(center, Size2f(60.f * scale, 40.f * scale), angle);
+    Point2f pts2f[4];
+    rect.points(pts2f);
+    std::vector<Point> pts(pts2f, pts2f + 4);
+    fillConvexPoly(img, pts, Scalar(40, 180, 220));
+    fillConvexPoly(mask, pts, Scalar(255));
+    circle(img, Point(center), cvRound(10 * scale), Scalar(200, 40, 60), -1);
+}
+
+typedef perf::TestBaseWithParam<int> LinemodMatchPerfTest;
+
+PERF_TEST_P_(LinemodMatchPerfTest, match)
+{
+    const int numTemplates = GetParam();
+
+    Ptr<linemod::Detector> detector = linemod::getDefaultLINE();
+    RNG rng(0);
+    for (int i = 0; i < numTemplates; i++)
+    {
+        Mat view(200, 200, CV_8UC3, Scalar::all(0)), mask(view.size(), CV_8U, Scalar(0));
+        drawObject(view, mask, Point2f(100, 100), rng.uniform(0.f, 180.f), rng.uniform(0.8f, 1.5f));
+        std::vector<Mat> sources(1, view);
+        detector->addTemplate(sources, format("object_%d", i % 10), mask);
+    }
+
+    Mat scene(480, 640, CV_8UC3, Scalar::all(0)), sceneMask(scene.size(), CV_8U, Scalar(0));
+    for (int i = 0; i < 5; i++)
+        drawObject(scene, sceneMask, Point2f(rng.uniform(100.f, 540.f), rng.uniform(100.f, 380.f)),
+                   rng.uniform(0.f, 180.f), rng.uniform(0.8f, 1.5f));
+    std::vector<Mat> sources(1, scene);
+
+    std::vector<linemod::Match> matches;
+    while (next())
+    {
+        startTimer();
+        detector->match(sources, 80.f, matches);
+        stopTimer();
+    }
+
+    SANITY_CHECK_NOTHING();
+}
+
+INSTANTIATE_TEST_CASE_P(/**/, LinemodMatchPerfTest, ::testing::Values(100, 2000));
+
+}}  // namespace
@@ -0,0 +1,52 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html
+
+#include "perf_precomp.hpp"
+
+namespace opencv_test { namespace {
+
+CV_ENUM(NormalsMethod, RgbdNormals::RGBD_NORMALS_METHOD_FALS,
+                       RgbdNormals::RGBD_NORMALS_METHOD_LINEMOD,
+                       RgbdNormals::RGBD_NORMALS_METHOD_SRI)
+
+typedef perf::TestBaseWithParam< tuple<NormalsMethod, Size> > RgbdNormalsPerfTest;
+
+PERF_TEST_P_(RgbdNormalsPerfTest, compute)
+{
+    const int method = get<0>(GetParam());
+    const Size size = get<1>(GetParam());
+
+    const float f = 525.f * size.width / 640.f;
+    Matx33f K(f, 0, size.width / 2.f - 0.5f,
+              0, f, size.height / 2.f - 0.5f,
+              0, 0, 1);
+
+    // smooth wavy surface in front of the camera
+    Mat_<float> depth(size);
+    for (int y = 0; y < size.height; y++)
+        for (int x = 0; x < size.width; x++)
+            depth(y, x) = 2.f + 0.3f * std::sin(x * 0.02f) * std::cos(y * 0.02f);
+
+    Mat points3d;
+    depthTo3d(depth, K, points3d);
+
+    RgbdNormals normalsComputer(size.height, size.width, CV_32F, K, 5, method);
+    normalsComputer.initialize();
+
+    Mat normals;
+    while (next())
+    {
+        startTimer();
+        normalsComputer(points3d, normals);
+        stopTimer();
+    }
+
+    SANITY_CHECK_NOTHING();
+}
+
+INSTANTIATE_TEST_CASE_P(/**/, RgbdNormalsPerfTest,
+                        ::testing::Combine(NormalsMethod::all(),
+                                           ::testing::Values(Size(640, 480), Size(1280, 720))));
+
+}}  // namespace
@@ -0,0 +1,66 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html
+
+#include "perf_precomp.hpp"
+#include "../test/test_pose_graph_common.hpp"
+
+namespace opencv_test { namespace {
+
+using namespace cv::kinfu;
+
+#if defined(HAVE_EIGEN)
+typedef perf::TestBaseWithParam<int> PoseGraphPerfTest;
+
+PERF_TEST_P_(PoseGraphPerfTest, levenbergMarquardt)
+{
+    std::vector<Affine3d> groundTruth;
+    const PoseGraph poseGraph = makeHelixPoseGraph(GetParam(), 100, 0.005, groundTruth);
+
+    PoseGraph g = poseGraph;
+    while (next())
+    {
+        g = poseGraph;
+        startTimer();
+        Optimizer::optimizeLevenbergMarquardt(g);
+        stopTimer();
+    }
+
+    // measurements are exact, so the optimum is the ground truth
+    double maxTransError, maxRotError;
+    poseGraphErrors(g, groundTruth, maxTransError, maxRotError);
+    EXPECT_LT(maxTransError, 1e-3);
+    EXPECT_LT(maxRotError, 1e-3);
+
+    SANITY_CHECK_NOTHING();
+}
+
+#if defined(CERES_FOUND)
+PERF_TEST_P_(PoseGraphPerfTest, ceres)
+{
+    std::vector<Affine3d> groundTruth;
+    const PoseGraph poseGraph = makeHelixPoseGraph(GetParam(), 100, 0.005, groundTruth);
+
+    PoseGraph g = poseGraph;
+    while (next())
+    {
+        g = poseGraph;
+        startTimer();
+        Optimizer::optimizeCeres(g);
+        stopTimer();
+    }
+
+    // measurements are exact, so the optimum is the ground truth
+    double maxTransError, maxRotError;
+    poseGraphErrors(g, groundTruth, maxTransError, maxRotError);
+    EXPECT_LT(maxTransError, 1e-3);
+    EXPECT_LT(maxRotError, 1e-3);
+
+    SANITY_CHECK_NOTHING();
+}
+#endif
+
+INSTANTIATE_TEST_CASE_P(/**/, PoseGraphPerfTest, ::testing::Values(1000, 10000));
+#endif
+
+}}  // namespace
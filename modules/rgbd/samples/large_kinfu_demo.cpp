@@ -57,6 +57,7 @@ static const char* keys = {
     "{coarse | | Run on coarse settings (fast but ugly) or on default (slow but looks better),"
     " in coarse mode points and normals are displayed }"
     "{idle   | | Do not run LargeKinfu, just display depth frames }"
+    "{pipelined | | Integrate frames and optimize the pose graph on background threads }"
     "{record | | Write depth frames to specified file list"
     " (the same format as for the 'depth' key) }"
 };
@@ -126,6 +127,7 @@ int main(int argc, char** argv)
 
     // These params can be different for each depth sensor
     ds->updateParams(*params);
+    params->pipelined = parser.has("pipelined");
 
     // Disabled until there is no OpenCL accelerated HashTSDF is available
     cv::setUseOptimized(false);
@@ -226,6 +226,8 @@ struct IntegrateInvoker : ParallelLoopBody
     {
         CV_TRACE_FUNCTION();
 
+        std::vector<int> indices;
+        std::vector<float> dists;
         for(int x = range.start; x < range.end; x++)
         {
             Voxel* volDataX = volDataStart + x*volume.volDims[0];
@@ -239,10 +241,8 @@ struct IntegrateInvoker : ParallelLoopBody
 
                     Point3f volPt = Point3f((float)x, (float)y, (float)z)*volume.voxelSize;
 
-                    if(warpfield->getNodeIndex())
+                    if(warpfield->getNodesLen() > 0)
                     {
-                        std::vector<int> indices(warpfield->k);
-                        std::vector<float> dists(warpfield->k);
                         warpfield->findNeighbours(volPt, indices, dists);
 
                         voxel.n = 0;
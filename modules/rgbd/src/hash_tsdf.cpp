@@ -24,6 +24,38 @@ namespace cv
 namespace kinfu
 {
 
+void VolumeUnitIndexes::clear()
+{
+    units.clear();
+    slots.assign(VOLUMES_SIZE, -1);
+}
+
+void VolumeUnitIndexes::rehash(size_t capacity)
+{
+    slots.assign(capacity, -1);
+    for (size_t i = 0; i < units.size(); i++)
+        slots[findSlot(units[i].coord)] = (int)i;
+}
+
+VolumeUnit& VolumeUnitIndexes::emplace(const Vec3i& coord, bool& inserted)
+{
+    size_t slot = findSlot(coord);
+    inserted = slots[slot] < 0;
+    if (inserted)
+    {
+        // keep the load factor under 1/2 so that the probe sequences stay short
+        if (2 * (units.size() + 1) > slots.size())
+        {
+            rehash(slots.size() * 2);
+            slot = findSlot(coord);
+        }
+        slots[slot] = (int)units.size();
+        units.push_back(VolumeUnit());
+        units.back().coord = coord;
+    }
+    return units[slots[slot]];
+}
+
 HashTSDFVolume::HashTSDFVolume(float _voxelSize, cv::Matx44f _pose, float _raycastStepFactor,
     float _truncDist, int _maxWeight, float _truncateThreshold,
     int _volumeUnitRes, bool _zFirstMemOrder)
@@ -61,7 +93,7 @@ HashTSDFVolumeCPU::HashTSDFVolumeCPU(float _voxelSize, const Matx44f& _pose, flo
 }
 
 HashTSDFVolumeCPU::HashTSDFVolumeCPU(const VolumeParams& _params, bool _zFirstMemOrder)
-    : HashTSDFVolume(_params.voxelSize, _params.pose.matrix, _params.raycastStepFactor, _params.tsdfTruncDist, _params.maxWeight,
+    : HashTSDFVolumeCPU(_params.voxelSize, _params.pose.matrix, _params.raycastStepFactor, _params.tsdfTruncDist, _params.maxWeight,
            _params.depthTruncThreshold, _params.unitResolution, _zFirstMemOrder)
 {
 }
@@ -70,6 +102,10 @@ void HashTSDFVolumeCPU::reset()
 {
     CV_TRACE_FUNCTION();
     lastVolIndex = 0;
+    volumeUnits.clear();
+    integrateCount = 0;
+    unitMeshes.clear();
+    lastMeshedIndex = 0;
     volUnitsData = cv::Mat(VOLUMES_SIZE, volumeUnitResolution * volumeUnitResolution * volumeUnitResolution, rawType<TsdfVoxel>());
 }
 
@@ -79,6 +115,7 @@ void HashTSDFVolumeCPU::integrate(InputArray _depth, float depthFactor, const Ma
 
     CV_Assert(_depth.type() == DEPTH_TYPE);
     Depth depth = _depth.getMat();
+    integrateCount++;
 
     //! Compute volumes to be allocated
     const int depthStride = int(log2(volumeUnitResolution));
@@ -86,7 +123,7 @@ void HashTSDFVolumeCPU::integrate(InputArray _depth, float depthFactor, const Ma
     const Intr::Reprojector reproj(intrinsics.makeReprojector());
     const Affine3f cam2vol(pose.inv() * Affine3f(cameraPose));
     const Point3f truncPt(truncDist, truncDist, truncDist);
-    VolumeUnitIndexSet newIndices;
+    std::vector<int> newIndices;
     Mutex mutex;
     Range allocateRange(0, depth.rows);
 
@@ -123,12 +160,13 @@ void HashTSDFVolumeCPU::integrate(InputArray _depth, float depthFactor, const Ma
         mutex.lock();
         for (const auto& tsdf_idx : localAccessVolUnits)
         {
-            //! If the insert into the global set passes
-            if (!this->volumeUnits.count(tsdf_idx))
+            //! If the insert into the global table passes
+            bool inserted;
+            this->volumeUnits.emplace(tsdf_idx, inserted);
+            if (inserted)
             {
                 // Volume allocation can be performed outside of the lock
-                this->volumeUnits.emplace(tsdf_idx, VolumeUnit());
-                newIndices.emplace(tsdf_idx);
+                newIndices.push_back((int)this->volumeUnits.size() - 1);
             }
         }
         mutex.unlock();
@@ -136,10 +174,10 @@ void HashTSDFVolumeCPU::integrate(InputArray _depth, float depthFactor, const Ma
     parallel_for_(allocateRange, AllocateVolumeUnitsInvoker);
 
     //! Perform the allocation
-    for (auto idx : newIndices)
+    for (int idx : newIndices)
     {
         VolumeUnit& vu = volumeUnits[idx];
-        Matx44f subvolumePose = pose.translate(volumeUnitIdxToVolume(idx)).matrix;
+        Matx44f subvolumePose = pose.translate(volumeUnitIdxToVolume(vu.coord)).matrix;
 
         vu.pose = subvolumePose;
         vu.index = lastVolIndex; lastVolIndex++;
@@ -157,13 +195,6 @@ void HashTSDFVolumeCPU::integrate(InputArray _depth, float depthFactor, const Ma
         vu.isActive = true;
     }
 
-    //! Get keys for all the allocated volume Units
-    std::vector<Vec3i> totalVolUnits;
-    for (const auto& keyvalue : volumeUnits)
-    {
-        totalVolUnits.push_back(keyvalue.first);
-    }
-
     //! Mark volumes in the camera frustum as active
     Range inFrustumRange(0, (int)volumeUnits.size());
     parallel_for_(inFrustumRange, [&](const Range& range) {
@@ -172,24 +203,20 @@ void HashTSDFVolumeCPU::integrate(InputArray _depth, float depthFactor, const Ma
 
         for (int i = range.start; i < range.end; ++i)
         {
-            Vec3i tsdf_idx = totalVolUnits[i];
-            VolumeUnitIndexes::iterator it = volumeUnits.find(tsdf_idx);
-            if (it == volumeUnits.end())
-                return;
+            VolumeUnit& volumeUnit = volumeUnits[i];
 
-            Point3f volumeUnitPos = volumeUnitIdxToVolume(it->first);
+            Point3f volumeUnitPos = volumeUnitIdxToVolume(volumeUnit.coord);
             Point3f volUnitInCamSpace = vol2cam * volumeUnitPos;
             if (volUnitInCamSpace.z < 0 || volUnitInCamSpace.z > truncateThreshold)
             {
-                it->second.isActive = false;
-                return;
+                volumeUnit.isActive = false;
+                continue;
             }
             Point2f cameraPoint = proj(volUnitInCamSpace);
             if (cameraPoint.x >= 0 && cameraPoint.y >= 0 && cameraPoint.x < depth.cols && cameraPoint.y < depth.rows)
             {
-                assert(it != volumeUnits.end());
-                it->second.lastVisibleIndex = frameId;
-                it->second.isActive         = true;
+                volumeUnit.lastVisibleIndex = frameId;
+                volumeUnit.isActive         = true;
             }
         }
         });
@@ -204,21 +231,17 @@ void HashTSDFVolumeCPU::integrate(InputArray _depth, float depthFactor, const Ma
     }
 
     //! Integrate the correct volumeUnits
-    parallel_for_(Range(0, (int)totalVolUnits.size()), [&](const Range& range) {
+    parallel_for_(Range(0, (int)volumeUnits.size()), [&](const Range& range) {
         for (int i = range.start; i < range.end; i++)
         {
-            Vec3i tsdf_idx = totalVolUnits[i];
-            VolumeUnitIndexes::iterator it = volumeUnits.find(tsdf_idx);
-            if (it == volumeUnits.end())
-                return;
-
-            VolumeUnit& volumeUnit = it->second;
+            VolumeUnit& volumeUnit = volumeUnits[i];
             if (volumeUnit.isActive)
             {
                 //! The volume unit should already be added into the Volume from the allocator
                 integrateVolumeUnit(truncDist, voxelSize, maxWeight, volumeUnit.pose,
                     Point3i(volumeUnitResolution, volumeUnitResolution, volumeUnitResolution), volStrides, depth,
                     depthFactor, cameraPose, intrinsics, pixNorms, volUnitsData.row(volumeUnit.index));
+                volumeUnit.lastIntegratedIndex = integrateCount;
 
                 //! Ensure all active volumeUnits are set to inactive for next integration
                 volumeUnit.isActive = false;
@@ -276,9 +299,9 @@ inline TsdfVoxel HashTSDFVolumeCPU::at(const cv::Vec3i& volumeIdx) const
                                 cvFloor(volumeIdx[1] / volumeUnitResolution),
                                 cvFloor(volumeIdx[2] / volumeUnitResolution));
 
-    VolumeUnitIndexes::const_iterator it = volumeUnits.find(volumeUnitIdx);
+    const VolumeUnit* unit = volumeUnits.find(volumeUnitIdx);
 
-    if (it == volumeUnits.end())
+    if (!unit)
     {
         TsdfVoxel dummy;
         dummy.tsdf = floatToTsdf(1.f);
@@ -292,16 +315,16 @@ inline TsdfVoxel HashTSDFVolumeCPU::at(const cv::Vec3i& volumeIdx) const
 
     volUnitLocalIdx =
         cv::Vec3i(abs(volUnitLocalIdx[0]), abs(volUnitLocalIdx[1]), abs(volUnitLocalIdx[2]));
-    return _at(volUnitLocalIdx, it->second.index);
+    return _at(volUnitLocalIdx, unit->index);
 
 }
 
 TsdfVoxel HashTSDFVolumeCPU::at(const Point3f& point) const
 {
-    cv::Vec3i volumeUnitIdx          = volumeToVolumeUnitIdx(point);
-    VolumeUnitIndexes::const_iterator it = volumeUnits.find(volumeUnitIdx);
+    cv::Vec3i volumeUnitIdx  = volumeToVolumeUnitIdx(point);
+    const VolumeUnit* unit   = volumeUnits.find(volumeUnitIdx);
 
-    if (it == volumeUnits.end())
+    if (!unit)
     {
         TsdfVoxel dummy;
         dummy.tsdf = floatToTsdf(1.f);
@@ -313,7 +336,7 @@ TsdfVoxel HashTSDFVolumeCPU::at(const Point3f& point) const
     cv::Vec3i volUnitLocalIdx = volumeToVoxelCoord(point - volumeUnitPos);
     volUnitLocalIdx =
         cv::Vec3i(abs(volUnitLocalIdx[0]), abs(volUnitLocalIdx[1]), abs(volUnitLocalIdx[2]));
-    return _at(volUnitLocalIdx, it->second.index);
+    return _at(volUnitLocalIdx, unit->index);
 }
 
 static inline Vec3i voxelToVolumeUnitIdx(const Vec3i& pt, const int vuRes)
@@ -332,9 +355,9 @@ static inline Vec3i voxelToVolumeUnitIdx(const Vec3i& pt, const int vuRes)
     }
 }
 
-TsdfVoxel HashTSDFVolumeCPU::atVolumeUnit(const Vec3i& point, const Vec3i& volumeUnitIdx, VolumeUnitIndexes::const_iterator it) const
+TsdfVoxel HashTSDFVolumeCPU::atVolumeUnit(const Vec3i& point, const Vec3i& volumeUnitIdx, const VolumeUnit* unit) const
 {
-    if (it == volumeUnits.end())
+    if (!unit)
     {
         TsdfVoxel dummy;
         dummy.tsdf = floatToTsdf(1.f);
@@ -344,7 +367,7 @@ TsdfVoxel HashTSDFVolumeCPU::atVolumeUnit(const Vec3i& point, const Vec3i& volum
     Vec3i volUnitLocalIdx = point - volumeUnitIdx * volumeUnitResolution;
 
     // expanding at(), removing bounds check
-    const TsdfVoxel* volData = volUnitsData.ptr<TsdfVoxel>(it->second.index);
+    const TsdfVoxel* volData = volUnitsData.ptr<TsdfVoxel>(unit->index);
     int coordBase = volUnitLocalIdx[0] * volStrides[0] + volUnitLocalIdx[1] * volStrides[1] + volUnitLocalIdx[2] * volStrides[2];
     return volData[coordBase];
 }
@@ -392,10 +415,10 @@ float HashTSDFVolumeCPU::interpolateVoxelPoint(const Point3f& point) const
 
     // A small hash table to reduce a number of find() calls
     bool queried[8];
-    VolumeUnitIndexes::const_iterator iterMap[8];
+    const VolumeUnit* unitMap[8];
     for (int i = 0; i < 8; i++)
     {
-        iterMap[i] = volumeUnits.end();
+        unitMap[i] = nullptr;
         queried[i] = false;
     }
 
@@ -415,15 +438,15 @@ float HashTSDFVolumeCPU::interpolateVoxelPoint(const Point3f& point) const
 
         Vec3i volumeUnitIdx = voxelToVolumeUnitIdx(pt, volumeUnitResolution);
         int dictIdx = (volumeUnitIdx[0] & 1) + (volumeUnitIdx[1] & 1) * 2 + (volumeUnitIdx[2] & 1) * 4;
-        auto it = iterMap[dictIdx];
+        const VolumeUnit* unit = unitMap[dictIdx];
         if (!queried[dictIdx])
         {
-            it = volumeUnits.find(volumeUnitIdx);
-            iterMap[dictIdx] = it;
+            unit = volumeUnits.find(volumeUnitIdx);
+            unitMap[dictIdx] = unit;
             queried[dictIdx] = true;
         }
 
-        vx[i] = atVolumeUnit(pt, volumeUnitIdx, it).tsdf;
+        vx[i] = atVolumeUnit(pt, volumeUnitIdx, unit).tsdf;
     }
 
     return interpolate(tx, ty, tz, vx);
@@ -444,10 +467,10 @@ Point3f HashTSDFVolumeCPU::getNormalVoxel(const Point3f &point) const
 
     // A small hash table to reduce a number of find() calls
     bool queried[8];
-    VolumeUnitIndexes::const_iterator iterMap[8];
+    const VolumeUnit* unitMap[8];
     for (int i = 0; i < 8; i++)
     {
-        iterMap[i] = volumeUnits.end();
+        unitMap[i] = nullptr;
         queried[i] = false;
     }
 
@@ -478,15 +501,15 @@ Point3f HashTSDFVolumeCPU::getNormalVoxel(const Point3f &point) const
         Vec3i volumeUnitIdx = voxelToVolumeUnitIdx(pt, volumeUnitResolution);
 
         int dictIdx = (volumeUnitIdx[0] & 1) + (volumeUnitIdx[1] & 1) * 2 + (volumeUnitIdx[2] & 1) * 4;
-        auto it = iterMap[dictIdx];
+        const VolumeUnit* unit = unitMap[dictIdx];
         if (!queried[dictIdx])
         {
-            it = volumeUnits.find(volumeUnitIdx);
-            iterMap[dictIdx] = it;
+            unit = volumeUnits.find(volumeUnitIdx);
+            unitMap[dictIdx] = unit;
             queried[dictIdx] = true;
         }
 
-        vals[i] = tsdfToFloat(atVolumeUnit(pt, volumeUnitIdx, it).tsdf);
+        vals[i] = tsdfToFloat(atVolumeUnit(pt, volumeUnitIdx, unit).tsdf);
     }
 
 #if !USE_INTERPOLATION_IN_GETNORMAL
@@ -621,10 +644,8 @@ void HashTSDFVolumeCPU::raycast(const Matx44f& cameraPose, const kinfu::Intr& in
                 float tmax = volume.truncateThreshold;
                 float tcurr = tmin;
 
-                cv::Vec3i prevVolumeUnitIdx =
-                    cv::Vec3i(std::numeric_limits<int>::min(), std::numeric_limits<int>::min(),
-                        std::numeric_limits<int>::min());
-
+                //! Consecutive steps of a ray mostly stay in the same volume unit
+                VolumeUnitCache unitCache;
 
                 float tprev = tcurr;
                 float prevTsdf = volume.truncDist;
@@ -635,7 +656,7 @@ void HashTSDFVolumeCPU::raycast(const Matx44f& cameraPose, const kinfu::Intr& in
                     cv::Vec3i currVolumeUnitIdx = volume.volumeToVolumeUnitIdx(currRayPos);
 
 
-                    VolumeUnitIndexes::const_iterator it = volume.volumeUnits.find(currVolumeUnitIdx);
+                    const VolumeUnit* unit = unitCache.find(volume.volumeUnits, currVolumeUnitIdx);
 
                     float currTsdf = prevTsdf;
                     int currWeight = 0;
@@ -644,7 +665,7 @@ void HashTSDFVolumeCPU::raycast(const Matx44f& cameraPose, const kinfu::Intr& in
 
 
                     //! The subvolume exists in hashtable
-                    if (it != volume.volumeUnits.end())
+                    if (unit)
                     {
                         cv::Point3f currVolUnitPos =
                             volume.volumeUnitIdxToVolume(currVolumeUnitIdx);
@@ -652,7 +673,7 @@ void HashTSDFVolumeCPU::raycast(const Matx44f& cameraPose, const kinfu::Intr& in
 
 
                         //! TODO: Figure out voxel interpolation
-                        TsdfVoxel currVoxel = _at(volUnitLocalIdx, it->second.index);
+                        TsdfVoxel currVoxel = _at(volUnitLocalIdx, unit->index);
                         currTsdf = tsdfToFloat(currVoxel.tsdf);
                         currWeight = currVoxel.weight;
                         stepSize = tstep;
@@ -674,7 +695,6 @@ void HashTSDFVolumeCPU::raycast(const Matx44f& cameraPose, const kinfu::Intr& in
                         }
                         break;
                     }
-                    prevVolumeUnitIdx = currVolumeUnitIdx;
                     prevTsdf = currTsdf;
                     tprev = tcurr;
                     tcurr += stepSize;
@@ -696,12 +716,7 @@ void HashTSDFVolumeCPU::fetchPointsNormals(OutputArray _points, OutputArray _nor
     {
         std::vector<std::vector<ptype>> pVecs, nVecs;
 
-        std::vector<Vec3i> totalVolUnits;
-        for (const auto& keyvalue : volumeUnits)
-        {
-            totalVolUnits.push_back(keyvalue.first);
-        }
-        Range fetchRange(0, (int)totalVolUnits.size());
+        Range fetchRange(0, (int)volumeUnits.size());
         const int nstripes = -1;
 
         const HashTSDFVolumeCPU& volume(*this);
@@ -716,38 +731,32 @@ void HashTSDFVolumeCPU::fetchPointsNormals(OutputArray _points, OutputArray _nor
             std::vector<ptype> points, normals;
             for (int i = range.start; i < range.end; i++)
             {
-                cv::Vec3i tsdf_idx = totalVolUnits[i];
-
+                const VolumeUnit& volumeUnit = volume.volumeUnits[i];
+                Point3f base_point = volume.volumeUnitIdxToVolume(volumeUnit.coord);
+                std::vector<ptype> localPoints;
+                std::vector<ptype> localNormals;
+                for (int x = 0; x < volume.volumeUnitResolution; x++)
+                    for (int y = 0; y < volume.volumeUnitResolution; y++)
+                        for (int z = 0; z < volume.volumeUnitResolution; z++)
+                        {
+                            cv::Vec3i voxelIdx(x, y, z);
+                            TsdfVoxel voxel = _at(voxelIdx, volumeUnit.index);
 
-                VolumeUnitIndexes::const_iterator it = volume.volumeUnits.find(tsdf_idx);
-                Point3f base_point = volume.volumeUnitIdxToVolume(tsdf_idx);
-                if (it != volume.volumeUnits.end())
-                {
-                    std::vector<ptype> localPoints;
-                    std::vector<ptype> localNormals;
-                    for (int x = 0; x < volume.volumeUnitResolution; x++)
-                        for (int y = 0; y < volume.volumeUnitResolution; y++)
-                            for (int z = 0; z < volume.volumeUnitResolution; z++)
+                            if (voxel.tsdf != -128 && voxel.weight != 0)
                             {
-                                cv::Vec3i voxelIdx(x, y, z);
-                                TsdfVoxel voxel = _at(voxelIdx, it->second.index);
-
-                                if (voxel.tsdf != -128 && voxel.weight != 0)
+                                Point3f point = base_point + volume.voxelCoordToVolume(voxelIdx);
+                                localPoints.push_back(toPtype(point));
+                                if (needNormals)
                                 {
-                                    Point3f point = base_point + volume.voxelCoordToVolume(voxelIdx);
-                                    localPoints.push_back(toPtype(point));
-                                    if (needNormals)
-                                    {
-                                        Point3f normal = volume.getNormalVoxel(point);
-                                        localNormals.push_back(toPtype(normal));
-                                    }
+                                    Point3f normal = volume.getNormalVoxel(point);
+                                    localNormals.push_back(toPtype(normal));
                                 }
                             }
+                        }
 
-                    AutoLock al(mutex);
-                    pVecs.push_back(localPoints);
-                    nVecs.push_back(localNormals);
-                }
+                AutoLock al(mutex);
+                pVecs.push_back(localPoints);
+                nVecs.push_back(localNormals);
             }
         };
 
@@ -804,13 +813,85 @@ void HashTSDFVolumeCPU::fetchNormals(InputArray _points, OutputArray _normals) c
     }
 }
 
+void HashTSDFVolumeCPU::fetchMesh(OutputArray _vertices, OutputArray _triangles) const
+{
+    CV_TRACE_FUNCTION();
+
+    AutoLock al(meshMutex);
+
+    //! The cubes of a unit reach into its neighbours at +1 in each axis,
+    //! so a unit is remeshed if it or one of these neighbours was integrated since the last call
+    auto neighbourUnit = [&](const VolumeUnit& volumeUnit, int n)
+    {
+        return volumeUnits.find(volumeUnit.coord + Vec3i(n >> 2, (n >> 1) & 1, n & 1));
+    };
+
+    const size_t numMeshedUnits = unitMeshes.size();
+    unitMeshes.resize(volumeUnits.size());
+    std::vector<int> dirtyUnits;
+    for (size_t i = 0; i < volumeUnits.size(); i++)
+    {
+        bool dirty = i >= numMeshedUnits;
+        for (int n = 0; n < 8 && !dirty; n++)
+        {
+            const VolumeUnit* neighbour = neighbourUnit(volumeUnits[i], n);
+            dirty = neighbour && neighbour->lastIntegratedIndex > lastMeshedIndex;
+        }
+        if (dirty)
+            dirtyUnits.push_back((int)i);
+    }
+
+    parallel_for_(Range(0, (int)dirtyUnits.size()), [&](const Range& range)
+    {
+        const int res = volumeUnitResolution;
+        const int side = res + 1;
+        std::vector<TsdfVoxel> block(side * side * side);
+        TsdfVoxel empty;
+        empty.tsdf = floatToTsdf(1.f);
+        empty.weight = 0;
+
+        for (int i = range.start; i < range.end; i++)
+        {
+            const VolumeUnit& volumeUnit = volumeUnits[dirtyUnits[i]];
+            const TsdfVoxel* unitData[8];
+            for (int n = 0; n < 8; n++)
+            {
+                const VolumeUnit* neighbour = neighbourUnit(volumeUnit, n);
+                unitData[n] = neighbour ? volUnitsData.ptr<TsdfVoxel>(neighbour->index) : nullptr;
+            }
+
+            //! Gather the voxels of the unit and the first layer of its neighbours
+            TsdfVoxel* dst = block.data();
+            for (int x = 0; x < side; x++)
+                for (int y = 0; y < side; y++)
+                    for (int z = 0; z < side; z++)
+                    {
+                        const int n = (x == res) << 2 | (y == res) << 1 | (z == res);
+                        *dst++ = unitData[n] ? unitData[n][(x % res) * volStrides[0] + (y % res) * volStrides[1] +
+                                                           (z % res) * volStrides[2]]
+                                             : empty;
+                    }
+
+            MeshChunk& mesh = unitMeshes[dirtyUnits[i]];
+            mesh.clear();
+            marchCubes(block.data(), Vec3i::all(side), volumeUnit.coord * res,
+                       volumeUnitIdxToVolume(volumeUnit.coord), voxelSize, mesh);
+        }
+    });
+    lastMeshedIndex = integrateCount;
+
+    std::vector<const MeshChunk*> chunks;
+    for (const MeshChunk& mesh : unitMeshes)
+        chunks.push_back(&mesh);
+    mergeMeshChunks(chunks, pose, _vertices, _triangles);
+}
+
 int HashTSDFVolumeCPU::getVisibleBlocks(int currFrameId, int frameThreshold) const
 {
     int numVisibleBlocks = 0;
     //! TODO: Iterate over map parallely?
-    for (const auto& keyvalue : volumeUnits)
+    for (const VolumeUnit& volumeUnit : volumeUnits)
     {
-        const VolumeUnit& volumeUnit = keyvalue.second;
         if (volumeUnit.lastVisibleIndex > (currFrameId - frameThreshold))
             numVisibleBlocks++;
     }
@@ -6,7 +6,7 @@
 #define __OPENCV_HASH_TSDF_H__
 
 #include <opencv2/rgbd/volume.hpp>
-#include <unordered_map>
+#include <limits>
 #include <unordered_set>
 
 #include "tsdf_functions.hpp"
@@ -57,11 +57,82 @@ struct VolumeUnit
     VolumeIndex index;
     cv::Matx44f pose;
     int lastVisibleIndex = 0;
+    //! Integration counter value when the unit was updated last, see HashTSDFVolumeCPU::fetchMesh
+    int lastIntegratedIndex = 0;
     bool isActive;
 };
 
 typedef std::unordered_set<cv::Vec3i, tsdf_hash> VolumeUnitIndexSet;
-typedef std::unordered_map<cv::Vec3i, VolumeUnit, tsdf_hash> VolumeUnitIndexes;
+
+//! Open addressing hash table of the volume units
+/** The units are stored contiguously in insertion order and the table keeps only their
+ *  positions, probed linearly. Units are never removed except by clear(), so pointers
+ *  to them stay valid until the next insertion.
+ */
+class VolumeUnitIndexes
+{
+public:
+    VolumeUnitIndexes() { clear(); }
+
+    //! Returns the unit with the given coordinates or nullptr if there is none
+    const VolumeUnit* find(const Vec3i& coord) const
+    {
+        const int idx = slots[findSlot(coord)];
+        return idx < 0 ? nullptr : &units[idx];
+    }
+    VolumeUnit* find(const Vec3i& coord)
+    {
+        const int idx = slots[findSlot(coord)];
+        return idx < 0 ? nullptr : &units[idx];
+    }
+
+    //! Returns the unit with the given coordinates, adding a default one if there is none
+    VolumeUnit& emplace(const Vec3i& coord, bool& inserted);
+
+    void clear();
+    size_t size() const { return units.size(); }
+
+    VolumeUnit& operator[](size_t i) { return units[i]; }
+    const VolumeUnit& operator[](size_t i) const { return units[i]; }
+
+    std::vector<VolumeUnit>::const_iterator begin() const { return units.begin(); }
+    std::vector<VolumeUnit>::const_iterator end() const { return units.end(); }
+
+private:
+    size_t findSlot(const Vec3i& coord) const
+    {
+        const size_t mask = slots.size() - 1;
+        // Fibonacci hashing spreads the bits of the combined hash over the table
+        size_t slot = size_t((uint64(tsdf_hash()(coord)) * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+        while (slots[slot] >= 0 && units[slots[slot]].coord != coord)
+            slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    void rehash(size_t capacity);
+
+    std::vector<VolumeUnit> units;
+    std::vector<int> slots;
+};
+
+//! Remembers the last volume unit found, since consecutive lookups mostly hit the same one
+struct VolumeUnitCache
+{
+    VolumeUnitCache() : coord(Vec3i::all(std::numeric_limits<int>::min())), unit(nullptr) {}
+
+    const VolumeUnit* find(const VolumeUnitIndexes& volumeUnits, const Vec3i& _coord)
+    {
+        if (_coord != coord)
+        {
+            coord = _coord;
+            unit = volumeUnits.find(_coord);
+        }
+        return unit;
+    }
+
+    Vec3i coord;
+    const VolumeUnit* unit;
+};
 
 class HashTSDFVolumeCPU : public HashTSDFVolume
 {
@@ -79,6 +150,7 @@ class HashTSDFVolumeCPU : public HashTSDFVolume
 
     void fetchNormals(InputArray points, OutputArray _normals) const override;
     void fetchPointsNormals(OutputArray points, OutputArray normals) const override;
+    void fetchMesh(OutputArray vertices, OutputArray triangles) const override;
 
     void reset() override;
     size_t getTotalVolumeUnits() const { return volumeUnits.size(); }
@@ -92,7 +164,7 @@ class HashTSDFVolumeCPU : public HashTSDFVolume
     virtual TsdfVoxel at(const cv::Point3f& point) const;
     virtual TsdfVoxel _at(const cv::Vec3i& volumeIdx, VolumeIndex indx) const;
 
-    TsdfVoxel atVolumeUnit(const Vec3i& point, const Vec3i& volumeUnitIdx, VolumeUnitIndexes::const_iterator it) const;
+    TsdfVoxel atVolumeUnit(const Vec3i& point, const Vec3i& volumeUnitIdx, const VolumeUnit* unit) const;
 
 
     float interpolateVoxelPoint(const Point3f& point) const;
@@ -113,6 +185,13 @@ class HashTSDFVolumeCPU : public HashTSDFVolume
        VolumeUnitIndexes volumeUnits;
        cv::Mat volUnitsData;
        VolumeIndex lastVolIndex;
+       //! Number of integrate() calls, frame ids can't tell the updated units since KinFu doesn't pass them
+       int integrateCount;
+
+       //! Meshes of the volume units as of the last fetchMesh() call
+       mutable std::vector<MeshChunk> unitMeshes;
+       mutable int lastMeshedIndex;
+       mutable Mutex meshMutex;
 };
 
 template<typename T>
@@ -5,6 +5,11 @@
 // This code is also subject to the license terms in the LICENSE_KinectFusion.md file found in this
 // module's directory
 
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
 #include "fast_icp.hpp"
 #include "hash_tsdf.hpp"
 #include "kinfu_frame.hpp"
@@ -66,6 +71,8 @@ Ptr<Params> Params::defaultParams()
     p.tsdf_min_camera_movement = 0.f;              // meters, disabled
     p.lightPose                = Vec3f::all(0.f);  // meters
 
+    p.pipelined = false;
+
     return makePtr<Params>(p);
 }
 
@@ -127,6 +134,49 @@ class LargeKinfuImpl : public LargeKinfu
     bool updateT(const MatType& depth);
 
    private:
+    typedef typename SubmapManager<MatType>::Type SubmapType;
+
+    //! Model prediction of a submap, tracked against the new frames
+    struct TrackingTarget
+    {
+        int id;
+        SubmapType type;
+        //! Points and normals raycast from the submap at cameraPose
+        std::vector<MatType> pyrPoints;
+        std::vector<MatType> pyrNormals;
+        Affine3f cameraPose;
+    };
+
+    //! Everything the integration needs from a tracked frame
+    struct IntegrationJob
+    {
+        int frameId;
+        MatType depth;
+        std::vector<MatType> framePoints;
+        std::vector<MatType> frameNormals;
+        //! Successfully tracked submaps, their new camera pose and whether the camera moved enough
+        //! to integrate the frame. The submap types are checked again when the job runs, since the
+        //! previous job may have changed them.
+        std::vector<int> submapIds;
+        std::vector<Affine3f> cameraPoses;
+        std::vector<bool> cameraMoved;
+    };
+
+    Ptr<IntegrationJob> track(int frameId, const MatType& depth, const std::vector<MatType>& newPoints,
+                              const std::vector<MatType>& newNormals,
+                              const std::vector<TrackingTarget>& targets) const;
+    //! Integrates and raycasts the tracked submaps, then updates the submaps, returns true if the map changed
+    bool integrate(const IntegrationJob& job);
+    std::vector<TrackingTarget> getTrackingTargets() const;
+
+    void integrationLoop();
+    void optimizationLoop();
+    //! Waits until the worker threads are idle, the model can then be read safely
+    void waitIdle() const;
+    //! Same as waitIdle() and applies a pending optimized pose graph
+    void waitPipeline();
+    void stopPipeline();
+
     Params params;
 
     cv::Ptr<ICP> icp;
@@ -135,31 +185,193 @@ class LargeKinfuImpl : public LargeKinfu
 
     int frameCounter;
     Affine3f pose;
+
+    //! Pipelined mode, see Params::pipelined. The submap manager belongs to the integration
+    //! thread while it runs, the tracking only reads the published targets.
+    mutable std::mutex pipelineMutex;
+    mutable std::condition_variable pipelineCond;
+    std::thread integrationThread;
+    std::thread optimizationThread;
+    bool stopRequested;
+    bool integrating;
+    bool optimizing;
+    //! Incremented by reset(), the workers drop the results of the work taken before
+    int generation;
+    Ptr<IntegrationJob> pendingJob;
+    Ptr<PoseGraph> pendingPoseGraph;
+    Ptr<PoseGraph> optimizedPoseGraph;
+    std::vector<TrackingTarget> trackingTargets;
+    std::exception_ptr pipelineError;
 };
 
 template<typename MatType>
 LargeKinfuImpl<MatType>::LargeKinfuImpl(const Params& _params)
-    : params(_params)
+    : params(_params), stopRequested(false), integrating(false), optimizing(false), generation(0)
 {
     icp = makeICP(params.intr, params.icpIterations, params.icpAngleThresh, params.icpDistThresh);
 
     submapMgr = cv::makePtr<SubmapManager<MatType>>(params.volumeParams);
     reset();
-    submapMgr->createNewSubmap(true);
 
+    if (params.pipelined)
+    {
+        integrationThread  = std::thread(&LargeKinfuImpl<MatType>::integrationLoop, this);
+        optimizationThread = std::thread(&LargeKinfuImpl<MatType>::optimizationLoop, this);
+    }
 }
 
 template<typename MatType>
 void LargeKinfuImpl<MatType>::reset()
 {
+    // the work in progress is not published anymore, the frames and graphs still waiting are
+    // dropped once it is done, a failed pipeline is usable again afterwards
+    std::unique_lock<std::mutex> lock(pipelineMutex);
+    generation++;
+    pipelineCond.wait(lock, [this] { return !integrating && !optimizing; });
+    pendingJob.release();
+    pendingPoseGraph.release();
+    optimizedPoseGraph.release();
+    pipelineError = nullptr;
+
     frameCounter = 0;
     pose         = Affine3f::Identity();
     submapMgr->reset();
+    submapMgr->createNewSubmap(true);
+    trackingTargets = getTrackingTargets();
 }
 
 template<typename MatType>
 LargeKinfuImpl<MatType>::~LargeKinfuImpl()
 {
+    stopPipeline();
+}
+
+template<typename MatType>
+void LargeKinfuImpl<MatType>::stopPipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        stopRequested = true;
+    }
+    pipelineCond.notify_all();
+    if (integrationThread.joinable())
+        integrationThread.join();
+    if (optimizationThread.joinable())
+        optimizationThread.join();
+}
+
+template<typename MatType>
+void LargeKinfuImpl<MatType>::waitIdle() const
+{
+    if (!params.pipelined)
+        return;
+
+    std::unique_lock<std::mutex> lock(pipelineMutex);
+    pipelineCond.wait(lock, [this] {
+        return pipelineError || (!pendingJob && !integrating && !pendingPoseGraph && !optimizing);
+    });
+    if (pipelineError)
+        std::rethrow_exception(pipelineError);
+}
+
+template<typename MatType>
+void LargeKinfuImpl<MatType>::waitPipeline()
+{
+    waitIdle();
+
+    // the workers are idle, the optimized poses can be applied right away
+    std::lock_guard<std::mutex> lock(pipelineMutex);
+    if (optimizedPoseGraph)
+    {
+        submapMgr->PoseGraphToMap(*optimizedPoseGraph);
+        optimizedPoseGraph.release();
+    }
+}
+
+template<typename MatType>
+void LargeKinfuImpl<MatType>::integrationLoop()
+{
+    for (;;)
+    {
+        Ptr<IntegrationJob> job;
+        Ptr<PoseGraph> optimized;
+        int jobGeneration;
+        {
+            std::unique_lock<std::mutex> lock(pipelineMutex);
+            pipelineCond.wait(lock, [this] { return stopRequested || pendingJob; });
+            if (stopRequested)
+                return;
+            std::swap(job, pendingJob);
+            std::swap(optimized, optimizedPoseGraph);
+            jobGeneration = generation;
+            integrating = true;
+        }
+
+        try
+        {
+            if (optimized)
+                submapMgr->PoseGraphToMap(*optimized);
+
+            bool isMapUpdated = integrate(*job);
+
+            Ptr<PoseGraph> poseGraph;
+            if (isMapUpdated)
+                poseGraph = makePtr<PoseGraph>(submapMgr->MapToPoseGraph());
+
+            std::lock_guard<std::mutex> lock(pipelineMutex);
+            if (jobGeneration == generation)
+            {
+                trackingTargets = getTrackingTargets();
+                // an older graph which is not being optimized yet is superseded
+                if (poseGraph)
+                    pendingPoseGraph = poseGraph;
+            }
+            integrating = false;
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(pipelineMutex);
+            pipelineError = std::current_exception();
+            integrating = false;
+        }
+        pipelineCond.notify_all();
+    }
+}
+
+template<typename MatType>
+void LargeKinfuImpl<MatType>::optimizationLoop()
+{
+    for (;;)
+    {
+        Ptr<PoseGraph> poseGraph;
+        int graphGeneration;
+        {
+            std::unique_lock<std::mutex> lock(pipelineMutex);
+            pipelineCond.wait(lock, [this] { return stopRequested || pendingPoseGraph; });
+            if (stopRequested)
+                return;
+            std::swap(poseGraph, pendingPoseGraph);
+            graphGeneration = generation;
+            optimizing = true;
+        }
+
+        try
+        {
+            Optimizer::optimize(*poseGraph);
+
+            std::lock_guard<std::mutex> lock(pipelineMutex);
+            if (graphGeneration == generation)
+                optimizedPoseGraph = poseGraph;
+            optimizing = false;
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(pipelineMutex);
+            pipelineError = std::current_exception();
+            optimizing = false;
+        }
+        pipelineCond.notify_all();
+    }
 }
 
 template<typename MatType>
@@ -171,7 +383,15 @@ const Params& LargeKinfuImpl<MatType>::getParams() const
 template<typename MatType>
 const Affine3f LargeKinfuImpl<MatType>::getPose() const
 {
-    return pose;
+    waitIdle();
+
+    std::lock_guard<std::mutex> lock(pipelineMutex);
+    Ptr<Submap<MatType>> currSubmap = submapMgr->getCurrentSubmap();
+    Affine3f submapPose = currSubmap->pose;
+    // poses optimized in the background reach the submaps with the next frame
+    if (optimizedPoseGraph && !optimizedPoseGraph->nodes.at(currSubmap->id).isPoseFixed())
+        submapPose = optimizedPoseGraph->nodes.at(currSubmap->id).getPose();
+    return submapPose * currSubmap->cameraPose;
 }
 
 template<>
@@ -209,81 +429,172 @@ bool LargeKinfuImpl<UMat>::update(InputArray _depth)
 }
 
 template<typename MatType>
-bool LargeKinfuImpl<MatType>::updateT(const MatType& _depth)
+std::vector<typename LargeKinfuImpl<MatType>::TrackingTarget> LargeKinfuImpl<MatType>::getTrackingTargets() const
 {
-    CV_TRACE_FUNCTION();
+    std::vector<TrackingTarget> targets;
+    for (const auto& it : submapMgr->activeSubmaps)
+    {
+        Ptr<Submap<MatType>> submap = submapMgr->getSubmap(it.first);
+        TrackingTarget target;
+        target.id         = it.first;
+        target.type       = it.second.type;
+        target.pyrPoints  = submap->pyrPoints;
+        target.pyrNormals = submap->pyrNormals;
+        target.cameraPose = submap->cameraPose;
+        targets.push_back(target);
+    }
+    return targets;
+}
 
-    MatType depth;
-    if (_depth.type() != DEPTH_TYPE)
-        _depth.convertTo(depth, DEPTH_TYPE);
-    else
-        depth = _depth;
+template<typename MatType>
+Ptr<typename LargeKinfuImpl<MatType>::IntegrationJob> LargeKinfuImpl<MatType>::track(
+    int frameId, const MatType& depth, const std::vector<MatType>& newPoints,
+    const std::vector<MatType>& newNormals, const std::vector<TrackingTarget>& targets) const
+{
+    CV_TRACE_FUNCTION();
 
-    std::vector<MatType> newPoints, newNormals;
-    makeFrameFromDepth(depth, newPoints, newNormals, params.intr, params.pyramidLevels, params.depthFactor,
-                       params.bilateral_sigma_depth, params.bilateral_sigma_spatial, params.bilateral_kernel_size,
-                       params.truncateThreshold);
+    Ptr<IntegrationJob> job = makePtr<IntegrationJob>();
+    job->frameId      = frameId;
+    job->depth        = depth;
+    job->framePoints  = newPoints;
+    job->frameNormals = newNormals;
 
-    std::cout << "Current frameID: " << frameCounter << "\n";
-    for (const auto& it : submapMgr->activeSubmaps)
+    for (const TrackingTarget& target : targets)
     {
-        int currTrackingId = it.first;
-        auto submapData = it.second;
-        Ptr<Submap<MatType>> currTrackingSubmap = submapMgr->getSubmap(currTrackingId);
-        Affine3f affine;
-        std::cout << "Current tracking ID: " << currTrackingId << std::endl;
+        std::cout << "Current tracking ID: " << target.id << std::endl;
 
-        if(frameCounter == 0) //! Only one current tracking map
+        if (frameId == 0)  //! Only one current tracking map
         {
-            currTrackingSubmap->integrate(depth, params.depthFactor, params.intr, frameCounter);
-            currTrackingSubmap->pyrPoints = newPoints;
-            currTrackingSubmap->pyrNormals = newNormals;
+            job->submapIds.push_back(target.id);
+            job->cameraPoses.push_back(target.cameraPose);
+            job->cameraMoved.push_back(true);
             continue;
         }
 
         //1. Track
-        bool trackingSuccess =
-            icp->estimateTransform(affine, currTrackingSubmap->pyrPoints, currTrackingSubmap->pyrNormals, newPoints, newNormals);
-        if (trackingSuccess)
-            currTrackingSubmap->composeCameraPose(affine);
-        else
+        Affine3f affine;
+        bool trackingSuccess = icp->estimateTransform(affine, target.pyrPoints, target.pyrNormals, newPoints, newNormals);
+        if (!trackingSuccess)
         {
             std::cout << "Tracking failed" << std::endl;
             continue;
         }
 
-        //2. Integrate
-        if(submapData.type == SubmapManager<MatType>::Type::NEW || submapData.type == SubmapManager<MatType>::Type::CURRENT)
+        // We do not integrate volume if camera does not move
+        float rnorm = (float)cv::norm(affine.rvec());
+        float tnorm = (float)cv::norm(affine.translation());
+
+        job->submapIds.push_back(target.id);
+        job->cameraPoses.push_back(target.cameraPose * affine);
+        job->cameraMoved.push_back((rnorm + tnorm) / 2 >= params.tsdf_min_camera_movement);
+    }
+    return job;
+}
+
+template<typename MatType>
+bool LargeKinfuImpl<MatType>::integrate(const IntegrationJob& job)
+{
+    CV_TRACE_FUNCTION();
+
+    for (size_t i = 0; i < job.submapIds.size(); i++)
+    {
+        int currTrackingId = job.submapIds[i];
+
+        // the previous job may have dropped the submap from the active ones or changed its type
+        auto active = submapMgr->activeSubmaps.find(currTrackingId);
+        if (active == submapMgr->activeSubmaps.end())
+            continue;
+        const SubmapType type = active->second.type;
+
+        Ptr<Submap<MatType>> currTrackingSubmap = submapMgr->getSubmap(currTrackingId);
+        currTrackingSubmap->cameraPose = job.cameraPoses[i];
+
+        if (job.frameId == 0)
         {
-            float rnorm = (float)cv::norm(affine.rvec());
-            float tnorm = (float)cv::norm(affine.translation());
-            // We do not integrate volume if camera does not move
-            if ((rnorm + tnorm) / 2 >= params.tsdf_min_camera_movement)
-                currTrackingSubmap->integrate(depth, params.depthFactor, params.intr, frameCounter);
+            currTrackingSubmap->integrate(job.depth, params.depthFactor, params.intr, job.frameId);
+            currTrackingSubmap->pyrPoints  = job.framePoints;
+            currTrackingSubmap->pyrNormals = job.frameNormals;
+            continue;
         }
 
-        //3. Raycast
-        currTrackingSubmap->raycast(currTrackingSubmap->cameraPose, params.intr, params.frameSize, currTrackingSubmap->pyrPoints[0], currTrackingSubmap->pyrNormals[0]);
+        //2. Integrate
+        if ((type == SubmapType::NEW || type == SubmapType::CURRENT) && job.cameraMoved[i])
+            currTrackingSubmap->integrate(job.depth, params.depthFactor, params.intr, job.frameId);
 
-        currTrackingSubmap->updatePyrPointsNormals(params.pyramidLevels);
+        //3. Raycast, into new buffers since the tracking may still use the previous ones
+        std::vector<MatType> pyrPoints(1), pyrNormals(1);
+        currTrackingSubmap->raycast(currTrackingSubmap->cameraPose, params.intr, params.frameSize, pyrPoints[0], pyrNormals[0]);
+        buildPyramidPointsNormals(pyrPoints[0], pyrNormals[0], pyrPoints, pyrNormals, params.pyramidLevels);
+        {
+            std::lock_guard<std::mutex> lock(pipelineMutex);
+            currTrackingSubmap->pyrPoints.swap(pyrPoints);
+            currTrackingSubmap->pyrNormals.swap(pyrNormals);
+        }
 
         std::cout << "Submap: " << currTrackingId << " Total allocated blocks: " << currTrackingSubmap->getTotalAllocatedBlocks() << "\n";
-        std::cout << "Submap: " << currTrackingId << " Visible blocks: " << currTrackingSubmap->getVisibleBlocks(frameCounter) << "\n";
-
+        std::cout << "Submap: " << currTrackingId << " Visible blocks: " << currTrackingSubmap->getVisibleBlocks(job.frameId) << "\n";
     }
+
     //4. Update map
-    bool isMapUpdated = submapMgr->updateMap(frameCounter, newPoints, newNormals);
+    bool isMapUpdated = submapMgr->updateMap(job.frameId, job.framePoints, job.frameNormals);
+    std::cout << "Number of submaps: " << submapMgr->submapList.size() << "\n";
+    return isMapUpdated;
+}
+
+template<typename MatType>
+bool LargeKinfuImpl<MatType>::updateT(const MatType& _depth)
+{
+    CV_TRACE_FUNCTION();
+
+    MatType depth;
+    if (_depth.type() != DEPTH_TYPE)
+        _depth.convertTo(depth, DEPTH_TYPE);
+    else if (params.pipelined)
+        _depth.copyTo(depth);  // the caller may reuse its buffer while the frame is integrated
+    else
+        depth = _depth;
+
+    std::vector<MatType> newPoints, newNormals;
+    makeFrameFromDepth(depth, newPoints, newNormals, params.intr, params.pyramidLevels, params.depthFactor,
+                       params.bilateral_sigma_depth, params.bilateral_sigma_spatial, params.bilateral_kernel_size,
+                       params.truncateThreshold);
+
+    std::cout << "Current frameID: " << frameCounter << "\n";
+    if (!params.pipelined)
+    {
+        Ptr<IntegrationJob> job = track(frameCounter, depth, newPoints, newNormals, getTrackingTargets());
+        bool isMapUpdated = integrate(*job);
+        if (isMapUpdated)
+        {
+            // TODO: Convert constraints to posegraph
+            PoseGraph poseGraph = submapMgr->MapToPoseGraph();
+            std::cout << "Created posegraph\n";
+            Optimizer::optimize(poseGraph);
+            submapMgr->PoseGraphToMap(poseGraph);
+        }
+        frameCounter++;
+        return true;
+    }
 
-    if(isMapUpdated)
+    std::vector<TrackingTarget> targets;
     {
-        // TODO: Convert constraints to posegraph
-        PoseGraph poseGraph = submapMgr->MapToPoseGraph();
-        std::cout << "Created posegraph\n";
-        Optimizer::optimize(poseGraph);
-        submapMgr->PoseGraphToMap(poseGraph);
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        if (pipelineError)
+            std::rethrow_exception(pipelineError);
+        targets = trackingTargets;
+    }
 
+    Ptr<IntegrationJob> job = track(frameCounter, depth, newPoints, newNormals, targets);
+    {
+        // a pending frame which is not being integrated yet is skipped
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        pendingJob = job;
     }
-    std::cout << "Number of submaps: " << submapMgr->submapList.size() << "\n";
+    pipelineCond.notify_all();
+
+    // the next frames need the prediction of the first one
+    if (frameCounter == 0)
+        waitPipeline();
 
     frameCounter++;
     return true;
@@ -296,6 +607,7 @@ void LargeKinfuImpl<MatType>::render(OutputArray image, const Matx44f& _cameraPo
 
     Affine3f cameraPose(_cameraPose);
 
+    waitIdle();
     auto currSubmap = submapMgr->getCurrentSubmap();
     const Affine3f id = Affine3f::Identity();
     if ((cameraPose.rotation() == pose.rotation() && cameraPose.translation() == pose.translation()) ||
@@ -315,6 +627,7 @@ void LargeKinfuImpl<MatType>::render(OutputArray image, const Matx44f& _cameraPo
 template<typename MatType>
 void LargeKinfuImpl<MatType>::getCloud(OutputArray p, OutputArray n) const
 {
+    waitIdle();
     auto currSubmap = submapMgr->getCurrentSubmap();
     currSubmap->volume.fetchPointsNormals(p, n);
 }
@@ -322,6 +635,7 @@ void LargeKinfuImpl<MatType>::getCloud(OutputArray p, OutputArray n) const
 template<typename MatType>
 void LargeKinfuImpl<MatType>::getPoints(OutputArray points) const
 {
+    waitIdle();
     auto currSubmap = submapMgr->getCurrentSubmap();
     currSubmap->volume.fetchPointsNormals(points, noArray());
 }
@@ -329,6 +643,7 @@ void LargeKinfuImpl<MatType>::getPoints(OutputArray points) const
 template<typename MatType>
 void LargeKinfuImpl<MatType>::getNormals(InputArray points, OutputArray normals) const
 {
+    waitIdle();
     auto currSubmap = submapMgr->getCurrentSubmap();
     currSubmap->volume.fetchNormals(points, normals);
 }
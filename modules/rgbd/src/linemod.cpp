@@ -5,6 +5,15 @@
 // This code is also subject to the license terms in the LICENSE_WillowGarage.md file found in this module's directory
 
 #include "precomp.hpp"
+#include "linemod_kernels.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define HAVE_LINEMOD_DB_MMAP
+#endif
 
 namespace cv
 {
@@ -913,55 +922,19 @@ void DepthNormal::write(FileStorage& fs) const
 *                                 Response maps                                          *
 \****************************************************************************************/
 
-static void orUnaligned8u(const uchar * src, const int src_stride,
+void orUnaligned8u(const uchar * src, const int src_stride,
                    uchar * dst, const int dst_stride,
-                   const int width, const int height)
+                   const int width, const int height, bool vectorize)
 {
-#if CV_SSE2
-  volatile bool haveSSE2 = checkHardwareSupport(CPU_SSE2);
-#if CV_SSE3
-  volatile bool haveSSE3 = checkHardwareSupport(CPU_SSE3);
-#endif
-  bool src_aligned = reinterpret_cast<unsigned long long>(src) % 16 == 0;
-#endif
-
+  CV_UNUSED(vectorize);
   for (int r = 0; r < height; ++r)
   {
     int c = 0;
 
-#if CV_SSE2
-    // Use aligned loads if possible
-    if (haveSSE2 && src_aligned)
-    {
-      for ( ; c < width - 15; c += 16)
-      {
-        const __m128i* src_ptr = reinterpret_cast<const __m128i*>(src + c);
-        __m128i* dst_ptr = reinterpret_cast<__m128i*>(dst + c);
-        *dst_ptr = _mm_or_si128(*dst_ptr, *src_ptr);
-      }
-    }
-#if CV_SSE3
-    // Use LDDQU for fast unaligned load
-    else if (haveSSE3)
-    {
-      for ( ; c < width - 15; c += 16)
-      {
-        __m128i val = _mm_lddqu_si128(reinterpret_cast<const __m128i*>(src + c));
-        __m128i* dst_ptr = reinterpret_cast<__m128i*>(dst + c);
-        *dst_ptr = _mm_or_si128(*dst_ptr, val);
-      }
-    }
-#endif
-    // Fall back to MOVDQU
-    else if (haveSSE2)
-    {
-      for ( ; c < width - 15; c += 16)
-      {
-        __m128i val = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + c));
-        __m128i* dst_ptr = reinterpret_cast<__m128i*>(dst + c);
-        *dst_ptr = _mm_or_si128(*dst_ptr, val);
-      }
-    }
+#if CV_SIMD
+    // dst rows are aligned, but src is shifted by the spreading offset
+    for ( ; vectorize && c <= width - v_uint8::nlanes; c += v_uint8::nlanes)
+      v_store(dst + c, vx_load(dst + c) | vx_load(src + c));
 #endif
     for ( ; c < width; ++c)
       dst[c] |= src[c];
@@ -1160,9 +1133,10 @@ static const unsigned char* accessLinearMemory(const std::vector<Mat>& linear_me
  * \param      size            Size (W, H) of the original input image.
  * \param      T               Sampling step.
  */
-static void similarity(const std::vector<Mat>& linear_memories, const Template& templ,
-                Mat& dst, Size size, int T)
+void similarity(const std::vector<Mat>& linear_memories, const Template& templ,
+                Mat& dst, Size size, int T, bool vectorize)
 {
+  CV_UNUSED(vectorize);
   // 63 features or less is a special case because the max similarity per-feature is 4.
   // 255/4 = 63, so up to that many we can add up similarities in 8 bits without worrying
   // about overflow. Therefore here we use _mm_add_epi8 as the workhorse, whereas a more
@@ -1190,16 +1164,10 @@ static void similarity(const std::vector<Mat>& linear_memories, const Template&
 
   /// @todo In old code, dst is buffer of size m_U. Could make it something like
   /// (span_x)x(span_y) instead?
-  dst = Mat::zeros(H, W, CV_8U);
+  dst.create(H, W, CV_8U);
+  dst.setTo(Scalar::all(0));
   uchar* dst_ptr = dst.ptr<uchar>();
 
-#if CV_SSE2
-  volatile bool haveSSE2 = checkHardwareSupport(CV_CPU_SSE2);
-#if CV_SSE3
-  volatile bool haveSSE3 = checkHardwareSupport(CV_CPU_SSE3);
-#endif
-#endif
-
   // Compute the similarity measure for this template by accumulating the contribution of
   // each feature
   for (int i = 0; i < (int)templ.features.size(); ++i)
@@ -1215,31 +1183,10 @@ static void similarity(const std::vector<Mat>& linear_memories, const Template&
 
     // Now we do an aligned/unaligned add of dst_ptr and lm_ptr with template_positions elements
     int j = 0;
-    // Process responses 16 at a time if vectorization possible
-#if CV_SSE2
-#if CV_SSE3
-    if (haveSSE3)
-    {
-      // LDDQU may be more efficient than MOVDQU for unaligned load of next 16 responses
-      for ( ; j < template_positions - 15; j += 16)
-      {
-        __m128i responses = _mm_lddqu_si128(reinterpret_cast<const __m128i*>(lm_ptr + j));
-        __m128i* dst_ptr_sse = reinterpret_cast<__m128i*>(dst_ptr + j);
-        *dst_ptr_sse = _mm_add_epi8(*dst_ptr_sse, responses);
-      }
-    }
-    else
-#endif
-    if (haveSSE2)
-    {
-      // Fall back to MOVDQU
-      for ( ; j < template_positions - 15; j += 16)
-      {
-        __m128i responses = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lm_ptr + j));
-        __m128i* dst_ptr_sse = reinterpret_cast<__m128i*>(dst_ptr + j);
-        *dst_ptr_sse = _mm_add_epi8(*dst_ptr_sse, responses);
-      }
-    }
+    // Process responses a whole vector register at a time if vectorization possible
+#if CV_SIMD
+    for ( ; vectorize && j <= template_positions - v_uint8::nlanes; j += v_uint8::nlanes)
+      v_store(dst_ptr + j, v_add_wrap(vx_load(dst_ptr + j), vx_load(lm_ptr + j)));
 #endif
     for ( ; j < template_positions; ++j)
       dst_ptr[j] = uchar(dst_ptr[j] + lm_ptr[j]);
@@ -1256,8 +1203,8 @@ static void similarity(const std::vector<Mat>& linear_memories, const Template&
  * \param      T               Sampling step.
  * \param      center          Center of the local region.
  */
-static void similarityLocal(const std::vector<Mat>& linear_memories, const Template& templ,
-                     Mat& dst, Size size, int T, Point center)
+void similarityLocal(const std::vector<Mat>& linear_memories, const Template& templ,
+                     Mat& dst, Size size, int T, Point center, bool vectorize)
 {
   // Similar to whole-image similarity() above. This version takes a position 'center'
   // and computes the energy in the 16x16 patch centered on it.
@@ -1265,7 +1212,8 @@ static void similarityLocal(const std::vector<Mat>& linear_memories, const Templ
 
   // Compute the similarity map in a 16x16 patch around center
   int W = size.width / T;
-  dst = Mat::zeros(16, 16, CV_8U);
+  dst.create(16, 16, CV_8U);
+  dst.setTo(Scalar::all(0));
 
   // Offset each feature point by the requested center. Further adjust to (-8,-8) from the
   // center to get the top-left corner of the 16x16 patch.
@@ -1273,14 +1221,6 @@ static void similarityLocal(const std::vector<Mat>& linear_memories, const Templ
   int offset_x = (center.x / T - 8) * T;
   int offset_y = (center.y / T - 8) * T;
 
-#if CV_SSE2
-  volatile bool haveSSE2 = checkHardwareSupport(CV_CPU_SSE2);
-#if CV_SSE3
-  volatile bool haveSSE3 = checkHardwareSupport(CV_CPU_SSE3);
-#endif
-  __m128i* dst_ptr_sse = dst.ptr<__m128i>();
-#endif
-
   for (int i = 0; i < (int)templ.features.size(); ++i)
   {
     Feature f = templ.features[i];
@@ -1292,58 +1232,48 @@ static void similarityLocal(const std::vector<Mat>& linear_memories, const Templ
 
     const uchar* lm_ptr = accessLinearMemory(linear_memories, f, T, W);
 
+    uchar* dst_ptr = dst.ptr<uchar>();
     // Process whole row at a time if vectorization possible
-#if CV_SSE2
-#if CV_SSE3
-    if (haveSSE3)
-    {
-      // LDDQU may be more efficient than MOVDQU for unaligned load of 16 responses from current row
-      for (int row = 0; row < 16; ++row)
-      {
-        __m128i aligned = _mm_lddqu_si128(reinterpret_cast<const __m128i*>(lm_ptr));
-        dst_ptr_sse[row] = _mm_add_epi8(dst_ptr_sse[row], aligned);
-        lm_ptr += W; // Step to next row
-      }
-    }
-    else
-#endif
-    if (haveSSE2)
+#if CV_SIMD128
+    if (vectorize)
     {
-      // Fall back to MOVDQU
       for (int row = 0; row < 16; ++row)
       {
-        __m128i aligned = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lm_ptr));
-        dst_ptr_sse[row] = _mm_add_epi8(dst_ptr_sse[row], aligned);
+        v_store_aligned(dst_ptr, v_add_wrap(v_load_aligned(dst_ptr), v_load(lm_ptr)));
+        dst_ptr += 16;
         lm_ptr += W; // Step to next row
       }
+      continue;
     }
-    else
+#else
+    CV_UNUSED(vectorize);
 #endif
+    for (int row = 0; row < 16; ++row)
     {
-      uchar* dst_ptr = dst.ptr<uchar>();
-      for (int row = 0; row < 16; ++row)
-      {
-        for (int col = 0; col < 16; ++col)
-          dst_ptr[col] = uchar(dst_ptr[col] + lm_ptr[col]);
-        dst_ptr += 16;
-        lm_ptr += W;
-      }
+      for (int col = 0; col < 16; ++col)
+        dst_ptr[col] = uchar(dst_ptr[col] + lm_ptr[col]);
+      dst_ptr += 16;
+      lm_ptr += W;
     }
   }
 }
 
-static void addUnaligned8u16u(const uchar * src1, const uchar * src2, ushort * res, int length)
+void addUnaligned8u16u(const uchar * src1, const uchar * src2, ushort * res, int length, bool vectorize)
 {
-  const uchar * end = src1 + length;
-
-  while (src1 != end)
+  CV_UNUSED(vectorize);
+  int i = 0;
+#if CV_SIMD
+  for ( ; vectorize && i <= length - v_uint8::nlanes; i += v_uint8::nlanes)
   {
-    *res = *src1 + *src2;
-
-    ++src1;
-    ++src2;
-    ++res;
+    v_uint16 a0, a1, b0, b1;
+    v_expand(vx_load(src1 + i), a0, a1);
+    v_expand(vx_load(src2 + i), b0, b1);
+    v_store(res + i, a0 + b0);
+    v_store(res + i + v_uint16::nlanes, a1 + b1);
   }
+#endif
+  for ( ; i < length; ++i)
+    res[i] = ushort(src1[i] + src2[i]);
 }
 
 /**
@@ -1362,6 +1292,7 @@ static void addSimilarities(const std::vector<Mat>& similarities, Mat& dst)
   {
     // NOTE: add() seems to be rather slow in the 8U + 8U -> 16U case
     dst.create(similarities[0].size(), CV_16U);
+    CV_DbgAssert(similarities[0].isContinuous() && similarities[1].isContinuous());
     addUnaligned8u16u(similarities[0].ptr(), similarities[1].ptr(), dst.ptr<ushort>(), static_cast<int>(dst.total()));
 
     /// @todo Optimize 16u + 8u -> 16u when more than 2 modalities
@@ -1370,11 +1301,217 @@ static void addSimilarities(const std::vector<Mat>& similarities, Mat& dst)
   }
 }
 
+/****************************************************************************************\
+*                               Binary template database                                 *
+\****************************************************************************************/
+
+// Database layout: the header, the modality names, the template pyramids of every class and
+// finally the class directory. All values are stored in native byte order.
+static const char LINEMOD_DB_MAGIC[8] = {'L', 'M', 'O', 'D', 'T', 'P', 'L', 'S'};
+static const uint LINEMOD_DB_VERSION = 1;
+static const uint LINEMOD_DB_BYTE_ORDER = 0x01020304;
+
+struct LinemodDatabaseHeader
+{
+  char magic[8];
+  uint version;
+  uint byteOrder;
+  int pyramidLevels;
+  uint numModalities;
+  uint numClasses;
+  uint reserved;
+  uint64 directoryOffset;
+  uint64 fileSize;
+};
+
+struct Detector::TemplateDatabase
+{
+  const uchar* data;
+  size_t size;
+
+  std::vector<uchar> fileData;
+  void* mappedData;
+  size_t mappedSize;
+
+  TemplateDatabase() : data(0), size(0), mappedData(0), mappedSize(0) {}
+
+  ~TemplateDatabase()
+  {
+#ifdef HAVE_LINEMOD_DB_MMAP
+    if (mappedData)
+      munmap(mappedData, mappedSize);
+#endif
+  }
+
+  bool map(const String& filename)
+  {
+#ifdef HAVE_LINEMOD_DB_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+      void* mapped = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapped != MAP_FAILED)
+      {
+        mappedData = mapped;
+        mappedSize = (size_t)st.st_size;
+        data = (const uchar*)mapped;
+        size = mappedSize;
+      }
+    }
+    close(fd);
+    return mappedData != 0;
+#else
+    CV_UNUSED(filename);
+    return false;
+#endif
+  }
+
+  bool read(const String& filename)
+  {
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f)
+      return false;
+
+    bool ok = false;
+    if (fseek(f, 0, SEEK_END) == 0)
+    {
+      const long fsize = ftell(f);
+      if (fsize > 0 && fseek(f, 0, SEEK_SET) == 0)
+      {
+        fileData.resize((size_t)fsize);
+        ok = fread(&fileData[0], 1, (size_t)fsize, f) == (size_t)fsize;
+      }
+    }
+    fclose(f);
+    if (ok)
+    {
+      data = &fileData[0];
+      size = fileData.size();
+    }
+    return ok;
+  }
+};
+
+// Bounds checked cursor over a part of the database, reading past the end clears ok
+struct DatabaseReader
+{
+  const uchar* ptr;
+  const uchar* end;
+  bool ok;
+
+  DatabaseReader(const uchar* data, size_t size) : ptr(data), end(data + size), ok(true) {}
+
+  size_t remaining() const { return (size_t)(end - ptr); }
+
+  template<typename T> T read()
+  {
+    T value = T();
+    if (ok && remaining() >= sizeof(T))
+    {
+      memcpy(&value, ptr, sizeof(T));
+      ptr += sizeof(T);
+    }
+    else
+      ok = false;
+    return value;
+  }
+
+  String readString()
+  {
+    uint length = read<uint>();
+    if (!ok || remaining() < length)
+    {
+      ok = false;
+      return String();
+    }
+    String str((const char*)ptr, length);
+    ptr += length;
+    return str;
+  }
+};
+
+template<typename T> static void writeDatabaseValue(std::vector<uchar>& buf, const T& value)
+{
+  const uchar* p = (const uchar*)&value;
+  buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+static void writeDatabaseString(std::vector<uchar>& buf, const String& str)
+{
+  writeDatabaseValue(buf, (uint)str.size());
+  buf.insert(buf.end(), str.begin(), str.end());
+}
+
+static void encodeTemplatePyramids(const std::vector< std::vector<Template> >& tps, std::vector<uchar>& buf)
+{
+  for (size_t i = 0; i < tps.size(); ++i)
+  {
+    const std::vector<Template>& tp = tps[i];
+    writeDatabaseValue(buf, (uint)tp.size());
+    for (size_t j = 0; j < tp.size(); ++j)
+    {
+      const Template& templ = tp[j];
+      writeDatabaseValue(buf, templ.width);
+      writeDatabaseValue(buf, templ.height);
+      writeDatabaseValue(buf, templ.pyramid_level);
+      writeDatabaseValue(buf, (uint)templ.features.size());
+      for (size_t k = 0; k < templ.features.size(); ++k)
+      {
+        writeDatabaseValue(buf, templ.features[k].x);
+        writeDatabaseValue(buf, templ.features[k].y);
+        writeDatabaseValue(buf, templ.features[k].label);
+      }
+    }
+  }
+}
+
+static bool decodeTemplatePyramids(const uchar* data, size_t size, int num_templates,
+                                   std::vector< std::vector<Template> >& tps)
+{
+  // counts are checked against the remaining bytes before anything is allocated
+  DatabaseReader reader(data, size);
+  if (num_templates < 0 || (size_t)num_templates > size / sizeof(uint))
+    return false;
+  tps.resize(num_templates);
+  for (int i = 0; i < num_templates && reader.ok; ++i)
+  {
+    uint num = reader.read<uint>();
+    if (num > reader.remaining() / (4 * sizeof(int)))
+      return false;
+    std::vector<Template>& tp = tps[i];
+    tp.resize(num);
+    for (uint j = 0; j < num && reader.ok; ++j)
+    {
+      Template& templ = tp[j];
+      templ.width = reader.read<int>();
+      templ.height = reader.read<int>();
+      templ.pyramid_level = reader.read<int>();
+      uint num_features = reader.read<uint>();
+      if (num_features > reader.remaining() / (3 * sizeof(int)))
+        return false;
+      templ.features.resize(num_features);
+      for (uint k = 0; k < num_features; ++k)
+      {
+        Feature& f = templ.features[k];
+        f.x = reader.read<int>();
+        f.y = reader.read<int>();
+        f.label = reader.read<int>();
+      }
+    }
+  }
+  return reader.ok && reader.remaining() == 0;
+}
+
 /****************************************************************************************\
 *                               High-level Detector API                                  *
 \****************************************************************************************/
 
 Detector::Detector()
+  : pending_classes_mutex(makePtr<Mutex>())
 {
 }
 
@@ -1382,7 +1519,8 @@ Detector::Detector(const std::vector< Ptr<Modality> >& _modalities,
                    const std::vector<int>& T_pyramid)
   : modalities(_modalities),
     pyramid_levels(static_cast<int>(T_pyramid.size())),
-    T_at_level(T_pyramid)
+    T_at_level(T_pyramid),
+    pending_classes_mutex(makePtr<Mutex>())
 {
 }
 
@@ -1443,12 +1581,16 @@ void Detector::match(const std::vector<Mat>& sources, float threshold, std::vect
     sizes.push_back(quantized.size());
   }
 
+  std::vector<TemplatesMap::const_iterator> classes;
   if (class_ids.empty())
   {
     // Match all templates
     TemplatesMap::const_iterator it = class_templates.begin(), itend = class_templates.end();
     for ( ; it != itend; ++it)
-      matchClass(lm_pyramid, sizes, threshold, matches, it->first, it->second);
+    {
+      loadPendingClass(it->first);
+      classes.push_back(it);
+    }
   }
   else
   {
@@ -1457,9 +1599,13 @@ void Detector::match(const std::vector<Mat>& sources, float threshold, std::vect
     {
       TemplatesMap::const_iterator it = class_templates.find(class_ids[i]);
       if (it != class_templates.end())
-        matchClass(lm_pyramid, sizes, threshold, matches, it->first, it->second);
+      {
+        loadPendingClass(it->first);
+        classes.push_back(it);
+      }
     }
   }
+  matchClasses(lm_pyramid, sizes, threshold, matches, classes);
 
   // Sort matches by similarity, and prune any duplicates introduced by pyramid refinement
   std::sort(matches.begin(), matches.end());
@@ -1475,131 +1621,177 @@ struct MatchPredicate
   float threshold;
 };
 
+struct Detector::MatchBuffers
+{
+  std::vector<Mat> similarities, local_similarities;
+  Mat total_similarity, total_local_similarity;
+};
+
 void Detector::matchClass(const LinearMemoryPyramid& lm_pyramid,
                           const std::vector<Size>& sizes,
                           float threshold, std::vector<Match>& matches,
                           const String& class_id,
                           const std::vector<TemplatePyramid>& template_pyramids) const
 {
-  // For each template...
+  MatchBuffers buffers;
   for (size_t template_id = 0; template_id < template_pyramids.size(); ++template_id)
+    matchTemplate(lm_pyramid, sizes, threshold, matches, class_id, static_cast<int>(template_id),
+                  template_pyramids[template_id], buffers);
+}
+
+void Detector::matchClasses(const LinearMemoryPyramid& lm_pyramid,
+                            const std::vector<Size>& sizes,
+                            float threshold, std::vector<Match>& matches,
+                            const std::vector<TemplatesMap::const_iterator>& classes) const
+{
+  // Flatten (class, template) pairs, so that many small classes are balanced as well as a few big ones
+  std::vector< std::pair<int, int> > jobs;
+  for (int i = 0; i < (int)classes.size(); ++i)
+    for (int t = 0; t < (int)classes[i]->second.size(); ++t)
+      jobs.push_back(std::make_pair(i, t));
+  if (jobs.empty())
+    return;
+
+  // Matches of each template are gathered separately and concatenated in the sequential order,
+  // thus the result doesn't depend on scheduling
+  std::vector< std::vector<Match> > job_matches(jobs.size());
+  int nstripes = std::min((int)jobs.size(), std::max(getNumThreads(), 1) * 4);
+  parallel_for_(Range(0, (int)jobs.size()), [&](const Range& range)
   {
-    const TemplatePyramid& tp = template_pyramids[template_id];
-
-    // First match over the whole image at the lowest pyramid level
-    /// @todo Factor this out into separate function
-    const std::vector<LinearMemories>& lowest_lm = lm_pyramid.back();
-
-    // Compute similarity maps for each modality at lowest pyramid level
-    std::vector<Mat> similarities(modalities.size());
-    int lowest_start = static_cast<int>(tp.size() - modalities.size());
-    int lowest_T = T_at_level.back();
-    int num_features = 0;
-    for (int i = 0; i < (int)modalities.size(); ++i)
+    MatchBuffers buffers;
+    for (int j = range.start; j < range.end; ++j)
     {
-      const Template& templ = tp[lowest_start + i];
-      num_features += static_cast<int>(templ.features.size());
-      similarity(lowest_lm[i], templ, similarities[i], sizes.back(), lowest_T);
+      const TemplatesMap::const_iterator& it = classes[jobs[j].first];
+      int template_id = jobs[j].second;
+      matchTemplate(lm_pyramid, sizes, threshold, job_matches[j], it->first, template_id,
+                    it->second[template_id], buffers);
     }
+  }, nstripes);
+
+  for (size_t j = 0; j < job_matches.size(); ++j)
+    matches.insert(matches.end(), job_matches[j].begin(), job_matches[j].end());
+}
 
-    // Combine into overall similarity
-    /// @todo Support weighting the modalities
-    Mat total_similarity;
-    addSimilarities(similarities, total_similarity);
+void Detector::matchTemplate(const LinearMemoryPyramid& lm_pyramid,
+                             const std::vector<Size>& sizes,
+                             float threshold, std::vector<Match>& matches,
+                             const String& class_id, int template_id,
+                             const TemplatePyramid& tp, MatchBuffers& buffers) const
+{
+  // First match over the whole image at the lowest pyramid level
+  /// @todo Factor this out into separate function
+  const std::vector<LinearMemories>& lowest_lm = lm_pyramid.back();
 
-    // Convert user-friendly percentage to raw similarity threshold. The percentage
-    // threshold scales from half the max response (what you would expect from applying
-    // the template to a completely random image) to the max response.
-    // NOTE: This assumes max per-feature response is 4, so we scale between [2*nf, 4*nf].
-    int raw_threshold = static_cast<int>(2*num_features + (threshold / 100.f) * (2*num_features) + 0.5f);
+  // Compute similarity maps for each modality at lowest pyramid level
+  std::vector<Mat>& similarities = buffers.similarities;
+  similarities.resize(modalities.size());
+  int lowest_start = static_cast<int>(tp.size() - modalities.size());
+  int lowest_T = T_at_level.back();
+  int num_features = 0;
+  for (int i = 0; i < (int)modalities.size(); ++i)
+  {
+    const Template& templ = tp[lowest_start + i];
+    num_features += static_cast<int>(templ.features.size());
+    similarity(lowest_lm[i], templ, similarities[i], sizes.back(), lowest_T);
+  }
 
-    // Find initial matches
-    std::vector<Match> candidates;
-    for (int r = 0; r < total_similarity.rows; ++r)
+  // Combine into overall similarity
+  /// @todo Support weighting the modalities
+  Mat& total_similarity = buffers.total_similarity;
+  addSimilarities(similarities, total_similarity);
+
+  // Convert user-friendly percentage to raw similarity threshold. The percentage
+  // threshold scales from half the max response (what you would expect from applying
+  // the template to a completely random image) to the max response.
+  // NOTE: This assumes max per-feature response is 4, so we scale between [2*nf, 4*nf].
+  int raw_threshold = static_cast<int>(2*num_features + (threshold / 100.f) * (2*num_features) + 0.5f);
+
+  // Find initial matches, they are appended to matches and refined there
+  std::vector<Match>& candidates = matches;
+  size_t first_candidate = candidates.size();
+  for (int r = 0; r < total_similarity.rows; ++r)
+  {
+    ushort* row = total_similarity.ptr<ushort>(r);
+    for (int c = 0; c < total_similarity.cols; ++c)
     {
-      ushort* row = total_similarity.ptr<ushort>(r);
-      for (int c = 0; c < total_similarity.cols; ++c)
+      int raw_score = row[c];
+      if (raw_score > raw_threshold)
       {
-        int raw_score = row[c];
-        if (raw_score > raw_threshold)
-        {
-          int offset = lowest_T / 2 + (lowest_T % 2 - 1);
-          int x = c * lowest_T + offset;
-          int y = r * lowest_T + offset;
-          float score =(raw_score * 100.f) / (4 * num_features) + 0.5f;
-          candidates.push_back(Match(x, y, score, class_id, static_cast<int>(template_id)));
-        }
+        int offset = lowest_T / 2 + (lowest_T % 2 - 1);
+        int x = c * lowest_T + offset;
+        int y = r * lowest_T + offset;
+        float score =(raw_score * 100.f) / (4 * num_features) + 0.5f;
+        candidates.push_back(Match(x, y, score, class_id, template_id));
       }
     }
+  }
 
-    // Locally refine each match by marching up the pyramid
-    for (int l = pyramid_levels - 2; l >= 0; --l)
+  // Locally refine each match by marching up the pyramid
+  for (int l = pyramid_levels - 2; l >= 0; --l)
+  {
+    const std::vector<LinearMemories>& lms = lm_pyramid[l];
+    int T = T_at_level[l];
+    int start = static_cast<int>(l * modalities.size());
+    Size size = sizes[l];
+    int border = 8 * T;
+    int offset = T / 2 + (T % 2 - 1);
+    int max_x = size.width - tp[start].width - border;
+    int max_y = size.height - tp[start].height - border;
+
+    std::vector<Mat>& similarities2 = buffers.local_similarities;
+    similarities2.resize(modalities.size());
+    Mat& total_similarity2 = buffers.total_local_similarity;
+    for (int m = (int)first_candidate; m < (int)candidates.size(); ++m)
     {
-      const std::vector<LinearMemories>& lms = lm_pyramid[l];
-      int T = T_at_level[l];
-      int start = static_cast<int>(l * modalities.size());
-      Size size = sizes[l];
-      int border = 8 * T;
-      int offset = T / 2 + (T % 2 - 1);
-      int max_x = size.width - tp[start].width - border;
-      int max_y = size.height - tp[start].height - border;
-
-      std::vector<Mat> similarities2(modalities.size());
-      Mat total_similarity2;
-      for (int m = 0; m < (int)candidates.size(); ++m)
-      {
-        Match& match2 = candidates[m];
-        int x = match2.x * 2 + 1; /// @todo Support other pyramid distance
-        int y = match2.y * 2 + 1;
+      Match& match2 = candidates[m];
+      int x = match2.x * 2 + 1; /// @todo Support other pyramid distance
+      int y = match2.y * 2 + 1;
 
-        // Require 8 (reduced) row/cols to the up/left
-        x = std::max(x, border);
-        y = std::max(y, border);
+      // Require 8 (reduced) row/cols to the up/left
+      x = std::max(x, border);
+      y = std::max(y, border);
 
-        // Require 8 (reduced) row/cols to the down/left, plus the template size
-        x = std::min(x, max_x);
-        y = std::min(y, max_y);
+      // Require 8 (reduced) row/cols to the down/left, plus the template size
+      x = std::min(x, max_x);
+      y = std::min(y, max_y);
 
-        // Compute local similarity maps for each modality
-        int numFeatures = 0;
-        for (int i = 0; i < (int)modalities.size(); ++i)
-        {
-          const Template& templ = tp[start + i];
-          numFeatures += static_cast<int>(templ.features.size());
-          similarityLocal(lms[i], templ, similarities2[i], size, T, Point(x, y));
-        }
-        addSimilarities(similarities2, total_similarity2);
+      // Compute local similarity maps for each modality
+      int numFeatures = 0;
+      for (int i = 0; i < (int)modalities.size(); ++i)
+      {
+        const Template& templ = tp[start + i];
+        numFeatures += static_cast<int>(templ.features.size());
+        similarityLocal(lms[i], templ, similarities2[i], size, T, Point(x, y));
+      }
+      addSimilarities(similarities2, total_similarity2);
 
-        // Find best local adjustment
-        int best_score = 0;
-        int best_r = -1, best_c = -1;
-        for (int r = 0; r < total_similarity2.rows; ++r)
+      // Find best local adjustment
+      int best_score = 0;
+      int best_r = -1, best_c = -1;
+      for (int r = 0; r < total_similarity2.rows; ++r)
+      {
+        ushort* row = total_similarity2.ptr<ushort>(r);
+        for (int c = 0; c < total_similarity2.cols; ++c)
         {
-          ushort* row = total_similarity2.ptr<ushort>(r);
-          for (int c = 0; c < total_similarity2.cols; ++c)
+          int score = row[c];
+          if (score > best_score)
           {
-            int score = row[c];
-            if (score > best_score)
-            {
-              best_score = score;
-              best_r = r;
-              best_c = c;
-            }
+            best_score = score;
+            best_r = r;
+            best_c = c;
           }
         }
-        // Update current match
-        match2.x = (x / T - 8 + best_c) * T + offset;
-        match2.y = (y / T - 8 + best_r) * T + offset;
-        match2.similarity = (best_score * 100.f) / (4 * numFeatures);
       }
-
-      // Filter out any matches that drop below the similarity threshold
-      std::vector<Match>::iterator new_end = std::remove_if(candidates.begin(), candidates.end(),
-                                                            MatchPredicate(threshold));
-      candidates.erase(new_end, candidates.end());
+      // Update current match
+      match2.x = (x / T - 8 + best_c) * T + offset;
+      match2.y = (y / T - 8 + best_r) * T + offset;
+      match2.similarity = (best_score * 100.f) / (4 * numFeatures);
     }
 
-    matches.insert(matches.end(), candidates.begin(), candidates.end());
+    // Filter out any matches that drop below the similarity threshold
+    std::vector<Match>::iterator new_end = std::remove_if(candidates.begin() + first_candidate, candidates.end(),
+                                                          MatchPredicate(threshold));
+    candidates.erase(new_end, candidates.end());
   }
 }
 
@@ -1607,6 +1799,7 @@ int Detector::addTemplate(const std::vector<Mat>& sources, const String& class_i
                           const Mat& object_mask, Rect* bounding_box)
 {
   int num_modalities = static_cast<int>(modalities.size());
+  loadPendingClass(class_id);
   std::vector<TemplatePyramid>& template_pyramids = class_templates[class_id];
   int template_id = static_cast<int>(template_pyramids.size());
 
@@ -1641,6 +1834,7 @@ int Detector::addTemplate(const std::vector<Mat>& sources, const String& class_i
 
 int Detector::addSyntheticTemplate(const std::vector<Template>& templates, const String& class_id)
 {
+  loadPendingClass(class_id);
   std::vector<TemplatePyramid>& template_pyramids = class_templates[class_id];
   int template_id = static_cast<int>(template_pyramids.size());
   template_pyramids.push_back(templates);
@@ -1649,6 +1843,7 @@ int Detector::addSyntheticTemplate(const std::vector<Template>& templates, const
 
 const std::vector<Template>& Detector::getTemplates(const String& class_id, int template_id) const
 {
+  loadPendingClass(class_id);
   TemplatesMap::const_iterator i = class_templates.find(class_id);
   CV_Assert(i != class_templates.end());
   CV_Assert(i->second.size() > size_t(template_id));
@@ -1660,7 +1855,7 @@ int Detector::numTemplates() const
   int ret = 0;
   TemplatesMap::const_iterator i = class_templates.begin(), iend = class_templates.end();
   for ( ; i != iend; ++i)
-    ret += static_cast<int>(i->second.size());
+    ret += numTemplates(i->first);
   return ret;
 }
 
@@ -1669,6 +1864,13 @@ int Detector::numTemplates(const String& class_id) const
   TemplatesMap::const_iterator i = class_templates.find(class_id);
   if (i == class_templates.end())
     return 0;
+
+  {
+    AutoLock lock(*pending_classes_mutex);
+    std::map<String, PendingClass>::const_iterator p = pending_classes.find(class_id);
+    if (p != pending_classes.end())
+      return p->second.num_templates;
+  }
   return static_cast<int>(i->second.size());
 }
 
@@ -1687,6 +1889,7 @@ std::vector<String> Detector::classIds() const
 void Detector::read(const FileNode& fn)
 {
   class_templates.clear();
+  pending_classes.clear();
   pyramid_levels = fn["pyramid_levels"];
   fn["T"] >> T_at_level;
 
@@ -1766,6 +1969,7 @@ void Detector::write(FileStorage& fs) const
 
 void Detector::writeClass(const String& class_id, FileStorage& fs) const
 {
+  loadPendingClass(class_id);
   TemplatesMap::const_iterator it = class_templates.find(class_id);
   CV_Assert(it != class_templates.end());
   const std::vector<TemplatePyramid>& tps = it->second;
@@ -1819,6 +2023,148 @@ void Detector::writeClasses(const String& format) const
   }
 }
 
+void Detector::writeClassesBinary(const String& filename) const
+{
+  std::vector<uchar> buf(sizeof(LinemodDatabaseHeader));
+  for (size_t i = 0; i < modalities.size(); ++i)
+    writeDatabaseString(buf, modalities[i]->name());
+
+  std::vector<uint64> offsets, sizes;
+  std::vector<int> counts;
+  TemplatesMap::const_iterator it = class_templates.begin(), it_end = class_templates.end();
+  for ( ; it != it_end; ++it)
+  {
+    const size_t offset = buf.size();
+    int count;
+    {
+      // classes that were never loaded are copied verbatim from their database
+      AutoLock lock(*pending_classes_mutex);
+      std::map<String, PendingClass>::const_iterator p = pending_classes.find(it->first);
+      if (p != pending_classes.end())
+      {
+        const uchar* data = p->second.db->data + p->second.offset;
+        buf.insert(buf.end(), data, data + p->second.size);
+        count = p->second.num_templates;
+      }
+      else
+      {
+        encodeTemplatePyramids(it->second, buf);
+        count = static_cast<int>(it->second.size());
+      }
+    }
+    offsets.push_back(offset);
+    sizes.push_back(buf.size() - offset);
+    counts.push_back(count);
+  }
+
+  LinemodDatabaseHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LINEMOD_DB_MAGIC, sizeof(header.magic));
+  header.version = LINEMOD_DB_VERSION;
+  header.byteOrder = LINEMOD_DB_BYTE_ORDER;
+  header.pyramidLevels = pyramid_levels;
+  header.numModalities = (uint)modalities.size();
+  header.numClasses = (uint)class_templates.size();
+  header.directoryOffset = buf.size();
+
+  size_t i = 0;
+  for (it = class_templates.begin(); it != it_end; ++it, ++i)
+  {
+    writeDatabaseString(buf, it->first);
+    writeDatabaseValue(buf, offsets[i]);
+    writeDatabaseValue(buf, sizes[i]);
+    writeDatabaseValue(buf, counts[i]);
+  }
+  header.fileSize = buf.size();
+  memcpy(&buf[0], &header, sizeof(header));
+
+  FILE* f = fopen(filename.c_str(), "wb");
+  if (!f)
+    CV_Error(Error::StsError, "Cannot open template database for writing: " + filename);
+  const bool ok = fwrite(&buf[0], 1, buf.size(), f) == buf.size();
+  if (fclose(f) != 0 || !ok)
+    CV_Error(Error::StsError, "Error writing template database: " + filename);
+}
+
+void Detector::readClassesBinary(const String& filename)
+{
+  Ptr<TemplateDatabase> db = makePtr<TemplateDatabase>();
+  if (!db->map(filename) && !db->read(filename))
+    CV_Error(Error::StsBadArg, "Cannot read template database: " + filename);
+
+  LinemodDatabaseHeader header;
+  if (db->size < sizeof(header))
+    CV_Error(Error::StsBadArg, "Template database is corrupted: " + filename);
+  memcpy(&header, db->data, sizeof(header));
+  if (memcmp(header.magic, LINEMOD_DB_MAGIC, sizeof(header.magic)) != 0)
+    CV_Error(Error::StsBadArg, "Not a template database: " + filename);
+  if (header.version != LINEMOD_DB_VERSION || header.byteOrder != LINEMOD_DB_BYTE_ORDER)
+    CV_Error(Error::StsBadArg, "Unsupported template database version or byte order: " + filename);
+  if (header.fileSize != db->size || header.directoryOffset > header.fileSize ||
+      header.directoryOffset < sizeof(header))
+    CV_Error(Error::StsBadArg, "Template database is corrupted: " + filename);
+
+  // Verify compatible with Detector settings
+  DatabaseReader reader(db->data + sizeof(header), (size_t)header.directoryOffset - sizeof(header));
+  CV_Assert(header.numModalities == modalities.size());
+  for (size_t i = 0; i < modalities.size(); ++i)
+  {
+    String name = reader.readString();
+    if (!reader.ok)
+      CV_Error(Error::StsBadArg, "Template database is corrupted: " + filename);
+    CV_Assert(modalities[i]->name() == name);
+  }
+  CV_Assert(header.pyramidLevels == pyramid_levels);
+  const size_t data_begin = (size_t)(reader.ptr - db->data);
+  const size_t data_end = (size_t)header.directoryOffset;
+  const size_t min_entry_size = sizeof(uint) + 2 * sizeof(uint64) + sizeof(int);
+  if (header.numClasses > (db->size - data_end) / min_entry_size)
+    CV_Error(Error::StsBadArg, "Template database is corrupted: " + filename);
+
+  // Parse the whole directory before adding anything, a corrupted file leaves the detector as is
+  std::vector<String> ids(header.numClasses);
+  std::vector<PendingClass> classes(header.numClasses);
+  DatabaseReader dir(db->data + data_end, db->size - data_end);
+  for (uint i = 0; i < header.numClasses; ++i)
+  {
+    ids[i] = dir.readString();
+    uint64 offset = dir.read<uint64>(), size = dir.read<uint64>();
+    int num_templates = dir.read<int>();
+    if (!dir.ok || offset < data_begin || offset > data_end ||
+        size > data_end - offset || num_templates < 0)
+      CV_Error(Error::StsBadArg, "Template database is corrupted: " + filename);
+
+    // Detector should not already have this class
+    CV_Assert(class_templates.find(ids[i]) == class_templates.end());
+    classes[i].db = db;
+    classes[i].offset = (size_t)offset;
+    classes[i].size = (size_t)size;
+    classes[i].num_templates = num_templates;
+  }
+
+  AutoLock lock(*pending_classes_mutex);
+  for (uint i = 0; i < header.numClasses; ++i)
+  {
+    class_templates[ids[i]];
+    pending_classes[ids[i]] = classes[i];
+  }
+}
+
+void Detector::loadPendingClass(const String& class_id) const
+{
+  AutoLock lock(*pending_classes_mutex);
+  std::map<String, PendingClass>::iterator p = pending_classes.find(class_id);
+  if (p == pending_classes.end())
+    return;
+
+  const PendingClass& pc = p->second;
+  std::vector<TemplatePyramid> tps;
+  if (!decodeTemplatePyramids(pc.db->data + pc.offset, pc.size, pc.num_templates, tps))
+    CV_Error(Error::StsBadArg, "Template database is corrupted, cannot load class " + class_id);
+  class_templates[class_id].swap(tps);
+  pending_classes.erase(p);
+}
+
 static const int T_DEFAULTS[] = {5, 8};
 
 Ptr<Detector> getDefaultLINE()
@@ -0,0 +1,34 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html
+
+#ifndef __OPENCV_RGBD_LINEMOD_KERNELS_HPP__
+#define __OPENCV_RGBD_LINEMOD_KERNELS_HPP__
+
+#include "opencv2/rgbd/linemod.hpp"
+
+namespace cv
+{
+namespace linemod
+{
+
+// Inner loops of the LINEMOD response maps and matching, see linemod.cpp.
+// vectorize = false runs the scalar loops only, which the vectorized ones must match.
+
+CV_EXPORTS void orUnaligned8u(const uchar * src, const int src_stride,
+                              uchar * dst, const int dst_stride,
+                              const int width, const int height, bool vectorize = true);
+
+CV_EXPORTS void similarity(const std::vector<Mat>& linear_memories, const Template& templ,
+                           Mat& dst, Size size, int T, bool vectorize = true);
+
+CV_EXPORTS void similarityLocal(const std::vector<Mat>& linear_memories, const Template& templ,
+                                Mat& dst, Size size, int T, Point center, bool vectorize = true);
+
+CV_EXPORTS void addUnaligned8u16u(const uchar * src1, const uchar * src2, ushort * res, int length,
+                                  bool vectorize = true);
+
+} // namespace linemod
+} // namespace cv
+
+#endif
@@ -16,7 +16,7 @@ namespace dynafu {
 // For any cube the are 2^8=256 possible sets of vertex states
 // This table lists the edges intersected by the surface for all 256 possible vertex states
 // There are 12 edges.  For each entry in the table, if edge #n is intersected, then bit #n is set to 1
-int edgeTable[256] =
+static const int edgeTable[256] =
     {
         0x000, 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c, 0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
         0x190, 0x099, 0x393, 0x29a, 0x596, 0x49f, 0x795, 0x69c, 0x99c, 0x895, 0xb9f, 0xa96, 0xd9a, 0xc93, 0xf99, 0xe90,
@@ -40,7 +40,7 @@ int edgeTable[256] =
 //  0-5 edge triples with the list terminated by the invalid value -1.
 //  For example: a2iTriangleConnectionTable[3] list the 2 triangles formed when corner[0]
 //  and corner[1] are inside of the surface, but the rest of the cube is not.
-int triTable[256][16] =
+static const int triTable[256][16] =
     {
         {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
         {0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
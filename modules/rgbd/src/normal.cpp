@@ -22,6 +22,42 @@ namespace rgbd
     return std::sqrt(vec[0] * vec[0] + vec[1] * vec[1] + vec[2] * vec[2]);
   }
 
+  /** Compute the distance to the origin of a row of 3d points
+   * @param point the row of points
+   * @param row the output distances
+   * @param width the number of points
+   */
+  template<typename T>
+  inline
+  void
+  computeRadiusRow(const Vec<T, 3>* point, T* row, int width)
+  {
+    for (int x = 0; x < width; ++x)
+      row[x] = norm_vec(point[x]);
+  }
+
+#if CV_SIMD128
+  template<>
+  inline
+  void
+  computeRadiusRow<float>(const Vec3f* point, float* row, int width)
+  {
+    const float* p = point[0].val;
+    int x = 0;
+    if (useOptimized())
+    {
+      for (; x <= width - 4; x += 4)
+      {
+        v_float32x4 px, py, pz;
+        v_load_deinterleave(p + 3 * x, px, py, pz);
+        v_store(row + x, v_sqrt(px * px + py * py + pz * pz));
+      }
+    }
+    for (; x < width; ++x)
+      row[x] = norm_vec(point[x]);
+  }
+#endif
+
   /** Given 3d points, compute their distance to the origin
    * @param points
    * @return
@@ -32,18 +68,12 @@ namespace rgbd
   {
     typedef Vec<T, 3> PointT;
 
-    // Compute the
-    Size size(points.cols, points.rows);
-    Mat_<T> r(size);
-    if (points.isContinuous())
-      size = Size(points.cols * points.rows, 1);
-    for (int y = 0; y < size.height; ++y)
+    Mat_<T> r(points.rows, points.cols);
+    parallel_for_(Range(0, points.rows), [&](const Range& range)
     {
-      const PointT* point = points.ptr < PointT > (y), *point_end = points.ptr < PointT > (y) + size.width;
-      T * row = r[y];
-      for (; point != point_end; ++point, ++row)
-        *row = norm_vec(*point);
-    }
+      for (int y = range.start; y < range.end; ++y)
+        computeRadiusRow<T>(points.ptr<PointT>(y), r[y], points.cols);
+    });
 
     return r;
   }
@@ -132,6 +162,44 @@ namespace rgbd
     }
   }
 
+  /** Normalize a row of normals and make sure they point towards the camera
+   * @param normal the row of normals
+   * @param width the number of normals
+   */
+  template<typename T>
+  inline
+  void
+  signNormalsRow(Vec<T, 3>* normal, int width)
+  {
+    for (int x = 0; x < width; ++x)
+      signNormal(normal[x][0], normal[x][1], normal[x][2], normal[x]);
+  }
+
+#if CV_SIMD128
+  template<>
+  inline
+  void
+  signNormalsRow<float>(Vec3f* normal, int width)
+  {
+    float* p = normal[0].val;
+    const v_float32x4 v_zero = v_setzero_f32(), v_one = v_setall_f32(1.f);
+    int x = 0;
+    if (useOptimized())
+    {
+      for (; x <= width - 4; x += 4)
+      {
+        v_float32x4 a, b, c;
+        v_load_deinterleave(p + 3 * x, a, b, c);
+        v_float32x4 norm = v_one / v_sqrt(a * a + b * b + c * c);
+        norm = v_select(c > v_zero, v_zero - norm, norm);
+        v_store_interleave(p + 3 * x, a * norm, b * norm, c * norm);
+      }
+    }
+    for (; x < width; ++x)
+      signNormal(normal[x][0], normal[x][1], normal[x][2], normal[x]);
+  }
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
   class RgbdNormalsImpl
@@ -228,15 +296,22 @@ namespace rgbd
       boxFilter(M, M, M.depth(), Size(window_size_, window_size_), Point(-1, -1), false);
 
       // Compute M's inverse
-      Mat33T M_inv;
       M_inv_.create(rows_, cols_);
-      Vec9T * M_inv_ptr = M_inv_[0];
-      for (M_ptr = &M(0); M_ptr != M_ptr_end; ++M_inv_ptr, ++M_ptr)
+      parallel_for_(Range(0, rows_), [&](const Range& range)
       {
-        // We have a semi-definite matrix
-        invert(Mat33T(M_ptr->val), M_inv, DECOMP_CHOLESKY);
-        *M_inv_ptr = Vec9T(M_inv.val);
-      }
+        Mat33T M_inv;
+        for (int y = range.start; y < range.end; ++y)
+        {
+          const Vec9T * M_row = M[y];
+          Vec9T * M_inv_row = M_inv_[y];
+          for (int x = 0; x < cols_; ++x)
+          {
+            // We have a semi-definite matrix
+            invert(Mat33T(M_row[x].val), M_inv, DECOMP_CHOLESKY);
+            M_inv_row[x] = Vec9T(M_inv.val);
+          }
+        }
+      });
     }
 
     /** Compute the normals
@@ -248,45 +323,58 @@ namespace rgbd
     {
       // Compute B
       Mat_<Vec3T> B(rows_, cols_);
-
-      const T* row_r = r.ptr < T > (0), *row_r_end = row_r + rows_ * cols_;
-      const Vec3T *row_V = V_[0];
-      Vec3T *row_B = B[0];
-      for (; row_r != row_r_end; ++row_r, ++row_B, ++row_V)
+      parallel_for_(Range(0, rows_), [&](const Range& range)
       {
-          Vec3T val = (*row_V) / (*row_r);
-          if(cvIsInf(val[0]) || cvIsNaN(val[0]) ||
-             cvIsInf(val[1]) || cvIsNaN(val[1]) ||
-             cvIsInf(val[2]) || cvIsNaN(val[2]))
-              *row_B = Vec3T();
-          else
-              *row_B = val;
-      }
+        for (int y = range.start; y < range.end; ++y)
+        {
+          const T* row_r = r.ptr<T>(y);
+          const Vec3T* row_V = V_[y];
+          Vec3T* row_B = B[y];
+          for (int x = 0; x < cols_; ++x)
+          {
+            const T inv_r = 1 / row_r[x];
+            const T b0 = row_V[x][0] * inv_r, b1 = row_V[x][1] * inv_r, b2 = row_V[x][2] * inv_r;
+            if (cvIsInf(b0) || cvIsNaN(b0) ||
+                cvIsInf(b1) || cvIsNaN(b1) ||
+                cvIsInf(b2) || cvIsNaN(b2))
+              row_B[x] = Vec3T();
+            else
+              row_B[x] = Vec3T(b0, b1, b2);
+          }
+        }
+      });
 
       // Apply a box filter to B
       boxFilter(B, B, B.depth(), Size(window_size_, window_size_), Point(-1, -1), false);
 
       // compute the Minv*B products
-      row_r = r.ptr < T > (0);
-      const Vec3T * B_vec = B[0];
-      const Mat33T * M_inv = reinterpret_cast<const Mat33T *>(M_inv_.ptr(0));
-      Vec3T *normal = normals.ptr<Vec3T>(0);
-      for (; row_r != row_r_end; ++row_r, ++B_vec, ++normal, ++M_inv)
-        if (cvIsNaN(*row_r))
-        {
-          (*normal)[0] = *row_r;
-          (*normal)[1] = *row_r;
-          (*normal)[2] = *row_r;
-        }
-        else
+      parallel_for_(Range(0, rows_), [&](const Range& range)
+      {
+        for (int y = range.start; y < range.end; ++y)
         {
-            Mat33T Mr = *M_inv;
-            Vec3T Br = *B_vec;
-            Vec3T MBr(Mr(0, 0) * Br[0] + Mr(0, 1)*Br[1] + Mr(0, 2)*Br[2],
-                      Mr(1, 0) * Br[0] + Mr(1, 1)*Br[1] + Mr(1, 2)*Br[2],
-                      Mr(2, 0) * Br[0] + Mr(2, 1)*Br[1] + Mr(2, 2)*Br[2]);
-           signNormal(MBr, *normal);
+          const T* row_r = r.ptr<T>(y);
+          const Vec3T* row_B = B[y];
+          const Vec9T* row_M_inv = M_inv_[y];
+          Vec3T* normal = normals.ptr<Vec3T>(y);
+          for (int x = 0; x < cols_; ++x)
+          {
+            if (cvIsNaN(row_r[x]))
+            {
+              normal[x][0] = row_r[x];
+              normal[x][1] = row_r[x];
+              normal[x][2] = row_r[x];
+            }
+            else
+            {
+              const T* m = row_M_inv[x].val;
+              const Vec3T& b = row_B[x];
+              signNormal(m[0] * b[0] + m[1] * b[1] + m[2] * b[2],
+                         m[3] * b[0] + m[4] * b[1] + m[5] * b[2],
+                         m[6] * b[0] + m[7] * b[1] + m[8] * b[2], normal[x]);
+            }
+          }
         }
+      });
     }
 
   private:
@@ -406,59 +494,61 @@ multiply_by_K_inv(const Matx<T, 3, 3> & K_inv, U a, U b, U c, Vec<T, 3> &res)
       K_inv(1, 1) = 1 / K(1, 1);
       K_inv(1, 2) = -K(1, 2) / K(1, 1);
 
-      Vec3T X1_minus_X, X2_minus_X;
-
       ContainerDepth difference_threshold = 50;
       normals.setTo(std::numeric_limits<DepthDepth>::quiet_NaN());
-      for (int y = r; y < rows_ - r - 1; ++y)
+      parallel_for_(Range(r, std::max(r, rows_ - r - 1)), [&](const Range& range)
       {
-        const DepthDepth * p_line = reinterpret_cast<const DepthDepth*>(depth.ptr(y, r));
-        Vec3T *normal = normals.ptr<Vec3T>(y, r);
-
-        for (int x = r; x < cols_ - r - 1; ++x)
+        Vec3T X1_minus_X, X2_minus_X;
+        for (int y = range.start; y < range.end; ++y)
         {
-          DepthDepth d = p_line[0];
-
-          // accum
-          long A[4];
-          A[0] = A[1] = A[2] = A[3] = 0;
-          ContainerDepth b[2];
-          b[0] = b[1] = 0;
-          for (unsigned int i = 0; i < square_size * square_size; ++i) {
-            // We need to cast to ContainerDepth in case we have unsigned DepthDepth
-            ContainerDepth delta = ContainerDepth(p_line[offsets[i]]) - ContainerDepth(d);
-            if (std::abs(delta) > difference_threshold)
-               continue;
-
-             A[0] += offsets_x_x[i];
-             A[1] += offsets_x_y[i];
-             A[3] += offsets_y_y[i];
-             b[0] += offsets_x[i] * delta;
-             b[1] += offsets_y[i] * delta;
-          }
+          const DepthDepth * p_line = reinterpret_cast<const DepthDepth*>(depth.ptr(y, r));
+          Vec3T *normal = normals.ptr<Vec3T>(y, r);
 
-          // solve for the optimal gradient D of equation (8)
-          long det = A[0] * A[3] - A[1] * A[1];
-          // We should divide the following two by det, but instead, we multiply
-          // X1_minus_X and X2_minus_X by det (which does not matter as we normalize the normals)
-          // Therefore, no division is done: this is only for speedup
-          ContainerDepth dx = (A[3] * b[0] - A[1] * b[1]);
-          ContainerDepth dy = (-A[1] * b[0] + A[0] * b[1]);
-
-          // Compute the dot product
-          //Vec3T X = K_inv * Vec3T(x, y, 1) * depth(y, x);
-          //Vec3T X1 = K_inv * Vec3T(x + 1, y, 1) * (depth(y, x) + dx);
-          //Vec3T X2 = K_inv * Vec3T(x, y + 1, 1) * (depth(y, x) + dy);
-          //Vec3T nor = (X1 - X).cross(X2 - X);
-          multiply_by_K_inv(K_inv, d * det + (x + 1) * dx, y * dx, dx, X1_minus_X);
-          multiply_by_K_inv(K_inv, x * dy, d * det + (y + 1) * dy, dy, X2_minus_X);
-          Vec3T nor = X1_minus_X.cross(X2_minus_X);
-          signNormal(nor, *normal);
-
-          ++p_line;
-          ++normal;
+          for (int x = r; x < cols_ - r - 1; ++x)
+          {
+            DepthDepth d = p_line[0];
+
+            // accum
+            long A[4];
+            A[0] = A[1] = A[2] = A[3] = 0;
+            ContainerDepth b[2];
+            b[0] = b[1] = 0;
+            for (unsigned int i = 0; i < square_size * square_size; ++i) {
+              // We need to cast to ContainerDepth in case we have unsigned DepthDepth
+              ContainerDepth delta = ContainerDepth(p_line[offsets[i]]) - ContainerDepth(d);
+              if (std::abs(delta) > difference_threshold)
+                 continue;
+
+               A[0] += offsets_x_x[i];
+               A[1] += offsets_x_y[i];
+               A[3] += offsets_y_y[i];
+               b[0] += offsets_x[i] * delta;
+               b[1] += offsets_y[i] * delta;
+            }
+
+            // solve for the optimal gradient D of equation (8)
+            long det = A[0] * A[3] - A[1] * A[1];
+            // We should divide the following two by det, but instead, we multiply
+            // X1_minus_X and X2_minus_X by det (which does not matter as we normalize the normals)
+            // Therefore, no division is done: this is only for speedup
+            ContainerDepth dx = (A[3] * b[0] - A[1] * b[1]);
+            ContainerDepth dy = (-A[1] * b[0] + A[0] * b[1]);
+
+            // Compute the dot product
+            //Vec3T X = K_inv * Vec3T(x, y, 1) * depth(y, x);
+            //Vec3T X1 = K_inv * Vec3T(x + 1, y, 1) * (depth(y, x) + dx);
+            //Vec3T X2 = K_inv * Vec3T(x, y + 1, 1) * (depth(y, x) + dy);
+            //Vec3T nor = (X1 - X).cross(X2 - X);
+            multiply_by_K_inv(K_inv, d * det + (x + 1) * dx, y * dx, dx, X1_minus_X);
+            multiply_by_K_inv(K_inv, x * dy, d * det + (y + 1) * dy, dy, X2_minus_X);
+            Vec3T nor = X1_minus_X.cross(X2_minus_X);
+            signNormal(nor, *normal);
+
+            ++p_line;
+            ++normal;
+          }
         }
-      }
+      });
 
       return normals;
     }
@@ -596,36 +686,43 @@ multiply_by_K_inv(const Matx<T, 3, 3> & K_inv, U a, U b, U c, Vec<T, 3> &res)
 
       // Fill the result matrix
       Mat_<Vec3T> normals(rows_, cols_);
-
-      const T* r_theta_ptr = r_theta[0], *r_theta_ptr_end = r_theta_ptr + rows_ * cols_;
-      const T* r_phi_ptr = r_phi[0];
-      const Mat33T * R = reinterpret_cast<const Mat33T *>(R_hat_[0]);
-      const T* r_ptr = r[0];
-      Vec3T * normal = normals[0];
-      for (; r_theta_ptr != r_theta_ptr_end; ++r_theta_ptr, ++r_phi_ptr, ++R, ++r_ptr, ++normal)
+      parallel_for_(Range(0, rows_), [&](const Range& range)
       {
-        if (cvIsNaN(*r_ptr))
-        {
-          (*normal)[0] = *r_ptr;
-          (*normal)[1] = *r_ptr;
-          (*normal)[2] = *r_ptr;
-        }
-        else
+        for (int y = range.start; y < range.end; ++y)
         {
-          T r_theta_over_r = (*r_theta_ptr) / (*r_ptr);
-          T r_phi_over_r = (*r_phi_ptr) / (*r_ptr);
-          // R(1,1) is 0
-          signNormal((*R)(0, 0) + (*R)(0, 1) * r_theta_over_r + (*R)(0, 2) * r_phi_over_r,
-                     (*R)(1, 0) + (*R)(1, 2) * r_phi_over_r,
-                     (*R)(2, 0) + (*R)(2, 1) * r_theta_over_r + (*R)(2, 2) * r_phi_over_r, *normal);
+          const T* r_theta_row = r_theta[y];
+          const T* r_phi_row = r_phi[y];
+          const T* r_row = r[y];
+          const Vec9T* R_row = R_hat_[y];
+          Vec3T* normal = normals[y];
+          for (int x = 0; x < cols_; ++x)
+          {
+            if (cvIsNaN(r_row[x]))
+            {
+              normal[x][0] = r_row[x];
+              normal[x][1] = r_row[x];
+              normal[x][2] = r_row[x];
+            }
+            else
+            {
+              const T* R = R_row[x].val;
+              T r_theta_over_r = r_theta_row[x] / r_row[x];
+              T r_phi_over_r = r_phi_row[x] / r_row[x];
+              // R(1,1) is 0
+              signNormal(R[0] + R[1] * r_theta_over_r + R[2] * r_phi_over_r,
+                         R[3] + R[5] * r_phi_over_r,
+                         R[6] + R[7] * r_theta_over_r + R[8] * r_phi_over_r, normal[x]);
+            }
+          }
         }
-      }
+      });
 
       remap(normals, normals_out, invxy_, invfxy_, INTER_LINEAR);
-      normal = normals_out.ptr<Vec3T>(0);
-      Vec3T * normal_end = normal + rows_ * cols_;
-      for (; normal != normal_end; ++normal)
-        signNormal((*normal)[0], (*normal)[1], (*normal)[2], *normal);
+      parallel_for_(Range(0, rows_), [&](const Range& range)
+      {
+        for (int y = range.start; y < range.end; ++y)
+          signNormalsRow<T>(normals_out.ptr<Vec3T>(y), cols_);
+      });
     }
   private:
     /** Stores R */
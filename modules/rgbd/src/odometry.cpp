@@ -9,6 +9,8 @@
 #include "precomp.hpp"
 #include "fast_icp.hpp"
 
+#include <atomic>
+
 #if defined(HAVE_EIGEN) && EIGEN_WORLD_VERSION == 3
 #  define HAVE_EIGEN3_HERE
 #  if defined(_MSC_VER)
@@ -111,8 +113,12 @@ void checkNormals(const Mat& normals, const Size& depthSize)
         CV_Error(Error::StsBadSize, "Normals type has to be CV_32FC3.");
 }
 
+// Pyramids which are not given by user are built in the buffers left by OdometryFrame::recycle(),
+// levels of matching size and type are refilled in place without reallocation
+
 static
-void preparePyramidImage(const Mat& image, std::vector<Mat>& pyramidImage, size_t levelCount)
+void preparePyramidImage(const Mat& image, std::vector<Mat>& pyramidImage, size_t levelCount,
+                         std::vector<Mat>& buffer)
 {
     if(!pyramidImage.empty())
     {
@@ -124,11 +130,15 @@ void preparePyramidImage(const Mat& image, std::vector<Mat>& pyramidImage, size_
             CV_Assert(pyramidImage[i].type() == image.type());
     }
     else
+    {
+        pyramidImage.swap(buffer);
         buildPyramid(image, pyramidImage, (int)levelCount - 1);
+    }
 }
 
 static
-void preparePyramidDepth(const Mat& depth, std::vector<Mat>& pyramidDepth, size_t levelCount)
+void preparePyramidDepth(const Mat& depth, std::vector<Mat>& pyramidDepth, size_t levelCount,
+                         std::vector<Mat>& buffer)
 {
     if(!pyramidDepth.empty())
     {
@@ -140,13 +150,16 @@ void preparePyramidDepth(const Mat& depth, std::vector<Mat>& pyramidDepth, size_
             CV_Assert(pyramidDepth[i].type() == depth.type());
     }
     else
+    {
+        pyramidDepth.swap(buffer);
         buildPyramid(depth, pyramidDepth, (int)levelCount - 1);
+    }
 }
 
 static
 void preparePyramidMask(const Mat& mask, const std::vector<Mat>& pyramidDepth, float minDepth, float maxDepth,
                         const std::vector<Mat>& pyramidNormal,
-                        std::vector<Mat>& pyramidMask)
+                        std::vector<Mat>& pyramidMask, std::vector<Mat>& buffer)
 {
     minDepth = std::max(0.f, minDepth);
 
@@ -163,43 +176,58 @@ void preparePyramidMask(const Mat& mask, const std::vector<Mat>& pyramidDepth, f
     }
     else
     {
-        Mat validMask;
+        pyramidMask.swap(buffer);
+        pyramidMask.resize(pyramidDepth.size());
+
+        Mat validMask = pyramidMask[0];
         if(mask.empty())
-            validMask = Mat(pyramidDepth[0].size(), CV_8UC1, Scalar(255));
+        {
+            validMask.create(pyramidDepth[0].size(), CV_8UC1);
+            validMask.setTo(Scalar(255));
+        }
         else
-            validMask = mask.clone();
+            mask.copyTo(validMask);
 
         buildPyramid(validMask, pyramidMask, (int)pyramidDepth.size() - 1);
 
         for(size_t i = 0; i < pyramidMask.size(); i++)
         {
-            Mat levelDepth = pyramidDepth[i].clone();
-            patchNaNs(levelDepth, 0);
-
+            const Mat& levelDepth = pyramidDepth[i];
             Mat& levelMask = pyramidMask[i];
-            levelMask &= (levelDepth > minDepth) & (levelDepth < maxDepth);
 
-            if(!pyramidNormal.empty())
+            const bool useNormals = !pyramidNormal.empty();
+            if(useNormals)
             {
                 CV_Assert(pyramidNormal[i].type() == CV_32FC3);
                 CV_Assert(pyramidNormal[i].size() == pyramidDepth[i].size());
-                Mat levelNormal = pyramidNormal[i].clone();
-
-                Mat validNormalMask = levelNormal == levelNormal; // otherwise it's Nan
-                CV_Assert(validNormalMask.type() == CV_8UC3);
-
-                std::vector<Mat> channelMasks;
-                split(validNormalMask, channelMasks);
-                validNormalMask = channelMasks[0] & channelMasks[1] & channelMasks[2];
+            }
 
-                levelMask &= validNormalMask;
+            for(int y = 0; y < levelMask.rows; y++)
+            {
+                const float* depth_row = levelDepth.ptr<float>(y);
+                const Vec3f* normals_row = useNormals ? pyramidNormal[i].ptr<Vec3f>(y) : 0;
+                uchar* mask_row = levelMask.ptr<uchar>(y);
+                for(int x = 0; x < levelMask.cols; x++)
+                {
+                    // comparisons with NaN are false, so NaN depth is rejected here
+                    float d = depth_row[x];
+                    bool valid = d > minDepth && d < maxDepth;
+                    if(useNormals)
+                    {
+                        const Vec3f& n = normals_row[x];
+                        valid = valid && !cvIsNaN(n[0]) && !cvIsNaN(n[1]) && !cvIsNaN(n[2]);
+                    }
+                    if(!valid)
+                        mask_row[x] = 0;
+                }
             }
         }
     }
 }
 
 static
-void preparePyramidCloud(const std::vector<Mat>& pyramidDepth, const Mat& cameraMatrix, std::vector<Mat>& pyramidCloud)
+void preparePyramidCloud(const std::vector<Mat>& pyramidDepth, const Mat& cameraMatrix, std::vector<Mat>& pyramidCloud,
+                         std::vector<Mat>& buffer)
 {
     if(!pyramidCloud.empty())
     {
@@ -217,18 +245,18 @@ void preparePyramidCloud(const std::vector<Mat>& pyramidDepth, const Mat& camera
         std::vector<Mat> pyramidCameraMatrix;
         buildPyramidCameraMatrix(cameraMatrix, (int)pyramidDepth.size(), pyramidCameraMatrix);
 
+        pyramidCloud.swap(buffer);
         pyramidCloud.resize(pyramidDepth.size());
         for(size_t i = 0; i < pyramidDepth.size(); i++)
         {
-            Mat cloud;
-            depthTo3d(pyramidDepth[i], pyramidCameraMatrix[i], cloud);
-            pyramidCloud[i] = cloud;
+            depthTo3d(pyramidDepth[i], pyramidCameraMatrix[i], pyramidCloud[i]);
         }
     }
 }
 
 static
-void preparePyramidSobel(const std::vector<Mat>& pyramidImage, int dx, int dy, std::vector<Mat>& pyramidSobel)
+void preparePyramidSobel(const std::vector<Mat>& pyramidImage, int dx, int dy, std::vector<Mat>& pyramidSobel,
+                         std::vector<Mat>& buffer)
 {
     if(!pyramidSobel.empty())
     {
@@ -243,6 +271,7 @@ void preparePyramidSobel(const std::vector<Mat>& pyramidImage, int dx, int dy, s
     }
     else
     {
+        pyramidSobel.swap(buffer);
         pyramidSobel.resize(pyramidImage.size());
         for(size_t i = 0; i < pyramidImage.size(); i++)
         {
@@ -259,29 +288,42 @@ void randomSubsetOfMask(Mat& mask, float part)
     const int needCount = std::max(minPointsCount, int(mask.total() * part));
     if(needCount < nonzeros)
     {
-        RNG rng;
-        Mat subset(mask.size(), CV_8UC1, Scalar(0));
+        // the subset is marked in place: 255 is a free point, 1 is a picked one
+        const uchar freePoint = 255, pickedPoint = 1;
+        for(int y = 0; y < mask.rows; y++)
+        {
+            uchar* mask_row = mask.ptr<uchar>(y);
+            for(int x = 0; x < mask.cols; x++)
+                mask_row[x] = mask_row[x] ? freePoint : 0;
+        }
 
+        RNG rng;
         int subsetSize = 0;
         while(subsetSize < needCount)
         {
             int y = rng(mask.rows);
             int x = rng(mask.cols);
-            if(mask.at<uchar>(y,x))
+            uchar& m = mask.at<uchar>(y,x);
+            if(m == freePoint)
             {
-                subset.at<uchar>(y,x) = 255;
-                mask.at<uchar>(y,x) = 0;
+                m = pickedPoint;
                 subsetSize++;
             }
         }
-        mask = subset;
+
+        for(int y = 0; y < mask.rows; y++)
+        {
+            uchar* mask_row = mask.ptr<uchar>(y);
+            for(int x = 0; x < mask.cols; x++)
+                mask_row[x] = mask_row[x] == pickedPoint ? 255 : 0;
+        }
     }
 }
 
 static
 void preparePyramidTexturedMask(const std::vector<Mat>& pyramid_dI_dx, const std::vector<Mat>& pyramid_dI_dy,
                                 const std::vector<float>& minGradMagnitudes, const std::vector<Mat>& pyramidMask, double maxPointsPart,
-                                std::vector<Mat>& pyramidTexturedMask)
+                                std::vector<Mat>& pyramidTexturedMask, std::vector<Mat>& buffer)
 {
     if(!pyramidTexturedMask.empty())
     {
@@ -297,36 +339,39 @@ void preparePyramidTexturedMask(const std::vector<Mat>& pyramid_dI_dx, const std
     else
     {
         const float sobelScale2_inv = 1.f / (float)(sobelScale * sobelScale);
+        pyramidTexturedMask.swap(buffer);
         pyramidTexturedMask.resize(pyramid_dI_dx.size());
         for(size_t i = 0; i < pyramidTexturedMask.size(); i++)
         {
             const float minScaledGradMagnitude2 = minGradMagnitudes[i] * minGradMagnitudes[i] * sobelScale2_inv;
             const Mat& dIdx = pyramid_dI_dx[i];
             const Mat& dIdy = pyramid_dI_dy[i];
+            const Mat& levelMask = pyramidMask[i];
 
-            Mat texturedMask(dIdx.size(), CV_8UC1, Scalar(0));
+            Mat& texturedMask = pyramidTexturedMask[i];
+            texturedMask.create(dIdx.size(), CV_8UC1);
 
             for(int y = 0; y < dIdx.rows; y++)
             {
                 const short *dIdx_row = dIdx.ptr<short>(y);
                 const short *dIdy_row = dIdy.ptr<short>(y);
+                const uchar *mask_row = levelMask.ptr<uchar>(y);
                 uchar *texturedMask_row = texturedMask.ptr<uchar>(y);
                 for(int x = 0; x < dIdx.cols; x++)
                 {
                     float magnitude2 = static_cast<float>(dIdx_row[x] * dIdx_row[x] + dIdy_row[x] * dIdy_row[x]);
-                    if(magnitude2 >= minScaledGradMagnitude2)
-                        texturedMask_row[x] = 255;
+                    texturedMask_row[x] = magnitude2 >= minScaledGradMagnitude2 ? mask_row[x] : 0;
                 }
             }
-            pyramidTexturedMask[i] = texturedMask & pyramidMask[i];
 
-            randomSubsetOfMask(pyramidTexturedMask[i], (float)maxPointsPart);
+            randomSubsetOfMask(texturedMask, (float)maxPointsPart);
         }
     }
 }
 
 static
-void preparePyramidNormals(const Mat& normals, const std::vector<Mat>& pyramidDepth, std::vector<Mat>& pyramidNormals)
+void preparePyramidNormals(const Mat& normals, const std::vector<Mat>& pyramidDepth, std::vector<Mat>& pyramidNormals,
+                           std::vector<Mat>& buffer)
 {
     if(!pyramidNormals.empty())
     {
@@ -341,6 +386,7 @@ void preparePyramidNormals(const Mat& normals, const std::vector<Mat>& pyramidDe
     }
     else
     {
+        pyramidNormals.swap(buffer);
         buildPyramid(normals, pyramidNormals, (int)pyramidDepth.size() - 1);
         // renormalize normals
         for(size_t i = 1; i < pyramidNormals.size(); i++)
@@ -361,7 +407,7 @@ void preparePyramidNormals(const Mat& normals, const std::vector<Mat>& pyramidDe
 
 static
 void preparePyramidNormalsMask(const std::vector<Mat>& pyramidNormals, const std::vector<Mat>& pyramidMask, double maxPointsPart,
-                               std::vector<Mat>& pyramidNormalsMask)
+                               std::vector<Mat>& pyramidNormalsMask, std::vector<Mat>& buffer)
 {
     if(!pyramidNormalsMask.empty())
     {
@@ -376,11 +422,12 @@ void preparePyramidNormalsMask(const std::vector<Mat>& pyramidNormals, const std
     }
     else
     {
+        pyramidNormalsMask.swap(buffer);
         pyramidNormalsMask.resize(pyramidMask.size());
 
         for(size_t i = 0; i < pyramidNormalsMask.size(); i++)
         {
-            pyramidNormalsMask[i] = pyramidMask[i].clone();
+            pyramidMask[i].copyTo(pyramidNormalsMask[i]);
             Mat& normalsMask = pyramidNormalsMask[i];
             for(int y = 0; y < normalsMask.rows; y++)
             {
@@ -444,8 +491,6 @@ void computeCorresps(const Mat& K, const Mat& K_inv, const Mat& Rt,
     CV_Assert(K_inv.type() == CV_64FC1);
     CV_Assert(Rt.type() == CV_64FC1);
 
-    Mat corresps(depth1.size(), CV_16SC2, Scalar::all(-1));
-
     Rect r(0, 0, depth1.cols, depth1.rows);
     Mat Kt = Rt(Rect(3,0,1,3)).clone();
     Kt = K * Kt;
@@ -478,67 +523,96 @@ void computeCorresps(const Mat& K, const Mat& K_inv, const Mat& Rt,
         }
     }
 
-    int correspCount = 0;
-    for(int v1 = 0; v1 < depth1.rows; v1++)
+    //! Several points of depth1 can project to the same pixel of depth0, the nearest one is kept.
+    //! The keys pack the projected depth above the inverted index of the point and are reduced
+    //! with an atomic min, so that on equal depths the last point in scan order wins as before
+    const int cols = depth1.cols;
+    const uint64 emptyKey = std::numeric_limits<uint64>::max();
+    std::vector<std::atomic<uint64>> nearestKeys(depth1.total());
+
+    parallel_for_(Range(0, depth1.rows), [&](const Range& range)
     {
-        const float *depth1_row = depth1.ptr<float>(v1);
-        const uchar *mask1_row = selectMask1.ptr<uchar>(v1);
-        for(int u1 = 0; u1 < depth1.cols; u1++)
+        for(int v0 = range.start; v0 < range.end; v0++)
+            for(int u0 = 0; u0 < cols; u0++)
+                nearestKeys[v0 * cols + u0].store(emptyKey, std::memory_order_relaxed);
+    });
+
+    parallel_for_(Range(0, depth1.rows), [&](const Range& range)
+    {
+        for(int v1 = range.start; v1 < range.end; v1++)
         {
-            float d1 = depth1_row[u1];
-            if(mask1_row[u1])
+            const float *depth1_row = depth1.ptr<float>(v1);
+            const uchar *mask1_row = selectMask1.ptr<uchar>(v1);
+            for(int u1 = 0; u1 < cols; u1++)
             {
+                if(!mask1_row[u1])
+                    continue;
+
+                float d1 = depth1_row[u1];
                 CV_DbgAssert(!cvIsNaN(d1));
                 float transformed_d1 = static_cast<float>(d1 * (KRK_inv6_u1[u1] + KRK_inv7_v1_plus_KRK_inv8[v1]) +
                                                           Kt_ptr[2]);
-                if(transformed_d1 > 0)
-                {
-                    float transformed_d1_inv = 1.f / transformed_d1;
-                    int u0 = cvRound(transformed_d1_inv * (d1 * (KRK_inv0_u1[u1] + KRK_inv1_v1_plus_KRK_inv2[v1]) +
-                                                           Kt_ptr[0]));
-                    int v0 = cvRound(transformed_d1_inv * (d1 * (KRK_inv3_u1[u1] + KRK_inv4_v1_plus_KRK_inv5[v1]) +
-                                                           Kt_ptr[1]));
-
-                    if(r.contains(Point(u0,v0)))
-                    {
-                        float d0 = depth0.at<float>(v0,u0);
-                        if(validMask0.at<uchar>(v0, u0) && std::abs(transformed_d1 - d0) <= maxDepthDiff)
-                        {
-                            CV_DbgAssert(!cvIsNaN(d0));
-                            Vec2s& c = corresps.at<Vec2s>(v0,u0);
-                            if(c[0] != -1)
-                            {
-                                int exist_u1 = c[0], exist_v1 = c[1];
-
-                                float exist_d1 = (float)(depth1.at<float>(exist_v1,exist_u1) *
-                                    (KRK_inv6_u1[exist_u1] + KRK_inv7_v1_plus_KRK_inv8[exist_v1]) + Kt_ptr[2]);
-
-                                if(transformed_d1 > exist_d1)
-                                    continue;
-                            }
-                            else
-                                correspCount++;
-
-                            c = Vec2s((short)u1, (short)v1);
-                        }
-                    }
-                }
+                if(transformed_d1 <= 0)
+                    continue;
+
+                float transformed_d1_inv = 1.f / transformed_d1;
+                int u0 = cvRound(transformed_d1_inv * (d1 * (KRK_inv0_u1[u1] + KRK_inv1_v1_plus_KRK_inv2[v1]) +
+                                                       Kt_ptr[0]));
+                int v0 = cvRound(transformed_d1_inv * (d1 * (KRK_inv3_u1[u1] + KRK_inv4_v1_plus_KRK_inv5[v1]) +
+                                                       Kt_ptr[1]));
+                if(!r.contains(Point(u0,v0)))
+                    continue;
+
+                float d0 = depth0.at<float>(v0,u0);
+                if(!validMask0.at<uchar>(v0, u0) || std::abs(transformed_d1 - d0) > maxDepthDiff)
+                    continue;
+                CV_DbgAssert(!cvIsNaN(d0));
+
+                // positive floats compare the same way as their bit patterns
+                Cv32suf depthBits;
+                depthBits.f = transformed_d1;
+                uint64 key = ((uint64)depthBits.u << 32) | (uint64)(~(unsigned)(v1 * cols + u1));
+
+                std::atomic<uint64>& nearest = nearestKeys[v0 * cols + u0];
+                uint64 prev = nearest.load(std::memory_order_relaxed);
+                while(key < prev && !nearest.compare_exchange_weak(prev, key, std::memory_order_relaxed))
+                    ;
             }
         }
-    }
+    });
 
-    _corresps.create(correspCount, 1, CV_32SC4);
+    std::vector<int> rowOffsets(depth1.rows + 1, 0);
+    parallel_for_(Range(0, depth1.rows), [&](const Range& range)
+    {
+        for(int v0 = range.start; v0 < range.end; v0++)
+        {
+            int count = 0;
+            for(int u0 = 0; u0 < cols; u0++)
+                count += nearestKeys[v0 * cols + u0].load(std::memory_order_relaxed) != emptyKey;
+            rowOffsets[v0 + 1] = count;
+        }
+    });
+    for(int v0 = 0; v0 < depth1.rows; v0++)
+        rowOffsets[v0 + 1] += rowOffsets[v0];
+
+    _corresps.create(rowOffsets.back(), 1, CV_32SC4);
     Vec4i * corresps_ptr = _corresps.ptr<Vec4i>();
-    for(int v0 = 0, i = 0; v0 < corresps.rows; v0++)
+    parallel_for_(Range(0, depth1.rows), [&](const Range& range)
     {
-        const Vec2s* corresps_row = corresps.ptr<Vec2s>(v0);
-        for(int u0 = 0; u0 < corresps.cols; u0++)
+        for(int v0 = range.start; v0 < range.end; v0++)
         {
-            const Vec2s& c = corresps_row[u0];
-            if(c[0] != -1)
-                corresps_ptr[i++] = Vec4i(u0,v0,c[0],c[1]);
+            int i = rowOffsets[v0];
+            for(int u0 = 0; u0 < cols; u0++)
+            {
+                uint64 key = nearestKeys[v0 * cols + u0].load(std::memory_order_relaxed);
+                if(key != emptyKey)
+                {
+                    int idx = (int)(~(unsigned)(key & 0xffffffff));
+                    corresps_ptr[i++] = Vec4i(u0, v0, idx % cols, idx / cols);
+                }
+            }
         }
-    }
+    });
 }
 
 static inline
@@ -614,6 +688,45 @@ void calcICPEquationCoeffsTranslation(double* C, const Point3f& /*p0*/, const Ve
 typedef
 void (*CalcICPEquationCoeffsPtr)(double*, const Point3f&, const Vec3f&);
 
+//! Adds a*a^T to the upper triangle of a row-major dim x dim matrix with rows of 6 elements
+static inline
+void addOuterProduct(double* AtA, const double* a, int dim)
+{
+#if CV_SIMD128_64F
+    if(dim == 6)
+    {
+        // whole rows are cheaper than the triangle in pairs of lanes
+        const v_float64x2 a01 = v_load(a), a23 = v_load(a + 2), a45 = v_load(a + 4);
+        for(int y = 0; y < 6; y++)
+        {
+            double* row = AtA + y * 6;
+            const v_float64x2 ay = v_setall_f64(a[y]);
+            v_store(row,     v_muladd(ay, a01, v_load(row)));
+            v_store(row + 2, v_muladd(ay, a23, v_load(row + 2)));
+            v_store(row + 4, v_muladd(ay, a45, v_load(row + 4)));
+        }
+        return;
+    }
+#endif
+    for(int y = 0; y < dim; y++)
+        for(int x = y; x < dim; x++)
+            AtA[y * 6 + x] += a[y] * a[x];
+}
+
+//! Accumulates the partial sums of a thread into the normal equations
+static inline
+void addLsmPart(Mat& AtA, Mat& AtB, const Matx66d& partAtA, const Vec6d& partAtB, int transformDim)
+{
+    double* AtB_ptr = AtB.ptr<double>();
+    for(int y = 0; y < transformDim; y++)
+    {
+        double* AtA_ptr = AtA.ptr<double>(y);
+        for(int x = y; x < transformDim; x++)
+            AtA_ptr[x] += partAtA(y, x);
+        AtB_ptr[y] += partAtB[y];
+    }
+}
+
 static
 void calcRgbdLsmMatrices(const Mat& image0, const Mat& cloud0, const Mat& Rt,
                const Mat& image1, const Mat& dI_dx1, const Mat& dI_dy1,
@@ -622,7 +735,6 @@ void calcRgbdLsmMatrices(const Mat& image0, const Mat& cloud0, const Mat& Rt,
 {
     AtA = Mat(transformDim, transformDim, CV_64FC1, Scalar(0));
     AtB = Mat(transformDim, 1, CV_64FC1, Scalar(0));
-    double* AtB_ptr = AtB.ptr<double>();
 
     const int correspsCount = corresps.rows;
 
@@ -634,53 +746,60 @@ void calcRgbdLsmMatrices(const Mat& image0, const Mat& cloud0, const Mat& Rt,
 
     const Vec4i* corresps_ptr = corresps.ptr<Vec4i>();
 
+    Mutex mutex;
     double sigma = 0;
-    for(int correspIndex = 0; correspIndex < corresps.rows; correspIndex++)
+    parallel_for_(Range(0, correspsCount), [&](const Range& range)
     {
-         const Vec4i& c = corresps_ptr[correspIndex];
-         int u0 = c[0], v0 = c[1];
-         int u1 = c[2], v1 = c[3];
+        double partSigma = 0;
+        for(int correspIndex = range.start; correspIndex < range.end; correspIndex++)
+        {
+             const Vec4i& c = corresps_ptr[correspIndex];
+             int u0 = c[0], v0 = c[1];
+             int u1 = c[2], v1 = c[3];
 
-         diffs_ptr[correspIndex] = static_cast<float>(static_cast<int>(image0.at<uchar>(v0,u0)) -
-                                                      static_cast<int>(image1.at<uchar>(v1,u1)));
-         sigma += diffs_ptr[correspIndex] * diffs_ptr[correspIndex];
-    }
+             diffs_ptr[correspIndex] = static_cast<float>(static_cast<int>(image0.at<uchar>(v0,u0)) -
+                                                          static_cast<int>(image1.at<uchar>(v1,u1)));
+             partSigma += diffs_ptr[correspIndex] * diffs_ptr[correspIndex];
+        }
+        AutoLock al(mutex);
+        sigma += partSigma;
+    });
     sigma = std::sqrt(sigma/correspsCount);
 
-    std::vector<double> A_buf(transformDim);
-    double* A_ptr = &A_buf[0];
-
-    for(int correspIndex = 0; correspIndex < corresps.rows; correspIndex++)
+    parallel_for_(Range(0, correspsCount), [&](const Range& range)
     {
-         const Vec4i& c = corresps_ptr[correspIndex];
-         int u0 = c[0], v0 = c[1];
-         int u1 = c[2], v1 = c[3];
-
-         double w = sigma + std::abs(diffs_ptr[correspIndex]);
-         w = w > DBL_EPSILON ? 1./w : 1.;
+        Matx66d partAtA = Matx66d::zeros();
+        Vec6d partAtB = Vec6d::all(0);
+        double A_ptr[6];
+        for(int correspIndex = range.start; correspIndex < range.end; correspIndex++)
+        {
+             const Vec4i& c = corresps_ptr[correspIndex];
+             int u0 = c[0], v0 = c[1];
+             int u1 = c[2], v1 = c[3];
 
-         double w_sobelScale = w * sobelScaleIn;
+             double w = sigma + std::abs(diffs_ptr[correspIndex]);
+             w = w > DBL_EPSILON ? 1./w : 1.;
 
-         const Point3f& p0 = cloud0.at<Point3f>(v0,u0);
-         Point3f tp0;
-         tp0.x = (float)(p0.x * Rt_ptr[0] + p0.y * Rt_ptr[1] + p0.z * Rt_ptr[2] + Rt_ptr[3]);
-         tp0.y = (float)(p0.x * Rt_ptr[4] + p0.y * Rt_ptr[5] + p0.z * Rt_ptr[6] + Rt_ptr[7]);
-         tp0.z = (float)(p0.x * Rt_ptr[8] + p0.y * Rt_ptr[9] + p0.z * Rt_ptr[10] + Rt_ptr[11]);
+             double w_sobelScale = w * sobelScaleIn;
 
-         func(A_ptr,
-              w_sobelScale * dI_dx1.at<short int>(v1,u1),
-              w_sobelScale * dI_dy1.at<short int>(v1,u1),
-              tp0, fx, fy);
+             const Point3f& p0 = cloud0.at<Point3f>(v0,u0);
+             Point3f tp0;
+             tp0.x = (float)(p0.x * Rt_ptr[0] + p0.y * Rt_ptr[1] + p0.z * Rt_ptr[2] + Rt_ptr[3]);
+             tp0.y = (float)(p0.x * Rt_ptr[4] + p0.y * Rt_ptr[5] + p0.z * Rt_ptr[6] + Rt_ptr[7]);
+             tp0.z = (float)(p0.x * Rt_ptr[8] + p0.y * Rt_ptr[9] + p0.z * Rt_ptr[10] + Rt_ptr[11]);
 
-        for(int y = 0; y < transformDim; y++)
-        {
-            double* AtA_ptr = AtA.ptr<double>(y);
-            for(int x = y; x < transformDim; x++)
-                AtA_ptr[x] += A_ptr[y] * A_ptr[x];
+             func(A_ptr,
+                  w_sobelScale * dI_dx1.at<short int>(v1,u1),
+                  w_sobelScale * dI_dy1.at<short int>(v1,u1),
+                  tp0, fx, fy);
 
-            AtB_ptr[y] += A_ptr[y] * w * diffs_ptr[correspIndex];
+             addOuterProduct(partAtA.val, A_ptr, transformDim);
+             for(int y = 0; y < transformDim; y++)
+                 partAtB[y] += A_ptr[y] * w * diffs_ptr[correspIndex];
         }
-    }
+        AutoLock al(mutex);
+        addLsmPart(AtA, AtB, partAtA, partAtB, transformDim);
+    });
 
     for(int y = 0; y < transformDim; y++)
         for(int x = y+1; x < transformDim; x++)
@@ -695,7 +814,6 @@ void calcICPLsmMatrices(const Mat& cloud0, const Mat& Rt,
 {
     AtA = Mat(transformDim, transformDim, CV_64FC1, Scalar(0));
     AtB = Mat(transformDim, 1, CV_64FC1, Scalar(0));
-    double* AtB_ptr = AtB.ptr<double>();
 
     const int correspsCount = corresps.rows;
 
@@ -710,50 +828,58 @@ void calcICPLsmMatrices(const Mat& cloud0, const Mat& Rt,
 
     const Vec4i* corresps_ptr = corresps.ptr<Vec4i>();
 
+    Mutex mutex;
     double sigma = 0;
-    for(int correspIndex = 0; correspIndex < corresps.rows; correspIndex++)
+    parallel_for_(Range(0, correspsCount), [&](const Range& range)
     {
-        const Vec4i& c = corresps_ptr[correspIndex];
-        int u0 = c[0], v0 = c[1];
-        int u1 = c[2], v1 = c[3];
-
-        const Point3f& p0 = cloud0.at<Point3f>(v0,u0);
-        Point3f tp0;
-        tp0.x = (float)(p0.x * Rt_ptr[0] + p0.y * Rt_ptr[1] + p0.z * Rt_ptr[2] + Rt_ptr[3]);
-        tp0.y = (float)(p0.x * Rt_ptr[4] + p0.y * Rt_ptr[5] + p0.z * Rt_ptr[6] + Rt_ptr[7]);
-        tp0.z = (float)(p0.x * Rt_ptr[8] + p0.y * Rt_ptr[9] + p0.z * Rt_ptr[10] + Rt_ptr[11]);
-
-        Vec3f n1 = normals1.at<Vec3f>(v1, u1);
-        Point3f v = cloud1.at<Point3f>(v1,u1) - tp0;
-
-        tps0_ptr[correspIndex] = tp0;
-        diffs_ptr[correspIndex] = n1[0] * v.x + n1[1] * v.y + n1[2] * v.z;
-        sigma += diffs_ptr[correspIndex] * diffs_ptr[correspIndex];
-    }
+        double partSigma = 0;
+        for(int correspIndex = range.start; correspIndex < range.end; correspIndex++)
+        {
+            const Vec4i& c = corresps_ptr[correspIndex];
+            int u0 = c[0], v0 = c[1];
+            int u1 = c[2], v1 = c[3];
+
+            const Point3f& p0 = cloud0.at<Point3f>(v0,u0);
+            Point3f tp0;
+            tp0.x = (float)(p0.x * Rt_ptr[0] + p0.y * Rt_ptr[1] + p0.z * Rt_ptr[2] + Rt_ptr[3]);
+            tp0.y = (float)(p0.x * Rt_ptr[4] + p0.y * Rt_ptr[5] + p0.z * Rt_ptr[6] + Rt_ptr[7]);
+            tp0.z = (float)(p0.x * Rt_ptr[8] + p0.y * Rt_ptr[9] + p0.z * Rt_ptr[10] + Rt_ptr[11]);
+
+            Vec3f n1 = normals1.at<Vec3f>(v1, u1);
+            Point3f v = cloud1.at<Point3f>(v1,u1) - tp0;
+
+            tps0_ptr[correspIndex] = tp0;
+            diffs_ptr[correspIndex] = n1[0] * v.x + n1[1] * v.y + n1[2] * v.z;
+            partSigma += diffs_ptr[correspIndex] * diffs_ptr[correspIndex];
+        }
+        AutoLock al(mutex);
+        sigma += partSigma;
+    });
 
     sigma = std::sqrt(sigma/correspsCount);
 
-    std::vector<double> A_buf(transformDim);
-    double* A_ptr = &A_buf[0];
-    for(int correspIndex = 0; correspIndex < corresps.rows; correspIndex++)
+    parallel_for_(Range(0, correspsCount), [&](const Range& range)
     {
-        const Vec4i& c = corresps_ptr[correspIndex];
-        int u1 = c[2], v1 = c[3];
-
-        double w = sigma + std::abs(diffs_ptr[correspIndex]);
-        w = w > DBL_EPSILON ? 1./w : 1.;
+        Matx66d partAtA = Matx66d::zeros();
+        Vec6d partAtB = Vec6d::all(0);
+        double A_ptr[6];
+        for(int correspIndex = range.start; correspIndex < range.end; correspIndex++)
+        {
+            const Vec4i& c = corresps_ptr[correspIndex];
+            int u1 = c[2], v1 = c[3];
 
-        func(A_ptr, tps0_ptr[correspIndex], normals1.at<Vec3f>(v1, u1) * w);
+            double w = sigma + std::abs(diffs_ptr[correspIndex]);
+            w = w > DBL_EPSILON ? 1./w : 1.;
 
-        for(int y = 0; y < transformDim; y++)
-        {
-            double* AtA_ptr = AtA.ptr<double>(y);
-            for(int x = y; x < transformDim; x++)
-                AtA_ptr[x] += A_ptr[y] * A_ptr[x];
+            func(A_ptr, tps0_ptr[correspIndex], normals1.at<Vec3f>(v1, u1) * w);
 
-            AtB_ptr[y] += A_ptr[y] * w * diffs_ptr[correspIndex];
+            addOuterProduct(partAtA.val, A_ptr, transformDim);
+            for(int y = 0; y < transformDim; y++)
+                partAtB[y] += A_ptr[y] * w * diffs_ptr[correspIndex];
         }
-    }
+        AutoLock al(mutex);
+        addLsmPart(AtA, AtB, partAtA, partAtB, transformDim);
+    });
 
     for(int y = 0; y < transformDim; y++)
         for(int x = y+1; x < transformDim; x++)
@@ -1037,6 +1163,55 @@ void OdometryFrame::releasePyramids()
 
     pyramidNormals.clear();
     pyramidNormalsMask.clear();
+
+    for(int i = 0; i < PYR_COUNT; i++)
+        pyramidBuffers[i].clear();
+    normalsBuffer.release();
+}
+
+// Only the memory owned by the frame alone is kept, so that a data shared with user is never overwritten
+static
+void recycleMat(Mat& m, Mat& buffer)
+{
+    if(m.u && m.u->refcount == 1)
+        buffer = m;
+    m.release();
+}
+
+static
+void recyclePyramid(std::vector<Mat>& pyramid, std::vector<Mat>& buffer)
+{
+    if(pyramid.empty())
+        return;
+
+    buffer.resize(pyramid.size());
+    for(size_t i = 0; i < pyramid.size(); i++)
+        recycleMat(pyramid[i], buffer[i]);
+    pyramid.clear();
+}
+
+void OdometryFrame::recycle()
+{
+    ID = -1;
+    image.release();
+    depth.release();
+    mask.release();
+
+    recyclePyramid(pyramidImage, pyramidBuffers[PYR_IMAGE]);
+    recyclePyramid(pyramidDepth, pyramidBuffers[PYR_DEPTH]);
+    recyclePyramid(pyramidMask, pyramidBuffers[PYR_MASK]);
+
+    recyclePyramid(pyramidCloud, pyramidBuffers[PYR_CLOUD]);
+
+    recyclePyramid(pyramid_dI_dx, pyramidBuffers[PYR_DIX]);
+    recyclePyramid(pyramid_dI_dy, pyramidBuffers[PYR_DIY]);
+    recyclePyramid(pyramidTexturedMask, pyramidBuffers[PYR_TEXMASK]);
+
+    recyclePyramid(pyramidNormals, pyramidBuffers[PYR_NORM]);
+    recyclePyramid(pyramidNormalsMask, pyramidBuffers[PYR_NORMMASK]);
+
+    // level 0 of normals pyramid shares the data with normals
+    recycleMat(normals, normalsBuffer);
 }
 
 bool Odometry::compute(const Mat& srcImage, const Mat& srcDepth, const Mat& srcMask,
@@ -1158,22 +1333,23 @@ Size RgbdOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType) c
         frame->mask = frame->pyramidMask[0];
     checkMask(frame->mask, frame->image.size());
 
-    preparePyramidImage(frame->image, frame->pyramidImage, iterCounts.total());
+    preparePyramidImage(frame->image, frame->pyramidImage, iterCounts.total(), frame->pyramidBuffers[OdometryFrame::PYR_IMAGE]);
 
-    preparePyramidDepth(frame->depth, frame->pyramidDepth, iterCounts.total());
+    preparePyramidDepth(frame->depth, frame->pyramidDepth, iterCounts.total(), frame->pyramidBuffers[OdometryFrame::PYR_DEPTH]);
 
     preparePyramidMask(frame->mask, frame->pyramidDepth, (float)minDepth, (float)maxDepth,
-                       frame->pyramidNormals, frame->pyramidMask);
+                       frame->pyramidNormals, frame->pyramidMask, frame->pyramidBuffers[OdometryFrame::PYR_MASK]);
 
     if(cacheType & OdometryFrame::CACHE_SRC)
-        preparePyramidCloud(frame->pyramidDepth, cameraMatrix, frame->pyramidCloud);
+        preparePyramidCloud(frame->pyramidDepth, cameraMatrix, frame->pyramidCloud, frame->pyramidBuffers[OdometryFrame::PYR_CLOUD]);
 
     if(cacheType & OdometryFrame::CACHE_DST)
     {
-        preparePyramidSobel(frame->pyramidImage, 1, 0, frame->pyramid_dI_dx);
-        preparePyramidSobel(frame->pyramidImage, 0, 1, frame->pyramid_dI_dy);
+        preparePyramidSobel(frame->pyramidImage, 1, 0, frame->pyramid_dI_dx, frame->pyramidBuffers[OdometryFrame::PYR_DIX]);
+        preparePyramidSobel(frame->pyramidImage, 0, 1, frame->pyramid_dI_dy, frame->pyramidBuffers[OdometryFrame::PYR_DIY]);
         preparePyramidTexturedMask(frame->pyramid_dI_dx, frame->pyramid_dI_dy, minGradientMagnitudes,
-                                   frame->pyramidMask, maxPointsPart, frame->pyramidTexturedMask);
+                                   frame->pyramidMask, maxPointsPart, frame->pyramidTexturedMask,
+                                   frame->pyramidBuffers[OdometryFrame::PYR_TEXMASK]);
     }
 
     return frame->image.size();
@@ -1243,9 +1419,9 @@ Size ICPOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType) co
         frame->mask = frame->pyramidMask[0];
     checkMask(frame->mask, frame->depth.size());
 
-    preparePyramidDepth(frame->depth, frame->pyramidDepth, iterCounts.total());
+    preparePyramidDepth(frame->depth, frame->pyramidDepth, iterCounts.total(), frame->pyramidBuffers[OdometryFrame::PYR_DEPTH]);
 
-    preparePyramidCloud(frame->pyramidDepth, cameraMatrix, frame->pyramidCloud);
+    preparePyramidCloud(frame->pyramidDepth, cameraMatrix, frame->pyramidCloud, frame->pyramidBuffers[OdometryFrame::PYR_CLOUD]);
 
     if(cacheType & OdometryFrame::CACHE_DST)
     {
@@ -1266,21 +1442,23 @@ Size ICPOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType) co
                                                           normalWinSize,
                                                           normalMethod);
 
+                std::swap(frame->normals, frame->normalsBuffer);
                 (*normalsComputer)(frame->pyramidCloud[0], frame->normals);
             }
         }
         checkNormals(frame->normals, frame->depth.size());
 
-        preparePyramidNormals(frame->normals, frame->pyramidDepth, frame->pyramidNormals);
+        preparePyramidNormals(frame->normals, frame->pyramidDepth, frame->pyramidNormals, frame->pyramidBuffers[OdometryFrame::PYR_NORM]);
 
         preparePyramidMask(frame->mask, frame->pyramidDepth, (float)minDepth, (float)maxDepth,
-                           frame->pyramidNormals, frame->pyramidMask);
+                           frame->pyramidNormals, frame->pyramidMask, frame->pyramidBuffers[OdometryFrame::PYR_MASK]);
 
-        preparePyramidNormalsMask(frame->pyramidNormals, frame->pyramidMask, maxPointsPart, frame->pyramidNormalsMask);
+        preparePyramidNormalsMask(frame->pyramidNormals, frame->pyramidMask, maxPointsPart, frame->pyramidNormalsMask,
+                                  frame->pyramidBuffers[OdometryFrame::PYR_NORMMASK]);
     }
     else
         preparePyramidMask(frame->mask, frame->pyramidDepth, (float)minDepth, (float)maxDepth,
-                           frame->pyramidNormals, frame->pyramidMask);
+                           frame->pyramidNormals, frame->pyramidMask, frame->pyramidBuffers[OdometryFrame::PYR_MASK]);
 
     return frame->depth.size();
 }
@@ -1362,11 +1540,11 @@ Size RgbdICPOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType
         frame->mask = frame->pyramidMask[0];
     checkMask(frame->mask, frame->image.size());
 
-    preparePyramidImage(frame->image, frame->pyramidImage, iterCounts.total());
+    preparePyramidImage(frame->image, frame->pyramidImage, iterCounts.total(), frame->pyramidBuffers[OdometryFrame::PYR_IMAGE]);
 
-    preparePyramidDepth(frame->depth, frame->pyramidDepth, iterCounts.total());
+    preparePyramidDepth(frame->depth, frame->pyramidDepth, iterCounts.total(), frame->pyramidBuffers[OdometryFrame::PYR_DEPTH]);
 
-    preparePyramidCloud(frame->pyramidDepth, cameraMatrix, frame->pyramidCloud);
+    preparePyramidCloud(frame->pyramidDepth, cameraMatrix, frame->pyramidCloud, frame->pyramidBuffers[OdometryFrame::PYR_CLOUD]);
 
     if(cacheType & OdometryFrame::CACHE_DST)
     {
@@ -1387,27 +1565,29 @@ Size RgbdICPOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType
                                                           normalWinSize,
                                                           normalMethod);
 
+                std::swap(frame->normals, frame->normalsBuffer);
                 (*normalsComputer)(frame->pyramidCloud[0], frame->normals);
             }
         }
         checkNormals(frame->normals, frame->depth.size());
 
-        preparePyramidNormals(frame->normals, frame->pyramidDepth, frame->pyramidNormals);
+        preparePyramidNormals(frame->normals, frame->pyramidDepth, frame->pyramidNormals, frame->pyramidBuffers[OdometryFrame::PYR_NORM]);
 
         preparePyramidMask(frame->mask, frame->pyramidDepth, (float)minDepth, (float)maxDepth,
-                           frame->pyramidNormals, frame->pyramidMask);
+                           frame->pyramidNormals, frame->pyramidMask, frame->pyramidBuffers[OdometryFrame::PYR_MASK]);
 
-        preparePyramidSobel(frame->pyramidImage, 1, 0, frame->pyramid_dI_dx);
-        preparePyramidSobel(frame->pyramidImage, 0, 1, frame->pyramid_dI_dy);
+        preparePyramidSobel(frame->pyramidImage, 1, 0, frame->pyramid_dI_dx, frame->pyramidBuffers[OdometryFrame::PYR_DIX]);
+        preparePyramidSobel(frame->pyramidImage, 0, 1, frame->pyramid_dI_dy, frame->pyramidBuffers[OdometryFrame::PYR_DIY]);
         preparePyramidTexturedMask(frame->pyramid_dI_dx, frame->pyramid_dI_dy,
                                    minGradientMagnitudes, frame->pyramidMask,
-                                   maxPointsPart, frame->pyramidTexturedMask);
+                                   maxPointsPart, frame->pyramidTexturedMask, frame->pyramidBuffers[OdometryFrame::PYR_TEXMASK]);
 
-        preparePyramidNormalsMask(frame->pyramidNormals, frame->pyramidMask, maxPointsPart, frame->pyramidNormalsMask);
+        preparePyramidNormalsMask(frame->pyramidNormals, frame->pyramidMask, maxPointsPart, frame->pyramidNormalsMask,
+                                  frame->pyramidBuffers[OdometryFrame::PYR_NORMMASK]);
     }
     else
         preparePyramidMask(frame->mask, frame->pyramidDepth, (float)minDepth, (float)maxDepth,
-                           frame->pyramidNormals, frame->pyramidMask);
+                           frame->pyramidNormals, frame->pyramidMask, frame->pyramidBuffers[OdometryFrame::PYR_MASK]);
 
     return frame->image.size();
 }
@@ -1493,6 +1673,10 @@ Size FastICPOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType
     Intr intr(cameraMatrix);
     float depthFactor = 1.f; // user should rescale depth manually
     float truncateThreshold = 0.f; // disabled
+    if(frame->pyramidCloud.empty())
+        frame->pyramidCloud.swap(frame->pyramidBuffers[OdometryFrame::PYR_CLOUD]);
+    if(frame->pyramidNormals.empty())
+        frame->pyramidNormals.swap(frame->pyramidBuffers[OdometryFrame::PYR_NORM]);
     makeFrameFromDepth(frame->depth, frame->pyramidCloud, frame->pyramidNormals, intr, (int)iterCounts.total(),
                        depthFactor, sigmaDepth, sigmaSpatial, kernelSize, truncateThreshold);
 
@@ -216,58 +216,62 @@ public:
     n_.create(mini_rows, mini_cols);
     Q_.create(points3d.rows, points3d.cols);
     mse_.create(mini_rows, mini_cols);
-    for (int y = 0; y < mini_rows; ++y)
-      for (int x = 0; x < mini_cols; ++x)
-      {
-        // Update the tiles
-        Matx33f Q = Matx33f::zeros();
-        Vec3f m = Vec3f(0, 0, 0);
-        int K = 0;
-        for (int j = y * block_size; j < std::min((y + 1) * block_size, points3d.rows); ++j)
+    // The tiles are independent, fit them in parallel
+    parallel_for_(Range(0, mini_rows), [&](const Range& range)
+    {
+      for (int y = range.start; y < range.end; ++y)
+        for (int x = 0; x < mini_cols; ++x)
         {
-          const Vec3f * vec = points3d.ptr < Vec3f > (j, x * block_size), *vec_end;
-          float * pointpointt = reinterpret_cast<float*>(Q_.ptr < Vec<float, 9> > (j, x * block_size));
-          if (x == mini_cols - 1)
-            vec_end = points3d.ptr < Vec3f > (j, points3d.cols - 1) + 1;
-          else
-            vec_end = vec + block_size;
-          for (; vec != vec_end; ++vec, pointpointt += 9)
+          // Update the tiles
+          Matx33f Q = Matx33f::zeros();
+          Vec3f m = Vec3f(0, 0, 0);
+          int K = 0;
+          for (int j = y * block_size; j < std::min((y + 1) * block_size, points3d.rows); ++j)
           {
-            if (cvIsNaN(vec->val[0]))
-              continue;
-            // Fill point*point.t()
-            *pointpointt = vec->val[0] * vec->val[0];
-            *(pointpointt + 1) = vec->val[0] * vec->val[1];
-            *(pointpointt + 2) = vec->val[0] * vec->val[2];
-            *(pointpointt + 3) = *(pointpointt + 1);
-            *(pointpointt + 4) = vec->val[1] * vec->val[1];
-            *(pointpointt + 5) = vec->val[1] * vec->val[2];
-            *(pointpointt + 6) = *(pointpointt + 2);
-            *(pointpointt + 7) = *(pointpointt + 5);
-            *(pointpointt + 8) = vec->val[2] * vec->val[2];
-
-            Q += *reinterpret_cast<Matx33f*>(pointpointt);
-            m += (*vec);
-            ++K;
+            const Vec3f * vec = points3d.ptr < Vec3f > (j, x * block_size), *vec_end;
+            float * pointpointt = reinterpret_cast<float*>(Q_.ptr < Vec<float, 9> > (j, x * block_size));
+            if (x == mini_cols - 1)
+              vec_end = points3d.ptr < Vec3f > (j, points3d.cols - 1) + 1;
+            else
+              vec_end = vec + block_size;
+            for (; vec != vec_end; ++vec, pointpointt += 9)
+            {
+              if (cvIsNaN(vec->val[0]))
+                continue;
+              // Fill point*point.t()
+              *pointpointt = vec->val[0] * vec->val[0];
+              *(pointpointt + 1) = vec->val[0] * vec->val[1];
+              *(pointpointt + 2) = vec->val[0] * vec->val[2];
+              *(pointpointt + 3) = *(pointpointt + 1);
+              *(pointpointt + 4) = vec->val[1] * vec->val[1];
+              *(pointpointt + 5) = vec->val[1] * vec->val[2];
+              *(pointpointt + 6) = *(pointpointt + 2);
+              *(pointpointt + 7) = *(pointpointt + 5);
+              *(pointpointt + 8) = vec->val[2] * vec->val[2];
+
+              Q += *reinterpret_cast<Matx33f*>(pointpointt);
+              m += (*vec);
+              ++K;
+            }
+          }
+          if (K == 0)
+          {
+            mse_(y, x) = std::numeric_limits<float>::max();
+            continue;
           }
-        }
-        if (K == 0)
-        {
-          mse_(y, x) = std::numeric_limits<float>::max();
-          continue;
-        }
 
-        m /= K;
-        m_(y, x) = m;
+          m /= K;
+          m_(y, x) = m;
 
-        // Compute C
-        Matx33f C = Q - K * m * m.t();
+          // Compute C
+          Matx33f C = Q - K * m * m.t();
 
-        // Compute n
-        SVD svd(C);
-        n_(y, x) = Vec3f(svd.vt.at<float>(2, 0), svd.vt.at<float>(2, 1), svd.vt.at<float>(2, 2));
-        mse_(y, x) = svd.w.at<float>(2) / K;
-      }
+          // Compute n
+          SVD svd(C);
+          n_(y, x) = Vec3f(svd.vt.at<float>(2, 0), svd.vt.at<float>(2, 1), svd.vt.at<float>(2, 2));
+          mse_(y, x) = svd.w.at<float>(2) / K;
+        }
+    });
   }
 
   /** The size of the block */
@@ -342,6 +346,12 @@ public:
   {
     done_tiles_(y, x) = 1;
   }
+
+  bool
+  done(int y, int x) const
+  {
+    return done_tiles_(y, x) != 0;
+  }
 private:
   /** The list of tiles ordered from most planar to least */
   std::list<PlaneTile> tiles_;
@@ -510,7 +520,8 @@ private:
                      threshold_(threshold),
                      sensor_error_a_(sensor_error_a),
                      sensor_error_b_(sensor_error_b),
-                     sensor_error_c_(sensor_error_c)
+                     sensor_error_c_(sensor_error_c),
+                     use_previous_planes_(false)
   {}
 
   Ptr<RgbdPlane> RgbdPlane::create(int method, int block_size, int min_size, double threshold,
@@ -558,11 +569,49 @@ private:
     std::vector<Vec4f> plane_coefficients;
     float mse_min = (float)(threshold_ * threshold_);
 
-    while (!plane_queue.empty())
+    // Seed tiles from the previous planes: for each of them, the most planar tile lying on it
+    std::vector<TileQueue::PlaneTile> seeds;
+    if (use_previous_planes_)
+    {
+      Mat_<unsigned char> seeded = Mat_<unsigned char>::zeros(plane_grid.mse_.size());
+      for (size_t i = 0; i < previous_planes_.size(); ++i)
+      {
+        const Vec4f& prev = previous_planes_[i];
+        Vec3f prev_n(prev[0], prev[1], prev[2]);
+        int best_x = -1, best_y = -1;
+        float best_mse = mse_min;
+        for (int y = 0; y < plane_grid.mse_.rows; ++y)
+          for (int x = 0; x < plane_grid.mse_.cols; ++x)
+          {
+            float mse = plane_grid.mse_(y, x);
+            if (mse > best_mse || seeded(y, x))
+              continue;
+            if (std::abs(prev_n.dot(plane_grid.n_(y, x))) < 0.9f ||
+                std::abs(prev_n.dot(plane_grid.m_(y, x)) + prev[3]) > threshold_)
+              continue;
+            best_x = x;
+            best_y = y;
+            best_mse = mse;
+          }
+        if (best_x < 0)
+          continue;
+        seeded(best_y, best_x) = 1;
+        seeds.push_back(TileQueue::PlaneTile(best_x, best_y, best_mse));
+      }
+    }
+
+    size_t seed_index = 0;
+    while (index_plane < 255)
     {
-      // Get the first tile if it's good enough
-      const TileQueue::PlaneTile front_tile = plane_queue.front();
-      if (front_tile.mse_ > mse_min)
+      // Get the next seed which is not part of a plane yet, then the first tile if it's good enough
+      TileQueue::PlaneTile front_tile(0, 0, 0);
+      while (seed_index < seeds.size() && plane_queue.done(seeds[seed_index].y_, seeds[seed_index].x_))
+        ++seed_index;
+      if (seed_index < seeds.size())
+        front_tile = seeds[seed_index++];
+      else if (!plane_queue.empty() && plane_queue.front().mse_ <= mse_min)
+        front_tile = plane_queue.front();
+      else
         break;
 
       InlierFinder inlier_finder((float)threshold_, points3d, normals, (unsigned char)index_plane, block_size_);
@@ -614,13 +663,13 @@ private:
       }
 
       ++index_plane;
-      if (index_plane >= 255)
-        break;
       Vec4f coeffs(plane->n()[0], plane->n()[1], plane->n()[2], plane->d());
       if (coeffs(2) > 0)
         coeffs = -coeffs;
       plane_coefficients.push_back(coeffs);
-    };
+    }
+
+    previous_planes_ = plane_coefficients;
 
     // Fill the plane coefficients
     if (plane_coefficients.empty())
@@ -2,7 +2,9 @@
 // It is subject to the license terms in the LICENSE file found in the top-level directory
 // of this distribution and at http://opencv.org/license.html
 
+#include "precomp.hpp"
 #include "pose_graph.hpp"
+#include "sparse_block_matrix.hpp"
 
 #include <iostream>
 #include <limits>
@@ -25,54 +27,45 @@ bool PoseGraph::isValid() const
     if (numNodes <= 0 || numEdges <= 0)
         return false;
 
+    //! Since each node does not maintain its neighbor list
+    std::unordered_map<int, std::vector<int>> adjacentNodes;
+    for (const PoseGraphEdge& edge : edges)
+    {
+        adjacentNodes[edge.getSourceNodeId()].push_back(edge.getTargetNodeId());
+        adjacentNodes[edge.getTargetNodeId()].push_back(edge.getSourceNodeId());
+    }
+
     std::unordered_set<int> nodesVisited;
     std::vector<int> nodesToVisit;
 
     nodesToVisit.push_back(nodes.at(0).getId());
+    nodesVisited.insert(nodes.at(0).getId());
 
     bool isGraphConnected = false;
     while (!nodesToVisit.empty())
     {
         int currNodeId = nodesToVisit.back();
         nodesToVisit.pop_back();
-        std::cout << "Visiting node: " << currNodeId << "\n";
-        nodesVisited.insert(currNodeId);
-        // Since each node does not maintain its neighbor list
-        for (int i = 0; i < numEdges; i++)
+        for (int nextNodeId : adjacentNodes[currNodeId])
         {
-            const PoseGraphEdge& potentialEdge = edges.at(i);
-            int nextNodeId                     = -1;
-
-            if (potentialEdge.getSourceNodeId() == currNodeId)
-            {
-                nextNodeId = potentialEdge.getTargetNodeId();
-            }
-            else if (potentialEdge.getTargetNodeId() == currNodeId)
-            {
-                nextNodeId = potentialEdge.getSourceNodeId();
-            }
-            if (nextNodeId != -1)
-            {
-                std::cout << "Next node: " << nextNodeId << " " << nodesVisited.count(nextNodeId)
-                          << std::endl;
-                if (nodesVisited.count(nextNodeId) == 0)
-                {
-                    nodesToVisit.push_back(nextNodeId);
-                }
-            }
+            if (nodesVisited.insert(nextNodeId).second)
+                nodesToVisit.push_back(nextNodeId);
         }
     }
 
     isGraphConnected = (int(nodesVisited.size()) == numNodes);
     std::cout << "nodesVisited: " << nodesVisited.size()
               << " IsGraphConnected: " << isGraphConnected << std::endl;
+    std::unordered_set<int> nodeIds;
+    for (const PoseGraphNode& node : nodes)
+        nodeIds.insert(node.getId());
     bool invalidEdgeNode = false;
     for (int i = 0; i < numEdges; i++)
     {
         const PoseGraphEdge& edge = edges.at(i);
         // edges have spurious source/target nodes
-        if ((nodesVisited.count(edge.getSourceNodeId()) != 1) ||
-            (nodesVisited.count(edge.getTargetNodeId()) != 1))
+        if ((nodeIds.count(edge.getSourceNodeId()) != 1) ||
+            (nodeIds.count(edge.getTargetNodeId()) != 1))
         {
             invalidEdgeNode = true;
             break;
@@ -130,23 +123,244 @@ void Optimizer::createOptimizationProblem(PoseGraph& poseGraph, ceres::Problem&
 }
 #endif
 
-void Optimizer::optimize(PoseGraph& poseGraph)
+#if defined(HAVE_EIGEN)
+typedef Eigen::Matrix<double, 6, 1> Vector6d;
+typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+typedef std::vector<Pose3d, Eigen::aligned_allocator<Pose3d>> Pose3dVector;
+typedef std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d>> Matrix6dVector;
+
+static inline Eigen::Matrix3d skew(const Eigen::Vector3d& v)
 {
-    PoseGraph poseGraphOriginal = poseGraph;
+    Eigen::Matrix3d m;
+    m << 0, -v.z(), v.y(),
+         v.z(), 0, -v.x(),
+         -v.y(), v.x(), 0;
+    return m;
+}
 
-    if (!poseGraphOriginal.isValid())
-    {
-        CV_Error(Error::StsBadArg,
-                 "Invalid PoseGraph that is either not connected or has invalid nodes");
+//! Pose increment: translation is added, rotation is composed on the right
+static inline Pose3d updatePose(const Pose3d& pose, const double* delta)
+{
+    Pose3d out(pose);
+    out.t += Eigen::Vector3d(delta[0], delta[1], delta[2]);
+    Eigen::Vector3d phi(delta[3], delta[4], delta[5]);
+    double angle = phi.norm();
+    if (angle > std::numeric_limits<double>::epsilon())
+        out.r = out.r * Eigen::Quaterniond(Eigen::AngleAxisd(angle, phi / angle));
+    out.normalizeRotation();
+    return out;
+}
+
+//! Same residual as Pose3dErrorFunctor, the jacobians are taken w.r.t. the pose increments
+static void computeEdgeResidual(const Pose3d& sourcePose, const Pose3d& targetPose,
+                                const Pose3d& poseMeasurement, const Matrix6d& sqrtInfo,
+                                Vector6d& residual, Matrix6d* sourceJacobian, Matrix6d* targetJacobian)
+{
+    const Eigen::Quaterniond targetQuatInv = targetPose.r.conjugate();
+    const Eigen::Quaterniond relativeQuat  = targetQuatInv * sourcePose.r;
+    const Eigen::Vector3d relativeTrans    = targetQuatInv * (sourcePose.t - targetPose.t);
+    const Eigen::Quaterniond deltaRot      = poseMeasurement.r * relativeQuat.conjugate();
+
+    Vector6d error;
+    error.head<3>() = relativeTrans - poseMeasurement.t;
+    error.tail<3>() = 2.0 * deltaRot.vec();
+    residual = sqrtInfo * error;
+
+    if (!sourceJacobian || !targetJacobian)
         return;
+
+    //! Perturbing the source rotation multiplies deltaRot by Exp(-R_meas * phi) on the left,
+    //! perturbing the target rotation multiplies it by Exp(phi) on the right
+    const Eigen::Matrix3d targetRotInv = targetQuatInv.toRotationMatrix();
+    const Eigen::Matrix3d wI = deltaRot.w() * Eigen::Matrix3d::Identity();
+    const Eigen::Matrix3d vHat = skew(deltaRot.vec());
+
+    Matrix6d js = Matrix6d::Zero(), jt = Matrix6d::Zero();
+    js.block<3, 3>(0, 0) = targetRotInv;
+    js.block<3, 3>(3, 3) = -(wI - vHat) * poseMeasurement.r.toRotationMatrix();
+    jt.block<3, 3>(0, 0) = -targetRotInv;
+    jt.block<3, 3>(0, 3) = skew(relativeTrans);
+    jt.block<3, 3>(3, 3) = wI + vHat;
+
+    *sourceJacobian = sqrtInfo * js;
+    *targetJacobian = sqrtInfo * jt;
+}
+
+static inline void addBlock(BlockSparseMat<double, 6, 6>& H, int i, int j, const Matrix6d& block)
+{
+    Matx66d& dst = H.refBlock(i, j);
+    for (int r = 0; r < 6; r++)
+        for (int c = 0; c < 6; c++)
+            dst(r, c) += block(r, c);
+}
+
+int Optimizer::optimizeLevenbergMarquardt(PoseGraph& poseGraph, int maxIterations)
+{
+    CV_TRACE_FUNCTION();
+
+    const int numNodes = poseGraph.getNumNodes();
+    const int numEdges = poseGraph.getNumEdges();
+    CV_Assert(numEdges > 0);
+
+    std::unordered_map<int, int> nodeIndices;
+    for (int i = 0; i < numNodes; i++)
+        nodeIndices[poseGraph.nodes[i].getId()] = i;
+
+    //! Fixed nodes are not optimized, without any the first one is held to remove the gauge freedom
+    bool anyFixed = false;
+    for (const PoseGraphNode& node : poseGraph.nodes)
+        anyFixed = anyFixed || node.isPoseFixed();
+
+    std::vector<int> nodeVariables(numNodes, -1);
+    int numVariables = 0;
+    for (int i = 0; i < numNodes; i++)
+    {
+        if (!poseGraph.nodes[i].isPoseFixed() && (anyFixed || i > 0))
+            nodeVariables[i] = numVariables++;
     }
+    if (numVariables == 0)
+        return 0;
 
-    int numNodes = poseGraph.getNumNodes();
-    int numEdges = poseGraph.getNumEdges();
-    std::cout << "Optimizing PoseGraph with " << numNodes << " nodes and " << numEdges << " edges"
-              << std::endl;
+    std::vector<int> edgeSources(numEdges), edgeTargets(numEdges);
+    Pose3dVector measurements(numEdges);
+    Matrix6dVector sqrtInfos(numEdges);
+    for (int e = 0; e < numEdges; e++)
+    {
+        const PoseGraphEdge& edge = poseGraph.edges[e];
+        edgeSources[e]  = nodeIndices.at(edge.getSourceNodeId());
+        edgeTargets[e]  = nodeIndices.at(edge.getTargetNodeId());
+        measurements[e] = Pose3d(edge.transformation.rotation(), edge.transformation.translation());
+        cv2eigen(Matx66d(edge.information), sqrtInfos[e]);
+    }
+
+    Pose3dVector poses(numNodes), newPoses(numNodes);
+    for (int i = 0; i < numNodes; i++)
+        poses[i] = poseGraph.nodes[i].se3Pose;
+
+    std::vector<double> edgeCosts(numEdges);
+    Matrix6dVector sourceJacobians(numEdges), targetJacobians(numEdges);
+    std::vector<Vector6d, Eigen::aligned_allocator<Vector6d>> residuals(numEdges);
+
+    auto computeCost = [&](const Pose3dVector& currPoses, bool linearize)
+    {
+        parallel_for_(Range(0, numEdges), [&](const Range& range)
+        {
+            for (int e = range.start; e < range.end; e++)
+            {
+                computeEdgeResidual(currPoses[edgeSources[e]], currPoses[edgeTargets[e]], measurements[e],
+                                    sqrtInfos[e], residuals[e],
+                                    linearize ? &sourceJacobians[e] : nullptr,
+                                    linearize ? &targetJacobians[e] : nullptr);
+                edgeCosts[e] = 0.5 * residuals[e].squaredNorm();
+            }
+        });
+        double cost = 0;
+        for (double c : edgeCosts)
+            cost += c;
+        return cost;
+    };
+
+    //! Normal equations H * delta = -g, only the lower triangular blocks of H are filled
+    BlockSparseMat<double, 6, 6> H(numVariables);
+    Eigen::VectorXd g(6 * numVariables);
+    auto buildSystem = [&]()
+    {
+        for (auto& ijv : H.ijValue)
+            ijv.second = Matx66d::zeros();
+        g.setZero();
+
+        for (int e = 0; e < numEdges; e++)
+        {
+            const int s = nodeVariables[edgeSources[e]], t = nodeVariables[edgeTargets[e]];
+            const Matrix6d& js = sourceJacobians[e];
+            const Matrix6d& jt = targetJacobians[e];
+            if (s >= 0 && s == t)
+            {
+                const Matrix6d j = js + jt;
+                addBlock(H, s, s, j.transpose() * j);
+                g.segment<6>(6 * s) += j.transpose() * residuals[e];
+                continue;
+            }
+            if (s >= 0)
+            {
+                addBlock(H, s, s, js.transpose() * js);
+                g.segment<6>(6 * s) += js.transpose() * residuals[e];
+            }
+            if (t >= 0)
+            {
+                addBlock(H, t, t, jt.transpose() * jt);
+                g.segment<6>(6 * t) += jt.transpose() * residuals[e];
+            }
+            if (s >= 0 && t >= 0)
+            {
+                if (s > t)
+                    addBlock(H, s, t, js.transpose() * jt);
+                else
+                    addBlock(H, t, s, jt.transpose() * js);
+            }
+        }
+    };
+
+    const double functionTolerance  = 1e-6;
+    const double parameterTolerance = 1e-8;
+    const double maxLambda          = 1e16;
+    double lambda                   = 1e-4;
+
+    BlockSparseCholesky<double, 6> cholesky;
+    double cost = computeCost(poses, true);
+    buildSystem();
+    cholesky.analyzePattern(H);
+
+    int iter = 0;
+    for (; iter < maxIterations && lambda < maxLambda; iter++)
+    {
+        if (!cholesky.factorize(H, lambda))
+        {
+            lambda *= 10;
+            continue;
+        }
+        Eigen::VectorXd delta = cholesky.solve(-g);
+        if (delta.lpNorm<Eigen::Infinity>() < parameterTolerance)
+            break;
+
+        newPoses = poses;
+        for (int i = 0; i < numNodes; i++)
+        {
+            if (nodeVariables[i] >= 0)
+                newPoses[i] = updatePose(poses[i], delta.data() + 6 * nodeVariables[i]);
+        }
+
+        double newCost = computeCost(newPoses, false);
+        if (newCost < cost)
+        {
+            bool converged = (cost - newCost) < functionTolerance * cost;
+            std::swap(poses, newPoses);
+            cost   = newCost;
+            lambda = std::max(lambda / 10, 1e-12);
+            if (converged)
+            {
+                iter++;
+                break;
+            }
+            computeCost(poses, true);
+            buildSystem();
+        }
+        else
+        {
+            lambda *= 10;
+        }
+    }
+
+    for (int i = 0; i < numNodes; i++)
+        poseGraph.nodes[i].setPose(poses[i]);
+
+    return iter;
+}
+#endif
 
 #if defined(CERES_FOUND) && defined(HAVE_EIGEN)
+void Optimizer::optimizeCeres(PoseGraph& poseGraph)
+{
     ceres::Problem problem;
     createOptimizationProblem(poseGraph, problem);
 
@@ -160,8 +374,35 @@ void Optimizer::optimize(PoseGraph& poseGraph)
     std::cout << summary.FullReport() << '\n';
 
     std::cout << "Is solution usable: " << summary.IsSolutionUsable() << std::endl;
+
+    //! Ceres updates se3Pose in place, keep the affine pose in sync
+    for (PoseGraphNode& node : poseGraph.nodes)
+        node.setPose(node.se3Pose);
+}
+#endif
+
+void Optimizer::optimize(PoseGraph& poseGraph)
+{
+    PoseGraph poseGraphOriginal = poseGraph;
+
+    if (!poseGraphOriginal.isValid())
+    {
+        CV_Error(Error::StsBadArg,
+                 "Invalid PoseGraph that is either not connected or has invalid nodes");
+        return;
+    }
+
+    int numNodes = poseGraph.getNumNodes();
+    int numEdges = poseGraph.getNumEdges();
+    std::cout << "Optimizing PoseGraph with " << numNodes << " nodes and " << numEdges << " edges"
+              << std::endl;
+
+#if defined(CERES_FOUND) && defined(HAVE_EIGEN)
+    optimizeCeres(poseGraph);
+#elif defined(HAVE_EIGEN)
+    optimizeLevenbergMarquardt(poseGraph);
 #else
-    CV_Error(Error::StsNotImplemented, "Ceres and Eigen required for Pose Graph optimization");
+    CV_Error(Error::StsNotImplemented, "Eigen required for Pose Graph optimization");
 #endif
 }
 
@@ -218,7 +218,7 @@ struct PoseGraphEdge
 /* }; */
 // clang-format on
 
-class PoseGraph
+class CV_EXPORTS PoseGraph
 {
    public:
     typedef std::vector<PoseGraphNode> NodeVector;
@@ -253,9 +253,20 @@ class PoseGraph
 
 namespace Optimizer
 {
-void optimize(PoseGraph& poseGraph);
+//! Optimizes the node poses with Ceres if available, with the built-in solver otherwise
+CV_EXPORTS void optimize(PoseGraph& poseGraph);
+
+#if defined(HAVE_EIGEN)
+//! Built-in Levenberg-Marquardt solver over the node poses
+/** Minimizes the same cost as the Ceres path, the normal equations are solved
+ *  by a sparse Cholesky factorization whose symbolic part is computed once.
+ *  Returns the number of iterations done.
+ */
+CV_EXPORTS int optimizeLevenbergMarquardt(PoseGraph& poseGraph, int maxIterations = 100);
+#endif
 
 #if defined(CERES_FOUND)
+CV_EXPORTS void optimizeCeres(PoseGraph& poseGraph);
 void createOptimizationProblem(PoseGraph& poseGraph, ceres::Problem& problem);
 
 //! Error Functor required for Ceres to obtain an auto differentiable cost function
@@ -287,7 +298,7 @@ class Pose3dErrorFunctor
         Eigen::Quaternion<T> targetQuatInv = targetQuat.conjugate();
 
         Eigen::Quaternion<T> relativeQuat    = targetQuatInv * sourceQuat;
-        Eigen::Matrix<T, 3, 1> relativeTrans = targetQuatInv * (targetTrans - sourceTrans);
+        Eigen::Matrix<T, 3, 1> relativeTrans = targetQuatInv * (sourceTrans - targetTrans);
 
         //! Definition should actually be relativeQuat * poseMeasurement.r.conjugate()
         Eigen::Quaternion<T> deltaRot =
@@ -108,9 +108,91 @@ struct BlockSparseMat
     IDtoBlockValueMap ijValue;
 };
 
+#if defined(HAVE_EIGEN)
+/*!
+ * \class BlockSparseCholesky
+ * Sparse LDLT solver for a sequence of symmetric block matrices sharing the same pattern
+ *
+ * Only the lower triangular blocks of the matrices are read. The pattern is analyzed once
+ * by analyzePattern(), later factorizations refill the values in place and reuse
+ * the fill-reducing ordering and the symbolic factorization.
+ */
+template<typename _Tp, int blockN>
+struct BlockSparseCholesky
+{
+    typedef BlockSparseMat<_Tp, blockN, blockN> BlockMat;
+    typedef Eigen::Matrix<_Tp, Eigen::Dynamic, 1> Vector;
+    typedef Vec<int, blockN> BlockOffsets;
+
+    void analyzePattern(const BlockMat& H)
+    {
+        //! Every element of the lower blocks is kept, even zero ones, so that the pattern stays fixed
+        std::vector<Eigen::Triplet<_Tp>> tripletList;
+        tripletList.reserve(H.ijValue.size() * blockN * blockN);
+        for (const auto& ijv : H.ijValue)
+        {
+            int xb = ijv.first.x, yb = ijv.first.y;
+            if (xb < yb)
+                continue;
+            for (int j = 0; j < blockN; j++)
+                for (int i = (xb == yb ? j : 0); i < blockN; i++)
+                    tripletList.push_back(Eigen::Triplet<_Tp>(blockN * xb + i, blockN * yb + j, _Tp(0)));
+        }
+        A.resize(blockN * H.nBlocks, blockN * H.nBlocks);
+        A.setFromTriplets(tripletList.begin(), tripletList.end());
+        A.makeCompressed();
+
+        //! Rows of a block are contiguous in each of its columns
+        blockOffsets.clear();
+        for (const auto& ijv : H.ijValue)
+        {
+            int xb = ijv.first.x, yb = ijv.first.y;
+            if (xb < yb)
+                continue;
+            BlockOffsets& offsets = blockOffsets[ijv.first];
+            for (int j = 0; j < blockN; j++)
+                offsets[j] = int(&A.coeffRef(blockN * xb + (xb == yb ? j : 0), blockN * yb + j) - A.valuePtr());
+        }
+
+        solver.analyzePattern(A);
+    }
+
+    //! Factorizes H with its diagonal scaled by (1 + lambda), H must have the analyzed pattern
+    bool factorize(const BlockMat& H, _Tp lambda = 0)
+    {
+        _Tp* values = A.valuePtr();
+        for (const auto& ijv : H.ijValue)
+        {
+            int xb = ijv.first.x, yb = ijv.first.y;
+            if (xb < yb)
+                continue;
+            const BlockOffsets& offsets = blockOffsets.at(ijv.first);
+            const typename BlockMat::MatType& block = ijv.second;
+            for (int j = 0; j < blockN; j++)
+            {
+                int i0 = (xb == yb ? j : 0);
+                for (int i = i0; i < blockN; i++)
+                    values[offsets[j] + i - i0] = block(i, j);
+                if (xb == yb)
+                    values[offsets[j]] *= (1 + lambda);
+            }
+        }
+
+        solver.factorize(A);
+        return solver.info() == Eigen::Success;
+    }
+
+    Vector solve(const Vector& b) const { return solver.solve(b); }
+
+    Eigen::SparseMatrix<_Tp> A;
+    std::unordered_map<Point2i, BlockOffsets, typename BlockMat::Point2iHash> blockOffsets;
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<_Tp>, Eigen::Lower> solver;
+};
+#endif
+
 //! Function to solve a sparse linear system of equations HX = B
 //! Requires Eigen
-static bool sparseSolve(const BlockSparseMat<float, 6, 6>& H, const Mat& B, Mat& X, Mat& predB)
+static inline bool sparseSolve(const BlockSparseMat<float, 6, 6>& H, const Mat& B, Mat& X, Mat& predB)
 {
     bool result = false;
 #if defined(HAVE_EIGEN)
@@ -9,6 +9,7 @@
 
 #include <opencv2/core/affine.hpp>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include "hash_tsdf.hpp"
@@ -148,7 +149,11 @@ class SubmapManager
     SubmapManager(const VolumeParams& _volumeParams) : volumeParams(_volumeParams) {}
     virtual ~SubmapManager() = default;
 
-    void reset() { submapList.clear(); };
+    void reset()
+    {
+        submapList.clear();
+        activeSubmaps.clear();
+    };
 
     bool shouldCreateSubmap(int frameId);
     bool shouldChangeCurrSubmap(int _frameId, int toSubmapId);
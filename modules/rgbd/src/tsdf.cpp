@@ -812,6 +812,61 @@ void TSDFVolumeCPU::fetchNormals(InputArray _points, OutputArray _normals) const
     }
 }
 
+void TSDFVolume::fetchVolumeMesh(const TsdfVoxel* volData, OutputArray _vertices, OutputArray _triangles) const
+{
+    CV_TRACE_FUNCTION();
+
+    // The volume is cut into blocks of cubes meshed in parallel,
+    // each block reads one more layer of voxels than it has cubes
+    const int blockSize = 16;
+    const Vec3i numCubes(volResolution.x - 1, volResolution.y - 1, volResolution.z - 1);
+    const Vec3i numBlocks(divUp(max(numCubes[0], 0), blockSize),
+                          divUp(max(numCubes[1], 0), blockSize),
+                          divUp(max(numCubes[2], 0), blockSize));
+    std::vector<MeshChunk> meshes(numBlocks[0] * numBlocks[1] * numBlocks[2]);
+
+    parallel_for_(Range(0, (int)meshes.size()), [&](const Range& range)
+    {
+        std::vector<TsdfVoxel> block;
+        for (int i = range.start; i < range.end; i++)
+        {
+            const Vec3i blockIdx = Vec3i(i / (numBlocks[1] * numBlocks[2]),
+                                         (i / numBlocks[2]) % numBlocks[1],
+                                         i % numBlocks[2]) * blockSize;
+            Vec3i dims;
+            for (int k = 0; k < 3; k++)
+                dims[k] = min(blockSize, numCubes[k] - blockIdx[k]) + 1;
+
+            block.resize(dims[0] * dims[1] * dims[2]);
+            TsdfVoxel* dst = block.data();
+            for (int x = 0; x < dims[0]; x++)
+                for (int y = 0; y < dims[1]; y++)
+                {
+                    const TsdfVoxel* src = volData + (blockIdx[0] + x) * volDims[0] +
+                                           (blockIdx[1] + y) * volDims[1] + blockIdx[2] * volDims[2];
+                    for (int z = 0; z < dims[2]; z++, src += volDims[2])
+                        *dst++ = *src;
+                }
+
+            Point3f origin = Point3f((float)blockIdx[0] + 0.5f, (float)blockIdx[1] + 0.5f,
+                                     (float)blockIdx[2] + 0.5f) * voxelSize;
+            marchCubes(block.data(), dims, blockIdx, origin, voxelSize, meshes[i]);
+        }
+    });
+
+    std::vector<const MeshChunk*> chunks;
+    for (const MeshChunk& mesh : meshes)
+        chunks.push_back(&mesh);
+    mergeMeshChunks(chunks, pose, _vertices, _triangles);
+}
+
+void TSDFVolumeCPU::fetchMesh(OutputArray _vertices, OutputArray _triangles) const
+{
+    CV_TRACE_FUNCTION();
+
+    fetchVolumeMesh(volume.ptr<TsdfVoxel>(), _vertices, _triangles);
+}
+
 ///////// GPU implementation /////////
 
 #ifdef HAVE_OPENCL
@@ -1166,6 +1221,15 @@ void TSDFVolumeGPU::fetchPointsNormals(OutputArray points, OutputArray normals)
     }
 }
 
+void TSDFVolumeGPU::fetchMesh(OutputArray _vertices, OutputArray _triangles) const
+{
+    CV_TRACE_FUNCTION();
+
+    // GPU voxels have the same (tsdf, weight) layout as the CPU ones
+    Mat volData = volume.getMat(ACCESS_READ);
+    fetchVolumeMesh(volData.ptr<TsdfVoxel>(), _vertices, _triangles);
+}
+
 #endif
 
 Ptr<TSDFVolume> makeTSDFVolume(float _voxelSize, Matx44f _pose, float _raycastStepFactor,
@@ -49,6 +49,10 @@ class TSDFVolume : public Volume
     float truncDist;
     Vec4i volDims;
     Vec8i neighbourCoords;
+
+   protected:
+    //! Marching cubes over the whole volume, volData is laid out according to volDims
+    void fetchVolumeMesh(const TsdfVoxel* volData, OutputArray vertices, OutputArray triangles) const;
 };
 
 class TSDFVolumeCPU : public TSDFVolume
@@ -65,6 +69,7 @@ class TSDFVolumeCPU : public TSDFVolume
 
     virtual void fetchNormals(InputArray points, OutputArray _normals) const override;
     virtual void fetchPointsNormals(OutputArray points, OutputArray normals) const override;
+    virtual void fetchMesh(OutputArray vertices, OutputArray triangles) const override;
 
     virtual void reset() override;
     virtual TsdfVoxel at(const Vec3i& volumeIdx) const;
@@ -100,6 +105,7 @@ class TSDFVolumeGPU : public TSDFVolume
 
     virtual void fetchPointsNormals(OutputArray points, OutputArray normals) const override;
     virtual void fetchNormals(InputArray points, OutputArray normals) const override;
+    virtual void fetchMesh(OutputArray vertices, OutputArray triangles) const override;
 
     virtual void reset() override;
 
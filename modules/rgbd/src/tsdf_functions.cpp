@@ -6,6 +6,9 @@
 
 #include "precomp.hpp"
 #include "tsdf_functions.hpp"
+#include "marchingcubes.hpp"
+
+#include <unordered_map>
 
 namespace cv {
 
@@ -373,5 +376,152 @@ void integrateVolumeUnit(
 
 }
 
+// Corners and edges of a cube, in the order expected by the marching cubes tables
+static const Vec3i cubeCorners[8] =
+{
+    Vec3i(0, 0, 0), Vec3i(0, 0, 1), Vec3i(0, 1, 1), Vec3i(0, 1, 0),
+    Vec3i(1, 0, 0), Vec3i(1, 0, 1), Vec3i(1, 1, 1), Vec3i(1, 1, 0)
+};
+
+static const int cubeEdges[12][2] =
+{
+    {0, 1}, {1, 2}, {2, 3}, {3, 0},
+    {4, 5}, {5, 6}, {6, 7}, {7, 4},
+    {0, 4}, {1, 5}, {2, 6}, {3, 7}
+};
+
+static inline uint64 meshEdgeKey(const Vec3i& voxelIdx, int axis)
+{
+    // 20 bits per coordinate cover a million voxels around the origin
+    const int bias = 1 << 19;
+    return ((uint64)((voxelIdx[0] + bias) & 0xFFFFF) << 42) |
+           ((uint64)((voxelIdx[1] + bias) & 0xFFFFF) << 22) |
+           ((uint64)((voxelIdx[2] + bias) & 0xFFFFF) << 2) | (uint64)axis;
+}
+
+void marchCubes(const TsdfVoxel* voxels, const Vec3i& dims, const Vec3i& blockIdx,
+                const Point3f& origin, float voxelSize, MeshChunk& mesh)
+{
+    CV_Assert(dims[0] > 1 && dims[1] > 1 && dims[2] > 1);
+
+    const int xstride = dims[1] * dims[2], ystride = dims[2];
+    int cornerOffsets[8];
+    for (int i = 0; i < 8; i++)
+        cornerOffsets[i] = cubeCorners[i][0] * xstride + cubeCorners[i][1] * ystride + cubeCorners[i][2];
+
+    // Every edge starting at a voxel gets a vertex at most once, shared by the cubes around it
+    std::vector<int> edgeVertices(dims[0] * xstride * 3, -1);
+
+    for (int x = 0; x < dims[0] - 1; x++)
+    {
+        for (int y = 0; y < dims[1] - 1; y++)
+        {
+            for (int z = 0; z < dims[2] - 1; z++)
+            {
+                const int base = x * xstride + y * ystride + z;
+
+                float values[8];
+                int cubeIndex = 0;
+                bool observed = true;
+                for (int i = 0; i < 8 && observed; i++)
+                {
+                    const TsdfVoxel& voxel = voxels[base + cornerOffsets[i]];
+                    observed = voxel.weight != 0;
+                    values[i] = tsdfToFloat(voxel.tsdf);
+                    if (values[i] < 0)
+                        cubeIndex |= 1 << i;
+                }
+
+                const int edges = dynafu::edgeTable[cubeIndex];
+                if (!observed || !edges)
+                    continue;
+
+                int cubeVertices[12];
+                for (int e = 0; e < 12; e++)
+                {
+                    if (!(edges & (1 << e)))
+                        continue;
+
+                    int c0 = cubeEdges[e][0], c1 = cubeEdges[e][1];
+                    int axis = 0;
+                    while (cubeCorners[c0][axis] == cubeCorners[c1][axis])
+                        axis++;
+                    // the edge is identified by its lower end
+                    if (cubeCorners[c1][axis] < cubeCorners[c0][axis])
+                        std::swap(c0, c1);
+
+                    int& vertex = edgeVertices[(base + cornerOffsets[c0]) * 3 + axis];
+                    if (vertex < 0)
+                    {
+                        const Vec3i voxelIdx = Vec3i(x, y, z) + cubeCorners[c0];
+                        Point3f p((float)voxelIdx[0], (float)voxelIdx[1], (float)voxelIdx[2]);
+                        const float t = values[c0] / (values[c0] - values[c1]);
+                        if (axis == 0) p.x += t;
+                        if (axis == 1) p.y += t;
+                        if (axis == 2) p.z += t;
+
+                        vertex = (int)mesh.vertices.size();
+                        mesh.vertices.push_back(origin + p * voxelSize);
+                        mesh.edgeKeys.push_back(meshEdgeKey(blockIdx + voxelIdx, axis));
+                    }
+                    cubeVertices[e] = vertex;
+                }
+
+                const int* tri = dynafu::triTable[cubeIndex];
+                for (int t = 0; tri[t] != -1; t += 3)
+                    mesh.triangles.push_back(Vec3i(cubeVertices[tri[t]], cubeVertices[tri[t + 1]],
+                                                   cubeVertices[tri[t + 2]]));
+            }
+        }
+    }
+}
+
+void mergeMeshChunks(const std::vector<const MeshChunk*>& chunks, const Affine3f& pose,
+                     OutputArray _vertices, OutputArray _triangles)
+{
+    CV_TRACE_FUNCTION();
+
+    size_t numVertices = 0, numTriangles = 0;
+    for (const MeshChunk* chunk : chunks)
+    {
+        numVertices += chunk->vertices.size();
+        numTriangles += chunk->triangles.size();
+    }
+
+    std::vector<ptype> vertices;
+    std::vector<Vec3i> triangles;
+    vertices.reserve(numVertices);
+    triangles.reserve(numTriangles);
+
+    // The vertices on the block borders are found by both blocks
+    std::unordered_map<uint64, int> weldedVertices;
+    weldedVertices.reserve(numVertices);
+    std::vector<int> remap;
+    for (const MeshChunk* chunk : chunks)
+    {
+        remap.resize(chunk->vertices.size());
+        for (size_t i = 0; i < chunk->vertices.size(); i++)
+        {
+            auto it = weldedVertices.emplace(chunk->edgeKeys[i], (int)vertices.size());
+            if (it.second)
+                vertices.push_back(toPtype(pose * chunk->vertices[i]));
+            remap[i] = it.first->second;
+        }
+        for (const Vec3i& t : chunk->triangles)
+            triangles.push_back(Vec3i(remap[t[0]], remap[t[1]], remap[t[2]]));
+    }
+
+    _vertices.create((int)vertices.size(), 1, POINT_TYPE);
+    if (!vertices.empty())
+        Mat((int)vertices.size(), 1, POINT_TYPE, &vertices[0]).copyTo(_vertices.getMat());
+
+    if (_triangles.needed())
+    {
+        _triangles.create((int)triangles.size(), 1, CV_32SC3);
+        if (!triangles.empty())
+            Mat((int)triangles.size(), 1, CV_32SC3, &triangles[0]).copyTo(_triangles.getMat());
+    }
+}
+
 } // namespace kinfu
 } // namespace cv
@@ -43,6 +43,35 @@ void integrateVolumeUnit(
     InputArray _depth, float depthFactor, const cv::Matx44f& cameraPose,
     const cv::kinfu::Intr& intrinsics, InputArray _pixNorms, InputArray _volume);
 
+//! Part of a triangle mesh, its vertices are keyed by the voxel grid edges they lie on
+struct MeshChunk
+{
+    std::vector<uint64> edgeKeys;
+    std::vector<Point3f> vertices;
+    std::vector<Vec3i> triangles;
+
+    void clear()
+    {
+        edgeKeys.clear();
+        vertices.clear();
+        triangles.clear();
+    }
+};
+
+//! Runs marching cubes over a dense block of voxels
+/** The block holds dims[0]*dims[1]*dims[2] voxels, z index changing fastest.
+ *  Cubes having an unobserved corner are skipped.
+ *  @param blockIdx index of the first voxel of the block in the whole voxel grid,
+ *  the vertices are keyed by it so that the vertices shared by adjacent blocks can be welded
+ *  @param origin position of the first voxel in the volume
+ */
+void marchCubes(const TsdfVoxel* voxels, const Vec3i& dims, const Vec3i& blockIdx,
+                const Point3f& origin, float voxelSize, MeshChunk& mesh);
+
+//! Concatenates the chunks into a mesh in the POINT_TYPE/CV_32SC3 format, welding the shared vertices
+void mergeMeshChunks(const std::vector<const MeshChunk*>& chunks, const Affine3f& pose,
+                     OutputArray vertices, OutputArray triangles);
+
 }  // namespace kinfu
 }  // namespace cv
 #endif
@@ -11,7 +11,7 @@ baseRes(baseResolution),
 resGrowthRate(resolutionGrowth),
 regGraphNodes(n_levels-1),
 heirarchy(n_levels-1),
-nodeIndex(nullptr)
+nodeIndex(std::sqrt(baseResolution))
 {
     CV_Assert(k <= DYNAFU_MAX_NEIGHBOURS);
 }
@@ -38,7 +38,7 @@ bool PtCmp(cv::Point3f a, cv::Point3f b)
             ((a.x >= b.x) && (a.y >= b.y) && (a.z < b.z));
 }
 
-Ptr<flann::GenericIndex<flann::L2_Simple<float> > > WarpField::getNodeIndex() const
+const PointGrid& WarpField::getNodeIndex() const
 {
     return nodeIndex;
 }
@@ -55,9 +55,188 @@ Mat getNodesPos(NodeVectorType nv)
     return nodePos;
 }
 
+PointGrid::PointGrid(float _cellSize) :
+cellSize(_cellSize),
+cellSizeInv(1.f/_cellSize),
+points(),
+cells(),
+minCell(),
+maxCell()
+{
+    CV_Assert(cellSize > 0);
+}
+
+void PointGrid::clear()
+{
+    points.clear();
+    cells.clear();
+}
+
+void PointGrid::add(Point3f pt)
+{
+    Vec3i c = cellOf(pt);
+    if(points.empty())
+    {
+        minCell = maxCell = c;
+    }
+    else
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            minCell[i] = std::min(minCell[i], c[i]);
+            maxCell[i] = std::max(maxCell[i], c[i]);
+        }
+    }
+    cells[c].push_back((int)points.size());
+    points.push_back(pt);
+}
+
+void PointGrid::knnSearch(Point3f query, int k, std::vector<int>& indices, std::vector<float>& dists) const
+{
+    indices.clear();
+    dists.clear();
+    k = std::min(k, (int)points.size());
+    if(k <= 0)
+    {
+        return;
+    }
+
+    // keeps the k best candidates sorted by distance
+    auto consider = [&](int i)
+    {
+        Point3f d = points[i] - query;
+        float dist = d.dot(d);
+        if((int)dists.size() == k)
+        {
+            if(dist >= dists.back())
+                return;
+            dists.pop_back();
+            indices.pop_back();
+        }
+        size_t pos = std::upper_bound(dists.begin(), dists.end(), dist) - dists.begin();
+        dists.insert(dists.begin() + pos, dist);
+        indices.insert(indices.begin() + pos, i);
+    };
+
+    // Visit cubic shells of cells around the query cell, starting from the first shell
+    // which touches the occupied cells. A point outside of shell r is farther than r cells.
+    Vec3i c = cellOf(query);
+    int r = 0;
+    for(int i = 0; i < 3; i++)
+        r = std::max(r, std::max(minCell[i] - c[i], c[i] - maxCell[i]));
+
+    size_t work = 0;
+    for( ; ; r++)
+    {
+        Vec3i lo, hi;
+        for(int i = 0; i < 3; i++)
+        {
+            lo[i] = std::max(c[i] - r, minCell[i]);
+            hi[i] = std::min(c[i] + r, maxCell[i]);
+        }
+
+        auto visit = [&](int x, int y, int z)
+        {
+            auto it = cells.find(Vec3i(x, y, z));
+            if(it != cells.end())
+            {
+                for(int i: it->second)
+                    consider(i);
+            }
+        };
+
+        for(int x = lo[0]; x <= hi[0]; x++)
+        {
+            for(int y = lo[1]; y <= hi[1]; y++, work++)
+            {
+                if(std::abs(x - c[0]) == r || std::abs(y - c[1]) == r)
+                {
+                    for(int z = lo[2]; z <= hi[2]; z++, work++)
+                        visit(x, y, z);
+                }
+                else
+                {
+                    if(c[2] - r >= minCell[2])
+                        visit(x, y, c[2] - r);
+                    if(c[2] + r <= maxCell[2])
+                        visit(x, y, c[2] + r);
+                }
+            }
+        }
+
+        float shellDist = r*cellSize;
+        if((int)dists.size() == k && dists.back() <= shellDist*shellDist)
+            break;
+        if(c[0] - r <= minCell[0] && c[1] - r <= minCell[1] && c[2] - r <= minCell[2] &&
+           c[0] + r >= maxCell[0] && c[1] + r >= maxCell[1] && c[2] + r >= maxCell[2])
+            break;
+
+        // sparse grid far from the query, a linear scan is cheaper
+        if(work > points.size())
+        {
+            indices.clear();
+            dists.clear();
+            for(int i = 0; i < (int)points.size(); i++)
+                consider(i);
+            break;
+        }
+    }
+}
+
+void PointGrid::radiusSearch(Point3f query, float radiusSq, std::vector<int>& indices,
+                             int maxResults) const
+{
+    indices.clear();
+    if(points.empty() || radiusSq < 0 || maxResults <= 0)
+    {
+        return;
+    }
+
+    float radius = std::sqrt(radiusSq);
+    Vec3i lo = cellOf(query - Point3f(radius, radius, radius));
+    Vec3i hi = cellOf(query + Point3f(radius, radius, radius));
+    for(int i = 0; i < 3; i++)
+    {
+        lo[i] = std::max(lo[i], minCell[i]);
+        hi[i] = std::min(hi[i], maxCell[i]);
+    }
+
+    for(int x = lo[0]; x <= hi[0]; x++)
+    {
+        for(int y = lo[1]; y <= hi[1]; y++)
+        {
+            for(int z = lo[2]; z <= hi[2]; z++)
+            {
+                auto it = cells.find(Vec3i(x, y, z));
+                if(it == cells.end())
+                    continue;
+
+                for(int i: it->second)
+                {
+                    Point3f d = points[i] - query;
+                    if(d.dot(d) <= radiusSq)
+                        indices.push_back(i);
+                }
+            }
+        }
+    }
+
+    if((int)indices.size() > maxResults)
+    {
+        auto closer = [&](int a, int b)
+        {
+            Point3f da = points[a] - query, db = points[b] - query;
+            float distA = da.dot(da), distB = db.dot(db);
+            return distA < distB || (distA == distB && a < b);
+        };
+        std::nth_element(indices.begin(), indices.begin() + maxResults, indices.end(), closer);
+        indices.resize(maxResults);
+    }
+}
+
 void WarpField::updateNodesFromPoints(InputArray inputPoints)
 {
-    Mat points_matrix(inputPoints.size().height, 3, CV_32F);
+    Mat points_matrix;
     if(inputPoints.channels() == 1)
     {
         points_matrix = inputPoints.getMat().colRange(0, 3);
@@ -67,8 +246,13 @@ void WarpField::updateNodesFromPoints(InputArray inputPoints)
         points_matrix = inputPoints.getMat().reshape(1).colRange(0, 3).clone();
     }
 
-    cvflann::LinearIndexParams params;
-    flann::GenericIndex<flann::L2_Simple <float> > searchIndex(points_matrix, params);
+    // radii are squared distances, see PointGrid
+    PointGrid searchIndex(std::sqrt(baseRes));
+    for(int i = 0; i < points_matrix.rows; i++)
+    {
+        const float* p = points_matrix.ptr<float>(i);
+        searchIndex.add(Point3f(p[0], p[1], p[2]));
+    }
 
     AutoBuffer<bool> validIndex;
     removeSupported(searchIndex, validIndex);
@@ -76,38 +260,33 @@ void WarpField::updateNodesFromPoints(InputArray inputPoints)
     NodeVectorType newNodes;
     if((int)nodes.size() > k)
     {
-        newNodes = subsampleIndex(points_matrix, searchIndex, validIndex, baseRes, nodeIndex);
+        newNodes = subsampleIndex(searchIndex, validIndex, baseRes, &nodeIndex);
     }
     else
     {
-        newNodes = subsampleIndex(points_matrix, searchIndex, validIndex, baseRes);
+        newNodes = subsampleIndex(searchIndex, validIndex, baseRes);
     }
 
     initTransforms(newNodes);
     nodes.insert(nodes.end(), newNodes.begin(), newNodes.end());
-    nodesPos = getNodesPos(nodes);
-    //re-build index
-    nodeIndex = new flann::GenericIndex<flann::L2_Simple<float> >(nodesPos,
-                                                                  cvflann::LinearIndexParams());
+
+    // the node index grows with the nodes instead of being rebuilt
+    for(const Ptr<WarpNode>& n: newNodes)
+        nodeIndex.add(n->pos);
 
     constructRegGraph();
 }
 
 
-void WarpField::removeSupported(flann::GenericIndex<flann::L2_Simple<float> >& ind,
-                                  AutoBuffer<bool>& validInd)
+void WarpField::removeSupported(const PointGrid& ind, AutoBuffer<bool>& validInd)
 {
     validInd.allocate(ind.size());
     std::fill_n(validInd.data(), ind.size(), true);
 
+    std::vector<int> indices_vec;
     for(WarpNode* n: nodes)
     {
-        std::vector<float> query = {n->pos.x, n->pos.y, n->pos.z};
-
-        std::vector<int> indices_vec(maxNeighbours);
-        std::vector<float> dists_vec(maxNeighbours);
-
-        ind.radiusSearch(query, indices_vec, dists_vec, n->radius, cvflann::SearchParams());
+        ind.radiusSearch(n->pos, n->radius, indices_vec, maxNeighbours);
 
         for(auto i: indices_vec)
         {
@@ -117,15 +296,16 @@ void WarpField::removeSupported(flann::GenericIndex<flann::L2_Simple<float> >& i
     }
 }
 
-NodeVectorType WarpField::subsampleIndex(Mat& pmat,
-                                         flann::GenericIndex<flann::L2_Simple<float> >& ind,
-                                         AutoBuffer<bool>& validIndex, float res,
-                                         Ptr<flann::GenericIndex<flann::L2_Simple<float> > > knnIndex)
+NodeVectorType WarpField::subsampleIndex(const PointGrid& ind, AutoBuffer<bool>& validIndex, float res,
+                                         const PointGrid* knnIndex)
 {
     CV_TRACE_FUNCTION();
 
     NodeVectorType temp_nodes;
 
+    std::vector<int> indices_vec;
+    std::vector<int> knn_indices;
+    std::vector<float> knn_dists;
     for(int i = 0; i < (int)validIndex.size(); i++)
     {
         if(!validIndex[i])
@@ -133,11 +313,7 @@ NodeVectorType WarpField::subsampleIndex(Mat& pmat,
             continue;
         }
 
-        std::vector<int> indices_vec(maxNeighbours);
-        std::vector<float> dist_vec(maxNeighbours);
-
-        ind.radiusSearch(pmat.row(i), indices_vec, dist_vec, res, cvflann::SearchParams());
-
+        ind.radiusSearch(ind[i], res, indices_vec, maxNeighbours);
 
         Ptr<WarpNode> wn = new WarpNode;
         Point3f centre(0, 0, 0);
@@ -146,9 +322,7 @@ NodeVectorType WarpField::subsampleIndex(Mat& pmat,
         {
             if(validIndex[index])
             {
-                centre += Point3f(pmat.at<float>(index, 0),
-                                  pmat.at<float>(index, 1),
-                                  pmat.at<float>(index, 2));
+                centre += ind[index];
                 len++;
             }
         }
@@ -161,15 +335,10 @@ NodeVectorType WarpField::subsampleIndex(Mat& pmat,
             validIndex[index] = false;
         }
 
-        std::vector<int> knn_indices(k+1, 0);
-        std::vector<float> knn_dists(k+1, 0);
-
-        std::vector<float> query = {wn->pos.x, wn->pos.y, wn->pos.z};
-
         if(knnIndex != nullptr)
         {
-            knnIndex->knnSearch(query, knn_indices, knn_dists, (k+1), cvflann::SearchParams());
-            wn->radius = *std::max_element(knn_dists.begin(), knn_dists.end());
+            knnIndex->knnSearch(wn->pos, k+1, knn_indices, knn_dists);
+            wn->radius = knn_dists.empty() ? res : knn_dists.back();
         }
         else
         {
@@ -186,44 +355,47 @@ NodeVectorType WarpField::subsampleIndex(Mat& pmat,
 
 void WarpField::initTransforms(NodeVectorType nv)
 {
-    if(nodesPos.size().height == 0)
+    if(nodeIndex.size() == 0)
     {
         return;
     }
 
-    for(auto nodePtr: nv)
+    parallel_for_(Range(0, (int)nv.size()), [&](const Range& range)
     {
-        std::vector<int> knnIndices(k);
-        std::vector<float> knnDists(k);
-
-        std::vector<float> query = {nodePtr->pos.x, nodePtr->pos.y, nodePtr->pos.z};
+        std::vector<int> knnIndices;
+        std::vector<float> knnDists;
+        std::vector<float> weights;
+        std::vector<Affine3f> transforms;
+        for(int n = range.start; n < range.end; n++)
+        {
+            const Ptr<WarpNode>& nodePtr = nv[n];
+            nodeIndex.knnSearch(nodePtr->pos, k, knnIndices, knnDists);
 
-        nodeIndex->knnSearch(query ,knnIndices, knnDists, k, cvflann::SearchParams());
+            weights.resize(knnIndices.size());
+            transforms.resize(knnIndices.size());
 
-        std::vector<float> weights(knnIndices.size());
-        std::vector<Affine3f> transforms(knnIndices.size());
+            size_t i = 0;
+            for(int idx: knnIndices)
+            {
+                weights[i] = nodes[idx]->weight(nodePtr->pos);
+                transforms[i++] = nodes[idx]->transform;
+            }
 
-        size_t i = 0;
-        for(int idx: knnIndices)
-        {
-            weights[i] = nodes[idx]->weight(nodePtr->pos);
-            transforms[i++] = nodes[idx]->transform;
-        }
+            Affine3f pose = DQB(weights, transforms);
+            // linearly interpolate translations
+            Vec3f translation(0,0,0);
+            float totalWeight = 0;
+            for(i = 0; i < transforms.size(); i++)
+            {
+                translation += weights[i]*transforms[i].translation();
+                totalWeight += weights[i];
+            }
 
-        Affine3f pose = DQB(weights, transforms);
-        // linearly interpolate translations
-        Vec3f translation(0,0,0);
-        float totalWeight = 0;
-        for(i = 0; i < transforms.size(); i++)
-        {
-            translation += weights[i]*transforms[i].translation();
-            totalWeight += weights[i];
+            if(totalWeight < 1e-5) translation = Vec3f(0, 0, 0);
+            else translation /= totalWeight;
+            nodePtr->transform = Affine3f(pose.rotation(), translation);
         }
-
-        if(totalWeight < 1e-5) translation = Vec3f(0, 0, 0);
-        else translation /= totalWeight;
-        nodePtr->transform = Affine3f(pose.rotation(), translation);
-    }
+    });
 }
 
 void WarpField::constructRegGraph()
@@ -239,48 +411,39 @@ void WarpField::constructRegGraph()
 
     float effResolution = baseRes*resGrowthRate;
     NodeVectorType curNodes = nodes;
-    Mat curNodeMatrix = getNodesPos(curNodes);
-
-    Ptr<flann::GenericIndex<flann::L2_Simple<float> > > curNodeIndex(
-        new flann::GenericIndex<flann::L2_Simple<float> >(curNodeMatrix,
-                                                          cvflann::LinearIndexParams()));
+    PointGrid curNodeIndex(std::sqrt(effResolution));
+    for(const Ptr<WarpNode>& n: curNodes)
+        curNodeIndex.add(n->pos);
 
     for(int l = 0; l < (n_levels-1); l++)
     {
         AutoBuffer<bool> nodeValidity;
-        nodeValidity.allocate(curNodeIndex->size());
+        nodeValidity.allocate(curNodeIndex.size());
 
-        std::fill_n(nodeValidity.data(), curNodeIndex->size(), true);
-        NodeVectorType coarseNodes = subsampleIndex(curNodeMatrix, *curNodeIndex, nodeValidity,
-                                                    effResolution);
+        std::fill_n(nodeValidity.data(), curNodeIndex.size(), true);
+        NodeVectorType coarseNodes = subsampleIndex(curNodeIndex, nodeValidity, effResolution);
 
         initTransforms(coarseNodes);
 
-        Mat coarseNodeMatrix = getNodesPos(coarseNodes);
-
-        Ptr<flann::GenericIndex<flann::L2_Simple<float> > > coarseNodeIndex(
-            new flann::GenericIndex<flann::L2_Simple<float> >(coarseNodeMatrix,
-                                                              cvflann::LinearIndexParams()));
+        PointGrid coarseNodeIndex(std::sqrt(effResolution*resGrowthRate));
+        for(const Ptr<WarpNode>& n: coarseNodes)
+            coarseNodeIndex.add(n->pos);
 
         heirarchy[l] = std::vector<nodeNeighboursType>(curNodes.size());
-        for(int i = 0; i < (int)curNodes.size(); i++)
+        parallel_for_(Range(0, (int)curNodes.size()), [&](const Range& range)
         {
-            std::vector<int> children_indices(k);
-            std::vector<float> children_dists(k);
-
-            std::vector<float> query = {curNodeMatrix.at<float>(i, 0),
-                                        curNodeMatrix.at<float>(i, 1),
-                                        curNodeMatrix.at<float>(i, 2)};
-
-            coarseNodeIndex->knnSearch(query, children_indices, children_dists, k,
-                                       cvflann::SearchParams());
-            heirarchy[l][i].fill(-1);
-            std::copy(children_indices.begin(), children_indices.end(), heirarchy[l][i].begin());
-        }
+            std::vector<int> children_indices;
+            std::vector<float> children_dists;
+            for(int i = range.start; i < range.end; i++)
+            {
+                coarseNodeIndex.knnSearch(curNodeIndex[i], k, children_indices, children_dists);
+                heirarchy[l][i].fill(-1);
+                std::copy(children_indices.begin(), children_indices.end(), heirarchy[l][i].begin());
+            }
+        });
 
         regGraphNodes.push_back(coarseNodes);
         curNodes = coarseNodes;
-        curNodeMatrix = coarseNodeMatrix;
         curNodeIndex = coarseNodeIndex;
         effResolution *= resGrowthRate;
     }
@@ -301,7 +464,7 @@ Point3f WarpField::applyWarp(Point3f p, const nodeNeighboursType neighbours, int
 
     for(int i = 0; i < n; i++)
     {
-        Ptr<WarpNode> neigh = nodes[neighbours[i]];
+        const Ptr<WarpNode>& neigh = nodes[neighbours[i]];
         float w = neigh->weight(p);
         if(w < 0.01)
         {
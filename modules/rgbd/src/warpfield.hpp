@@ -1,8 +1,9 @@
 #ifndef __OPENCV_RGBD_WARPFIELD_HPP__
 #define __OPENCV_RGBD_WARPFIELD_HPP__
 
+#include <array>
+#include <unordered_map>
 #include "opencv2/core.hpp"
-#include "opencv2/flann.hpp"
 #include "dqb.hpp"
 
 #define DYNAFU_MAX_NEIGHBOURS 10
@@ -18,7 +19,7 @@ struct WarpNode
     float radius;
     Affine3f transform;
 
-    float weight(Point3f x)
+    float weight(Point3f x) const
     {
         Point3f diff = pos - x;
         float L2 = diff.x*diff.x + diff.y*diff.y + diff.z*diff.z;
@@ -28,6 +29,58 @@ struct WarpNode
 
 typedef std::vector<Ptr<WarpNode> > NodeVectorType;
 
+struct PointGridHash
+{
+    size_t operator()(const Vec3i& c) const noexcept
+    {
+        return size_t(c[0])*73856093u ^ size_t(c[1])*19349663u ^ size_t(c[2])*83492791u;
+    }
+};
+
+//! Uniform grid hash of points for nearest neighbour and radius queries
+/** Points can be added incrementally, the grid is never rebuilt. Distances are squared
+ *  like the ones of flann::L2_Simple so the results can replace a FLANN index.
+ *  Queries are const and may run concurrently.
+ */
+class CV_EXPORTS PointGrid
+{
+public:
+    explicit PointGrid(float _cellSize = .1f);
+
+    void clear();
+    void add(Point3f pt);
+
+    size_t size() const
+    {
+        return points.size();
+    }
+
+    const Point3f& operator[](int i) const
+    {
+        return points[i];
+    }
+
+    /** Up to k nearest points sorted by increasing distance, fewer when the grid is smaller than k */
+    void knnSearch(Point3f query, int k, std::vector<int>& indices, std::vector<float>& dists) const;
+
+    /** Indices of the points whose squared distance to query is at most radiusSq.
+     *  If there are more than maxResults of them, only the maxResults nearest ones are kept.
+     */
+    void radiusSearch(Point3f query, float radiusSq, std::vector<int>& indices,
+                      int maxResults = INT_MAX) const;
+
+private:
+    Vec3i cellOf(Point3f pt) const
+    {
+        return Vec3i(cvFloor(pt.x*cellSizeInv), cvFloor(pt.y*cellSizeInv), cvFloor(pt.z*cellSizeInv));
+    }
+
+    float cellSize, cellSizeInv;
+    std::vector<Point3f> points;
+    std::unordered_map<Vec3i, std::vector<int>, PointGridHash> cells;
+    Vec3i minCell, maxCell;
+};
+
 class WarpField
 {
 public:
@@ -49,29 +102,28 @@ public:
 
     void setAllRT(Affine3f warpRT);
 
-    Ptr<flann::GenericIndex<flann::L2_Simple<float> > > getNodeIndex() const;
+    const PointGrid& getNodeIndex() const;
 
-    inline void findNeighbours(Point3f queryPt, std::vector<int>& indices, std::vector<float>& dists)
+    /** k nearest warp nodes of a point with their squared distances, safe to call concurrently */
+    inline void findNeighbours(Point3f queryPt, std::vector<int>& indices, std::vector<float>& dists) const
     {
-        std::vector<float> query = {queryPt.x, queryPt.y, queryPt.z};
-        nodeIndex->knnSearch(query, indices, dists, k, cvflann::SearchParams());
+        nodeIndex.knnSearch(queryPt, k, indices, dists);
     }
 
     int k; //k-nearest neighbours will be used
     int n_levels; // number of levels in the heirarchy
 
 private:
-    void removeSupported(flann::GenericIndex<flann::L2_Simple<float> >& ind, AutoBuffer<bool>& supInd);
+    void removeSupported(const PointGrid& ind, AutoBuffer<bool>& supInd);
 
-    NodeVectorType subsampleIndex(Mat& pmat, flann::GenericIndex<flann::L2_Simple<float> >& ind,
-                                  AutoBuffer<bool>& supInd, float res,
-                                  Ptr<flann::GenericIndex<flann::L2_Simple<float> > > knnIndex = nullptr);
+    NodeVectorType subsampleIndex(const PointGrid& ind, AutoBuffer<bool>& supInd, float res,
+                                  const PointGrid* knnIndex = nullptr);
     void constructRegGraph();
 
     void initTransforms(NodeVectorType nv);
 
     NodeVectorType nodes; //heirarchy level 0
-    int maxNeighbours;
+    int maxNeighbours; // at most that many points are covered by a node
 
     float baseRes;
     float resGrowthRate;
@@ -79,9 +131,7 @@ private:
     std::vector<NodeVectorType> regGraphNodes; // heirarchy levels 1 to L
     heirarchyType heirarchy;
 
-    Ptr<flann::GenericIndex<flann::L2_Simple<float> > > nodeIndex;
-
-    Mat nodesPos;
+    PointGrid nodeIndex;
 
 };
 
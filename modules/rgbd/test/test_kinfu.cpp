@@ -378,4 +378,137 @@ TEST( KinectFusion, DISABLED_hashTsdf )
     //! hashTSDF does not support non-equal volumeDims
     flyTest(true, false, true);
 }
+
+static void largeKinfuFly(const Ptr<large_kinfu::LargeKinfu>& lkf, const std::vector<Mat>& depths,
+                          std::vector<Affine3f>& kfPoses)
+{
+    kfPoses.clear();
+    for (size_t i = 0; i < depths.size(); i++)
+    {
+        ASSERT_TRUE(lkf->update(depths[i]));
+        // waits for the frame to be integrated, so that no pipelined frame is skipped
+        kfPoses.push_back(lkf->getPose());
+    }
+}
+
+static void largeKinfuRun(bool pipelined, std::vector<Affine3f>& kfPoses, Mat& points)
+{
+    Ptr<large_kinfu::Params> params = large_kinfu::Params::coarseParams();
+    params->pipelined = pipelined;
+
+    Ptr<Scene> scene = Scene::create(false, params->frameSize, params->intr, params->depthFactor);
+    Ptr<large_kinfu::LargeKinfu> lkf = large_kinfu::LargeKinfu::create(params);
+
+    std::vector<Mat> depths;
+    for (const Affine3f& pose : scene->getPoses())
+        depths.push_back(scene->depth(pose));
+
+    largeKinfuFly(lkf, depths, kfPoses);
+    lkf->getPoints(points);
+}
+
+static void expectSamePoses(const std::vector<Affine3f>& expected, const std::vector<Affine3f>& actual)
+{
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        EXPECT_LT(cv::norm(expected[i].rvec() - actual[i].rvec()), 1e-3) << "frame " << i;
+        EXPECT_LT(cv::norm(expected[i].translation() - actual[i].translation()), 1e-3) << "frame " << i;
+    }
+}
+
+#ifdef OPENCV_ENABLE_NONFREE
+TEST( LargeKinfu, pipelined )
+#else
+TEST(LargeKinfu, DISABLED_pipelined)
+#endif
+{
+    std::vector<Affine3f> serialPoses, pipelinedPoses;
+    Mat serialPoints, pipelinedPoints;
+    largeKinfuRun(false, serialPoses, serialPoints);
+    largeKinfuRun(true, pipelinedPoses, pipelinedPoints);
+
+    expectSamePoses(serialPoses, pipelinedPoses);
+
+    // the clouds may differ by the order of the parallel reductions only
+    ASSERT_GT(serialPoints.rows, 0);
+    EXPECT_LE(std::abs(serialPoints.rows - pipelinedPoints.rows), serialPoints.rows / 100);
+    Scalar serialMean = cv::mean(serialPoints), pipelinedMean = cv::mean(pipelinedPoints);
+    for (int c = 0; c < 3; c++)
+        EXPECT_NEAR(serialMean[c], pipelinedMean[c], 1e-3);
+}
+
+// Frames are given without waiting: the tracking overlaps the integration of the previous
+// frames, some of them may be skipped and the pose graphs superseded
+#ifdef OPENCV_ENABLE_NONFREE
+TEST( LargeKinfu, pipelined_unsynchronized )
+#else
+TEST(LargeKinfu, DISABLED_pipelined_unsynchronized)
+#endif
+{
+    Ptr<large_kinfu::Params> params = large_kinfu::Params::coarseParams();
+    params->pipelined = true;
+
+    Ptr<Scene> scene = Scene::create(false, params->frameSize, params->intr, params->depthFactor);
+    Ptr<large_kinfu::LargeKinfu> lkf = large_kinfu::LargeKinfu::create(params);
+
+    std::vector<Affine3f> poses = scene->getPoses();
+    std::vector<Mat> depths;
+    for (const Affine3f& pose : poses)
+        depths.push_back(scene->depth(pose));
+
+    ASSERT_TRUE(lkf->update(depths[0]));
+    Affine3f startPoseKF = lkf->getPose();
+    for (size_t i = 1; i < depths.size(); i++)
+        ASSERT_TRUE(lkf->update(depths[i]));
+
+    Affine3f kfPose = lkf->getPose();
+    Affine3f pose = (poses[0].inv() * poses.back()) * startPoseKF;
+    EXPECT_LT(cv::norm(kfPose.rvec() - pose.rvec()), 0.02);
+    EXPECT_LT(cv::norm(kfPose.translation() - pose.translation()), 0.1);
+
+    Mat points;
+    lkf->getPoints(points);
+    EXPECT_GT(points.rows, 0);
+}
+
+// reset() while frames are being integrated or graphs optimized: nothing of the previous map
+// may be applied to the new one, which is then built as by a new instance
+#ifdef OPENCV_ENABLE_NONFREE
+TEST( LargeKinfu, pipelined_reset )
+#else
+TEST(LargeKinfu, DISABLED_pipelined_reset)
+#endif
+{
+    Ptr<large_kinfu::Params> params = large_kinfu::Params::coarseParams();
+    params->pipelined = true;
+
+    Ptr<Scene> scene = Scene::create(false, params->frameSize, params->intr, params->depthFactor);
+    Ptr<large_kinfu::LargeKinfu> lkf = large_kinfu::LargeKinfu::create(params);
+
+    std::vector<Mat> depths;
+    for (const Affine3f& pose : scene->getPoses())
+        depths.push_back(scene->depth(pose));
+
+    for (size_t n = 1; n < std::min(depths.size(), (size_t)6); n++)
+    {
+        SCOPED_TRACE(cv::format("reset after %d frames", (int)n));
+        for (size_t i = 0; i < n; i++)
+            ASSERT_TRUE(lkf->update(depths[i]));
+        lkf->reset();
+
+        Affine3f pose = lkf->getPose();
+        EXPECT_EQ(0, cv::norm(pose.matrix, Matx44f::eye(), NORM_INF));
+    }
+
+    std::vector<Affine3f> freshPoses, resetPoses;
+    Mat freshPoints, resetPoints;
+    largeKinfuRun(true, freshPoses, freshPoints);
+    largeKinfuFly(lkf, depths, resetPoses);
+    lkf->getPoints(resetPoints);
+
+    expectSamePoses(freshPoses, resetPoses);
+    ASSERT_GT(freshPoints.rows, 0);
+    EXPECT_LE(std::abs(freshPoints.rows - resetPoints.rows), freshPoints.rows / 100);
+}
 }} // namespace
@@ -0,0 +1,251 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html
+
+#include "test_precomp.hpp"
+#include "../src/linemod_kernels.hpp"
+#include <fstream>
+
+namespace opencv_test { namespace {
+
+/** Random template pyramids with the layout produced by Detector::addTemplate() */
+static void addRandomTemplates(linemod::Detector& detector, const String& classId, int numTemplates, RNG& rng)
+{
+    const int numModalities = (int)detector.getModalities().size();
+    for (int t = 0; t < numTemplates; t++)
+    {
+        std::vector<linemod::Template> templates(numModalities * detector.pyramidLevels());
+        for (size_t i = 0; i < templates.size(); i++)
+        {
+            linemod::Template& templ = templates[i];
+            templ.pyramid_level = (int)i / numModalities;
+            templ.width = rng.uniform(10, 100) >> templ.pyramid_level;
+            templ.height = rng.uniform(10, 100) >> templ.pyramid_level;
+            int numFeatures = rng.uniform(0, 64);
+            for (int f = 0; f < numFeatures; f++)
+                templ.features.push_back(linemod::Feature(rng.uniform(0, templ.width), rng.uniform(0, templ.height),
+                                                          rng.uniform(0, 8)));
+        }
+        detector.addSyntheticTemplate(templates, classId);
+    }
+}
+
+static void checkTemplatesEqual(const std::vector<linemod::Template>& expected,
+                                const std::vector<linemod::Template>& actual)
+{
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        EXPECT_EQ(expected[i].width, actual[i].width);
+        EXPECT_EQ(expected[i].height, actual[i].height);
+        EXPECT_EQ(expected[i].pyramid_level, actual[i].pyramid_level);
+        ASSERT_EQ(expected[i].features.size(), actual[i].features.size());
+        for (size_t f = 0; f < expected[i].features.size(); f++)
+        {
+            EXPECT_EQ(expected[i].features[f].x, actual[i].features[f].x);
+            EXPECT_EQ(expected[i].features[f].y, actual[i].features[f].y);
+            EXPECT_EQ(expected[i].features[f].label, actual[i].features[f].label);
+        }
+    }
+}
+
+TEST(Rgbd_Linemod, binaryTemplateDatabase)
+{
+    Ptr<linemod::Detector> detector = linemod::getDefaultLINEMOD();
+    RNG rng(17);
+    addRandomTemplates(*detector, "box", 5, rng);
+    addRandomTemplates(*detector, "cup", 12, rng);
+    addRandomTemplates(*detector, "empty", 0, rng);
+
+    String filename = cv::tempfile(".bin");
+    detector->writeClassesBinary(filename);
+
+    Ptr<linemod::Detector> loaded = linemod::getDefaultLINEMOD();
+    loaded->readClassesBinary(filename);
+
+    // the directory alone gives the classes and template counts
+    EXPECT_EQ(detector->classIds(), loaded->classIds());
+    EXPECT_EQ(detector->numTemplates(), loaded->numTemplates());
+    EXPECT_EQ(12, loaded->numTemplates("cup"));
+
+    std::vector<String> ids = detector->classIds();
+    for (size_t c = 0; c < ids.size(); c++)
+    {
+        for (int t = 0; t < detector->numTemplates(ids[c]); t++)
+        {
+            SCOPED_TRACE(cv::format("class %s, template %d", ids[c].c_str(), t));
+            checkTemplatesEqual(detector->getTemplates(ids[c], t), loaded->getTemplates(ids[c], t));
+        }
+    }
+
+    // a database written by a partially loaded detector copies the pending classes as is
+    Ptr<linemod::Detector> partial = linemod::getDefaultLINEMOD();
+    partial->readClassesBinary(filename);
+    partial->getTemplates("box", 0);
+    String filename2 = cv::tempfile(".bin");
+    partial->writeClassesBinary(filename2);
+
+    Ptr<linemod::Detector> reloaded = linemod::getDefaultLINEMOD();
+    reloaded->readClassesBinary(filename2);
+    for (int t = 0; t < detector->numTemplates("cup"); t++)
+        checkTemplatesEqual(detector->getTemplates("cup", t), reloaded->getTemplates("cup", t));
+
+    // incompatible detector settings
+    Ptr<linemod::Detector> line = linemod::getDefaultLINE();
+    EXPECT_ANY_THROW(line->readClassesBinary(filename));
+
+    remove(filename.c_str());
+    remove(filename2.c_str());
+}
+
+TEST(Rgbd_Linemod, binaryTemplateDatabase_corrupted)
+{
+    Ptr<linemod::Detector> detector = linemod::getDefaultLINE();
+    RNG rng(18);
+    addRandomTemplates(*detector, "box", 3, rng);
+
+    String filename = cv::tempfile(".bin");
+    detector->writeClassesBinary(filename);
+
+    std::vector<char> data;
+    {
+        std::ifstream in(filename.c_str(), std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    ASSERT_GT(data.size(), (size_t)64);
+
+    // truncated file
+    {
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        out.write(&data[0], data.size() - 5);
+    }
+    Ptr<linemod::Detector> loaded = linemod::getDefaultLINE();
+    EXPECT_ANY_THROW(loaded->readClassesBinary(filename));
+    EXPECT_EQ(0, loaded->numClasses());
+
+    remove(filename.c_str());
+}
+
+TEST(Rgbd_Linemod, kernels)
+{
+    RNG rng(19);
+    // widths around the vector sizes, sources shifted from the vector alignment
+    const int widths[] = { 1, 15, 16, 17, 31, 33, 63, 67, 100 };
+    for (int width : widths)
+    {
+        for (int shift = 0; shift < 4; shift++)
+        {
+            SCOPED_TRACE(cv::format("width %d, shift %d", width, shift));
+
+            Mat src(7, width + 8, CV_8U), dst(7, width, CV_8U);
+            rng.fill(src, RNG::UNIFORM, 0, 256);
+            rng.fill(dst, RNG::UNIFORM, 0, 256);
+            Mat dstVec = dst.clone(), dstScalar = dst.clone();
+            linemod::orUnaligned8u(src.ptr() + shift, (int)src.step1(), dstVec.ptr(), (int)dstVec.step1(),
+                                   width, src.rows, true);
+            linemod::orUnaligned8u(src.ptr() + shift, (int)src.step1(), dstScalar.ptr(), (int)dstScalar.step1(),
+                                   width, src.rows, false);
+            EXPECT_EQ(0, cvtest::norm(dstVec, dstScalar, NORM_INF));
+
+            std::vector<ushort> sumVec(width), sumScalar(width);
+            linemod::addUnaligned8u16u(src.ptr() + shift, src.ptr(1) + 3 - shift, &sumVec[0], width, true);
+            linemod::addUnaligned8u16u(src.ptr() + shift, src.ptr(1) + 3 - shift, &sumScalar[0], width, false);
+            EXPECT_EQ(sumScalar, sumVec);
+        }
+    }
+
+    // random linear memories of an image of W x H cells, with responses in [0, 4]
+    const int T = 4, W = 41, H = 37;
+    const Size size(W * T, H * T);
+    std::vector<Mat> memories(8);
+    for (Mat& m : memories)
+    {
+        m.create(T * T, W * H, CV_8U);
+        rng.fill(m, RNG::UNIFORM, 0, 5);
+    }
+
+    for (int t = 0; t < 20; t++)
+    {
+        SCOPED_TRACE(cv::format("template %d", t));
+
+        linemod::Template templ;
+        templ.width = rng.uniform(1, 8 * T);
+        templ.height = rng.uniform(1, 8 * T);
+        int numFeatures = rng.uniform(1, 64);
+        for (int f = 0; f < numFeatures; f++)
+            templ.features.push_back(linemod::Feature(rng.uniform(0, templ.width), rng.uniform(0, templ.height),
+                                                      rng.uniform(0, 8)));
+
+        Mat simVec, simScalar;
+        linemod::similarity(memories, templ, simVec, size, T, true);
+        linemod::similarity(memories, templ, simScalar, size, T, false);
+        EXPECT_EQ(0, cvtest::norm(simVec, simScalar, NORM_INF));
+
+        Point center(rng.uniform(8 * T, (W - 24) * T), rng.uniform(8 * T, (H - 24) * T));
+        linemod::similarityLocal(memories, templ, simVec, size, T, center, true);
+        linemod::similarityLocal(memories, templ, simScalar, size, T, center, false);
+        EXPECT_EQ(0, cvtest::norm(simVec, simScalar, NORM_INF));
+    }
+}
+
+// The matches of the templates, computed in parallel, are listed in the same order whatever
+// the number of threads
+TEST(Rgbd_Linemod, match_threads)
+{
+    int nThreads = cv::getNumThreads();
+    if (nThreads == 1)
+        throw SkipTestException("Single thread environment");
+
+    Ptr<linemod::Detector> detector = linemod::getDefaultLINE();
+
+    // a few shapes, each learned with its own mask at several sizes
+    Mat scene(480, 640, CV_8UC3, Scalar::all(0));
+    for (int i = 0; i < 3; i++)
+    {
+        Mat image(480, 640, CV_8UC3, Scalar::all(0)), mask(480, 640, CV_8U, Scalar::all(0));
+        for (int s = 0; s < 3; s++)
+        {
+            image.setTo(Scalar::all(0));
+            mask.setTo(Scalar::all(0));
+            int r = 30 + 10 * s;
+            Point c(160 + 160 * i, 120 + 120 * (s % 2));
+            if (i == 0)
+            {
+                circle(image, c, r, Scalar(0, 200, 255), FILLED);
+                circle(mask, c, r + 3, Scalar::all(255), FILLED);
+            }
+            else
+            {
+                Rect rect(c.x - r, c.y - r / i, 2 * r, 2 * r / i);
+                rectangle(image, rect, Scalar(255, 100 * i, 0), FILLED);
+                rectangle(mask, Rect(rect.x - 3, rect.y - 3, rect.width + 6, rect.height + 6), Scalar::all(255), FILLED);
+            }
+            image.copyTo(scene, mask);
+            detector->addTemplate(std::vector<Mat>(1, image), cv::format("shape%d", i), mask);
+        }
+    }
+    ASSERT_GT(detector->numTemplates(), 0);
+
+    std::vector<linemod::Match> multiThreadMatches, singleThreadMatches;
+    detector->match(std::vector<Mat>(1, scene), 80.f, multiThreadMatches);
+
+    cv::setNumThreads(1);
+    detector->match(std::vector<Mat>(1, scene), 80.f, singleThreadMatches);
+    cv::setNumThreads(nThreads);
+
+    ASSERT_FALSE(singleThreadMatches.empty());
+    ASSERT_EQ(singleThreadMatches.size(), multiThreadMatches.size());
+    for (size_t i = 0; i < singleThreadMatches.size(); i++)
+    {
+        SCOPED_TRACE(cv::format("match %d", (int)i));
+        const linemod::Match& m1 = singleThreadMatches[i];
+        const linemod::Match& mN = multiThreadMatches[i];
+        EXPECT_EQ(m1.x, mN.x);
+        EXPECT_EQ(m1.y, mN.y);
+        EXPECT_EQ(m1.similarity, mN.similarity);
+        EXPECT_EQ(m1.class_id, mN.class_id);
+        EXPECT_EQ(m1.template_id, mN.template_id);
+    }
+}
+
+}}  // namespace
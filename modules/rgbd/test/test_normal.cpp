@@ -435,12 +435,102 @@ TEST(Rgbd_Normals, compute)
   test.safe_run();
 }
 
+// Normals of 3 planes computed with the scalar loops in a single thread, in a single thread
+// and with all threads
+static void computeNormalsModes(RgbdNormals::RGBD_NORMALS_METHOD method, int depth,
+                                Mat& scalar, Mat& serial, Mat& parallel)
+{
+  std::vector<Plane> plane_params;
+  Mat_<unsigned char> plane_mask;
+  Mat points3d, ground_normals;
+  gen_points_3d(plane_params, plane_mask, points3d, ground_normals, 3);
+  points3d.convertTo(points3d, depth);
+
+  Mat input = points3d;
+  if (method == RgbdNormals::RGBD_NORMALS_METHOD_LINEMOD)
+  {
+    std::vector<Mat> channels;
+    split(points3d, channels);
+    input = channels[2];
+  }
+
+  RgbdNormals normals_computer(H, W, depth, K, 5, method);
+  normals_computer.initialize();
+
+  int nThreads = getNumThreads();
+  normals_computer(input, parallel);
+  setNumThreads(1);
+  normals_computer(input, serial);
+  setUseOptimized(false);
+  normals_computer(input, scalar);
+  setUseOptimized(true);
+  setNumThreads(nThreads);
+}
+
+static double maxNormalDifference(const Mat& expected, const Mat& actual)
+{
+  // invalid normals must be at the same places
+  Mat e = expected.reshape(1), a = actual.reshape(1);
+  EXPECT_EQ(0, countNonZero((e != e) != (a != a)));
+  e = e.clone();
+  a = a.clone();
+  patchNaNs(e, 0);
+  patchNaNs(a, 0);
+  return cvtest::norm(e, a, NORM_INF);
+}
+
+TEST(Rgbd_Normals, optimizations)
+{
+  const RgbdNormals::RGBD_NORMALS_METHOD methods[] = { RgbdNormals::RGBD_NORMALS_METHOD_FALS,
+                                                       RgbdNormals::RGBD_NORMALS_METHOD_LINEMOD,
+                                                       RgbdNormals::RGBD_NORMALS_METHOD_SRI };
+  for (RgbdNormals::RGBD_NORMALS_METHOD method : methods)
+  {
+    for (int depth : { CV_32F, CV_64F })
+    {
+      SCOPED_TRACE(cv::format("method %d, depth %d", (int)method, depth));
+
+      Mat scalar, serial, parallel;
+      computeNormalsModes(method, depth, scalar, serial, parallel);
+      ASSERT_EQ(serial.type(), parallel.type());
+
+      // every pixel is computed the same way whatever the thread
+      EXPECT_EQ(0, maxNormalDifference(serial, parallel));
+      // the vectorized loops may differ from the scalar ones by rounding only
+      EXPECT_LE(maxNormalDifference(scalar, serial), 1e-5);
+    }
+  }
+}
+
 TEST(Rgbd_Plane, compute)
 {
   CV_RgbdPlaneTest test;
   test.safe_run();
 }
 
+TEST(Rgbd_Plane, previousPlanes)
+{
+  std::vector<Plane> planes;
+  Mat points3d, ground_normals;
+  Mat_<unsigned char> plane_mask;
+  gen_points_3d(planes, plane_mask, points3d, ground_normals, 3);
+
+  RgbdPlane plane_computer;
+  plane_computer.setUsePreviousPlanes(true);
+
+  Mat mask_first, mask_second;
+  std::vector<Vec4f> coeffs_first, coeffs_second;
+  plane_computer(points3d, mask_first, coeffs_first);
+  ASSERT_FALSE(coeffs_first.empty());
+
+  // Seeded with its own result, the detector finds the same planes in the same order
+  plane_computer(points3d, mask_second, coeffs_second);
+  ASSERT_EQ(coeffs_first.size(), coeffs_second.size());
+  for (size_t i = 0; i < coeffs_first.size(); ++i)
+    EXPECT_LE(cv::norm(coeffs_first[i] - coeffs_second[i]), 1e-4);
+  EXPECT_LE(countNonZero(mask_first != mask_second), 0.001 * mask_first.total());
+}
+
 TEST(Rgbd_Plane, regression_2309_valgrind_check)
 {
     Mat points(640, 480, CV_32FC3, Scalar::all(0));
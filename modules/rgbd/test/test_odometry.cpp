@@ -134,6 +134,7 @@ public:
 protected:
     bool readData(Mat& image, Mat& depth) const;
     static void generateRandomTransformation(Mat& R, Mat& t);
+    void checkRecycledFrames(const Mat& image, const Mat& depth, const Mat& K);
 
     virtual void run(int);
 
@@ -193,6 +194,57 @@ void CV_OdometryTest::generateRandomTransformation(Mat& rvec, Mat& tvec)
     normalize(tvec, tvec, rng.uniform(0.008f, maxTranslation));
 }
 
+// Frames recycled by swapping should give the same result as the new ones and reuse the pyramids memory
+void CV_OdometryTest::checkRecycledFrames(const Mat& image, const Mat& depth, const Mat& K)
+{
+    const int nFrames = 6;
+    std::vector<Mat> images(nFrames), depths(nFrames);
+    images[0] = image; depths[0] = depth;
+    for(int i = 1; i < nFrames; i++)
+    {
+        Mat rvec, tvec;
+        generateRandomTransformation(rvec, tvec);
+        warpFrame(images[i-1], depths[i-1], rvec, tvec, K, images[i], depths[i]);
+        dilateFrame(images[i], depths[i]);
+    }
+
+    Ptr<OdometryFrame> srcFrame = OdometryFrame::create(images[0], depths[0]);
+    Ptr<OdometryFrame> dstFrame = OdometryFrame::create();
+    Ptr<OdometryFrame> newSrcFrame = OdometryFrame::create(images[0], depths[0]);
+    std::vector<uchar*> cloudData;
+    for(int i = 1; i < nFrames; i++)
+    {
+        dstFrame->recycle();
+        dstFrame->image = images[i];
+        dstFrame->depth = depths[i];
+
+        Ptr<OdometryFrame> newDstFrame = OdometryFrame::create(images[i], depths[i]);
+
+        Mat recycledRt, newRt;
+        bool recycledComputed = odometry->compute(srcFrame, dstFrame, recycledRt);
+        bool newComputed = odometry->compute(newSrcFrame, newDstFrame, newRt);
+        ASSERT_EQ(newComputed, recycledComputed);
+        if(newComputed)
+            EXPECT_LE(cvtest::norm(recycledRt, newRt, NORM_INF), 1e-6);
+        newSrcFrame = newDstFrame;
+
+        // the same frame object is a source one every second step
+        if(i == 3)
+        {
+            for(size_t j = 0; j < srcFrame->pyramidCloud.size(); j++)
+                cloudData.push_back(srcFrame->pyramidCloud[j].data);
+        }
+        else if(i == 5)
+        {
+            ASSERT_EQ(cloudData.size(), srcFrame->pyramidCloud.size());
+            for(size_t j = 0; j < cloudData.size(); j++)
+                EXPECT_EQ(cloudData[j], srcFrame->pyramidCloud[j].data);
+        }
+
+        std::swap(srcFrame, dstFrame);
+    }
+}
+
 void CV_OdometryTest::run(int)
 {
     float fx = 525.0f, // default
@@ -298,6 +350,9 @@ void CV_OdometryTest::run(int)
         ts->printf(cvtest::TS::LOG, "\nIncorrect count of accurate poses [2nd case]: %f / %f", static_cast<double>(better_5times_count), maxError5 * static_cast<double>(iterCount));
         ts->set_failed_test_info(cvtest::TS::FAIL_BAD_ACCURACY);
     }
+
+    // 3. Process a sequence with recycled frames.
+    checkRecycledFrames(image, depth, K);
 }
 
 /****************************************************************************************\
@@ -0,0 +1,30 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html
+
+#include "test_precomp.hpp"
+#include "test_pose_graph_common.hpp"
+
+namespace opencv_test { namespace {
+
+using namespace cv::kinfu;
+
+#if defined(HAVE_EIGEN)
+TEST(PoseGraph, levenbergMarquardt)
+{
+    std::vector<Affine3d> groundTruth;
+    PoseGraph poseGraph = makeHelixPoseGraph(500, 50, 0.01, groundTruth);
+    ASSERT_TRUE(poseGraph.isValid());
+
+    int iterations = Optimizer::optimizeLevenbergMarquardt(poseGraph);
+    EXPECT_LT(iterations, 100);
+
+    // measurements are exact, so the optimum is the ground truth
+    double maxTransError, maxRotError;
+    poseGraphErrors(poseGraph, groundTruth, maxTransError, maxRotError);
+    EXPECT_LT(maxTransError, 1e-3);
+    EXPECT_LT(maxRotError, 1e-3);
+}
+#endif
+
+}}  // namespace
@@ -0,0 +1,75 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html
+
+#ifndef OPENCV_RGBD_TEST_POSE_GRAPH_COMMON_HPP
+#define OPENCV_RGBD_TEST_POSE_GRAPH_COMMON_HPP
+
+#include "opencv2/core/private.hpp"  // cvconfig.h: HAVE_EIGEN as seen by the library
+#include "../src/pose_graph.hpp"
+
+namespace opencv_test {
+
+#if defined(HAVE_EIGEN)
+/** Helix trajectory with odometry edges and loop closures to the previous turn,
+ *  the initial poses are built from noisy odometry and the edges are exact. */
+inline cv::kinfu::PoseGraph makeHelixPoseGraph(int numNodes, int nodesPerTurn, double noise,
+                                               std::vector<Affine3d>& groundTruth)
+{
+    using namespace cv::kinfu;
+
+    RNG rng(42);
+    groundTruth.clear();
+    for (int i = 0; i < numNodes; i++)
+    {
+        double angle = CV_2PI * i / nodesPerTurn;
+        groundTruth.push_back(Affine3d(Vec3d(0, 0, angle),
+                                       Vec3d(cos(angle), sin(angle), 0.1 * i / nodesPerTurn)));
+    }
+
+    PoseGraph poseGraph;
+    Affine3d estimate = groundTruth[0];
+    for (int i = 0; i < numNodes; i++)
+    {
+        if (i > 0)
+        {
+            Affine3d odometryNoise(Vec3d(rng.gaussian(noise), rng.gaussian(noise), rng.gaussian(noise)),
+                                   Vec3d(rng.gaussian(noise), rng.gaussian(noise), rng.gaussian(noise)));
+            estimate = estimate * groundTruth[i - 1].inv() * groundTruth[i] * odometryNoise;
+        }
+        PoseGraphNode node(i, Affine3f(estimate));
+        if (i == 0)
+            node.setFixed();
+        poseGraph.addNode(node);
+    }
+
+    // an edge measures the source pose in the target frame
+    for (int i = 1; i < numNodes; i++)
+    {
+        poseGraph.addEdge(PoseGraphEdge(i, i - 1, Affine3f(groundTruth[i - 1].inv() * groundTruth[i])));
+        if (i >= nodesPerTurn)
+        {
+            int j = i - nodesPerTurn;
+            poseGraph.addEdge(PoseGraphEdge(i, j, Affine3f(groundTruth[j].inv() * groundTruth[i])));
+        }
+    }
+    return poseGraph;
+}
+
+//! Largest translation and rotation errors of the node poses against the ground truth
+inline void poseGraphErrors(const cv::kinfu::PoseGraph& poseGraph, const std::vector<Affine3d>& groundTruth,
+                            double& maxTransError, double& maxRotError)
+{
+    maxTransError = maxRotError = 0;
+    for (int i = 0; i < poseGraph.getNumNodes(); i++)
+    {
+        Affine3d pose(poseGraph.nodes[i].getPose());
+        maxTransError = std::max(maxTransError, cv::norm(pose.translation() - groundTruth[i].translation()));
+        maxRotError   = std::max(maxRotError, cv::norm((pose.inv() * groundTruth[i]).rvec()));
+    }
+}
+#endif
+
+}  // namespace
+
+#endif
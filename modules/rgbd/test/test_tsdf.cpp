@@ -470,6 +470,104 @@ void valid_points_test(bool isHashTSDF)
     ASSERT_LT(0.5 - percentValidity, 0.3);
 }
 
+// checks that every vertex has a vertex of the reference mesh within the tolerance
+static void checkMeshVertices(const Mat& vertices, const Mat& refVertices, float tolerance)
+{
+    typedef std::tuple<int, int, int> Cell;
+    auto cellOf = [&](const Vec4f& v, int dx, int dy, int dz)
+    {
+        return Cell(cvFloor(v[0] / tolerance) + dx, cvFloor(v[1] / tolerance) + dy, cvFloor(v[2] / tolerance) + dz);
+    };
+    std::map<Cell, std::vector<int> > grid;
+    for (int i = 0; i < refVertices.rows; i++)
+        grid[cellOf(refVertices.at<Vec4f>(i), 0, 0, 0)].push_back(i);
+
+    for (int i = 0; i < vertices.rows; i++)
+    {
+        const Vec4f& v = vertices.at<Vec4f>(i);
+        float minDist = std::numeric_limits<float>::max();
+        for (int dz = -1; dz <= 1; dz++)
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    auto it = grid.find(cellOf(v, dx, dy, dz));
+                    if (it == grid.end())
+                        continue;
+                    for (int j : it->second)
+                    {
+                        const Vec4f& r = refVertices.at<Vec4f>(j);
+                        minDist = std::min(minDist, (float)norm(Vec3f(v[0] - r[0], v[1] - r[1], v[2] - r[2])));
+                    }
+                }
+        ASSERT_LE(minDist, tolerance) << "vertex " << i;
+    }
+}
+
+void mesh_test(bool isHashTSDF)
+{
+    Ptr<kinfu::Params> _params;
+    if (isHashTSDF)
+        _params = kinfu::Params::hashTSDFParams(true);
+    else
+        _params = kinfu::Params::coarseParams();
+
+    Ptr<Scene> scene = Scene::create(_params->frameSize, _params->intr, _params->depthFactor);
+    std::vector<Affine3f> poses = scene->getPoses();
+
+    auto makeVolume = [&]()
+    {
+        return kinfu::makeVolume(_params->volumeType, _params->voxelSize, _params->volumePose.matrix,
+            _params->raycast_step_factor, _params->tsdf_trunc_dist, _params->tsdf_max_weight,
+            _params->truncateThreshold, _params->volumeDims);
+    };
+
+    Ptr<kinfu::Volume> volume = makeVolume();
+    Mat vertices, triangles;
+    volume->integrate(scene->depth(poses[0]), _params->depthFactor, poses[0].matrix, _params->intr);
+    volume->fetchMesh(vertices, triangles);
+    ASSERT_GT(vertices.rows, 0);
+    ASSERT_GT(triangles.rows, 0);
+    ASSERT_EQ(triangles.type(), CV_32SC3);
+
+    // every vertex is used and shared vertices are not duplicated
+    std::vector<int> uses(vertices.rows, 0);
+    for (int i = 0; i < triangles.rows; i++)
+    {
+        const Vec3i& t = triangles.at<Vec3i>(i);
+        for (int k = 0; k < 3; k++)
+        {
+            ASSERT_GE(t[k], 0);
+            ASSERT_LT(t[k], vertices.rows);
+            uses[t[k]]++;
+        }
+    }
+    for (int i = 0; i < vertices.rows; i++)
+    {
+        ASSERT_GT(uses[i], 0);
+        ASSERT_FALSE(cvIsNaN(vertices.at<Vec4f>(i)[0]));
+    }
+    ASSERT_GT(3 * triangles.rows, 2 * vertices.rows);
+
+    // remeshing only the updated part gives the same mesh as meshing everything at once
+    Mat newVertices, newTriangles;
+    volume->integrate(scene->depth(poses[1]), _params->depthFactor, poses[1].matrix, _params->intr);
+    volume->fetchMesh(newVertices, newTriangles);
+
+    Ptr<kinfu::Volume> refVolume = makeVolume();
+    Mat refVertices, refTriangles;
+    refVolume->integrate(scene->depth(poses[0]), _params->depthFactor, poses[0].matrix, _params->intr);
+    refVolume->integrate(scene->depth(poses[1]), _params->depthFactor, poses[1].matrix, _params->intr);
+    refVolume->fetchMesh(refVertices, refTriangles);
+
+    ASSERT_EQ(newVertices.rows, refVertices.rows);
+    ASSERT_EQ(newTriangles.rows, refTriangles.rows);
+
+    // the vertex order may differ, compare the positions both ways
+    const float tolerance = _params->voxelSize * 1e-3f;
+    checkMeshVertices(newVertices, refVertices, tolerance);
+    checkMeshVertices(refVertices, newVertices, tolerance);
+}
+
 TEST(TSDF, raycast_normals)
 {
     normal_test(false, true, false, false);
@@ -510,4 +608,14 @@ TEST(HashTSDF, valid_points)
     valid_points_test(true);
 }
 
+TEST(TSDF, fetch_mesh)
+{
+    mesh_test(false);
+}
+
+TEST(HashTSDF, fetch_mesh)
+{
+    mesh_test(true);
+}
+
 }}  // namespace
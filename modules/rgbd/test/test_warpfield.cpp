@@ -0,0 +1,120 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html
+
+#include "test_precomp.hpp"
+#include "../src/warpfield.hpp"
+
+namespace opencv_test { namespace {
+
+using namespace cv::dynafu;
+
+// Two distant blobs, so that most of the cells between them are empty
+static std::vector<Point3f> makeBlobs(RNG& rng, int n)
+{
+    std::vector<Point3f> points;
+    for (int i = 0; i < n; i++)
+    {
+        Point3f centre = (i % 2) ? Point3f(2.f, -1.f, 0.5f) : Point3f(-1.f, 0.5f, 0.f);
+        points.push_back(centre + Point3f(rng.uniform(-.3f, .3f), rng.uniform(-.3f, .3f), rng.uniform(-.3f, .3f)));
+    }
+    return points;
+}
+
+static float sqDist(Point3f a, Point3f b)
+{
+    Point3f d = a - b;
+    return d.dot(d);
+}
+
+TEST(DynaFu_PointGrid, knnSearch)
+{
+    RNG rng(7);
+    const std::vector<Point3f> points = makeBlobs(rng, 500);
+    PointGrid grid(0.1f);
+
+    std::vector<int> indices;
+    std::vector<float> dists;
+    grid.knnSearch(Point3f(0, 0, 0), 4, indices, dists);
+    EXPECT_TRUE(indices.empty());
+
+    for (const Point3f& p : points)
+        grid.add(p);
+
+    const int ks[] = { 1, 4, 10, 600 };
+    for (int q = 0; q < 50; q++)
+    {
+        // inside the blobs, between them and far outside of the grid
+        Point3f query(rng.uniform(-4.f, 5.f), rng.uniform(-4.f, 4.f), rng.uniform(-3.f, 3.f));
+
+        std::vector<float> expected;
+        for (const Point3f& p : points)
+            expected.push_back(sqDist(p, query));
+        std::sort(expected.begin(), expected.end());
+
+        for (int k : ks)
+        {
+            SCOPED_TRACE(cv::format("query %d, k = %d", q, k));
+            grid.knnSearch(query, k, indices, dists);
+
+            const size_t n = std::min((size_t)k, points.size());
+            ASSERT_EQ(n, indices.size());
+            ASSERT_EQ(n, dists.size());
+            for (size_t i = 0; i < n; i++)
+            {
+                EXPECT_FLOAT_EQ(expected[i], dists[i]);
+                EXPECT_FLOAT_EQ(sqDist(points[indices[i]], query), dists[i]);
+            }
+        }
+    }
+}
+
+TEST(DynaFu_PointGrid, radiusSearch)
+{
+    RNG rng(11);
+    const std::vector<Point3f> points = makeBlobs(rng, 500);
+    PointGrid grid(0.1f);
+
+    std::vector<int> indices;
+    grid.radiusSearch(Point3f(0, 0, 0), 1.f, indices);
+    EXPECT_TRUE(indices.empty());
+
+    for (const Point3f& p : points)
+        grid.add(p);
+
+    for (int q = 0; q < 50; q++)
+    {
+        Point3f query(rng.uniform(-4.f, 5.f), rng.uniform(-4.f, 4.f), rng.uniform(-3.f, 3.f));
+        float radiusSq = rng.uniform(0.f, 2.f);
+        SCOPED_TRACE(cv::format("query %d", q));
+
+        std::vector<int> expected;
+        for (int i = 0; i < (int)points.size(); i++)
+        {
+            if (sqDist(points[i], query) <= radiusSq)
+                expected.push_back(i);
+        }
+
+        grid.radiusSearch(query, radiusSq, indices);
+        std::sort(indices.begin(), indices.end());
+        EXPECT_EQ(expected, indices);
+
+        // only the nearest ones are kept when there are too many
+        const int maxResults = 5;
+        grid.radiusSearch(query, radiusSq, indices, maxResults);
+        ASSERT_EQ(std::min(expected.size(), (size_t)maxResults), indices.size());
+        float farthest = 0;
+        for (int i : indices)
+        {
+            EXPECT_TRUE(std::binary_search(expected.begin(), expected.end(), i));
+            farthest = std::max(farthest, sqDist(points[i], query));
+        }
+        for (int i : expected)
+        {
+            if (std::find(indices.begin(), indices.end(), i) == indices.end())
+                EXPECT_GE(sqDist(points[i], query), farthest);
+        }
+    }
+}
+
+}}  // namespace
@@ -59,6 +59,8 @@ namespace ppf_match_3d
 //! @addtogroup surface_matching
 //! @{
 
+struct ICPScene;
+
 /**
 * @brief This class implements a very efficient and robust variant of the iterative closest point (ICP) algorithm.
 * The task is to register a 3D model (or point cloud) against a set of noisy target data. The variants are put together
@@ -151,13 +153,55 @@ public:
      */
   CV_WRAP int registerModelToScene(const Mat& srcPC, const Mat& dstPC, CV_IN_OUT std::vector<Pose3DPtr>& poses);
 
+  /**
+     *  \brief Sets the scene for repeated registrations
+     *
+     *  @param [in] dstPC The input point cloud for the scene, with the normals (Nx6). Currently, CV_32F is
+     *  the only supported data type.
+     *  @param [in] cameraMatrix Optional 3x3 camera matrix of an organized scene. When it is given,
+     *  correspondences are found by projecting the model points into the scene image (projective data
+     *  association) instead of searching a KD-tree.
+     *  @param [in] width Width of the organized scene. Its rows are then the pixels of a width x (N/width)
+     *  image in row-major order, in the camera frame. Invalid pixels have NaN coordinates or a non-positive
+     *  depth. Ignored without cameraMatrix.
+     *
+     *  \details The scene is copied. Without a camera matrix, the KD-trees of the sampled scene are built once
+     *  per pyramid sampling and kept for the following registrations against this scene.
+     */
+  CV_WRAP void setScene(const Mat& dstPC, InputArray cameraMatrix = noArray(), int width = 0);
+
+  /**
+     *  \brief Perform registration against the scene given to setScene
+     *
+     *  @param [in] srcPC The input point cloud for the model. Expected to have the normals (Nx6). Currently,
+     *  CV_32F is the only supported data type.
+     *  @param [out] residual The output registration error.
+     *  @param [out] pose Transformation between srcPC and the scene.
+     *  \return On successful termination, the function returns 0.
+     */
+  CV_WRAP int registerModelToScene(const Mat& srcPC, CV_OUT double& residual, CV_OUT Matx44d& pose);
+
+  /**
+     *  \brief Perform registration with multiple initial poses against the scene given to setScene
+     *
+     *  @param [in] srcPC The input point cloud for the model. Expected to have the normals (Nx6). Currently,
+     *  CV_32F is the only supported data type.
+     *  @param [in,out] poses Input poses to start with but also list output of poses.
+     *  \return On successful termination, the function returns 0.
+     */
+  CV_WRAP int registerModelToScene(const Mat& srcPC, CV_IN_OUT std::vector<Pose3DPtr>& poses);
+
 private:
+  int registerModel(const Mat& srcPC, ICPScene& scene, double& residual, Matx44d& pose);
+  void registerModel(const Mat& srcPC, ICPScene& scene, std::vector<Pose3DPtr>& poses);
+
   float m_tolerance;
   int m_maxIterations;
   float m_rejectionScale;
   int m_numNeighborsCorr;
   int m_numLevels;
   int m_sampleType;
+  Ptr<ICPScene> m_scene;
 
 };
 
@@ -82,6 +82,8 @@ typedef struct THash
   int i, ppfInd;
 } THash;
 
+struct PPFModelIndex;
+
 /**
   * @brief Class, allowing the load and matching 3D models.
   * Typical Use:
@@ -140,6 +142,29 @@ public:
     */
   CV_WRAP void match(const Mat& scene, CV_OUT std::vector<Pose3DPtr> &results, const double relativeSceneSampleStep=1.0/5.0, const double relativeSceneDistance=0.03);
 
+  /**
+    *  \brief Saves the trained model into a binary file.
+    *
+    *  @param [in] fileName Path of the model file
+    *
+    *  \details The file stores the sampled model and a flat copy of the hashtable, laid out so that
+    *  loadModel can map it into memory and match with it directly. The format is native to the
+    *  machine (byte order and alignment) and is meant as a cache of trained models, not for exchange.
+    */
+  CV_WRAP void saveModel(const String& fileName) const;
+
+  /**
+    *  \brief Loads a model written by saveModel.
+    *
+    *  @param [in] fileName Path of the model file
+    *
+    *  \details The file is memory mapped where the platform supports it (and read into memory
+    *  otherwise, or when the OPENCV_SURFACE_MATCHING_MMAP environment variable is 0), so the
+    *  model is ready for "match" without retraining. The search parameters are reset to the
+    *  defaults of the loaded model, call setSearchParams afterwards to change them.
+    */
+  CV_WRAP void loadModel(const String& fileName);
+
   void read(const FileNode& fn);
   void write(FileStorage& fs) const;
 
@@ -151,6 +176,7 @@ protected:
   int num_ref_points;
   hashtable_int* hash_table;
   THash* hash_nodes;
+  Ptr<PPFModelIndex> model_index;
 
   double position_threshold, rotation_threshold;
   bool use_weighted_avg;
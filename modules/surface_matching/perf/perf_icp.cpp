@@ -0,0 +1,47 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html.
+#include "perf_precomp.hpp"
+#include "../test/test_icp_common.hpp"
+
+namespace opencv_test { namespace {
+
+enum { ICP_KDTREE, ICP_KDTREE_PREPARED, ICP_PROJECTIVE };
+CV_ENUM(ICPAssociation, ICP_KDTREE, ICP_KDTREE_PREPARED, ICP_PROJECTIVE)
+
+typedef tuple<int, ICPAssociation> ICPParams;
+typedef TestBaseWithParam<ICPParams> ICPPerfTest;
+
+PERF_TEST_P(ICPPerfTest, registerModelToScene, Combine(Values(80, 160, 320), ICPAssociation::all()))
+{
+    const int width = get<0>(GetParam()), height = width * 3 / 4;
+    const int association = get<1>(GetParam());
+    const Matx33d K(width, 0, 0.5 * (width - 1), 0, width, 0.5 * (height - 1), 0, 0, 1);
+    const Mat scene = generateOrganizedScene(K, width, height);
+
+    Matx44d offset;
+    const Mat model = generateOffsetModel(scene, width, height, offset);
+
+    ICP icp(100, 0.005f, 2.5f, 4);
+    if (association == ICP_KDTREE_PREPARED)
+        icp.setScene(scene);
+    else if (association == ICP_PROJECTIVE)
+        icp.setScene(scene, K, width);
+
+    double residual = 0;
+    Matx44d pose;
+    if (association != ICP_KDTREE)
+        icp.registerModelToScene(model, residual, pose); // warm up the prepared scene
+
+    TEST_CYCLE()
+    {
+        if (association == ICP_KDTREE)
+            icp.registerModelToScene(model, scene, residual, pose);
+        else
+            icp.registerModelToScene(model, residual, pose);
+    }
+
+    SANITY_CHECK_NOTHING();
+}
+
+}} // namespace
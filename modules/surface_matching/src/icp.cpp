@@ -242,8 +242,153 @@ static hashtable_int* getHashtable(int* data, size_t length, int numMaxElement)
   return hashtable;
 }
 
+static inline bool isValidScenePoint(const float* pt)
+{
+  return cvIsNaN(pt[0]) == 0 && cvIsNaN(pt[1]) == 0 && cvIsNaN(pt[2]) == 0;
+}
+
+// Scene of the registration. The scene is kept in its own coordinates: the model points are
+// brought into the scene frame for the correspondence search, so the search structures do
+// not depend on the normalization of a particular model and can be reused across calls.
+struct ICPScene
+{
+  struct Level
+  {
+    Mat points;
+    void* flann;
+  };
+
+  Mat points;
+  Vec3d mean;
+  bool projective;
+  Matx33d cameraMatrix;
+  int width, height;
+
+  Mutex mutex;
+  std::map<int, Level> levels;
+
+  ICPScene(const Mat& dstPC, InputArray _cameraMatrix, int _width)
+  {
+    CV_Assert(dstPC.type() == CV_32F || dstPC.type() == CV_32FC1);
+    CV_Assert(dstPC.cols >= 6 && dstPC.rows > 0);
+
+    points = dstPC;
+    projective = !_cameraMatrix.empty();
+    width = height = 0;
+    if (projective)
+    {
+      CV_Assert(_cameraMatrix.rows() == 3 && _cameraMatrix.cols() == 3);
+      CV_Assert(_width > 0 && dstPC.rows % _width == 0);
+      Mat K;
+      _cameraMatrix.getMat().convertTo(K, CV_64F);
+      cameraMatrix = Matx33d((const double*)K.data);
+      width = _width;
+      height = dstPC.rows / _width;
+    }
+
+    // as in PCA, over the valid points
+    double mean1=0, mean2 = 0, mean3 = 0;
+    int numValid = 0;
+    for (int i=0; i<points.rows; i++)
+    {
+      const float *row = points.ptr<float>(i);
+      if (isValidScenePoint(row))
+      {
+        mean1 += (double)row[0];
+        mean2 += (double)row[1];
+        mean3 += (double)row[2];
+        numValid++;
+      }
+    }
+    CV_Assert(numValid > 0);
+    mean = Vec3d(mean1, mean2, mean3) * (1.0 / numValid);
+  }
+
+  ~ICPScene()
+  {
+    for (std::map<int, Level>::iterator it = levels.begin(); it != levels.end(); ++it)
+      destroyFlann(it->second.flann);
+  }
+
+  // sum of the distances of the valid scene points to the given center
+  double computeDistToPoint(const Vec3d& center) const
+  {
+    double dist = 0;
+    for (int i=0; i<points.rows; i++)
+    {
+      const float *row = points.ptr<float>(i);
+      if (isValidScenePoint(row))
+      {
+        const Vec3d d((double)row[0] - center[0], (double)row[1] - center[1], (double)row[2] - center[2]);
+        dist += sqrt(d.dot(d));
+      }
+    }
+    return dist;
+  }
+
+  // uniformly sampled scene and its KD-tree for a sampling step, built on first use
+  const Level& getLevel(int sampleStep)
+  {
+    AutoLock lock(mutex);
+    std::map<int, Level>::iterator it = levels.find(sampleStep);
+    if (it == levels.end())
+    {
+      Level level;
+      level.points = samplePCUniform(points, sampleStep);
+      level.flann = indexPCFlann(level.points);
+      it = levels.insert(std::make_pair(sampleStep, level)).first;
+    }
+    return it->second;
+  }
+
+  // Projective data association: every query point is projected into the scene image and
+  // paired with the scene point at that pixel. Unpaired points get the index -1.
+  void findProjectiveCorrespondences(const Mat& queryPC, int* indices, float* distances) const
+  {
+    parallel_for_(Range(0, queryPC.rows), [&](const Range& range)
+    {
+      for (int i=range.start; i<range.end; i++)
+      {
+        const float* q = queryPC.ptr<float>(i);
+        indices[i] = -1;
+        distances[i] = 0;
+        if (!(q[2] > 0))
+          continue;
+
+        const Vec3d p = cameraMatrix * Vec3d(q[0], q[1], q[2]);
+        const double u = p[0] / p[2], v = p[1] / p[2];
+        if (!(u > -0.5 && u < width - 0.5 && v > -0.5 && v < height - 0.5))
+          continue;
+
+        const int ind = cvRound(v) * width + cvRound(u);
+        const float* pt = points.ptr<float>(ind);
+        if (!isValidScenePoint(pt) || !(pt[2] > 0))
+          continue;
+
+        const float dx = pt[0] - q[0], dy = pt[1] - q[1], dz = pt[2] - q[2];
+        indices[i] = ind;
+        distances[i] = dx*dx + dy*dy + dz*dz;
+      }
+    });
+  }
+};
+
+// moves the normalized model points back into the scene coordinates
+static void denormalizePC(const Mat& srcPC, const Vec3d& mean, double scale, Mat& dstPC)
+{
+  const double invScale = 1.0 / scale;
+  for (int i=0; i<srcPC.rows; i++)
+  {
+    const float* src = srcPC.ptr<float>(i);
+    float* dst = dstPC.ptr<float>(i);
+    dst[0] = (float)(src[0] * invScale + mean[0]);
+    dst[1] = (float)(src[1] * invScale + mean[1]);
+    dst[2] = (float)(src[2] * invScale + mean[2]);
+  }
+}
+
 // source point clouds are assumed to contain their normals
-int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, double& residual, Matx44d& pose)
+int ICP::registerModel(const Mat& srcPC, ICPScene& scene, double& residual, Matx44d& pose)
 {
   int n = srcPC.rows;
   CV_CheckGT(n, 0, "");
@@ -251,30 +396,23 @@ int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, double& residu
   const bool useRobustReject = m_rejectionScale>0;
 
   Mat srcTemp = srcPC.clone();
-  Mat dstTemp = dstPC.clone();
-  Vec3d meanSrc, meanDst;
+  Vec3d meanSrc;
   computeMeanCols(srcTemp, meanSrc);
-  computeMeanCols(dstTemp, meanDst);
-  Vec3d meanAvg = 0.5 * (meanSrc + meanDst);
+  Vec3d meanAvg = 0.5 * (meanSrc + scene.mean);
   subtractColumns(srcTemp, meanAvg);
-  subtractColumns(dstTemp, meanAvg);
 
   double distSrc = computeDistToOrigin(srcTemp);
-  double distDst = computeDistToOrigin(dstTemp);
+  double distDst = scene.computeDistToPoint(meanAvg);
 
   double scale = (double)n / ((distSrc + distDst)*0.5);
 
   srcTemp(cv::Range(0, srcTemp.rows), cv::Range(0,3)) *= scale;
-  dstTemp(cv::Range(0, dstTemp.rows), cv::Range(0,3)) *= scale;
 
   Mat srcPC0 = srcTemp;
-  Mat dstPC0 = dstTemp;
 
   // initialize pose
   pose = Matx44d::eye();
 
-  Mat M = Mat::eye(4,4,CV_64F);
-
   double tempResidual = 0;
 
 
@@ -294,20 +432,33 @@ int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, double& residu
     /*
     Tolga Birdal thinks that downsampling the scene points might decrease the accuracy.
     Hamdi Sahloul, however, noticed that accuracy increased (pose residual decreased slightly).
+    The projective association looks the points up in the full scene image instead.
     */
-    Mat dstPCS = samplePCUniform(dstPC0, sampleStep);
-    void* flann = indexPCFlann(dstPCS);
+    Mat dstPCS;
+    void* flann = 0;
+    if (scene.projective)
+    {
+      dstPCS = scene.points;
+    }
+    else
+    {
+      const ICPScene::Level& sceneLevel = scene.getLevel(sampleStep);
+      dstPCS = sceneLevel.points;
+      flann = sceneLevel.flann;
+    }
 
     double fval_old=9999999999;
     double fval_perc=0;
     double fval_min=9999999999;
     Mat Src_Moved = srcPCT.clone();
+    Mat Src_Scene = Mat(Src_Moved.rows, 3, CV_32F);
 
     int i=0;
 
     size_t numElSrc = (size_t)Src_Moved.rows;
     int sizesResult[2] = {(int)numElSrc, 1};
     float* distances = new float[numElSrc];
+    float* distancesCorr = new float[numElSrc];
     int* indices = new int[numElSrc];
 
     Mat Indices(2, sizesResult, CV_32S, indices, 0);
@@ -322,35 +473,50 @@ int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, double& residu
 
     Matx44d PoseX = Matx44d::eye();
 
+    const float scaleSqr = (float)(scale*scale);
+
     while ( (!(fval_perc<(1+TolP) && fval_perc>(1-TolP))) && i<MaxIterationsPyr)
     {
-      uint di=0, selInd = 0;
+      uint di=0, selInd = 0, numCorr = 0;
 
-      queryPCFlann(flann, Src_Moved, Indices, Distances);
+      // Step 1: Data association in the scene coordinates. The distances are brought back to
+      // the normalized frame
+      denormalizePC(Src_Moved, meanAvg, scale, Src_Scene);
+      if (scene.projective)
+        scene.findProjectiveCorrespondences(Src_Scene, indices, distances);
+      else
+        queryPCFlann(flann, Src_Scene, Indices, Distances);
 
       for (di=0; di<numElSrc; di++)
       {
-        newI[di] = di;
-        newJ[di] = indices[di];
+        distances[di] *= scaleSqr;
+        if (indices[di] >= 0)
+        {
+          newI[numCorr] = di;
+          newJ[numCorr] = indices[di];
+          distancesCorr[numCorr] = distances[di];
+          numCorr++;
+        }
       }
 
+      if (numCorr < 6)
+        break;
+
       if (useRobustReject)
       {
-        int numInliers = 0;
-        float threshold = getRejectionThreshold(distances, Distances.rows, m_rejectionScale);
-        Mat acceptInd = Distances<threshold;
+        uint numInliers = 0;
+        float threshold = getRejectionThreshold(distancesCorr, (int)numCorr, m_rejectionScale);
 
-        uchar *accPtr = (uchar*)acceptInd.data;
-        for (int l=0; l<acceptInd.rows; l++)
+        for (uint l=0; l<numCorr; l++)
         {
-          if (accPtr[l])
+          if (distances[newI[l]] < threshold)
           {
-            newI[numInliers] = l;
-            newJ[numInliers] = indices[l];
+            newI[numInliers] = newI[l];
+            newJ[numInliers] = newJ[l];
             numInliers++;
           }
         }
-        numElSrc=numInliers;
+        numCorr=numInliers;
       }
 
       // Step 2: Picky ICP
@@ -358,7 +524,7 @@ int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, double& residu
       // is assigned to the same model point m_j, then select p_i that corresponds
       // to the minimum distance
 
-      hashtable_int* duplicateTable = getHashtable(newJ, numElSrc, dstPCS.rows);
+      hashtable_int* duplicateTable = getHashtable(newJ, numCorr, dstPCS.rows);
 
       for (di=0; di<duplicateTable->size; di++)
       {
@@ -370,15 +536,15 @@ int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, double& residu
           size_t idx = reinterpret_cast<size_t>(node->data)-1, dn=0;
           int dup = (int)node->key-1;
           size_t minIdxD = idx;
-          float minDist = distances[idx];
+          float minDist = distances[newI[idx]];
 
           while ( node )
           {
             idx = reinterpret_cast<size_t>(node->data)-1;
 
-            if (distances[idx] < minDist)
+            if (distances[newI[idx]] < minDist)
             {
-              minDist = distances[idx];
+              minDist = distances[newI[idx]];
               minIdxD = idx;
             }
 
@@ -413,7 +579,7 @@ int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, double& residu
           for (ci=0; ci<srcPCT.cols; ci++)
           {
             srcMatchPt[ci] = (double)srcPt[ci];
-            dstMatchPt[ci] = (double)dstPt[ci];
+            dstMatchPt[ci] = ci < 3 ? ((double)dstPt[ci] - meanAvg[ci]) * scale : (double)dstPt[ci];
           }
         }
 
@@ -450,10 +616,10 @@ int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, double& residu
     delete[] indicesModel;
     delete[] indicesScene;
     delete[] distances;
+    delete[] distancesCorr;
     delete[] indices;
 
     tempResidual = fval_min;
-    destroyFlann(flann);
   }
 
   Matx33d Rpose;
@@ -467,8 +633,7 @@ int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, double& residu
   return 0;
 }
 
-// source point clouds are assumed to contain their normals
-int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, std::vector<Pose3DPtr>& poses)
+void ICP::registerModel(const Mat& srcPC, ICPScene& scene, std::vector<Pose3DPtr>& poses)
 {
   #if defined _OPENMP
   #pragma omp parallel for
@@ -477,9 +642,48 @@ int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, std::vector<Po
   {
     Matx44d poseICP = Matx44d::eye();
     Mat srcTemp = transformPCPose(srcPC, poses[i]->pose);
-    registerModelToScene(srcTemp, dstPC, poses[i]->residual, poseICP);
+    registerModel(srcTemp, scene, poses[i]->residual, poseICP);
     poses[i]->appendPose(poseICP);
   }
+}
+
+// source point clouds are assumed to contain their normals
+int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, double& residual, Matx44d& pose)
+{
+  ICPScene scene(dstPC, noArray(), 0);
+  return registerModel(srcPC, scene, residual, pose);
+}
+
+// source point clouds are assumed to contain their normals
+int ICP::registerModelToScene(const Mat& srcPC, const Mat& dstPC, std::vector<Pose3DPtr>& poses)
+{
+  // the scene and its KD-trees are shared by all the poses
+  ICPScene scene(dstPC, noArray(), 0);
+  registerModel(srcPC, scene, poses);
+  return 0;
+}
+
+void ICP::setScene(const Mat& dstPC, InputArray cameraMatrix, int width)
+{
+  m_scene = makePtr<ICPScene>(dstPC.clone(), cameraMatrix, width);
+}
+
+int ICP::registerModelToScene(const Mat& srcPC, double& residual, Matx44d& pose)
+{
+  if (!m_scene)
+  {
+    CV_Error(Error::StsError, "The scene is not set. Call setScene before the registration");
+  }
+  return registerModel(srcPC, *m_scene, residual, pose);
+}
+
+int ICP::registerModelToScene(const Mat& srcPC, std::vector<Pose3DPtr>& poses)
+{
+  if (!m_scene)
+  {
+    CV_Error(Error::StsError, "The scene is not set. Call setScene before the registration");
+  }
+  registerModel(srcPC, *m_scene, poses);
   return 0;
 }
 
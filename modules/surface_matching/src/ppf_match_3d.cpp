@@ -40,6 +40,15 @@
 
 #include "precomp.hpp"
 #include "hash_murmur.hpp"
+#include "opencv2/core/utils/configuration.private.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define HAVE_PPF_MODEL_MMAP
+#endif
 
 namespace cv
 {
@@ -116,6 +125,156 @@ static double computeAlpha(const Vec3d& p1, const Vec3d& n1, const Vec3d& p2)
   return (-alpha);
 }
 
+// model entry as used by the matching: the reference point and the model alpha of a pair
+struct PPFModelEntry
+{
+  int i;
+  float alpha;
+};
+
+// Flat (CSR) copy of the trained hashtable. The entries of bucket b are
+// entries[buckets[b]] ... entries[buckets[b+1]-1], in the same order as the chain of the
+// hashtable. The arrays either point to the owned vectors or into a mapped model file.
+struct PPFModelIndex
+{
+  size_t numBuckets;
+  const uint* buckets;
+  const PPFModelEntry* entries;
+
+  std::vector<uint> bucketData;
+  std::vector<PPFModelEntry> entryData;
+  std::vector<uchar> fileData;
+  void* mappedData;
+  size_t mappedSize;
+
+  PPFModelIndex() : numBuckets(0), buckets(0), entries(0), mappedData(0), mappedSize(0) {}
+
+  ~PPFModelIndex()
+  {
+#ifdef HAVE_PPF_MODEL_MMAP
+    if (mappedData)
+      munmap(mappedData, mappedSize);
+#endif
+  }
+};
+
+static Ptr<PPFModelIndex> flattenHashtable(hashtable_int* hashTable, const Mat& ppf, size_t ppfLength)
+{
+  Ptr<PPFModelIndex> index = makePtr<PPFModelIndex>();
+  const size_t numBuckets = hashTable->size;
+
+  index->bucketData.resize(numBuckets + 1);
+  uint numEntries = 0;
+  for (size_t b = 0; b < numBuckets; b++)
+  {
+    index->bucketData[b] = numEntries;
+    for (hashnode_i* node = hashTable->nodes[b]; node; node = node->next)
+      numEntries++;
+  }
+  index->bucketData[numBuckets] = numEntries;
+
+  index->entryData.resize(numEntries);
+  parallel_for_(Range(0, (int)numBuckets), [&](const Range& range)
+  {
+    for (int b = range.start; b < range.end; b++)
+    {
+      uint e = index->bucketData[b];
+      for (hashnode_i* node = hashTable->nodes[b]; node; node = node->next, e++)
+      {
+        const THash* tData = (const THash*)node->data;
+        index->entryData[e].i = tData->i;
+        index->entryData[e].alpha = ppf.ptr<float>(tData->ppfInd)[ppfLength-1];
+      }
+    }
+  });
+
+  index->numBuckets = numBuckets;
+  index->buckets = &index->bucketData[0];
+  index->entries = numEntries ? &index->entryData[0] : 0;
+  return index;
+}
+
+// binary model file layout: the header, followed by the sampled model points, the bucket
+// offsets and the entries. Every section starts at a multiple of PPF_MODEL_ALIGNMENT.
+static const char PPF_MODEL_MAGIC[8] = {'P', 'P', 'F', '3', 'D', 'M', 'D', 'L'};
+static const uint PPF_MODEL_VERSION = 1;
+static const uint PPF_MODEL_BYTE_ORDER = 0x01020304;
+static const size_t PPF_MODEL_ALIGNMENT = 64;
+
+struct PPFModelHeader
+{
+  char magic[8];
+  uint version;
+  uint byteOrder;
+  double samplingStepRelative, distanceStepRelative, angleStepRelative;
+  double angleStepRadians, angleStep, distanceStep;
+  uint64 numRefPoints, numCols, numBuckets, numEntries;
+  uint64 pointsOffset, bucketsOffset, entriesOffset, fileSize;
+};
+
+static uint64 alignModelOffset(uint64 offset)
+{
+  return (offset + PPF_MODEL_ALIGNMENT - 1) & ~(uint64)(PPF_MODEL_ALIGNMENT - 1);
+}
+
+static bool writeModelSection(FILE* f, uint64& pos, uint64 offset, const void* data, size_t size)
+{
+  static const char zeros[PPF_MODEL_ALIGNMENT] = {0};
+  CV_Assert(pos <= offset && offset - pos < PPF_MODEL_ALIGNMENT);
+
+  const size_t padding = (size_t)(offset - pos);
+  if (fwrite(zeros, 1, padding, f) != padding || (size && fwrite(data, 1, size, f) != size))
+    return false;
+
+  pos = offset + size;
+  return true;
+}
+
+static bool mapModelFile(const String& fileName, PPFModelIndex& index)
+{
+#ifdef HAVE_PPF_MODEL_MMAP
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    void* mapped = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped != MAP_FAILED)
+    {
+      index.mappedData = mapped;
+      index.mappedSize = (size_t)st.st_size;
+    }
+  }
+  close(fd);
+  return index.mappedData != 0;
+#else
+  CV_UNUSED(fileName); CV_UNUSED(index);
+  return false;
+#endif
+}
+
+static bool readModelFile(const String& fileName, PPFModelIndex& index)
+{
+  FILE* f = fopen(fileName.c_str(), "rb");
+  if (!f)
+    return false;
+
+  bool ok = false;
+  if (fseek(f, 0, SEEK_END) == 0)
+  {
+    const long size = ftell(f);
+    if (size > 0 && fseek(f, 0, SEEK_SET) == 0)
+    {
+      index.fileData.resize((size_t)size);
+      ok = fread(&index.fileData[0], 1, (size_t)size, f) == (size_t)size;
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
 PPF3DDetector::PPF3DDetector()
 {
   sampling_step_relative = 0.05;
@@ -192,6 +351,8 @@ void PPF3DDetector::clearTrainingModels()
     hashtableDestroy(this->hash_table);
     this->hash_table=0;
   }
+
+  this->model_index.release();
 }
 
 PPF3DDetector::~PPF3DDetector()
@@ -204,6 +365,8 @@ void PPF3DDetector::trainModel(const Mat &PC)
 {
   CV_Assert(PC.type() == CV_32F || PC.type() == CV_32FC1);
 
+  clearTrainingModels();
+
   // compute bbox
   Vec2f xRange, yRange, zRange;
   computeBboxStd(PC, xRange, yRange, zRange);
@@ -231,50 +394,252 @@ void PPF3DDetector::trainModel(const Mat &PC)
   // pre-allocate the hash nodes
   hash_nodes = (THash*)calloc(numRefPoints*numRefPoints, sizeof(THash));
 
-  // TODO : This can easily be parallelized. But we have to lock hashtable_insert.
-  // I realized that performance drops when this loop is parallelized (unordered
-  // inserts into the hashtable
-  // But it is still there to be investigated. For now, I leave this unparallelized
-  // since this is just a training part.
-  for (int i=0; i<numRefPoints; i++)
+  // The pair features are independent: every (i,j) pair owns its ppf row and its hash node,
+  // so they are computed in parallel without any synchronization.
+  parallel_for_(Range(0, numRefPoints), [&](const Range& range)
   {
-    const Vec3f p1(sampled.ptr<float>(i));
-    const Vec3f n1(sampled.ptr<float>(i) + 3);
+    for (int i=range.start; i<range.end; i++)
+    {
+      const Vec3f p1(sampled.ptr<float>(i));
+      const Vec3f n1(sampled.ptr<float>(i) + 3);
 
-    //printf("///////////////////// NEW REFERENCE ////////////////////////\n");
-    for (int j=0; j<numRefPoints; j++)
+      for (int j=0; j<numRefPoints; j++)
+      {
+        // cannot compute the ppf with myself
+        if (i!=j)
+        {
+          const Vec3f p2(sampled.ptr<float>(j));
+          const Vec3f n2(sampled.ptr<float>(j) + 3);
+
+          Vec4d f = Vec4d::all(0);
+          computePPFFeatures(p1, n1, p2, n2, f);
+          KeyType hashValue = hashPPF(f, angle_step_radians, distanceStep);
+          double alpha = computeAlpha(p1, n1, p2);
+          uint ppfInd = i*numRefPoints+j;
+
+          THash* hashNode = &hash_nodes[ppfInd];
+          hashNode->id = hashValue;
+          hashNode->i = i;
+          hashNode->ppfInd = ppfInd;
+
+          float* ppfRow = ppf.ptr<float>(ppfInd);
+          ppfRow[0] = (float)f[0];
+          ppfRow[1] = (float)f[1];
+          ppfRow[2] = (float)f[2];
+          ppfRow[3] = (float)f[3];
+          ppfRow[4] = (float)alpha;
+        }
+      }
+    }
+  });
+
+  // The hashtable is filled in stripes of buckets. The nodes are first partitioned by
+  // stripe, keeping the serial (i,j) order inside every stripe, then each stripe inserts
+  // its own nodes. Buckets are never shared between stripes, so no lock is needed and the
+  // resulting table is identical to the one built by a single serial loop.
+  const size_t numBuckets = hashTable->size;
+  const int numStripes = std::max(1, std::min(getNumThreads(), (int)numBuckets));
+  std::vector<int> rowStripeCount((size_t)numStripes*numRefPoints, 0);
+  parallel_for_(Range(0, numRefPoints), [&](const Range& range)
+  {
+    for (int i=range.start; i<range.end; i++)
     {
-      // cannot compute the ppf with myself
-      if (i!=j)
+      for (int j=0; j<numRefPoints; j++)
       {
-        const Vec3f p2(sampled.ptr<float>(j));
-        const Vec3f n2(sampled.ptr<float>(j) + 3);
-
-        Vec4d f = Vec4d::all(0);
-        computePPFFeatures(p1, n1, p2, n2, f);
-        KeyType hashValue = hashPPF(f, angle_step_radians, distanceStep);
-        double alpha = computeAlpha(p1, n1, p2);
-        uint ppfInd = i*numRefPoints+j;
+        if (i==j)
+          continue;
+        const size_t bucket = (KeyType)hash_nodes[i*numRefPoints+j].id % numBuckets;
+        rowStripeCount[(bucket*numStripes/numBuckets)*numRefPoints + i]++;
+      }
+    }
+  });
 
-        THash* hashNode = &hash_nodes[i*numRefPoints+j];
-        hashNode->id = hashValue;
-        hashNode->i = i;
-        hashNode->ppfInd = ppfInd;
+  // rowStripeCount becomes the position of the first node of row i in stripe s
+  std::vector<int> stripeStart(numStripes + 1, 0);
+  int numNodes = 0;
+  for (int k=0; k<numStripes*numRefPoints; k++)
+  {
+    if (k % numRefPoints == 0)
+      stripeStart[k / numRefPoints] = numNodes;
+    const int count = rowStripeCount[k];
+    rowStripeCount[k] = numNodes;
+    numNodes += count;
+  }
+  stripeStart[numStripes] = numNodes;
 
-        hashtableInsertHashed(hashTable, hashValue, (void*)hashNode);
+  std::vector<int> stripeNodes(numNodes);
+  parallel_for_(Range(0, numRefPoints), [&](const Range& range)
+  {
+    for (int i=range.start; i<range.end; i++)
+    {
+      for (int j=0; j<numRefPoints; j++)
+      {
+        if (i==j)
+          continue;
+        const int ppfInd = i*numRefPoints+j;
+        const size_t bucket = (KeyType)hash_nodes[ppfInd].id % numBuckets;
+        stripeNodes[rowStripeCount[(bucket*numStripes/numBuckets)*numRefPoints + i]++] = ppfInd;
+      }
+    }
+  });
 
-        Mat(f).reshape(1, 1).convertTo(ppf.row(ppfInd).colRange(0, 4), CV_32F);
-        ppf.ptr<float>(ppfInd)[4] = (float)alpha;
+  parallel_for_(Range(0, numStripes), [&](const Range& range)
+  {
+    for (int s=range.start; s<range.end; s++)
+    {
+      for (int k=stripeStart[s]; k<stripeStart[s+1]; k++)
+      {
+        THash* hashNode = &hash_nodes[stripeNodes[k]];
+        hashtableInsertHashed(hashTable, (KeyType)hashNode->id, (void*)hashNode);
       }
     }
-  }
+  });
 
   angle_step = angle_step_radians;
   distance_step = distanceStep;
-  hash_table = hashTable;
   num_ref_points = numRefPoints;
   sampled_pc = sampled;
+  model_index = flattenHashtable(hashTable, ppf, PPF_LENGTH);
+  trained = true;
+
+  // the matching only reads the flat index, the hashtable and the features it was built from
+  // are not kept next to it
+  hashtableDestroy(hashTable);
+  free(hash_nodes);
+  hash_nodes = NULL;
+  ppf.release();
+}
+
+void PPF3DDetector::saveModel(const String& fileName) const
+{
+  if (!trained || !model_index)
+  {
+    CV_Error(Error::StsError, "The model is not trained. Cannot save without training");
+  }
+
+  CV_Assert(sampled_pc.type() == CV_32F || sampled_pc.type() == CV_32FC1);
+  const Mat points = sampled_pc.isContinuous() ? sampled_pc : sampled_pc.clone();
+  const PPFModelIndex& index = *model_index;
+
+  PPFModelHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PPF_MODEL_MAGIC, sizeof(header.magic));
+  header.version = PPF_MODEL_VERSION;
+  header.byteOrder = PPF_MODEL_BYTE_ORDER;
+  header.samplingStepRelative = sampling_step_relative;
+  header.distanceStepRelative = distance_step_relative;
+  header.angleStepRelative = angle_step_relative;
+  header.angleStepRadians = angle_step_radians;
+  header.angleStep = angle_step;
+  header.distanceStep = distance_step;
+  header.numRefPoints = (uint64)points.rows;
+  header.numCols = (uint64)points.cols;
+  header.numBuckets = (uint64)index.numBuckets;
+  header.numEntries = (uint64)index.buckets[index.numBuckets];
+
+  const size_t pointsSize = points.total() * sizeof(float);
+  const size_t bucketsSize = (index.numBuckets + 1) * sizeof(uint);
+  const size_t entriesSize = (size_t)header.numEntries * sizeof(PPFModelEntry);
+  header.pointsOffset = alignModelOffset(sizeof(PPFModelHeader));
+  header.bucketsOffset = alignModelOffset(header.pointsOffset + pointsSize);
+  header.entriesOffset = alignModelOffset(header.bucketsOffset + bucketsSize);
+  header.fileSize = header.entriesOffset + entriesSize;
+
+  FILE* f = fopen(fileName.c_str(), "wb");
+  if (!f)
+  {
+    CV_Error(Error::StsError, "Cannot open the model file for writing: " + fileName);
+  }
+
+  uint64 pos = 0;
+  bool ok = writeModelSection(f, pos, 0, &header, sizeof(header)) &&
+            writeModelSection(f, pos, header.pointsOffset, points.ptr(), pointsSize) &&
+            writeModelSection(f, pos, header.bucketsOffset, index.buckets, bucketsSize) &&
+            writeModelSection(f, pos, header.entriesOffset, index.entries, entriesSize);
+  ok = (fclose(f) == 0) && ok;
+
+  if (!ok)
+  {
+    CV_Error(Error::StsError, "Cannot write the model file: " + fileName);
+  }
+}
+
+void PPF3DDetector::loadModel(const String& fileName)
+{
+  // OPENCV_SURFACE_MATCHING_MMAP=0 always reads the file into memory
+  const bool useMap = utils::getConfigurationParameterBool("OPENCV_SURFACE_MATCHING_MMAP", true);
+
+  Ptr<PPFModelIndex> index = makePtr<PPFModelIndex>();
+  if (!(useMap && mapModelFile(fileName, *index)) && !readModelFile(fileName, *index))
+  {
+    CV_Error(Error::StsError, "Cannot read the model file: " + fileName);
+  }
+
+  const uchar* data = index->mappedData ? (const uchar*)index->mappedData : &index->fileData[0];
+  const size_t dataSize = index->mappedData ? index->mappedSize : index->fileData.size();
+
+  PPFModelHeader header;
+  if (dataSize < sizeof(header))
+  {
+    CV_Error(Error::StsBadArg, "Not a PPF model file: " + fileName);
+  }
+  memcpy(&header, data, sizeof(header));
+
+  if (memcmp(header.magic, PPF_MODEL_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != PPF_MODEL_VERSION || header.byteOrder != PPF_MODEL_BYTE_ORDER)
+  {
+    CV_Error(Error::StsBadArg, "Not a PPF model file, or the file was written by an incompatible version or platform: " + fileName);
+  }
+
+  // the sizes are bounded first, so that none of the products below can overflow
+  bool valid = header.fileSize == (uint64)dataSize &&
+               header.numRefPoints > 0 && header.numRefPoints <= (uint64)INT_MAX &&
+               header.numCols >= 6 && header.numCols <= 64 &&
+               header.numBuckets > 0 && header.numBuckets < (uint64)UINT_MAX &&
+               (header.numBuckets & (header.numBuckets - 1)) == 0 &&
+               header.numEntries <= (uint64)UINT_MAX &&
+               header.pointsOffset % PPF_MODEL_ALIGNMENT == 0 &&
+               header.bucketsOffset % PPF_MODEL_ALIGNMENT == 0 &&
+               header.entriesOffset % PPF_MODEL_ALIGNMENT == 0 &&
+               header.pointsOffset >= sizeof(header);
+  valid = valid &&
+          header.pointsOffset + header.numRefPoints * header.numCols * sizeof(float) <= header.bucketsOffset &&
+          header.bucketsOffset + (header.numBuckets + 1) * sizeof(uint) <= header.entriesOffset &&
+          header.entriesOffset + header.numEntries * sizeof(PPFModelEntry) <= header.fileSize;
+
+  const uint* buckets = valid ? (const uint*)(data + header.bucketsOffset) : 0;
+  const PPFModelEntry* entries = valid ? (const PPFModelEntry*)(data + header.entriesOffset) : 0;
+
+  valid = valid && buckets[0] == 0 && buckets[header.numBuckets] == header.numEntries;
+  for (uint64 b = 0; valid && b < header.numBuckets; b++)
+    valid = buckets[b] <= buckets[b+1];
+  for (uint64 e = 0; valid && e < header.numEntries; e++)
+    valid = entries[e].i >= 0 && (uint64)entries[e].i < header.numRefPoints;
+
+  if (!valid)
+  {
+    CV_Error(Error::StsBadArg, "The PPF model file is corrupted: " + fileName);
+  }
+
+  clearTrainingModels();
+  ppf.release();
+
+  sampling_step_relative = header.samplingStepRelative;
+  distance_step_relative = header.distanceStepRelative;
+  angle_step_relative = header.angleStepRelative;
+  angle_step_radians = header.angleStepRadians;
+  angle_step = header.angleStep;
+  distance_step = header.distanceStep;
+  num_ref_points = (int)header.numRefPoints;
+  sampled_pc = Mat((int)header.numRefPoints, (int)header.numCols, CV_32F, (void*)(data + header.pointsOffset)).clone();
+
+  index->numBuckets = (size_t)header.numBuckets;
+  index->buckets = buckets;
+  index->entries = header.numEntries ? entries : 0;
+  model_index = index;
   trained = true;
+
+  setSearchParams();
 }
 
 
@@ -282,6 +647,12 @@ void PPF3DDetector::trainModel(const Mat &PC)
 ///////////////////////// MATCHING ////////////////////////////////////////
 
 
+// key of a translation cell in the pose clustering grid
+static uint64 hashPoseCell(const Vec3i& cell)
+{
+  return ((uint64)(uint)cell[0] * 73856093u) ^ ((uint64)(uint)cell[1] * 19349663u) ^ ((uint64)(uint)cell[2] * 83492791u);
+}
+
 bool PPF3DDetector::matchPose(const Pose3D& sourcePose, const Pose3D& targetPose)
 {
   // translational difference
@@ -302,24 +673,51 @@ void PPF3DDetector::clusterPoses(std::vector<Pose3DPtr>& poseList, int numPoses,
   // sort the poses for stability
   std::sort(poseList.begin(), poseList.end(), pose3DPtrCompare);
 
+  // The cluster centers are hashed into a grid over the translation with cells of the
+  // position threshold, so only the clusters in the 27 cells around a pose can match it.
+  // A pose still joins the oldest matching cluster, which gives the same clusters as
+  // comparing it against every cluster in turn.
+  const double cellSize = position_threshold > 0 ? position_threshold : 1.0;
+  std::unordered_map<uint64, std::vector<int> > clusterGrid;
+
   for (int i=0; i<numPoses; i++)
   {
     Pose3DPtr pose = poseList[i];
-    bool assigned = false;
+    const Vec3i cell(cvFloor(pose->t[0] / cellSize), cvFloor(pose->t[1] / cellSize), cvFloor(pose->t[2] / cellSize));
+    int assigned = -1;
 
-    // search all clusters
-    for (size_t j=0; j<poseClusters.size() && !assigned; j++)
+    for (int dz=-1; dz<=1; dz++)
     {
-      const Pose3DPtr poseCenter = poseClusters[j]->poseList[0];
-      if (matchPose(*pose, *poseCenter))
+      for (int dy=-1; dy<=1; dy++)
       {
-        poseClusters[j]->addPose(pose);
-        assigned = true;
+        for (int dx=-1; dx<=1; dx++)
+        {
+          std::unordered_map<uint64, std::vector<int> >::const_iterator it =
+              clusterGrid.find(hashPoseCell(cell + Vec3i(dx, dy, dz)));
+          if (it == clusterGrid.end())
+            continue;
+
+          // distinct cells may share a key, matchPose sorts those out
+          for (size_t j=0; j<it->second.size(); j++)
+          {
+            const int clusterInd = it->second[j];
+            if ((assigned < 0 || clusterInd < assigned) &&
+                matchPose(*pose, *poseClusters[clusterInd]->poseList[0]))
+            {
+              assigned = clusterInd;
+            }
+          }
+        }
       }
     }
 
-    if (!assigned)
+    if (assigned >= 0)
     {
+      poseClusters[assigned]->addPose(pose);
+    }
+    else
+    {
+      clusterGrid[hashPoseCell(cell)].push_back((int)poseClusters.size());
       poseClusters.push_back(PoseCluster3DPtr(new PoseCluster3D(pose)));
     }
   }
@@ -423,8 +821,10 @@ void PPF3DDetector::match(const Mat& pc, std::vector<Pose3DPtr>& results, const
   int numAngles = (int) (floor (2 * M_PI / angle_step));
   float distanceStep = (float)distance_step;
   uint n = num_ref_points;
-  std::vector<Pose3DPtr> poseList;
   int sceneSamplingStep = scene_sample_step;
+  const size_t numBuckets = model_index->numBuckets;
+  const uint* modelBuckets = model_index->buckets;
+  const PPFModelEntry* modelEntries = model_index->entries;
 
   // compute bbox
   Vec2f xRange, yRange, zRange;
@@ -438,155 +838,140 @@ void PPF3DDetector::match(const Mat& pc, std::vector<Pose3DPtr>& results, const
   float distanceSampleStep = diameter * RelativeSceneDistance;*/
   Mat sampled = samplePCByQuantization(pc, xRange, yRange, zRange, (float)relativeSceneDistance, 0);
 
-  // allocate the accumulator : Moved this to the inside of the loop
-  /*#if !defined (_OPENMP)
-     uint* accumulator = (uint*)calloc(numAngles*n, sizeof(uint));
-  #endif*/
-
-  poseList.reserve((sampled.rows/sceneSamplingStep)+4);
+  // The scene reference points vote independently. Every stripe keeps its own accumulator,
+  // which is cleared while it is searched for the maximum, and writes the pose of each
+  // reference point into its own slot, so the pose list does not depend on the scheduling.
+  const int numSceneRefPoints = (sampled.rows + sceneSamplingStep - 1) / sceneSamplingStep;
+  std::vector<Pose3DPtr> poseList(numSceneRefPoints);
 
-#if defined _OPENMP
-#pragma omp parallel for
-#endif
-  for (int i = 0; i < sampled.rows; i += sceneSamplingStep)
+  parallel_for_(Range(0, numSceneRefPoints), [&](const Range& range)
   {
-    uint refIndMax = 0, alphaIndMax = 0;
-    uint maxVotes = 0;
+    std::vector<uint> accumulator(numAngles*n, 0);
+
+    for (int r = range.start; r < range.end; r++)
+    {
+      const int i = r * sceneSamplingStep;
+      uint refIndMax = 0, alphaIndMax = 0;
+      uint maxVotes = 0;
 
-    const Vec3f p1(sampled.ptr<float>(i));
-    const Vec3f n1(sampled.ptr<float>(i) + 3);
-    Vec3d tsg = Vec3d::all(0);
-    Matx33d Rsg = Matx33d::all(0), RInv = Matx33d::all(0);
+      const Vec3f p1(sampled.ptr<float>(i));
+      const Vec3f n1(sampled.ptr<float>(i) + 3);
+      Vec3d tsg = Vec3d::all(0);
+      Matx33d Rsg = Matx33d::all(0), RInv = Matx33d::all(0);
 
-    uint* accumulator = (uint*)calloc(numAngles*n, sizeof(uint));
-    computeTransformRT(p1, n1, Rsg, tsg);
+      computeTransformRT(p1, n1, Rsg, tsg);
 
-    // Tolga Birdal's notice:
-    // As a later update, we might want to look into a local neighborhood only
-    // To do this, simply search the local neighborhood by radius look up
-    // and collect the neighbors to compute the relative pose
+      // Tolga Birdal's notice:
+      // As a later update, we might want to look into a local neighborhood only
+      // To do this, simply search the local neighborhood by radius look up
+      // and collect the neighbors to compute the relative pose
 
-    for (int j = 0; j < sampled.rows; j ++)
-    {
-      if (i!=j)
+      for (int j = 0; j < sampled.rows; j ++)
       {
-        const Vec3f p2(sampled.ptr<float>(j));
-        const Vec3f n2(sampled.ptr<float>(j) + 3);
-        Vec3d p2t;
-        double alpha_scene;
+        if (i!=j)
+        {
+          const Vec3f p2(sampled.ptr<float>(j));
+          const Vec3f n2(sampled.ptr<float>(j) + 3);
+          Vec3d p2t;
+          double alpha_scene;
 
-        Vec4d f = Vec4d::all(0);
-        computePPFFeatures(p1, n1, p2, n2, f);
-        KeyType hashValue = hashPPF(f, angle_step, distanceStep);
+          Vec4d f = Vec4d::all(0);
+          computePPFFeatures(p1, n1, p2, n2, f);
+          KeyType hashValue = hashPPF(f, angle_step, distanceStep);
 
-        p2t = tsg + Rsg * Vec3d(p2);
+          p2t = tsg + Rsg * Vec3d(p2);
 
-        alpha_scene=atan2(-p2t[2], p2t[1]);
+          alpha_scene=atan2(-p2t[2], p2t[1]);
 
-        if ( alpha_scene != alpha_scene)
-        {
-          continue;
-        }
+          if ( alpha_scene != alpha_scene)
+          {
+            continue;
+          }
+
+          if (sin(alpha_scene)*p2t[2]<0.0)
+            alpha_scene=-alpha_scene;
 
-        if (sin(alpha_scene)*p2t[2]<0.0)
           alpha_scene=-alpha_scene;
 
-        alpha_scene=-alpha_scene;
+          const size_t bucket = hashValue % numBuckets;
 
-        hashnode_i* node = hashtableGetBucketHashed(hash_table, (hashValue));
+          for (uint e = modelBuckets[bucket]; e < modelBuckets[bucket+1]; e++)
+          {
+            int corrI = modelEntries[e].i;
+            double alpha_model = (double)modelEntries[e].alpha;
+            double alpha = alpha_model - alpha_scene;
 
-        while (node)
-        {
-          THash* tData = (THash*) node->data;
-          int corrI = (int)tData->i;
-          int ppfInd = (int)tData->ppfInd;
-          float* ppfCorrScene = ppf.ptr<float>(ppfInd);
-          double alpha_model = (double)ppfCorrScene[PPF_LENGTH-1];
-          double alpha = alpha_model - alpha_scene;
-
-          /*  Tolga Birdal's note: Map alpha to the indices:
-                  atan2 generates results in (-pi pi]
-                  That's why alpha should be in range [-2pi 2pi]
-                  So the quantization would be :
-                  numAngles * (alpha+2pi)/(4pi)
-                  */
-
-          //printf("%f\n", alpha);
-          int alpha_index = (int)(numAngles*(alpha + 2*M_PI) / (4*M_PI));
-
-          uint accIndex = corrI * numAngles + alpha_index;
-
-          accumulator[accIndex]++;
-          node = node->next;
+            /*  Tolga Birdal's note: Map alpha to the indices:
+                    atan2 generates results in (-pi pi]
+                    That's why alpha should be in range [-2pi 2pi]
+                    So the quantization would be :
+                    numAngles * (alpha+2pi)/(4pi)
+                    */
+
+            //printf("%f\n", alpha);
+            int alpha_index = (int)(numAngles*(alpha + 2*M_PI) / (4*M_PI));
+
+            uint accIndex = corrI * numAngles + alpha_index;
+
+            accumulator[accIndex]++;
+          }
         }
       }
-    }
 
-    // Maximize the accumulator
-    for (uint k = 0; k < n; k++)
-    {
-      for (int j = 0; j < numAngles; j++)
+      // Maximize the accumulator
+      for (uint k = 0; k < n; k++)
       {
-        const uint accInd = k*numAngles + j;
-        const uint accVal = accumulator[ accInd ];
-        if (accVal > maxVotes)
+        for (int j = 0; j < numAngles; j++)
         {
-          maxVotes = accVal;
-          refIndMax = k;
-          alphaIndMax = j;
+          const uint accInd = k*numAngles + j;
+          const uint accVal = accumulator[ accInd ];
+          if (accVal > maxVotes)
+          {
+            maxVotes = accVal;
+            refIndMax = k;
+            alphaIndMax = j;
+          }
+          accumulator[accInd] = 0;
         }
-
-#if !defined (_OPENMP)
-        accumulator[accInd ] = 0;
-#endif
       }
-    }
 
-    // invert Tsg : Luckily rotation is orthogonal: Inverse = Transpose.
-    // We are not required to invert.
-    Vec3d tInv, tmg;
-    Matx33d Rmg;
-    RInv = Rsg.t();
-    tInv = -RInv * tsg;
+      // invert Tsg : Luckily rotation is orthogonal: Inverse = Transpose.
+      // We are not required to invert.
+      Vec3d tInv, tmg;
+      Matx33d Rmg;
+      RInv = Rsg.t();
+      tInv = -RInv * tsg;
 
-    Matx44d TsgInv;
-    rtToPose(RInv, tInv, TsgInv);
+      Matx44d TsgInv;
+      rtToPose(RInv, tInv, TsgInv);
 
-    // TODO : Compute pose
-    const Vec3f pMax(sampled_pc.ptr<float>(refIndMax));
-    const Vec3f nMax(sampled_pc.ptr<float>(refIndMax) + 3);
+      // TODO : Compute pose
+      const Vec3f pMax(sampled_pc.ptr<float>(refIndMax));
+      const Vec3f nMax(sampled_pc.ptr<float>(refIndMax) + 3);
 
-    computeTransformRT(pMax, nMax, Rmg, tmg);
+      computeTransformRT(pMax, nMax, Rmg, tmg);
 
-    Matx44d Tmg;
-    rtToPose(Rmg, tmg, Tmg);
+      Matx44d Tmg;
+      rtToPose(Rmg, tmg, Tmg);
 
-    // convert alpha_index to alpha
-    int alpha_index = alphaIndMax;
-    double alpha = (alpha_index*(4*M_PI))/numAngles-2*M_PI;
+      // convert alpha_index to alpha
+      int alpha_index = alphaIndMax;
+      double alpha = (alpha_index*(4*M_PI))/numAngles-2*M_PI;
 
-    // Equation 2:
-    Matx44d Talpha;
-    Matx33d R;
-    Vec3d t = Vec3d::all(0);
-    getUnitXRotation(alpha, R);
-    rtToPose(R, t, Talpha);
+      // Equation 2:
+      Matx44d Talpha;
+      Matx33d R;
+      Vec3d t = Vec3d::all(0);
+      getUnitXRotation(alpha, R);
+      rtToPose(R, t, Talpha);
 
-    Matx44d rawPose = TsgInv * (Talpha * Tmg);
+      Matx44d rawPose = TsgInv * (Talpha * Tmg);
 
-    Pose3DPtr pose(new Pose3D(alpha, refIndMax, maxVotes));
-    pose->updatePose(rawPose);
-    #if defined (_OPENMP)
-    #pragma omp critical
-    #endif
-    {
-      poseList.push_back(pose);
+      Pose3DPtr pose(new Pose3D(alpha, refIndMax, maxVotes));
+      pose->updatePose(rawPose);
+      poseList[r] = pose;
     }
-
-#if defined (_OPENMP)
-    free(accumulator);
-#endif
-  }
+  });
 
   // TODO : Make the parameters relative if not arguments.
   //double MinMatchScore = 0.5;
@@ -0,0 +1,50 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html.
+#include "test_precomp.hpp"
+#include "test_icp_common.hpp"
+
+namespace opencv_test { namespace {
+
+// the registration must bring the model back onto the scene it was taken from
+static void checkRegistration(const Matx44d& pose, const Matx44d& offset)
+{
+    Matx44d error = pose * offset;
+    double cosAngle = 0.5 * (error(0, 0) + error(1, 1) + error(2, 2) - 1.);
+    EXPECT_LT(std::acos(std::min(cosAngle, 1.)), 2e-3);
+    EXPECT_LT(cv::norm(Vec3d(error(0, 3), error(1, 3), error(2, 3))), 1e-3);
+}
+
+TEST(ICP, registerModelToScene)
+{
+    const int width = 160, height = 120;
+    const Matx33d K(width, 0, 0.5 * (width - 1), 0, width, 0.5 * (height - 1), 0, 0, 1);
+    const Mat scene = generateOrganizedScene(K, width, height);
+
+    Matx44d offset;
+    const Mat model = generateOffsetModel(scene, width, height, offset);
+
+    ICP icp(100, 0.0001f, 2.5f, 4);
+    double residual = 0;
+    Matx44d pose;
+
+    {
+        SCOPED_TRACE("KD-tree");
+        ASSERT_EQ(0, icp.registerModelToScene(model, scene, residual, pose));
+        checkRegistration(pose, offset);
+    }
+    {
+        SCOPED_TRACE("KD-tree, prepared scene");
+        icp.setScene(scene);
+        ASSERT_EQ(0, icp.registerModelToScene(model, residual, pose));
+        checkRegistration(pose, offset);
+    }
+    {
+        SCOPED_TRACE("projective association");
+        icp.setScene(scene, K, width);
+        ASSERT_EQ(0, icp.registerModelToScene(model, residual, pose));
+        checkRegistration(pose, offset);
+    }
+}
+
+}} // namespace
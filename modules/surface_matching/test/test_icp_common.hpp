@@ -0,0 +1,52 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html.
+#ifndef __OPENCV_TEST_ICP_COMMON_HPP__
+#define __OPENCV_TEST_ICP_COMMON_HPP__
+
+namespace opencv_test {
+
+// organized scene of a wavy surface seen by the camera K, one point per pixel, with normals
+inline Mat generateOrganizedScene(const Matx33d& K, int width, int height)
+{
+    Mat scene(width * height, 6, CV_32F);
+    for (int v = 0; v < height; v++)
+    {
+        for (int u = 0; u < width; u++)
+        {
+            const double a = (u - K(0, 2)) / K(0, 0), b = (v - K(1, 2)) / K(1, 1);
+            const double z = 1. + 0.05 * sin(6. * a) * cos(6. * b);
+            const double za = 0.3 * cos(6. * a) * cos(6. * b), zb = -0.3 * sin(6. * a) * sin(6. * b);
+
+            const Vec3d ray(a, b, 1.);
+            const Vec3d n = normalize((za * ray + Vec3d(z, 0, 0)).cross(zb * ray + Vec3d(0, z, 0)));
+            float* pt = scene.ptr<float>(v * width + u);
+            for (int c = 0; c < 3; c++)
+            {
+                pt[c] = (float)(z * ray[c]);
+                pt[c + 3] = (float)n[c];
+            }
+        }
+    }
+    return scene;
+}
+
+// the model is every third scene point of the central part, moved off the scene by offset
+inline Mat generateOffsetModel(const Mat& scene, int width, int height, Matx44d& offset)
+{
+    Mat model;
+    for (int v = height / 4; v < 3 * height / 4; v += 3)
+        for (int u = width / 4; u < 3 * width / 4; u += 3)
+            model.push_back(scene.row(v * width + u));
+
+    Pose3D pose;
+    Vec4d q = normalize(Vec4d(1., 0.01, -0.015, 0.005));
+    Vec3d t(0.01, -0.01, 0.);
+    pose.updatePoseQuat(q, t);
+    offset = pose.pose;
+    return transformPCPose(model, offset);
+}
+
+}  // namespace
+
+#endif
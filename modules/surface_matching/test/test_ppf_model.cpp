@@ -0,0 +1,148 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html.
+#include "test_precomp.hpp"
+#include <fstream>
+
+namespace opencv_test { namespace {
+
+// bumpy, asymmetric surface patch with normals
+static Mat generateModel()
+{
+    const int n = 40;
+    Mat model(n * n, 6, CV_32F);
+    for (int v = 0; v < n; v++)
+    {
+        for (int u = 0; u < n; u++)
+        {
+            const double a = (double)u / n - 0.5, b = (double)v / n - 0.3;
+            const double z = 0.1 * sin(7. * a) * cos(5. * b) + 0.3 * a * a + 0.1 * b;
+            const double za = 0.7 * cos(7. * a) * cos(5. * b) + 0.6 * a;
+            const double zb = -0.5 * sin(7. * a) * sin(5. * b) + 0.1;
+            const Vec3d normal = normalize(Vec3d(-za, -zb, 1.));
+            float* pt = model.ptr<float>(v * n + u);
+            pt[0] = (float)a;
+            pt[1] = (float)b;
+            pt[2] = (float)z;
+            for (int c = 0; c < 3; c++)
+                pt[c + 3] = (float)normal[c];
+        }
+    }
+    return model;
+}
+
+static void setModelMapping(bool enabled)
+{
+#ifdef _WIN32
+    _putenv_s("OPENCV_SURFACE_MATCHING_MMAP", enabled ? "1" : "0");
+#else
+    setenv("OPENCV_SURFACE_MATCHING_MMAP", enabled ? "1" : "0", 1);
+#endif
+}
+
+static void checkSameResults(const std::vector<Pose3DPtr>& expected, const std::vector<Pose3DPtr>& actual)
+{
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        EXPECT_EQ(expected[i]->numVotes, actual[i]->numVotes);
+        EXPECT_EQ(expected[i]->modelIndex, actual[i]->modelIndex);
+        EXPECT_EQ(0., cvtest::norm(Mat(expected[i]->pose), Mat(actual[i]->pose), NORM_INF));
+    }
+}
+
+TEST(SurfaceMatching_PPF3DDetector, saveLoadModel)
+{
+    const Mat model = generateModel();
+
+    Pose3D offset;
+    Vec4d q = normalize(Vec4d(1., 0.2, -0.1, 0.3));
+    Vec3d t(0.2, -0.1, 0.5);
+    offset.updatePoseQuat(q, t);
+    const Mat scene = transformPCPose(model, offset.pose);
+
+    PPF3DDetector detector(0.05, 0.05);
+    detector.trainModel(model);
+    std::vector<Pose3DPtr> expected;
+    detector.match(scene, expected, 1.0 / 5.0, 0.05);
+    ASSERT_FALSE(expected.empty());
+
+    const String fileName = cv::tempfile(".ppf");
+    detector.saveModel(fileName);
+
+    // memory mapped file, where the platform supports it
+    {
+        setModelMapping(true);
+        PPF3DDetector loaded;
+        loaded.loadModel(fileName);
+        std::vector<Pose3DPtr> results;
+        loaded.match(scene, results, 1.0 / 5.0, 0.05);
+        SCOPED_TRACE("mapped");
+        checkSameResults(expected, results);
+    }
+
+    // file read into memory
+    {
+        setModelMapping(false);
+        PPF3DDetector loaded;
+        loaded.loadModel(fileName);
+        std::vector<Pose3DPtr> results;
+        loaded.match(scene, results, 1.0 / 5.0, 0.05);
+        SCOPED_TRACE("read");
+        checkSameResults(expected, results);
+        setModelMapping(true);
+    }
+
+    remove(fileName.c_str());
+}
+
+// exposes what the detector keeps of its model
+class PPF3DDetectorModel : public PPF3DDetector
+{
+public:
+    PPF3DDetectorModel() : PPF3DDetector(0.05, 0.05) {}
+
+    bool keepsOnlyFlatIndex() const
+    {
+        return !hash_table && !hash_nodes && ppf.empty();
+    }
+};
+
+// the matching only needs the flat index: neither a trained nor a loaded model keeps the
+// hashtable next to it
+TEST(SurfaceMatching_PPF3DDetector, modelMemory)
+{
+    const Mat model = generateModel();
+    PPF3DDetectorModel detector;
+    detector.trainModel(model);
+    EXPECT_TRUE(detector.keepsOnlyFlatIndex());
+
+    // training again replaces the model
+    std::vector<Pose3DPtr> expected, results;
+    detector.match(model, expected, 1.0 / 5.0, 0.05);
+    detector.trainModel(model);
+    EXPECT_TRUE(detector.keepsOnlyFlatIndex());
+    detector.match(model, results, 1.0 / 5.0, 0.05);
+    checkSameResults(expected, results);
+
+    const String fileName = cv::tempfile(".ppf");
+    detector.saveModel(fileName);
+    PPF3DDetectorModel loaded;
+    loaded.loadModel(fileName);
+    EXPECT_TRUE(loaded.keepsOnlyFlatIndex());
+    remove(fileName.c_str());
+}
+
+TEST(SurfaceMatching_PPF3DDetector, loadModel_notAModel)
+{
+    const String fileName = cv::tempfile(".ppf");
+    {
+        std::ofstream out(fileName.c_str(), std::ios::binary);
+        out << "not a model file";
+    }
+    PPF3DDetector detector;
+    EXPECT_ANY_THROW(detector.loadModel(fileName));
+    remove(fileName.c_str());
+}
+
+}} // namespace
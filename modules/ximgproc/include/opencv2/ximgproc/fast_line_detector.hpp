@@ -52,6 +52,33 @@ public:
     CV_WRAP virtual void drawSegments(InputOutputArray _image, InputArray lines,
             bool draw_arrow = false) = 0;
 
+    /** @brief Sets the size of the square tiles the edge image is split into.
+      Segments are traced in every tile in parallel and the pieces of lines cut
+      by tile borders are merged back together. Tiles should be several times
+      longer than the length threshold. 0 (default) processes the whole image at once.
+    */
+    CV_WRAP virtual void setTileSize(int tile_size)
+    {
+        CV_UNUSED(tile_size);
+        CV_Error(Error::StsNotImplemented, "This line detector does not support tiling");
+    }
+    /** @see setTileSize */
+    CV_WRAP virtual int getTileSize() const { return 0; }
+
+    /** @brief Sets the number of image pyramid levels to skip.
+      If positive, lines are detected on the image downscaled by 2^levels with
+      pyrDown() and scaled back to the input resolution, which is much faster for
+      very large images. Length and distance thresholds then apply at the coarse
+      scale. 0 (default) detects lines at full resolution.
+    */
+    CV_WRAP virtual void setPyramidLevels(int levels)
+    {
+        CV_UNUSED(levels);
+        CV_Error(Error::StsNotImplemented, "This line detector does not support image pyramids");
+    }
+    /** @see setPyramidLevels */
+    CV_WRAP virtual int getPyramidLevels() const { return 0; }
+
     virtual ~FastLineDetector() { }
 };
 
@@ -0,0 +1,40 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html.
+#include "perf_precomp.hpp"
+
+namespace opencv_test { namespace {
+
+typedef TestBaseWithParam<Size> EdgeBoxesTest;
+
+PERF_TEST_P(EdgeBoxesTest, getBoundingBoxes, Values(szVGA, sz720p))
+{
+    Size sz = GetParam();
+
+    // edge map of random rectangle outlines
+    Mat edges(sz, CV_32FC1, Scalar::all(0)), orientations;
+    RNG rnd(1);
+    for (int i = 0; i < 60; i++)
+    {
+        Point p0(rnd.uniform(0, sz.width), rnd.uniform(0, sz.height));
+        Point p1(rnd.uniform(0, sz.width), rnd.uniform(0, sz.height));
+        rectangle(edges, p0, p1, Scalar::all(rnd.uniform(0.3, 1.0)), 2);
+    }
+    GaussianBlur(edges, edges, Size(0, 0), 1.5);
+
+    Ptr<StructuredEdgeDetection> sed = createStructuredEdgeDetection(getDataPath("cv/ximgproc/model.yml.gz"));
+    sed->computeOrientation(edges, orientations);
+
+    Ptr<EdgeBoxes> edgeboxes = createEdgeBoxes();
+    edgeboxes->setMaxBoxes(1000);
+    std::vector<Rect> boxes;
+
+    TEST_CYCLE()
+    {
+        edgeboxes->getBoundingBoxes(edges, orientations, boxes);
+    }
+
+    SANITY_CHECK_NOTHING();
+}
+
+}} // namespace
@@ -0,0 +1,41 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html.
+#include "perf_precomp.hpp"
+
+namespace opencv_test { namespace {
+
+typedef tuple<Size, int, int> FLDParams;
+typedef TestBaseWithParam<FLDParams> FastLineDetectorTest;
+
+PERF_TEST_P(FastLineDetectorTest, detect,
+            Combine(Values(sz1080p, Size(4096, 4096)), Values(0, 512), Values(0, 1)))
+{
+    Size sz = get<0>(GetParam());
+    int tileSize = get<1>(GetParam());
+    int pyramidLevels = get<2>(GetParam());
+
+    // random straight lines on a flat background
+    Mat src(sz, CV_8UC1, Scalar::all(40));
+    RNG rnd(1);
+    for (int i = 0; i < 300; i++)
+    {
+        Point p0(rnd.uniform(0, sz.width), rnd.uniform(0, sz.height));
+        Point p1(rnd.uniform(0, sz.width), rnd.uniform(0, sz.height));
+        line(src, p0, p1, Scalar::all(rnd.uniform(120, 256)), 3);
+    }
+
+    Ptr<FastLineDetector> fld = createFastLineDetector();
+    fld->setTileSize(tileSize);
+    fld->setPyramidLevels(pyramidLevels);
+    std::vector<Vec4f> lines;
+
+    TEST_CYCLE()
+    {
+        fld->detect(src, lines);
+    }
+
+    SANITY_CHECK_NOTHING();
+}
+
+}} // namespace
@@ -0,0 +1,31 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html.
+#include "perf_precomp.hpp"
+
+namespace opencv_test { namespace {
+
+typedef TestBaseWithParam<Size> StructuredEdgeDetectionTest;
+
+PERF_TEST_P(StructuredEdgeDetectionTest, detectEdges, Values(szVGA, sz720p))
+{
+    Size sz = GetParam();
+
+    Ptr<StructuredEdgeDetection> sed = createStructuredEdgeDetection(getDataPath("cv/ximgproc/model.yml.gz"));
+
+    Mat src(sz, CV_32FC3), dst(sz, CV_32FC1);
+    RNG rnd(1);
+    rnd.fill(src, RNG::UNIFORM, 0.f, 1.f);
+    GaussianBlur(src, src, Size(0, 0), 3.0);
+
+    declare.in(src).out(dst);
+
+    TEST_CYCLE()
+    {
+        sed->detectEdges(src, dst);
+    }
+
+    SANITY_CHECK_NOTHING();
+}
+
+}} // namespace
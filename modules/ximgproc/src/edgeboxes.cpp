@@ -160,18 +160,23 @@ private:
     vector<float> _scaleNorm;
     float _sxStep, _ayStep, _xyStepRatio;
 
-    // data structures for efficiency (see scoreBox)
-    Mat _sWts;
-    Mat _sDone, _sMap, _sIds;
-    int _sId;
+    // per-thread scratch buffers for efficiency (see scoreBox)
+    struct ScoreBuffers
+    {
+        explicit ScoreBuffers(int n) : sWts(n, 0.f), sDone(n, -1), sMap(n, 0), sIds(n, 0), sId(0) {}
+
+        vector<float> sWts;
+        vector<int> sDone, sMap, sIds;
+        int sId;
+    };
 
     // helper routines
     static bool boxesCompare(const Box &a, const Box &b) { return a.score < b.score; }
     void clusterEdges(Mat &edgeMap, Mat &orientationMap);
     void prepDataStructs(Mat &edgeMap);
     void scoreAllBoxes(Boxes &boxes);
-    void scoreBox(Box &box);
-    void refineBox(Box &box);
+    void scoreBox(Box &box, ScoreBuffers &buf) const;
+    void refineBox(Box &box, ScoreBuffers &buf) const;
     float boxesOverlap(Box &a, Box &b);
     void boxesNms(Boxes &boxes, float thr, float eta, int maxBoxes);
 };
@@ -561,25 +566,17 @@ void EdgeBoxesImpl::prepDataStructs(Mat &edgeMap)
             _vIdxImg.at<int>(x, y) = (int)_vIdxs[x].size() - 1;
         }
     }
-
-    // initialize scoreBox() data structures
-    int n = _segCnt + 1;
-    _sWts = Mat::zeros(n, 1, DataType<float>::type);
-    _sDone = Mat(n, 1, DataType<int>::type,Scalar(-1));
-    _sMap = Mat::zeros(n, 1, DataType<int>::type);
-    _sIds = Mat::zeros(n, 1, DataType<int>::type);
-    _sId = 0;
 }
 
 
-void EdgeBoxesImpl::scoreBox(Box &box)
+void EdgeBoxesImpl::scoreBox(Box &box, ScoreBuffers &buf) const
 {
     int i, j, k, q, bh, bw, y0, x0, y1, x1, y0m, y1m, x0m, x1m;
-    float *sWts = (float *)_sWts.data;
-    int *sDone = (int *)_sDone.data;
-    int *sMap = (int *)_sMap.data;
-    int *sIds = (int *)_sIds.data;
-    int sId = _sId++;
+    float *sWts = &buf.sWts[0];
+    int *sDone = &buf.sDone[0];
+    int *sMap = &buf.sMap[0];
+    int *sIds = &buf.sIds[0];
+    int sId = buf.sId++;
 
     // add edge count inside box
     y1 = clamp(box.y + box.h, 0, h - 1);
@@ -708,7 +705,7 @@ void EdgeBoxesImpl::scoreBox(Box &box)
 }
 
 
-void EdgeBoxesImpl::refineBox(Box &box)
+void EdgeBoxesImpl::refineBox(Box &box, ScoreBuffers &buf) const
 {
     int yStep = (int)(box.h * _xyStepRatio);
     int xStep = (int)(box.w * _xyStepRatio);
@@ -725,53 +722,53 @@ void EdgeBoxesImpl::refineBox(Box &box)
         B = box;
         B.y = box.y - yStep;
         B.h = B.h + yStep;
-        scoreBox(B);
+        scoreBox(B, buf);
 
         if (B.score <= box.score)
         {
             B = box;
             B.y = box.y + yStep;
             B.h = B.h - yStep;
-            scoreBox(B);
+            scoreBox(B, buf);
         }
         if (B.score > box.score) box = B;
         // search over y end
         B = box;
         B.h = B.h + yStep;
-        scoreBox(B);
+        scoreBox(B, buf);
 
         if (B.score <= box.score)
         {
             B = box;
             B.h = B.h - yStep;
-            scoreBox(B);
+            scoreBox(B, buf);
         }
         if (B.score > box.score) box = B;
         // search over x start
         B = box;
         B.x = box.x - xStep;
         B.w = B.w + xStep;
-        scoreBox(B);
+        scoreBox(B, buf);
 
         if (B.score <= box.score)
         {
             B = box;
             B.x = box.x + xStep;
             B.w = B.w - xStep;
-            scoreBox(B);
+            scoreBox(B, buf);
         }
 
         if (B.score > box.score) box = B;
         // search over x end
         B = box;
         B.w = B.w + xStep;
-        scoreBox(B);
+        scoreBox(B, buf);
 
         if (B.score <= box.score)
         {
             B = box;
             B.w = B.w - xStep;
-            scoreBox(B);
+            scoreBox(B, buf);
         }
         if (B.score > box.score) box = B;
     }
@@ -814,14 +811,22 @@ void EdgeBoxesImpl::scoreAllBoxes(Boxes &boxes)
     }
 
     // score all boxes, refine top candidates
-    int i, k = 0, m = (int)boxes.size();
-    for (i = 0; i < m; i++)
+    // (every box is scored independently, each stripe uses its own scratch buffers)
+    int m = (int)boxes.size();
+    parallel_for_(Range(0, m), [&](const Range& range)
     {
-        scoreBox(boxes[i]);
-        if (!boxes[i].score) continue;
-        k++;
-        refineBox(boxes[i]);
-    }
+        ScoreBuffers buf(_segCnt + 1);
+        for (int i = range.start; i < range.end; i++)
+        {
+            scoreBox(boxes[i], buf);
+            if (!boxes[i].score) continue;
+            refineBox(boxes[i], buf);
+        }
+    }, 4 * getNumThreads());
+
+    int k = 0;
+    for (int i = 0; i < m; i++)
+        if (boxes[i].score) k++;
     sort(boxes.rbegin(), boxes.rend(), boxesCompare);
     boxes.resize(k);
 }
@@ -859,8 +864,18 @@ void EdgeBoxesImpl::boxesNms(Boxes &boxes, float thr, float eta, int maxBoxes)
     const float step = 1 / thr;
     const float lstep = log(step);
 
+    // Kept boxes are bucketed by area (log scale) and, within every area bin,
+    // by the grid cell of their center. Cells are about as large as the boxes
+    // of the bin, so only a few of them have to be visited per candidate.
+    struct CenterGrid
+    {
+        int cell, cols, rows;
+        vector<vector<int> > cells;
+    };
+
     vector<Boxes> kept;
     kept.resize(nBin + 1);
+    vector<CenterGrid> grids(nBin + 1);
     int n = (int) boxes.size();
     int i = 0;
     int j, k, b;
@@ -869,22 +884,52 @@ void EdgeBoxesImpl::boxesNms(Boxes &boxes, float thr, float eta, int maxBoxes)
 
     while (i < n && m < maxBoxes)
     {
-        b = boxes[i].w * boxes[i].h;
+        Box &box = boxes[i];
+        b = box.w * box.h;
 
         bool keep = 1;
         b = clamp((int)(ceil(log(float(b)) / lstep)), d, nBin - d);
-        for (j = b - d; j <= b + d; j++)
+
+        // a kept box overlapping the candidate by more than thr has its center
+        // inside the candidate grown by (1/2 - thr) / thr of its size
+        float margin = thr > 0 ? max(0.f, .5f - thr) / thr : (float)(w + h);
+        float mx = margin * box.w + 1, my = margin * box.h + 1;
+        for (j = b - d; j <= b + d && keep; j++)
         {
-            for (k = 0; k < (int)kept[j].size(); k++)
+            const CenterGrid &grid = grids[j];
+            if (grid.cells.empty())
+                continue;
+
+            int cx0 = clamp((int)floor((box.x - mx) / grid.cell), 0, grid.cols - 1);
+            int cx1 = clamp((int)floor((box.x + box.w + mx) / grid.cell), 0, grid.cols - 1);
+            int cy0 = clamp((int)floor((box.y - my) / grid.cell), 0, grid.rows - 1);
+            int cy1 = clamp((int)floor((box.y + box.h + my) / grid.cell), 0, grid.rows - 1);
+            for (int cy = cy0; cy <= cy1 && keep; cy++)
             {
-                if (keep)
-                    keep = boxesOverlap(boxes[i], kept[j][k]) <= thr;
+                for (int cx = cx0; cx <= cx1 && keep; cx++)
+                {
+                    const vector<int> &cell = grid.cells[cy * grid.cols + cx];
+                    for (k = 0; k < (int)cell.size() && keep; k++)
+                        keep = boxesOverlap(box, kept[j][cell[k]]) <= thr;
+                }
             }
         }
 
         if (keep)
         {
-            kept[b].push_back(boxes[i]);
+            CenterGrid &grid = grids[b];
+            if (grid.cells.empty())
+            {
+                grid.cell = max(8, (int)min(sqrt(pow((double)step, (double)b)), (double)max(w, h)));
+                grid.cols = w / grid.cell + 1;
+                grid.rows = h / grid.cell + 1;
+                grid.cells.resize(grid.cols * grid.rows);
+            }
+            int cx = clamp((box.x + box.w / 2) / grid.cell, 0, grid.cols - 1);
+            int cy = clamp((box.y + box.h / 2) / grid.cell, 0, grid.rows - 1);
+            grid.cells[cy * grid.cols + cx].push_back((int)kept[b].size());
+
+            kept[b].push_back(box);
             m++;
         }
 
@@ -5,6 +5,7 @@
 #include "precomp.hpp"
 #include <vector>
 #include <iostream>
+#include <cmath>
 
 struct SEGMENT
 {
@@ -62,16 +63,23 @@ class FastLineDetectorImpl : public FastLineDetector
          */
         void drawSegments(InputOutputArray _image, InputArray lines, bool draw_arrow = false) CV_OVERRIDE;
 
+        void setTileSize(int _tile_size) CV_OVERRIDE { CV_Assert(_tile_size >= 0); tile_size = _tile_size; }
+        int getTileSize() const CV_OVERRIDE { return tile_size; }
+
+        void setPyramidLevels(int levels) CV_OVERRIDE { CV_Assert(levels >= 0); pyramid_levels = levels; }
+        int getPyramidLevels() const CV_OVERRIDE { return pyramid_levels; }
+
     private:
-        int imagewidth, imageheight, threshold_length;
+        int threshold_length;
         float threshold_dist;
         double canny_th1, canny_th2;
         int canny_aperture_size;
         bool do_merge;
+        int tile_size, pyramid_levels;
 
         FastLineDetectorImpl& operator= (const FastLineDetectorImpl&); // to quiet MSVC
         template<class T>
-            void incidentPoint(const Mat& l, T& pt);
+            void incidentPoint(const Mat& l, const Size& bounds, T& pt);
 
         void mergeLines(const SEGMENT& seg1, const SEGMENT& seg2, SEGMENT& seg_merged);
 
@@ -81,10 +89,14 @@ class FastLineDetectorImpl : public FastLineDetector
 
         double distPointLine(const Mat& p, Mat& l);
 
-        void extractSegments(const std::vector<Point2i>& points, std::vector<SEGMENT>& segments);
+        void extractSegments(const std::vector<Point2i>& points, const Size& bounds, std::vector<SEGMENT>& segments);
 
         void lineDetection(const Mat& src, std::vector<SEGMENT>& segments_all);
 
+        void traceSegments(const Mat& src, Mat& edges, Point offset, std::vector<SEGMENT>& segments_out);
+
+        void stitchSegments(const Mat& src, std::vector<SEGMENT>& segments);
+
         void pointInboardTest(const Mat& src, Point2i& pt);
 
         inline void getAngle(SEGMENT& seg);
@@ -111,7 +123,8 @@ CV_EXPORTS Ptr<FastLineDetector> createFastLineDetector(
 FastLineDetectorImpl::FastLineDetectorImpl(int _length_threshold, float _distance_threshold,
         double _canny_th1, double _canny_th2, int _canny_aperture_size, bool _do_merge)
     :threshold_length(_length_threshold), threshold_dist(_distance_threshold),
-    canny_th1(_canny_th1), canny_th2(_canny_th2), canny_aperture_size(_canny_aperture_size), do_merge(_do_merge)
+    canny_th1(_canny_th1), canny_th2(_canny_th2), canny_aperture_size(_canny_aperture_size), do_merge(_do_merge),
+    tile_size(0), pyramid_levels(0)
 {
     CV_Assert(_length_threshold > 0 && _distance_threshold > 0 &&
             _canny_th1 > 0 && _canny_th2 > 0 && _canny_aperture_size >= 0);
@@ -126,7 +139,32 @@ void FastLineDetectorImpl::detect(InputArray _image, OutputArray _lines)
 
     std::vector<Vec4f> lines;
     std::vector<SEGMENT> segments;
-    lineDetection(image, segments);
+    if (pyramid_levels > 0)
+    {
+        // Detect on the downscaled image, keeping it large enough for the border margins
+        Mat coarse = image;
+        int levels = 0;
+        for (; levels < pyramid_levels && std::min(coarse.rows, coarse.cols) >= 64; ++levels)
+            pyrDown(coarse, coarse);
+        lineDetection(coarse, segments);
+
+        // pixel i of the coarse image covers pixels [i*scale, (i+1)*scale) of the input
+        const float scale = (float)(1 << levels), shift = (scale - 1.0f) * 0.5f;
+        const float max_x = image.cols - 1.0f, max_y = image.rows - 1.0f;
+        for(size_t i = 0; i < segments.size(); ++i)
+        {
+            SEGMENT& seg = segments[i];
+            seg.x1 = std::min(std::max(seg.x1 * scale + shift, 0.0f), max_x);
+            seg.y1 = std::min(std::max(seg.y1 * scale + shift, 0.0f), max_y);
+            seg.x2 = std::min(std::max(seg.x2 * scale + shift, 0.0f), max_x);
+            seg.y2 = std::min(std::max(seg.y2 * scale + shift, 0.0f), max_y);
+            additionalOperationsOnSegment(image, seg);
+        }
+    }
+    else
+    {
+        lineDetection(image, segments);
+    }
     for(size_t i = 0; i < segments.size(); ++i)
     {
         const SEGMENT seg = segments[i];
@@ -322,7 +360,7 @@ bool FastLineDetectorImpl::mergeSegments(const SEGMENT& seg1, const SEGMENT& seg
 }
 
 template<class T>
-    void FastLineDetectorImpl::incidentPoint(const Mat& l, T& pt)
+    void FastLineDetectorImpl::incidentPoint(const Mat& l, const Size& bounds, T& pt)
     {
         double a[] = { (double)pt.x, (double)pt.y, 1.0 };
         double b[] = { l.at<double>(0,0), l.at<double>(1,0), 0.0 };
@@ -339,13 +377,13 @@ template<class T>
 
         Point2f pt_tmp;
         pt_tmp.x = (float)xk.at<double>(0,0) < 0.0f ? 0.0f : (float)xk.at<double>(0,0)
-            >= (imagewidth - 1.0f) ? (imagewidth - 1.0f) : (float)xk.at<double>(0,0);
+            >= (bounds.width - 1.0f) ? (bounds.width - 1.0f) : (float)xk.at<double>(0,0);
         pt_tmp.y = (float)xk.at<double>(1,0) < 0.0f ? 0.0f : (float)xk.at<double>(1,0)
-            >= (imageheight - 1.0f) ? (imageheight - 1.0f) : (float)xk.at<double>(1,0);
+            >= (bounds.height - 1.0f) ? (bounds.height - 1.0f) : (float)xk.at<double>(1,0);
         pt = T(pt_tmp);
     }
 
-void FastLineDetectorImpl::extractSegments(const std::vector<Point2i>& points, std::vector<SEGMENT>& segments)
+void FastLineDetectorImpl::extractSegments(const std::vector<Point2i>& points, const Size& bounds, std::vector<SEGMENT>& segments)
 {
     bool is_line;
 
@@ -414,7 +452,7 @@ void FastLineDetectorImpl::extractSegments(const std::vector<Point2i>& points, s
 
         l = p1.cross(p2);
 
-        incidentPoint(l, ps);
+        incidentPoint(l, bounds, ps);
 
         // Extending line
         for ( j = threshold_length + 1; i + j < total; j++ )
@@ -465,8 +503,8 @@ void FastLineDetectorImpl::extractSegments(const std::vector<Point2i>& points, s
         e2.x = (float)pe.x;
         e2.y = (float)pe.y;
 
-        incidentPoint(l, e1);
-        incidentPoint(l, e2);
+        incidentPoint(l, bounds, e1);
+        incidentPoint(l, bounds, e2);
         seg.x1 = e1.x;
         seg.y1 = e1.y;
         seg.x2 = e2.x;
@@ -539,15 +577,11 @@ bool FastLineDetectorImpl::getPointChain(const Mat& img, Point pt,
 
 void FastLineDetectorImpl::lineDetection(const Mat& src, std::vector<SEGMENT>& segments_all)
 {
-    int r, c;
-    imageheight=src.rows; imagewidth=src.cols;
-
-    std::vector<Point2i> points;
-    std::vector<SEGMENT> segments, segments_tmp;
+    std::vector<SEGMENT> segments_tmp;
     Mat canny;
     if (canny_aperture_size == 0)
     {
-        canny = src;
+        canny = src.clone();
     }
     else
     {
@@ -556,29 +590,102 @@ void FastLineDetectorImpl::lineDetection(const Mat& src, std::vector<SEGMENT>& s
     canny.colRange(0,6).rowRange(0,6) = 0;
     canny.colRange(src.cols-5,src.cols).rowRange(src.rows-5,src.rows) = 0;
 
-    SEGMENT seg, seg1, seg2;
+    SEGMENT seg1, seg2;
 
-    for ( r = 0; r < imageheight; r++ )
+    if (tile_size <= 0 || (tile_size >= src.cols && tile_size >= src.rows))
+    {
+        traceSegments(src, canny, Point(0, 0), segments_tmp);
+    }
+    else
     {
-        for ( c = 0; c < imagewidth; c++ )
+        // Trace every tile separately, then join the lines cut by tile borders
+        const int tiles_x = (src.cols + tile_size - 1) / tile_size;
+        const int tiles_y = (src.rows + tile_size - 1) / tile_size;
+        std::vector<std::vector<SEGMENT> > tile_segments(tiles_x * tiles_y);
+
+        parallel_for_(Range(0, tiles_x * tiles_y), [&](const Range& range)
+        {
+            for (int t = range.start; t < range.end; t++)
+            {
+                Rect roi(Point((t % tiles_x) * tile_size, (t / tiles_x) * tile_size), Size(tile_size, tile_size));
+                roi &= Rect(0, 0, src.cols, src.rows);
+                Mat tile = canny(roi).clone();
+                traceSegments(src, tile, roi.tl(), tile_segments[t]);
+            }
+        });
+
+        for (size_t t = 0; t < tile_segments.size(); t++)
+            segments_tmp.insert(segments_tmp.end(), tile_segments[t].begin(), tile_segments[t].end());
+
+        stitchSegments(src, segments_tmp);
+    }
+
+    if(!do_merge)
+    {
+        segments_all = segments_tmp;
+        return;
+    }
+
+    bool is_merged = false;
+    int ith = (int)segments_tmp.size() - 1;
+    int jth = ith - 1;
+    while(ith > 1 || jth > 0)
+    {
+        seg1 = segments_tmp[ith];
+        seg2 = segments_tmp[jth];
+        SEGMENT seg_merged;
+        is_merged = mergeSegments(seg1, seg2, seg_merged);
+        if(is_merged == true)
+        {
+            seg2 = seg_merged;
+            additionalOperationsOnSegment(src, seg2);
+            std::vector<SEGMENT>::iterator it = segments_tmp.begin() + ith;
+            *it = seg2;
+            segments_tmp.erase(segments_tmp.begin()+jth);
+            ith--;
+            jth = ith - 1;
+        }
+        else
+        {
+            jth--;
+        }
+        if(jth < 0) {
+            ith--;
+            jth = ith - 1;
+        }
+    }
+    segments_all = segments_tmp;
+}
+
+void FastLineDetectorImpl::traceSegments(const Mat& src, Mat& edges, Point offset, std::vector<SEGMENT>& segments_out)
+{
+    int r, c;
+
+    std::vector<Point2i> points;
+    std::vector<SEGMENT> segments;
+    SEGMENT seg;
+
+    for ( r = 0; r < edges.rows; r++ )
+    {
+        for ( c = 0; c < edges.cols; c++ )
         {
             // Find seeds - skip for non-seeds
-            if ( canny.at<unsigned char>(r,c) == 0 )
+            if ( edges.at<unsigned char>(r,c) == 0 )
                 continue;
 
             // Found seeds
             Point2i pt = Point2i(c,r);
 
             points.push_back(pt);
-            canny.at<unsigned char>(pt.y, pt.x) = 0;
+            edges.at<unsigned char>(pt.y, pt.x) = 0;
 
             float direction = 0.0f;
             int step = 0;
-            while(getPointChain(canny, pt, pt, direction, step))
+            while(getPointChain(edges, pt, pt, direction, step))
             {
                 points.push_back(pt);
                 step++;
-                canny.at<unsigned char>(pt.y, pt.x) = 0;
+                edges.at<unsigned char>(pt.y, pt.x) = 0;
             }
 
             if ( points.size() < (unsigned int)threshold_length + 1 )
@@ -587,7 +694,7 @@ void FastLineDetectorImpl::lineDetection(const Mat& src, std::vector<SEGMENT>& s
                 continue;
             }
 
-            extractSegments(points, segments);
+            extractSegments(points, edges.size(), segments);
 
             if ( segments.size() == 0 )
             {
@@ -601,52 +708,132 @@ void FastLineDetectorImpl::lineDetection(const Mat& src, std::vector<SEGMENT>& s
                         (seg.y1 - seg.y2)*(seg.y1 - seg.y2));
                 if(length < threshold_length)
                     continue;
+                seg.x1 += offset.x;
+                seg.y1 += offset.y;
+                seg.x2 += offset.x;
+                seg.y2 += offset.y;
                 if( (seg.x1 <= 5.0f && seg.x2 <= 5.0f) ||
                     (seg.y1 <= 5.0f && seg.y2 <= 5.0f) ||
-                    (seg.x1 >= imagewidth - 5.0f && seg.x2 >= imagewidth - 5.0f) ||
-                    (seg.y1 >= imageheight - 5.0f && seg.y2 >= imageheight - 5.0f) )
+                    (seg.x1 >= src.cols - 5.0f && seg.x2 >= src.cols - 5.0f) ||
+                    (seg.y1 >= src.rows - 5.0f && seg.y2 >= src.rows - 5.0f) )
                     continue;
                 additionalOperationsOnSegment(src, seg);
-                if(!do_merge)
-                    segments_all.push_back(seg);
-                segments_tmp.push_back(seg);
+                segments_out.push_back(seg);
             }
             points.clear();
             segments.clear();
         }
     }
-    if(!do_merge)
-        return;
+}
 
-    bool is_merged = false;
-    int ith = (int)segments_tmp.size() - 1;
-    int jth = ith - 1;
-    while(ith > 1 || jth > 0)
+void FastLineDetectorImpl::stitchSegments(const Mat& src, std::vector<SEGMENT>& segments)
+{
+    // Pieces of a line cut by a tile border end next to each other on both sides of it
+    const float gap = 2.0f * threshold_dist + 1.0f;
+    const int tile = tile_size;
+
+    struct Ends
     {
-        seg1 = segments_tmp[ith];
-        seg2 = segments_tmp[jth];
-        SEGMENT seg_merged;
-        is_merged = mergeSegments(seg1, seg2, seg_merged);
-        if(is_merged == true)
+        static Point2f get(const SEGMENT& s, int end)
         {
-            seg2 = seg_merged;
-            additionalOperationsOnSegment(src, seg2);
-            std::vector<SEGMENT>::iterator it = segments_tmp.begin() + ith;
-            *it = seg2;
-            segments_tmp.erase(segments_tmp.begin()+jth);
-            ith--;
-            jth = ith - 1;
+            return end == 0 ? Point2f(s.x1, s.y1) : Point2f(s.x2, s.y2);
         }
-        else
+        static bool nearBorder(const Point2f& p, int tile_)
         {
-            jth--;
+            float rx = std::fmod(p.x + 0.5f, (float)tile_);
+            float ry = std::fmod(p.y + 0.5f, (float)tile_);
+            return std::min(rx, tile_ - rx) <= 2.0f || std::min(ry, tile_ - ry) <= 2.0f;
         }
-        if(jth < 0) {
-            ith--;
-            jth = ith - 1;
+    };
+
+    // Only the ends lying next to a tile border can be stitched. They are indexed in cells of
+    // the size of the largest gap, so that the ends meeting one are in the 3x3 cells around it.
+    const int cells_x = cvFloor(src.cols / gap) + 1;
+    std::map<int64, std::vector<int> > cells;
+    auto cellOf = [&](const Point2f& p) { return Point(cvFloor(p.x / gap), cvFloor(p.y / gap)); };
+    auto addEnds = [&](int i)
+    {
+        for (int end = 0; end < 2; end++)
+        {
+            Point2f p = Ends::get(segments[i], end);
+            if (Ends::nearBorder(p, tile))
+            {
+                Point c = cellOf(p);
+                cells[(int64)c.y * cells_x + c.x].push_back(i);
+            }
         }
+    };
+
+    const int n = (int)segments.size();
+    std::vector<bool> alive(n, true);
+    std::vector<int> pending;
+    for (int i = n - 1; i >= 0; i--)
+    {
+        addEnds(i);
+        pending.push_back(i);
     }
-    segments_all = segments_tmp;
+
+    // Every merge removes a segment and only the merged one has to be looked at again
+    while (!pending.empty())
+    {
+        int i = pending.back();
+        pending.pop_back();
+        if (!alive[i])
+            continue;
+
+        bool is_merged = false;
+        for (int end = 0; end < 2 && !is_merged; end++)
+        {
+            Point2f p = Ends::get(segments[i], end);
+            if (!Ends::nearBorder(p, tile))
+                continue;
+
+            Point c = cellOf(p);
+            for (int cy = c.y - 1; cy <= c.y + 1 && !is_merged; cy++)
+            {
+                for (int cx = c.x - 1; cx <= c.x + 1 && !is_merged; cx++)
+                {
+                    auto cell = cells.find((int64)cy * cells_x + cx);
+                    if (cell == cells.end())
+                        continue;
+
+                    // Copied, as a merge adds entries to the cells
+                    const std::vector<int> candidates = cell->second;
+                    for (size_t k = 0; k < candidates.size() && !is_merged; k++)
+                    {
+                        int j = candidates[k];
+                        if (j == i || !alive[j])
+                            continue;
+
+                        // Cells may hold outdated ends of merged segments: check the current ones
+                        Point2f q1 = Ends::get(segments[j], 0), q2 = Ends::get(segments[j], 1);
+                        if (norm(p - q1) > gap && norm(p - q2) > gap)
+                            continue;
+
+                        int lo = std::min(i, j), hi = std::max(i, j);
+                        SEGMENT seg_merged;
+                        if (mergeSegments(segments[lo], segments[hi], seg_merged))
+                        {
+                            additionalOperationsOnSegment(src, seg_merged);
+                            segments[lo] = seg_merged;
+                            alive[hi] = false;
+                            addEnds(lo);
+                            pending.push_back(lo);
+                            is_merged = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (alive[i])
+            segments[kept++] = segments[i];
+    }
+    segments.resize(kept);
 }
 
 inline void FastLineDetectorImpl::getAngle(SEGMENT& seg)
@@ -56,8 +56,14 @@ namespace cv {
                     int to;
                     float weight;
 
+                    // Strict total order, so that sorting gives the same sequence
+                    // whatever the way the edge list was split between threads
                     bool operator <(const Edge& e) const {
-                        return weight < e.weight;
+                        if (weight != e.weight)
+                            return weight < e.weight;
+                        if (from != e.from)
+                            return from < e.from;
+                        return to < e.to;
                     }
             };
 
@@ -170,45 +176,103 @@ namespace cv {
 
             void GraphSegmentationImpl::buildGraph(Edge **edges, int &nb_edges, const Mat &img_filtered) {
 
-                *edges = new Edge[img_filtered.rows * img_filtered.cols * 4];
+                const int rows = img_filtered.rows, cols = img_filtered.cols;
 
-                nb_edges = 0;
+                *edges = new Edge[rows * cols * 4];
+
+                // Number of edges before each row: every pixel links to its horizontal neighbours
+                // and to the pixels above and below, when they exist
+                std::vector<int> row_offsets(rows + 1, 0);
+                for (int i = 0; i < rows; i++) {
+                    row_offsets[i + 1] = row_offsets[i] + 2 * (cols - 1) + cols * ((i > 0) + (i < rows - 1));
+                }
+
+                nb_edges = row_offsets[rows];
 
                 int nb_channels = img_filtered.channels();
 
-                for (int i = 0; i < (int)img_filtered.rows; i++) {
-                    const float* p = img_filtered.ptr<float>(i);
+                parallel_for_(Range(0, rows), [&](const Range& range) {
+                    for (int i = range.start; i < range.end; i++) {
+                        const float* p = img_filtered.ptr<float>(i);
+                        Edge* row_edges = *edges + row_offsets[i];
+                        int nb_row_edges = 0;
 
-                    for (int j = 0; j < (int)img_filtered.cols; j++) {
+                        for (int j = 0; j < cols; j++) {
 
-                        //Take the right, left, top and down pixel
-                        for (int delta = -1; delta <= 1; delta += 2) {
-                            for (int delta_j = 0, delta_i = 1; delta_j <= 1; delta_j++ || delta_i--) {
+                            //Take the right, left, top and down pixel
+                            for (int delta = -1; delta <= 1; delta += 2) {
+                                for (int delta_j = 0, delta_i = 1; delta_j <= 1; delta_j++ || delta_i--) {
 
-                                int i2 = i + delta * delta_i;
-                                int j2 = j + delta * delta_j;
+                                    int i2 = i + delta * delta_i;
+                                    int j2 = j + delta * delta_j;
 
-                                if (i2 >= 0 && i2 < img_filtered.rows && j2 >= 0 && j2 < img_filtered.cols) {
-                                    const float* p2 = img_filtered.ptr<float>(i2);
+                                    if (i2 >= 0 && i2 < rows && j2 >= 0 && j2 < cols) {
+                                        const float* p2 = img_filtered.ptr<float>(i2);
 
-                                    float tmp_total = 0;
+                                        float tmp_total = 0;
 
-                                    for ( int channel = 0; channel < nb_channels; channel++) {
-                                        tmp_total += pow(p[j * nb_channels + channel] - p2[j2 * nb_channels + channel], 2);
-                                    }
+                                        for ( int channel = 0; channel < nb_channels; channel++) {
+                                            tmp_total += pow(p[j * nb_channels + channel] - p2[j2 * nb_channels + channel], 2);
+                                        }
 
-                                    float diff = 0;
-                                    diff = sqrt(tmp_total);
+                                        float diff = 0;
+                                        diff = sqrt(tmp_total);
 
-                                    (*edges)[nb_edges].weight = diff;
-                                    (*edges)[nb_edges].from = i * img_filtered.cols +  j;
-                                    (*edges)[nb_edges].to = i2 * img_filtered.cols + j2;
+                                        row_edges[nb_row_edges].weight = diff;
+                                        row_edges[nb_row_edges].from = i * cols +  j;
+                                        row_edges[nb_row_edges].to = i2 * cols + j2;
 
-                                    nb_edges++;
+                                        nb_row_edges++;
+                                    }
                                 }
                             }
                         }
+
+                        CV_DbgAssert(nb_row_edges == row_offsets[i + 1] - row_offsets[i]);
                     }
+                });
+            }
+
+            // Sort edges: chunks are sorted in parallel, then merged pairwise, also in parallel
+            static void sortEdges(Edge *edges, int nb_edges) {
+
+                const int min_chunk = 1 << 16;
+                int nb_chunks = std::max(1, std::min(getNumThreads(), nb_edges / min_chunk));
+
+                std::vector<int> bounds(nb_chunks + 1);
+                for (int c = 0; c <= nb_chunks; c++) {
+                    bounds[c] = (int)((int64)nb_edges * c / nb_chunks);
+                }
+
+                parallel_for_(Range(0, nb_chunks), [&](const Range& range) {
+                    for (int c = range.start; c < range.end; c++) {
+                        std::sort(edges + bounds[c], edges + bounds[c + 1]);
+                    }
+                });
+
+                if (nb_chunks == 1)
+                    return;
+
+                std::vector<Edge> buffer(nb_edges);
+                Edge *src = edges, *dst = &buffer[0];
+
+                for (int width = 1; width < nb_chunks; width *= 2) {
+                    int nb_merges = (nb_chunks + 2 * width - 1) / (2 * width);
+
+                    parallel_for_(Range(0, nb_merges), [&](const Range& range) {
+                        for (int m = range.start; m < range.end; m++) {
+                            int first = bounds[2 * m * width];
+                            int middle = bounds[std::min(2 * m * width + width, nb_chunks)];
+                            int last = bounds[std::min(2 * m * width + 2 * width, nb_chunks)];
+                            std::merge(src + first, src + middle, src + middle, src + last, dst + first);
+                        }
+                    });
+
+                    std::swap(src, dst);
+                }
+
+                if (src != edges) {
+                    std::copy(src, src + nb_edges, edges);
                 }
             }
 
@@ -217,7 +281,7 @@ namespace cv {
                 int total_points = ( int)(img_filtered.rows * img_filtered.cols);
 
                 // Sort edges
-                std::sort(edges, edges + nb_edges);
+                sortEdges(edges, nb_edges);
 
                 // Create a set with all point (by default mapped to themselves)
                 *es = new PointSet(img_filtered.cols * img_filtered.rows);
@@ -348,6 +412,16 @@ namespace cv {
                 return graphseg;
             }
 
+            Ptr<GraphSegmentation> cloneGraphSegmentation(const Ptr<GraphSegmentation>& gs) {
+
+                Ptr<GraphSegmentationImpl> impl = gs.dynamicCast<GraphSegmentationImpl>();
+
+                if (!impl)
+                    return Ptr<GraphSegmentation>();
+
+                return makePtr<GraphSegmentationImpl>(*impl);
+            }
+
             PointSet::PointSet(int nb_elements_) {
                 nb_elements = nb_elements_;
 
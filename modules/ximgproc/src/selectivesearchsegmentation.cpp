@@ -244,6 +244,10 @@ namespace cv {
              * Stragegy / Multiple
              ***************************************/
 
+            // Return a new strategy with the same configuration, so that independent groupings can run
+            // concurrently. Empty if the strategy (or one of its parts) is not implemented in this module.
+            static Ptr<SelectiveSearchSegmentationStrategy> cloneStrategy(const Ptr<SelectiveSearchSegmentationStrategy>& s);
+
             class SelectiveSearchSegmentationStrategyMultipleImpl CV_FINAL : public SelectiveSearchSegmentationStrategyMultiple {
                 public:
                     SelectiveSearchSegmentationStrategyMultipleImpl() {
@@ -258,6 +262,8 @@ namespace cv {
                     virtual void addStrategy(Ptr<SelectiveSearchSegmentationStrategy> g, float weight) CV_OVERRIDE;
                     virtual void clearStrategies() CV_OVERRIDE;
 
+                    Ptr<SelectiveSearchSegmentationStrategy> clone() const;
+
                 private:
                     String name_;
                     std::vector<Ptr<SelectiveSearchSegmentationStrategy> > strategies;
@@ -277,6 +283,20 @@ namespace cv {
                 weights_total = 0;
             }
 
+            Ptr<SelectiveSearchSegmentationStrategy> SelectiveSearchSegmentationStrategyMultipleImpl::clone() const {
+                Ptr<SelectiveSearchSegmentationStrategyMultipleImpl> m = makePtr<SelectiveSearchSegmentationStrategyMultipleImpl>();
+
+                for (unsigned int i = 0; i < strategies.size(); i++) {
+                    Ptr<SelectiveSearchSegmentationStrategy> s = cloneStrategy(strategies[i]);
+                    if (s.empty()) {
+                        return Ptr<SelectiveSearchSegmentationStrategy>();
+                    }
+                    m->addStrategy(s, weights[i]);
+                }
+
+                return m;
+            }
+
             void SelectiveSearchSegmentationStrategyMultipleImpl::setImage(InputArray img_, InputArray regions_, InputArray sizes_, int image_id) {
                 for (unsigned int i = 0; i < strategies.size(); i++) {
                     strategies[i]->setImage(img_, regions_, sizes_, image_id);
@@ -688,6 +708,36 @@ namespace cv {
 
             // Core
 
+            static Ptr<SelectiveSearchSegmentationStrategy> cloneStrategy(const Ptr<SelectiveSearchSegmentationStrategy>& s) {
+                if (s.dynamicCast<SelectiveSearchSegmentationStrategyColorImpl>()) {
+                    return createSelectiveSearchSegmentationStrategyColor();
+                }
+                if (s.dynamicCast<SelectiveSearchSegmentationStrategySizeImpl>()) {
+                    return createSelectiveSearchSegmentationStrategySize();
+                }
+                if (s.dynamicCast<SelectiveSearchSegmentationStrategyFillImpl>()) {
+                    return createSelectiveSearchSegmentationStrategyFill();
+                }
+                if (s.dynamicCast<SelectiveSearchSegmentationStrategyTextureImpl>()) {
+                    return createSelectiveSearchSegmentationStrategyTexture();
+                }
+
+                Ptr<SelectiveSearchSegmentationStrategyMultipleImpl> m = s.dynamicCast<SelectiveSearchSegmentationStrategyMultipleImpl>();
+                if (m) {
+                    return m->clone();
+                }
+
+                return Ptr<SelectiveSearchSegmentationStrategy>();
+            }
+
+            // Return a copy of a graph segmentation created by this module (see graphsegmentation.cpp).
+            // Empty for user-defined implementations.
+            Ptr<GraphSegmentation> cloneGraphSegmentation(const Ptr<GraphSegmentation>& gs);
+
+            /****************************************
+             * Selective search
+             ***************************************/
+
             class SelectiveSearchSegmentationImpl CV_FINAL : public SelectiveSearchSegmentation {
                 public:
                     SelectiveSearchSegmentationImpl() {
@@ -731,6 +781,8 @@ namespace cv {
                     std::vector<Ptr<GraphSegmentation> > segmentations;
                     std::vector<Ptr<SelectiveSearchSegmentationStrategy> > strategies;
 
+                    void processSegmentation(const Mat& img, const Ptr<GraphSegmentation>& gs, std::vector<Ptr<SelectiveSearchSegmentationStrategy> >& pair_strategies, int image_id, std::vector<std::vector<Region> >& pair_regions);
+
                     void hierarchicalGrouping(const Mat& img, Ptr<SelectiveSearchSegmentationStrategy>& s, const Mat& img_regions, const Mat_<char>& is_neighbour, const Mat_<int>& sizes, int& nb_segs, const std::vector<Rect>& bounding_rects, std::vector<Region>& regions, int region_id);
             };
 
@@ -886,91 +938,140 @@ namespace cv {
 
             void SelectiveSearchSegmentationImpl::process(std::vector<Rect>& rects) {
 
-                std::vector<Region> all_regions;
+                // Every (image, graph segmentation) pair is segmented and grouped independently, so the pairs
+                // are processed in parallel, each with its own copies of the graph segmentation and of the
+                // strategies. Regions are ranked afterwards in the sequential order, which keeps the result
+                // the same as a serial run.
+                const int nb_segmentations = (int)segmentations.size();
+                const int nb_pairs = (int)images.size() * nb_segmentations;
+
+                std::vector<Ptr<GraphSegmentation> > pair_segmentations(nb_pairs);
+                std::vector<std::vector<Ptr<SelectiveSearchSegmentationStrategy> > > pair_strategies(nb_pairs);
+                bool parallel = true;
+
+                for (int pair = 0; pair < nb_pairs && parallel; pair++) {
+                    pair_segmentations[pair] = cloneGraphSegmentation(segmentations[pair % nb_segmentations]);
+                    parallel = !pair_segmentations[pair].empty();
+
+                    for (size_t strategy = 0; strategy < strategies.size() && parallel; strategy++) {
+                        Ptr<SelectiveSearchSegmentationStrategy> s = cloneStrategy(strategies[strategy]);
+                        parallel = !s.empty();
+                        pair_strategies[pair].push_back(s);
+                    }
+                }
 
-                int image_id = 0;
+                // User-defined segmentations or strategies cannot be copied: share them and run the pairs
+                // one after another
+                if (!parallel) {
+                    for (int pair = 0; pair < nb_pairs; pair++) {
+                        pair_segmentations[pair] = segmentations[pair % nb_segmentations];
+                        pair_strategies[pair] = strategies;
+                    }
+                }
 
-                for(std::vector<Mat>::iterator image = images.begin(); image != images.end(); ++image) {
-                    for(std::vector<Ptr<GraphSegmentation> >::iterator gs = segmentations.begin(); gs != segmentations.end(); ++gs) {
+                std::vector<std::vector<std::vector<Region> > > all_pair_regions(nb_pairs);
 
-                        Mat img_regions;
-                        Mat_<char> is_neighbour;
-                        Mat_<int> sizes;
+                auto body = [&](const Range& range) {
+                    for (int pair = range.start; pair < range.end; pair++) {
+                        processSegmentation(images[pair / nb_segmentations], pair_segmentations[pair],
+                                            pair_strategies[pair], pair, all_pair_regions[pair]);
+                    }
+                };
 
-                        // Compute initial segmentation
-                        (*gs)->processImage(*image, img_regions);
+                if (parallel) {
+                    parallel_for_(Range(0, nb_pairs), body, nb_pairs);
+                } else {
+                    body(Range(0, nb_pairs));
+                }
 
-                        // Get number of regions
-                        double min, max;
-                        minMaxLoc(img_regions, &min, &max);
-                        int nb_segs = (int)max + 1;
+                std::vector<Region> all_regions;
+
+                for (int pair = 0; pair < nb_pairs; pair++) {
+                    for (size_t strategy = 0; strategy < all_pair_regions[pair].size(); strategy++) {
+                        std::vector<Region>& regions = all_pair_regions[pair][strategy];
 
-                        // Compute bouding rects and neighbours
-                        std::vector<Rect> bounding_rects;
-                        bounding_rects.resize(nb_segs);
+                        // Compute regions' rank
+                        for(std::vector<Region>::iterator region = regions.begin(); region != regions.end(); ++region) {
+                            // Note: this is inverted from the paper, but we keep the lover region first so it's works
+                            (*region).rank = ((double) rand() / (RAND_MAX)) * ((*region).level);
+                            all_regions.push_back(*region);
+                        }
+                    }
+                }
+
+                std::sort(all_regions.begin(), all_regions.end());
+
+                std::map<Rect, char, rectComparator> processed_rect;
 
-                        std::vector<std::vector<cv::Point> > points;
+                rects.clear();
 
-                        points.resize(nb_segs);
+                // Remove duplicate in rect list
+                for(std::vector<Region>::iterator region = all_regions.begin(); region != all_regions.end(); ++region) {
+                    if (processed_rect.find((*region).bounding_box) == processed_rect.end()) {
+                        processed_rect[(*region).bounding_box] = true;
+                        rects.push_back((*region).bounding_box);
+                    }
+                }
 
-                        is_neighbour = Mat::zeros(nb_segs, nb_segs, CV_8UC1);
-                        sizes = Mat::zeros(nb_segs, 1, CV_32SC1);
+            }
 
-                        const int* previous_p = NULL;
+            void SelectiveSearchSegmentationImpl::processSegmentation(const Mat& img, const Ptr<GraphSegmentation>& gs, std::vector<Ptr<SelectiveSearchSegmentationStrategy> >& pair_strategies, int image_id, std::vector<std::vector<Region> >& pair_regions) {
 
-                        for (int i = 0; i < (int)img_regions.rows; i++) {
-                            const int* p = img_regions.ptr<int>(i);
+                Mat img_regions;
+                Mat_<char> is_neighbour;
+                Mat_<int> sizes;
 
-                            for (int j = 0; j < (int)img_regions.cols; j++) {
+                // Compute initial segmentation
+                gs->processImage(img, img_regions);
 
-                                points[p[j]].push_back(cv::Point(j, i));
-                                sizes.at<int>(p[j], 0) = sizes.at<int>(p[j], 0) + 1;
+                // Get number of regions
+                double min, max;
+                minMaxLoc(img_regions, &min, &max);
+                int nb_segs = (int)max + 1;
 
-                                if (i > 0 && j > 0) {
+                // Compute bouding rects and neighbours
+                std::vector<Rect> bounding_rects;
+                bounding_rects.resize(nb_segs);
 
-                                    is_neighbour.at<char>(p[j], p[j - 1]) = 1;
-                                    is_neighbour.at<char>(p[j], previous_p[j]) = 1;
-                                    is_neighbour.at<char>(p[j], previous_p[j - 1]) = 1;
+                std::vector<std::vector<cv::Point> > points;
 
-                                    is_neighbour.at<char>(p[j - 1], p[j]) = 1;
-                                    is_neighbour.at<char>(previous_p[j], p[j]) = 1;
-                                    is_neighbour.at<char>(previous_p[j - 1], p[j]) = 1;
-                                }
-                            }
-                            previous_p = p;
-                        }
+                points.resize(nb_segs);
 
-                        for(int seg = 0; seg < nb_segs; seg++) {
-                            bounding_rects[seg] = cv::boundingRect(points[seg]);
-                        }
+                is_neighbour = Mat::zeros(nb_segs, nb_segs, CV_8UC1);
+                sizes = Mat::zeros(nb_segs, 1, CV_32SC1);
 
-                        for(std::vector<Ptr<SelectiveSearchSegmentationStrategy> >::iterator strategy = strategies.begin(); strategy != strategies.end(); ++strategy) {
-                            std::vector<Region> regions;
-                            hierarchicalGrouping(*image, *strategy, img_regions, is_neighbour, sizes, nb_segs, bounding_rects, regions, image_id);
+                const int* previous_p = NULL;
 
-                            for(std::vector<Region>::iterator region = regions.begin(); region != regions.end(); ++region) {
-                                all_regions.push_back(*region);
-                            }
-                        }
+                for (int i = 0; i < (int)img_regions.rows; i++) {
+                    const int* p = img_regions.ptr<int>(i);
 
-                        image_id++;
-                    }
-                }
+                    for (int j = 0; j < (int)img_regions.cols; j++) {
 
-                std::sort(all_regions.begin(), all_regions.end());
+                        points[p[j]].push_back(cv::Point(j, i));
+                        sizes.at<int>(p[j], 0) = sizes.at<int>(p[j], 0) + 1;
 
-                std::map<Rect, char, rectComparator> processed_rect;
+                        if (i > 0 && j > 0) {
 
-                rects.clear();
+                            is_neighbour.at<char>(p[j], p[j - 1]) = 1;
+                            is_neighbour.at<char>(p[j], previous_p[j]) = 1;
+                            is_neighbour.at<char>(p[j], previous_p[j - 1]) = 1;
 
-                // Remove duplicate in rect list
-                for(std::vector<Region>::iterator region = all_regions.begin(); region != all_regions.end(); ++region) {
-                    if (processed_rect.find((*region).bounding_box) == processed_rect.end()) {
-                        processed_rect[(*region).bounding_box] = true;
-                        rects.push_back((*region).bounding_box);
+                            is_neighbour.at<char>(p[j - 1], p[j]) = 1;
+                            is_neighbour.at<char>(previous_p[j], p[j]) = 1;
+                            is_neighbour.at<char>(previous_p[j - 1], p[j]) = 1;
+                        }
                     }
+                    previous_p = p;
                 }
 
+                for(int seg = 0; seg < nb_segs; seg++) {
+                    bounding_rects[seg] = cv::boundingRect(points[seg]);
+                }
+
+                pair_regions.resize(pair_strategies.size());
+                for (size_t strategy = 0; strategy < pair_strategies.size(); strategy++) {
+                    hierarchicalGrouping(img, pair_strategies[strategy], img_regions, is_neighbour, sizes, nb_segs, bounding_rects, pair_regions[strategy], image_id);
+                }
             }
 
             void SelectiveSearchSegmentationImpl::hierarchicalGrouping(const Mat& img, Ptr<SelectiveSearchSegmentationStrategy>& s, const Mat& img_regions, const Mat_<char>& is_neighbour, const Mat_<int>& sizes_, int& nb_segs, const std::vector<Rect>& bounding_rects, std::vector<Region>& regions, int image_id) {
@@ -1080,12 +1181,6 @@ namespace cv {
                     }
                 }
 
-                // Compute regions' rank
-                for(std::vector<Region>::iterator region = regions.begin(); region != regions.end(); ++region) {
-                    // Note: this is inverted from the paper, but we keep the lover region first so it's works
-                    (*region).rank = ((double) rand() / (RAND_MAX)) * ((*region).level);
-                }
-
             }
 
             Ptr<SelectiveSearchSegmentation> createSelectiveSearchSegmentation() {
@@ -46,14 +46,7 @@
 #include <cmath>
 
 #include "advanced_types.hpp"
-
-#ifdef CV_CXX11
-#define CV_USE_PARALLEL_PREDICT_EDGES_1 1
-#define CV_USE_PARALLEL_PREDICT_EDGES_2 0  //1, see https://github.com/opencv/opencv_contrib/issues/2346
-#else
-#define CV_USE_PARALLEL_PREDICT_EDGES_1 0
-#define CV_USE_PARALLEL_PREDICT_EDGES_2 0
-#endif
+#include "opencv2/core/hal/intrin.hpp"
 
 /********************* Helper functions *********************/
 
@@ -152,27 +145,58 @@ static cv::Mat rgb2luv(const cv::Mat &src)
         lTable.push_back(*--lTable.end());
 
     const int nchannels = 3;
+    const float *pTable = &lTable[0];
 
-    for (int i = 0; i < src.rows; ++i)
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
     {
-        const float *pSrc = src.ptr<float>(i);
-        float *pDst = dst.ptr<float>(i);
-
-        for (int j = 0; j < src.cols*nchannels; j += nchannels)
+        for (int i = range.start; i < range.end; ++i)
         {
-            const float rgb[] = {pSrc[j + 0], pSrc[j + 1], pSrc[j + 2]};
+            const float *pSrc = src.ptr<float>(i);
+            float *pDst = dst.ptr<float>(i);
+
+            int j = 0;
+#if CV_SIMD128
+            const cv::v_float32x4 vmX0 = cv::v_setall_f32(mX[0]), vmX1 = cv::v_setall_f32(mX[1]), vmX2 = cv::v_setall_f32(mX[2]);
+            const cv::v_float32x4 vmY0 = cv::v_setall_f32(mY[0]), vmY1 = cv::v_setall_f32(mY[1]), vmY2 = cv::v_setall_f32(mY[2]);
+            const cv::v_float32x4 vmZ0 = cv::v_setall_f32(mZ[0]), vmZ1 = cv::v_setall_f32(mZ[1]), vmZ2 = cv::v_setall_f32(mZ[2]);
+            const cv::v_float32x4 v1024 = cv::v_setall_f32(1024.0f), veps = cv::v_setall_f32(1e-35f);
+            const cv::v_float32x4 vu = cv::v_setall_f32(13*4.0f), vun = cv::v_setall_f32(13*un), vminu = cv::v_setall_f32(minu);
+            const cv::v_float32x4 vv = cv::v_setall_f32(13*9.0f), vvn = cv::v_setall_f32(13*vn), vminv = cv::v_setall_f32(minv);
+            for (; j <= src.cols - 4; j += 4)
+            {
+                cv::v_float32x4 r, g, b;
+                v_load_deinterleave(pSrc + j*nchannels, r, g, b);
 
-            const float xyz[] = {mX[0]*rgb[0] + mX[1]*rgb[1] + mX[2]*rgb[2],
-                                 mY[0]*rgb[0] + mY[1]*rgb[1] + mY[2]*rgb[2],
-                                 mZ[0]*rgb[0] + mZ[1]*rgb[1] + mZ[2]*rgb[2]};
-            const float nz = 1.0f / float(xyz[0] + 15*xyz[1] + 3*xyz[2] + 1e-35);
+                cv::v_float32x4 x = vmX0*r + vmX1*g + vmX2*b;
+                cv::v_float32x4 y = vmY0*r + vmY1*g + vmY2*b;
+                cv::v_float32x4 z = vmZ0*r + vmZ1*g + vmZ2*b;
+                cv::v_float32x4 nz = cv::v_setall_f32(1.0f) / (x + cv::v_setall_f32(15.0f)*y + cv::v_setall_f32(3.0f)*z + veps);
 
-            const float l = pDst[j] = lTable[cvFloor(1024*xyz[1])];
+                int idx[4];
+                v_store(idx, v_floor(v1024*y));
+                cv::v_float32x4 l(pTable[idx[0]], pTable[idx[1]], pTable[idx[2]], pTable[idx[3]]);
+
+                v_store_interleave(pDst + j*nchannels, l,
+                                   l*(vu*x*nz - vun) - vminu,
+                                   l*(vv*y*nz - vvn) - vminv);
+            }
+#endif
+            for (; j < src.cols; ++j)
+            {
+                const float rgb[] = {pSrc[j*nchannels + 0], pSrc[j*nchannels + 1], pSrc[j*nchannels + 2]};
 
-            pDst[j + 1] = l * (13*4*xyz[0]*nz - 13*un) - minu;;
-            pDst[j + 2] = l * (13*9*xyz[1]*nz - 13*vn) - minv;
+                const float xyz[] = {mX[0]*rgb[0] + mX[1]*rgb[1] + mX[2]*rgb[2],
+                                     mY[0]*rgb[0] + mY[1]*rgb[1] + mY[2]*rgb[2],
+                                     mZ[0]*rgb[0] + mZ[1]*rgb[1] + mZ[2]*rgb[2]};
+                const float nz = 1.0f / (xyz[0] + 15*xyz[1] + 3*xyz[2] + 1e-35f);
+
+                const float l = pDst[j*nchannels] = pTable[cvFloor(1024*xyz[1])];
+
+                pDst[j*nchannels + 1] = l * (13*4*xyz[0]*nz - 13*un) - minu;
+                pDst[j*nchannels + 2] = l * (13*9*xyz[1]*nz - 13*vn) - minv;
+            }
         }
-    }
+    });
 
     return dst;
 }
@@ -207,60 +231,109 @@ static void gradientHist(const cv::Mat &src, cv::Mat &magnitude, cv::Mat &histog
     cv::Sobel( src, Dy, cv::DataType<float>::type,
         0, 1, 1, 1.0, 0.0, cv::BORDER_REFLECT );
 
-    int nchannels = src.channels();
+    const int nchannels = src.channels();
 
-    for (int i = 0; i < src.rows; ++i)
+    // per-pixel magnitude and orientation of the strongest channel
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
     {
-        const float *pDx = Dx.ptr<float>(i);
-        const float *pDy = Dy.ptr<float>(i);
+        cv::AutoBuffer<float> buf(2*src.cols);
+        float *rowDx = buf.data(), *rowDy = rowDx + src.cols;
 
-        float *pMagnitude = magnitude.ptr<float>(i);
-        float *pPhase = phase.ptr<float>(i);
-
-        for (int j = 0; j < src.cols*nchannels; j += nchannels)
+        for (int i = range.start; i < range.end; ++i)
         {
-            float fMagn = float(-1e-5), fdx = 0, fdy = 0;
-            for (int k = 0; k < nchannels; ++k)
+            const float *pDx = Dx.ptr<float>(i);
+            const float *pDy = Dy.ptr<float>(i);
+
+            float *pMagnitude = magnitude.ptr<float>(i);
+            float *pPhase = phase.ptr<float>(i);
+
+            int j = 0;
+#if CV_SIMD128
+            if (nchannels == 3)
             {
-                float cMagn = CV_SQR( pDx[j + k] ) + CV_SQR( pDy[j + k] );
-                if (cMagn > fMagn)
+                for (; j <= src.cols - 4; j += 4)
                 {
-                    fMagn = cMagn;
-                    fdx = pDx[j + k];
-                    fdy = pDy[j + k];
+                    cv::v_float32x4 dx0, dx1, dx2, dy0, dy1, dy2;
+                    v_load_deinterleave(pDx + j*3, dx0, dx1, dx2);
+                    v_load_deinterleave(pDy + j*3, dy0, dy1, dy2);
+
+                    cv::v_float32x4 fMagn = dx0*dx0 + dy0*dy0, fdx = dx0, fdy = dy0;
+
+                    cv::v_float32x4 cMagn = dx1*dx1 + dy1*dy1;
+                    cv::v_float32x4 mask = cMagn > fMagn;
+                    fMagn = v_select(mask, cMagn, fMagn);
+                    fdx = v_select(mask, dx1, fdx);
+                    fdy = v_select(mask, dy1, fdy);
+
+                    cMagn = dx2*dx2 + dy2*dy2;
+                    mask = cMagn > fMagn;
+                    fMagn = v_select(mask, cMagn, fMagn);
+                    fdx = v_select(mask, dx2, fdx);
+                    fdy = v_select(mask, dy2, fdy);
+
+                    v_store(pMagnitude + j, v_sqrt(fMagn));
+                    v_store(rowDx + j, fdx);
+                    v_store(rowDy + j, fdy);
                 }
             }
+#endif
+            for (; j < src.cols; ++j)
+            {
+                float fMagn = float(-1e-5), fdx = 0, fdy = 0;
+                for (int k = 0; k < nchannels; ++k)
+                {
+                    float cMagn = CV_SQR( pDx[j*nchannels + k] ) + CV_SQR( pDy[j*nchannels + k] );
+                    if (cMagn > fMagn)
+                    {
+                        fMagn = cMagn;
+                        fdx = pDx[j*nchannels + k];
+                        fdy = pDy[j*nchannels + k];
+                    }
+                }
 
-            pMagnitude[j/nchannels] = sqrtf(fMagn);
+                pMagnitude[j] = sqrtf(fMagn);
+                rowDx[j] = fdx;
+                rowDy[j] = fdy;
+            }
 
-            float angle = cv::fastAtan2(fdy, fdx) / 180.0f - 1.0f * (fdy < 0);
-            if (std::fabs(fdx) + std::fabs(fdy) < 1e-5)
-                angle = 0.5f;
-            pPhase[j/nchannels] = angle;
+            for (j = 0; j < src.cols; ++j)
+            {
+                float angle = cv::fastAtan2(rowDy[j], rowDx[j]) / 180.0f - 1.0f * (rowDy[j] < 0);
+                if (std::fabs(rowDx[j]) + std::fabs(rowDy[j]) < 1e-5)
+                    angle = 0.5f;
+                pPhase[j] = angle;
+            }
         }
-    }
+    });
 
     magnitude /= imsmooth( magnitude, gnrmRad )
         + 0.01*cv::Mat::ones( magnitude.size(), magnitude.type() );
 
-    for (int i = 0; i < phase.rows; ++i)
+    // every histogram row is accumulated from its own pSize source rows
+    cv::parallel_for_(cv::Range(0, histogram.rows), [&](const cv::Range& range)
     {
-        const float *pPhase = phase.ptr<float>(i);
-        const float *pMagn  = magnitude.ptr<float>(i);
-
-        float *pHist = histogram.ptr<float>(i/pSize);
-
-        for (int j = 0; j < phase.cols; ++j)
+        for (int h = range.start; h < range.end; ++h)
         {
-            int angle = cvRound(pPhase[j]*nBins);
-            if(angle >= nBins)
+            float *pHist = histogram.ptr<float>(h);
+
+            for (int i = h*pSize; i < std::min((h + 1)*pSize, phase.rows); ++i)
             {
-              angle = 0;
+                const float *pPhase = phase.ptr<float>(i);
+                const float *pMagn  = magnitude.ptr<float>(i);
+
+                for (int j = 0; j < phase.cols; ++j)
+                {
+                    int angle = cvRound(pPhase[j]*nBins);
+                    if(angle >= nBins)
+                    {
+                      angle = 0;
+                    }
+                    const int index = (j/pSize)*nBins + angle;
+                    pHist[index] += pMagn[j] / CV_SQR(pSize);
+                }
             }
-            const int index = (j/pSize)*nBins + angle;
-            pHist[index] += pMagn[j] / CV_SQR(pSize);
         }
-    }
+    });
 }
 
 /*!
@@ -523,6 +596,15 @@ public:
         }
 
         __rf.numberOfTreeNodes = int( __rf.childs.size() ) / __rf.options.numberOfTrees;
+
+        // tree-relative child links are resolved once, so that the traversal
+        // in predictEdges touches only flat per-node arrays
+        __rf.nodeChilds.resize( __rf.childs.size() );
+        for (size_t k = 0; k < __rf.childs.size(); ++k)
+        {
+            int baseNode = int(k) / __rf.numberOfTreeNodes * __rf.numberOfTreeNodes;
+            __rf.nodeChilds[k] = __rf.childs[k] != 0 ? baseNode + __rf.childs[k] - 1 : -1;
+        }
     }
 
     /*!
@@ -738,97 +820,106 @@ protected:
             }
             // lookup tables for mapping linear index to offset pairs
 
-        #if CV_USE_PARALLEL_PREDICT_EDGES_1
+        const int nNodes = int( __rf.nodeChilds.size() );
+        std::vector <int> nodeOffsetA(nNodes, 0), nodeOffsetB(nNodes, -1);
+        for (int node = 0; node < nNodes; ++node)
+        {
+            if (__rf.nodeChilds[node] < 0)
+                continue;
+
+            int currentId = __rf.featureIds[node];
+            if (currentId >= nFeatures)
+            {
+                nodeOffsetA[node] = offsetX[currentId - nFeatures];
+                nodeOffsetB[node] = offsetY[currentId - nFeatures];
+            }
+            else
+                nodeOffsetA[node] = offsetI[currentId];
+        }
+        // per-node feature offsets for the current image: a regular feature
+        // is read at A, a self-similarity feature is the difference A - B
+
+        const int *nodeChilds = &__rf.nodeChilds[0];
+        const float *nodeThresholds = &__rf.thresholds[0];
+        const int *pOffsetA = &nodeOffsetA[0];
+        const int *pOffsetB = &nodeOffsetB[0];
+
         parallel_for_(cv::Range(0, height), [&](const cv::Range& range)
-        #else
-        const cv::Range range(0, height);
-        #endif
         {
             for(int i = range.start; i < range.end; ++i) {
-                float *regFeaturesPtr = regFeatures.ptr<float>(i*stride/shrink);
-                float  *ssFeaturesPtr = ssFeatures.ptr<float>(i*stride/shrink);
+                const float *regFeaturesPtr = regFeatures.ptr<float>(i*stride/shrink);
+                const float  *ssFeaturesPtr = ssFeatures.ptr<float>(i*stride/shrink);
 
                 int *indexPtr = indexes.ptr<int>(i);
 
                 for (int j = 0, k = 0; j < width; ++k, j += !(k %= nTreesEval))
                     // for j,k in [0;width)x[0;nTreesEval)
                 {
-                    int baseNode = ( ((i + j)%(2*nTreesEval) + k)%nTrees )*nTreesNodes;
-                    int currentNode = baseNode;
+                    int currentNode = ( ((i + j)%(2*nTreesEval) + k)%nTrees )*nTreesNodes;
                     // select root node of the tree to evaluate
 
-                    int offset = (j*stride/shrink)*nchannels;
-                    while ( __rf.childs[currentNode] != 0 )
+                    const float *pReg = regFeaturesPtr + (j*stride/shrink)*nchannels;
+                    const float *pSs = ssFeaturesPtr + (j*stride/shrink)*nchannels;
+                    while ( nodeChilds[currentNode] >= 0 )
                     {
-                        int currentId = __rf.featureIds[currentNode];
-                        float currentFeature;
-
-                        if (currentId >= nFeatures)
-                        {
-                            int xIndex = offsetX[currentId - nFeatures];
-                            float A = ssFeaturesPtr[offset + xIndex];
-
-                            int yIndex = offsetY[currentId - nFeatures];
-                            float B = ssFeaturesPtr[offset + yIndex];
-
-                            currentFeature = A - B;
-                        }
-                        else
-                            currentFeature = regFeaturesPtr[offset + offsetI[currentId]];
+                        int offsetB = pOffsetB[currentNode];
+                        float currentFeature = offsetB < 0
+                            ? pReg[pOffsetA[currentNode]]
+                            : pSs[pOffsetA[currentNode]] - pSs[offsetB];
 
                         // compare feature to threshold and move left or right accordingly
-                        if (currentFeature < __rf.thresholds[currentNode])
-                            currentNode = baseNode + __rf.childs[currentNode] - 1;
-                        else
-                            currentNode = baseNode + __rf.childs[currentNode];
+                        currentNode = nodeChilds[currentNode]
+                            + !(currentFeature < nodeThresholds[currentNode]);
                     }
 
                     indexPtr[j*nTreesEval + k] = currentNode;
                 }
             }
-        }
-        #if CV_USE_PARALLEL_PREDICT_EDGES_1
-        );
-        #endif
+        });
 
         NChannelsMat dstM(dst.size(),
             CV_MAKETYPE(DataType<float>::type, outNum));
         dstM.setTo(0);
 
-        float step = 2.0f * CV_SQR(stride) / CV_SQR(ipSize) / nTreesEval;
-        #if CV_USE_PARALLEL_PREDICT_EDGES_2
-        parallel_for_(cv::Range(0, height), [&](const cv::Range& range)
-        #elif CV_USE_PARALLEL_PREDICT_EDGES_1
-        const cv::Range range(0, height);
-        #endif
+        const float step = 2.0f * CV_SQR(stride) / CV_SQR(ipSize) / nTreesEval;
+        const int nBnds = (int( __rf.edgeBoundaries.size() ) - 1) / (nTreesNodes * nTrees);
+
+        // Patches of neighbouring rows overlap in dstM, so the rows are split into
+        // stripes at least ipSize pixels high: stripes of the same parity never
+        // write to the same pixels and are processed in parallel in two passes.
+        // All increments are equal, so the result does not depend on their order.
+        const int stripeRows = (ipSize + stride - 1) / stride;
+        const int nStripes = (height + stripeRows - 1) / stripeRows;
+        for (int parity = 0; parity < 2; ++parity)
         {
-            for(int i = range.start; i < range.end; ++i)
+            parallel_for_(cv::Range(0, (nStripes + 1 - parity) / 2), [&](const cv::Range& range)
             {
-                int *pIndex = indexes.ptr<int>(i);
-                float *pDst = dstM.ptr<float>(i*stride);
+                for (int stripe = range.start; stripe < range.end; ++stripe)
+                {
+                    const int s = 2*stripe + parity;
+                    for (int i = s*stripeRows; i < std::min((s + 1)*stripeRows, height); ++i)
+                    {
+                        const int *pIndex = indexes.ptr<int>(i);
+                        float *pDst = dstM.ptr<float>(i*stride);
 
-                for (int j = 0, k = 0; j < width; ++k, j += !(k %= nTreesEval))
-                {// for j,k in [0;width)x[0;nTreesEval)
+                        for (int j = 0, k = 0; j < width; ++k, j += !(k %= nTreesEval))
+                        {// for j,k in [0;width)x[0;nTreesEval)
 
-                    int currentNode = pIndex[j*nTreesEval + k];
-                    size_t sizeBoundaries = __rf.edgeBoundaries.size();
-                    int convertedBoundaries = static_cast<int>(sizeBoundaries);
-                    int nBnds = (convertedBoundaries - 1) / (nTreesNodes * nTrees);
-                    int start = __rf.edgeBoundaries[currentNode * nBnds];
-                    int finish = __rf.edgeBoundaries[currentNode * nBnds + 1];
+                            int currentNode = pIndex[j*nTreesEval + k];
+                            int start = __rf.edgeBoundaries[currentNode * nBnds];
+                            int finish = __rf.edgeBoundaries[currentNode * nBnds + 1];
 
-                    if (start == finish)
-                        continue;
+                            if (start == finish)
+                                continue;
 
-                    int offset = j*stride*outNum;
-                    for (int p = start; p < finish; ++p)
-                        pDst[offset + offsetE[__rf.edgeBins[p]]] += step;
+                            int offset = j*stride*outNum;
+                            for (int p = start; p < finish; ++p)
+                                pDst[offset + offsetE[__rf.edgeBins[p]]] += step;
+                        }
+                    }
                 }
-            }
+            });
         }
-        #if CV_USE_PARALLEL_PREDICT_EDGES_2
-        );
-        #endif
 
         cv::reduce( dstM.reshape(1, int( dstM.total() ) ), dstM, 2, CV_REDUCE_SUM);
         imsmooth( dstM.reshape(1, dst.rows), 1 ).copyTo(dst);
@@ -886,6 +977,7 @@ protected:
         std::vector <int> featureIds;     /*!< feature coordinate thresholded at k-th node */
         std::vector <float> thresholds;   /*!< threshold applied to featureIds[k] at k-th node */
         std::vector <int> childs;         /*!< k --> child[k] - 1, child[k] */
+        std::vector <int> nodeChilds;     /*!< absolute index of the left child of k-th node, -1 for leaves */
 
         std::vector <int> edgeBoundaries; /*!< ... */
         std::vector <int> edgeBins;       /*!< ... */
@@ -165,49 +165,32 @@ void from32STo32F(Mat &img, Mat &outImg, float *mapping)
 
 
 /***************************************************************
- * Function: float2D
- * Description: allocate a 2D float array with dimension "dim1 x dim2"
+ * Struct: FilterContext
+ * Description: working memory of filterCore for one stripe of columns: the joint-histogram,
+ *                the BCB and the links of their necklace tables.
+ *                Every thread keeps its context, so the memory is reused for every column,
+ *                every channel and every call as long as the sizes do not change.
  ***************************************************************/
-float** float2D(int dim1, int dim2)
+struct FilterContext
 {
-    float **ret = new float*[dim1];
-    ret[0] = new float[dim1*dim2];
-    for(int i=1;i<dim1;i++)ret[i] = ret[i-1]+dim2;
-
-    return ret;
-}
-
-/***************************************************************
- * Function: float2D_release
- * Description: deallocate the 2D array created by float2D()
- ***************************************************************/
-void float2D_release(float **p)
-{
-    delete []p[0];
-    delete []p;
-}
-
-/***************************************************************
- * Function: int2D
- * Description: allocate a 2D integer array with dimension "dim1 x dim2"
- ***************************************************************/
-int** int2D(int dim1, int dim2)
-{
-    int **ret = new int*[dim1];
-    ret[0] = new int[dim1*dim2];
-    for(int i=1;i<dim1;i++)ret[i] = ret[i-1]+dim2;
+    void create(int nI, int nF)
+    {
+        H.create(nI, nF, CV_32S);
+        Hf.create(nI, nF, CV_32S);
+        Hb.create(nI, nF, CV_32S);
+        BCB.resize(nF);
+        BCBf.resize(nF);
+        BCBb.resize(nF);
+    }
 
-    return ret;
-}
+    Mat H, Hf, Hb;                 // joint-histogram and its forward/backward links
+    vector<int> BCB, BCBf, BCBb;   // BCB and its forward/backward links
+};
 
-/***************************************************************
- * Function: int2D_release
- * Description: deallocate the 2D array created by int2D()
- ***************************************************************/
-void int2D_release(int **p)
+static TLSData<FilterContext>& getFilterContexts()
 {
-    delete []p[0];
-    delete []p;
+    static TLSData<FilterContext>* contexts = new TLSData<FilterContext>();
+    return *contexts;
 }
 
 /***************************************************************
@@ -216,7 +199,7 @@ void int2D_release(int **p)
  ***************************************************************/
 inline void updateBCB(int &num,int *f,int *b,int i,int v)
 {
-    static int p1,p2;
+    int p1,p2;
 
     if(i)
     {
@@ -246,7 +229,7 @@ inline void updateBCB(int &num,int *f,int *b,int i,int v)
  *                If F is 3-channel, perform k-means clustering
  *                If F is 1-channel, only perform type-casting
  ***************************************************************/
-void featureIndexing(Mat &F, float **&wMap, int &nF, float sigmaI, int weightType){
+void featureIndexing(Mat &F, Mat &wMap, int &nF, float sigmaI, int weightType){
     // Configuration and Declaration
     Mat FNew;
     int cols = F.cols, rows = F.rows;
@@ -262,7 +245,7 @@ void featureIndexing(Mat &F, float **&wMap, int &nF, float sigmaI, int weightTyp
         F.convertTo(FNew, CV_32S);
 
         // Compute weight map (weight between each pair of feature index)
-        wMap = float2D(nF,nF);
+        wMap.create(nF, nF, CV_32F);
         float nSigmaI = sigmaI;
         float divider = (1.0f/(2*nSigmaI*nSigmaI));
 
@@ -284,7 +267,7 @@ void featureIndexing(Mat &F, float **&wMap, int &nF, float sigmaI, int weightTyp
                     default: val = exp(-(diff*diff)*divider);
                 }
 
-                wMap[i][j] = wMap[j][i] = val;
+                wMap.at<float>(i, j) = wMap.at<float>(j, i) = val;
             }
         }
     }
@@ -362,7 +345,7 @@ void featureIndexing(Mat &F, float **&wMap, int &nF, float sigmaI, int weightTyp
         }
 
         // Compute weight map (weight between each pair of feature index)
-        wMap = float2D(nF,nF);
+        wMap.create(nF, nF, CV_32F);
         float nSigmaI = sigmaI/256.0f*LOW_NUM;
         float divider = (1.0f/(2*nSigmaI*nSigmaI));
 
@@ -399,7 +382,7 @@ void featureIndexing(Mat &F, float **&wMap, int &nF, float sigmaI, int weightTyp
                     default: val = exp(-(diff0*diff0+diff1*diff1+diff2*diff2)*divider);
                 }
 
-                wMap[i][j] = wMap[j][i] = val;
+                wMap.at<float>(i, j) = wMap.at<float>(j, i) = val;
             }
         }
 
@@ -409,40 +392,36 @@ void featureIndexing(Mat &F, float **&wMap, int &nF, float sigmaI, int weightTyp
     F = FNew;
 }
 
-Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, Mat mask=Mat())
+/***************************************************************
+ * Function: filterCore
+ * Description: joint-histogram weighted median filtering of the columns [xStart, xEnd).
+ *                Every column is swept from top to bottom starting from an empty histogram,
+ *                so stripes of columns can be filtered independently, each with its own context.
+ ***************************************************************/
+void filterCore(const Mat &I, const Mat &F, const Mat &wMap, const Mat &mask, Mat &outImg,
+                int r, int nI, FilterContext &ctx, int xStart, int xEnd)
 {
     // Check validation
-    assert(I.depth() == CV_32S && I.channels()==1);//input image: 32SC1
-    assert(F.depth() == CV_32S && F.channels()==1);//feature image: 32SC1
+    CV_DbgAssert(I.depth() == CV_32S && I.channels()==1);//input image: 32SC1
+    CV_DbgAssert(F.depth() == CV_32S && F.channels()==1);//feature image: 32SC1
 
     // Configuration and declaration
     int rows = I.rows, cols = I.cols;
-    Mat outImg = I.clone();
-
-    // Handle Mask
-    if(mask.empty())
-    {
-        mask = Mat(I.size(),CV_8U);
-        mask = Scalar(1);
-    }
-
-    // Allocate memory for joint-histogram and BCB
-    int **H = int2D(nI,nF);
-    int *BCB = new int[nF];
+    int nF = wMap.rows;
 
-    // Allocate links for necklace table
-    int **Hf = int2D(nI,nF);//forward link
-    int **Hb = int2D(nI,nF);//backward link
-    int *BCBf = new int[nF];//forward link
-    int *BCBb = new int[nF];//backward link
+    // Joint-histogram, BCB and links for necklace tables
+    Mat &H = ctx.H, &Hf = ctx.Hf, &Hb = ctx.Hb;
+    int *BCB = &ctx.BCB[0];
+    int *BCBf = &ctx.BCBf[0];//forward link
+    int *BCBb = &ctx.BCBb[0];//backward link
 
     // Column Scanning
-    for(int x=0;x<cols;x++)
+    for(int x=xStart;x<xEnd;x++)
     {
         // Reset histogram and BCB for each column
         memset(BCB, 0, sizeof(int)*nF);
-        memset(H[0], 0, sizeof(int)*nF*nI);
-        for(int i=0;i<nI;i++)Hf[i][0]=Hb[i][0]=0;
+        H = Scalar::all(0);
+        for(int i=0;i<nI;i++)Hf.at<int>(i, 0)=Hb.at<int>(i, 0)=0;
         BCBf[0]=BCBb[0]=0;
 
         // Reset cut-point
@@ -456,23 +435,23 @@ Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, M
         int upY = min(rows-1,r);
         for(int i=0;i<=upY;i++)
         {
-            int *IPtr = I.ptr<int>(i);
-            int *FPtr = F.ptr<int>(i);
-            uchar *maskPtr = mask.ptr<uchar>(i);
+            const int *IPtr = I.ptr<int>(i);
+            const int *FPtr = F.ptr<int>(i);
+            const uchar *maskPtr = mask.ptr<uchar>(i);
 
             for(int j=downX;j<=upX;j++)
             {
                 if(!maskPtr[j])continue;
 
                 int fval = IPtr[j];
-                int *curHist = H[fval];
+                int *curHist = H.ptr<int>(fval);
                 int gval = FPtr[j];
 
                 // Maintain necklace table of joint-histogram
                 if(!curHist[gval] && gval)
                 {
-                    int *curHf = Hf[fval];
-                    int *curHb = Hb[fval];
+                    int *curHf = Hf.ptr<int>(fval);
+                    int *curHb = Hb.ptr<int>(fval);
 
                     int p1=0,p2=curHf[0];
                     curHf[p1]=gval;
@@ -491,8 +470,8 @@ Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, M
         {
             // Find weighted median with help of BCB and joint-histogram
             float balanceWeight = 0;
-            int curIndex = F.ptr<int>(y,x)[0];
-            float *fPtr = wMap[curIndex];
+            int curIndex = F.ptr<int>(y)[x];
+            const float *fPtr = wMap.ptr<float>(curIndex);
             int &curMedianVal = medianVal;
 
             // Compute current balance
@@ -511,8 +490,8 @@ Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, M
                 for(;balanceWeight >= 0 && curMedianVal > 0; curMedianVal--)
                 {
                     float curWeight = 0;
-                    int *nextHist = H[curMedianVal];
-                    int *nextHf = Hf[curMedianVal];
+                    int *nextHist = H.ptr<int>(curMedianVal);
+                    int *nextHf = Hf.ptr<int>(curMedianVal);
 
                     // Compute weight change by shift cut-point
                     int i=0;
@@ -535,8 +514,8 @@ Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, M
                 for(;balanceWeight < 0 && curMedianVal != nI-1; curMedianVal++)
                 {
                     float curWeight = 0;
-                    int *nextHist = H[curMedianVal+1];
-                    int *nextHf = Hf[curMedianVal+1];
+                    int *nextHist = H.ptr<int>(curMedianVal+1);
+                    int *nextHf = Hf.ptr<int>(curMedianVal+1);
 
                     // Compute weight change by shift cut-point
                     int i=0;
@@ -557,9 +536,9 @@ Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, M
             if(curMedianVal != -1)
             {
                 if(balanceWeight < 0)
-                    outImg.ptr<int>(y,x)[0] = curMedianVal+1;
+                    outImg.ptr<int>(y)[x] = curMedianVal+1;
                 else
-                    outImg.ptr<int>(y,x)[0] = curMedianVal;
+                    outImg.ptr<int>(y)[x] = curMedianVal;
             }
 
             // Update joint-histogram and BCB when local window is shifted.
@@ -569,23 +548,23 @@ Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, M
             int rownum = y + r + 1;
             if(rownum < rows)
             {
-                    int *inputImgPtr = I.ptr<int>(rownum);
-                    int *guideImgPtr = F.ptr<int>(rownum);
-                    uchar *maskPtr = mask.ptr<uchar>(rownum);
+                    const int *inputImgPtr = I.ptr<int>(rownum);
+                    const int *guideImgPtr = F.ptr<int>(rownum);
+                    const uchar *maskPtr = mask.ptr<uchar>(rownum);
 
                     for(int j=downX;j<=upX;j++)
                     {
                         if(!maskPtr[j])continue;
 
                         fval = inputImgPtr[j];
-                        curHist = H[fval];
+                        curHist = H.ptr<int>(fval);
                         gval = guideImgPtr[j];
 
                         // Maintain necklace table of joint-histogram
                         if(!curHist[gval] && gval)
                         {
-                            int *curHf = Hf[fval];
-                            int *curHb = Hb[fval];
+                            int *curHf = Hf.ptr<int>(fval);
+                            int *curHb = Hb.ptr<int>(fval);
 
                             int p1=0,p2=curHf[0];
                             curHf[gval]=p2;
@@ -605,16 +584,16 @@ Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, M
                 rownum = y - r;
                 if(rownum >= 0)
                 {
-                    int *inputImgPtr = I.ptr<int>(rownum);
-                    int *guideImgPtr = F.ptr<int>(rownum);
-                    uchar *maskPtr = mask.ptr<uchar>(rownum);
+                    const int *inputImgPtr = I.ptr<int>(rownum);
+                    const int *guideImgPtr = F.ptr<int>(rownum);
+                    const uchar *maskPtr = mask.ptr<uchar>(rownum);
 
                     for(int j=downX;j<=upX;j++)
                     {
                         if(!maskPtr[j])continue;
 
                         fval = inputImgPtr[j];
-                        curHist = H[fval];
+                        curHist = H.ptr<int>(fval);
                         gval = guideImgPtr[j];
 
                         curHist[gval]--;
@@ -622,8 +601,8 @@ Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, M
                         // Maintain necklace table of joint-histogram
                         if(!curHist[gval] && gval)
                         {
-                            int *curHf = Hf[fval];
-                            int *curHb = Hb[fval];
+                            int *curHf = Hf.ptr<int>(fval);
+                            int *curHb = Hb.ptr<int>(fval);
 
                             int p1=curHb[gval],p2=curHf[gval];
                             curHf[p1]=p2;
@@ -636,19 +615,6 @@ Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, M
                 }
         }
     }
-
-    // Deallocate the memory
-    {
-        delete []BCB;
-        delete []BCBf;
-        delete []BCBb;
-        int2D_release(H);
-        int2D_release(Hf);
-        int2D_release(Hb);
-    }
-
-    // end of the function
-    return outImg;
 }
 }
 
@@ -710,16 +676,33 @@ void weightedMedianFilter(InputArray joint, InputArray src, OutputArray dst, int
     //If "F" is 1-channel image, featureIndexing only does a type-casting on "F".
     //The output "F" is CV_32S type, containing indexes of feature values.
     //"wMap" is a 2D array that defines the distance between each pair of feature indexes.
-    // wMap[i][j] is the weight between feature index "i" and "j".
-    float **wMap = NULL;
+    // wMap(i,j) is the weight between feature index "i" and "j".
+    Mat wMap;
     featureIndexing(F, wMap, nF, float(sigma), weightType);
 
+    Mat M = mask.getMat();
+    if(M.empty())
+        M = Mat(I.size(), CV_8U, Scalar(1));
+    CV_Assert(M.size() == I.size() && M.type() == CV_8U);
+
     //Filtering - Joint-Histogram Framework
+    //Columns are split into stripes filtered in parallel with the context of the running thread.
+    int nStripes = std::max(1, std::min(I.cols, getNumThreads()));
     for(int i=0; i<(int)Is.size(); i++)
     {
-        Is[i] = filterCore(Is[i], F, wMap, r, nF, nI, mask.getMat());
+        Mat outImg = Is[i].clone();
+        parallel_for_(Range(0, nStripes), [&](const Range& range)
+        {
+            for(int s = range.start; s < range.end; s++)
+            {
+                FilterContext &ctx = getFilterContexts().getRef();
+                ctx.create(nI, nF);
+                filterCore(Is[i], F, wMap, M, outImg, r, nI, ctx,
+                           I.cols*s/nStripes, I.cols*(s+1)/nStripes);
+            }
+        }, nStripes);
+        Is[i] = outImg;
     }
-    float2D_release(wMap);
 
     //Postprocess F
     //Convert input image back to the original type.
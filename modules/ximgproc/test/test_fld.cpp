@@ -199,5 +199,44 @@ TEST_F(ximgproc_FLD, rotatedRect)
     ASSERT_EQ(EPOCHS, passedtests);
 }
 
+TEST_F(ximgproc_FLD, edgeLinesTiled)
+{
+    for (int i = 0; i < EPOCHS; ++i)
+    {
+        const unsigned int numOfLines = 1;
+        GenerateEdgeLines(test_image, numOfLines);
+        Ptr<FastLineDetector> detector = createFastLineDetector(10, 1.414213562f, 50, 50, 0);
+        detector->setTileSize(128);
+        detector->detect(test_image, lines);
+        if(numOfLines == lines.size()) ++passedtests;
+    }
+    ASSERT_EQ(EPOCHS, passedtests);
+}
+
+TEST_F(ximgproc_FLD, rotatedRectPyramid)
+{
+    for (int i = 0; i < EPOCHS; ++i)
+    {
+        GenerateRotatedRect(test_image);
+        Ptr<FastLineDetector> detector = createFastLineDetector();
+        detector->setPyramidLevels(1);
+        detector->detect(test_image, lines);
+
+        if(2u <= lines.size())  ++passedtests;
+    }
+    ASSERT_EQ(EPOCHS, passedtests);
+}
+
+TEST_F(ximgproc_FLD, tileSettings)
+{
+    Ptr<FastLineDetector> detector = createFastLineDetector();
+    EXPECT_EQ(0, detector->getTileSize());
+    EXPECT_EQ(0, detector->getPyramidLevels());
+    detector->setTileSize(256);
+    detector->setPyramidLevels(2);
+    EXPECT_EQ(256, detector->getTileSize());
+    EXPECT_EQ(2, detector->getPyramidLevels());
+    EXPECT_ANY_THROW(detector->setTileSize(-1));
+}
 
 }} // namespace
@@ -0,0 +1,56 @@
+// This file is part of OpenCV project.
+// It is subject to the license terms in the LICENSE file found in the top-level directory
+// of this distribution and at http://opencv.org/license.html.
+#include "test_precomp.hpp"
+
+namespace opencv_test { namespace {
+
+using namespace cv::ximgproc::segmentation;
+
+// The middle pixel is a region too small to be kept, at the same distance from both of its
+// neighbours: equal edges are taken by increasing source pixel, so it joins the left region.
+TEST(ximgproc_GraphSegmentation, small_area_ties)
+{
+    // A tiny sigma gives a 1x1 gaussian kernel, so edge weights are exact pixel differences
+    Ptr<GraphSegmentation> gs = createGraphSegmentation(0.001, 1.0f, 2);
+
+    const uchar left_dark[] = { 0, 0, 5, 10, 10 };
+    const uchar left_bright[] = { 10, 10, 5, 0, 0 };
+    const int expected[] = { 0, 0, 0, 1, 1 };
+
+    Mat labels;
+    gs->processImage(Mat(1, 5, CV_8UC1, (void*)left_dark), labels);
+    EXPECT_EQ(0, cvtest::norm(labels, Mat(1, 5, CV_32SC1, (void*)expected), NORM_INF));
+
+    gs->processImage(Mat(1, 5, CV_8UC1, (void*)left_bright), labels);
+    EXPECT_EQ(0, cvtest::norm(labels, Mat(1, 5, CV_32SC1, (void*)expected), NORM_INF));
+}
+
+// Edges are sorted in chunks split according to the number of threads; ties must not
+// make the result depend on it
+TEST(ximgproc_GraphSegmentation, threads_invariance)
+{
+    int nThreads = cv::getNumThreads();
+    if (nThreads == 1)
+        throw SkipTestException("Single thread environment");
+
+    // Few gray levels, so that most edges have the same weight
+    Mat src(256, 256, CV_8UC1);
+    RNG rng(0);
+    rng.fill(src, RNG::UNIFORM, 0, 4);
+    src *= 50;
+
+    Ptr<GraphSegmentation> gs = createGraphSegmentation(0.001, 100.0f, 20);
+
+    Mat resMultiThread;
+    gs->processImage(src, resMultiThread);
+
+    cv::setNumThreads(1);
+    Mat resSingleThread;
+    gs->processImage(src, resSingleThread);
+    cv::setNumThreads(nThreads);
+
+    EXPECT_EQ(0, cvtest::norm(resSingleThread, resMultiThread, NORM_INF));
+}
+
+}} // namespace